@@ -1,6 +1,8 @@
 #pragma once
-#define __NDIRECT 8UL
+#define __NDIRECT 7UL
 #define __NINDIRECT (__BSIZE / sizeof(uintptr_t))
-#define __MAXFILE (__NDIRECT + __NINDIRECT + (__NINDIRECT * __NINDIRECT))
+#define __MAXFILE                                                \
+	(__NDIRECT + __NINDIRECT + (__NINDIRECT * __NINDIRECT) + \
+	 (__NINDIRECT * __NINDIRECT * __NINDIRECT))
 #define __NDINDIRECT_PER_ENTRY __NDIRECT
 #define __NDINDIRECT_ENTRY __NDIRECT
@@ -1,8 +1,14 @@
 #pragma once
 
 #ifndef __ASSEMBLER__
+#ifdef __RELIX_USER__
+// Each thread has its own errno.
+int *__errno_location(void);
+#define errno (*__errno_location())
+#else
 extern int errno;
 #endif
+#endif
 #define EPERM 1 /* Operation not permitted */
 #define ENOENT 2 /* No such file or directory */
 #define ESRCH 3 /* No such process */
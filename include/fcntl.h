@@ -8,3 +8,18 @@
 int open(const char *, int flags, ...);
 int creat(const char *, mode_t mode);
 int fcntl(int fd, int cmd, ...);
+
+// Hints for splice(). They are accepted and ignored.
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_NONBLOCK 2
+#define SPLICE_F_MORE 4
+#define SPLICE_F_GIFT 8
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+               size_t len, unsigned int flags);
+
+// Modes for fallocate(). With none, it allocates the blocks and
+// grows the file over them. Punching a hole needs KEEP_SIZE too.
+#define FALLOC_FL_KEEP_SIZE 0x01
+#define FALLOC_FL_PUNCH_HOLE 0x02
+int fallocate(int fd, int mode, off_t offset, off_t len);
+int posix_fallocate(int fd, off_t offset, off_t len);
@@ -65,8 +65,8 @@
 #define PAGE_SIZE PAGESIZE
 
 #define HOST_NAME_MAX _POSIX_HOST_NAME_MAX
-#define IOV_MAX _XOPEN_IOV_MAX
-#define OPEN_MAX 100
+#define IOV_MAX 1024
+#define OPEN_MAX 4096
 #define NGROUPS_MAX _POSIX_NGROUPS_MAX
 
 #define FILESIZEBITS 64
@@ -0,0 +1,57 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct __pthread *pthread_t;
+
+typedef struct {
+	size_t stacksize;
+} pthread_attr_t;
+
+// 0: unlocked, 1: locked, 2: locked and maybe contended.
+typedef struct {
+	uint32_t state;
+} pthread_mutex_t;
+typedef struct {
+	int unused;
+} pthread_mutexattr_t;
+
+// Bumped by every signal or broadcast; waiters sleep on it.
+typedef struct {
+	uint32_t seq;
+} pthread_cond_t;
+typedef struct {
+	int unused;
+} pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+#define PTHREAD_COND_INITIALIZER { 0 }
+#define PTHREAD_STACK_MIN 16384
+
+#ifdef __RELIX_USER__
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg);
+int pthread_join(pthread_t thread, void **retval);
+__attribute__((noreturn)) void pthread_exit(void *retval);
+pthread_t pthread_self(void);
+int pthread_equal(pthread_t t1, pthread_t t2);
+
+int pthread_attr_init(pthread_attr_t *attr);
+int pthread_attr_destroy(pthread_attr_t *attr);
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize);
+int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *stacksize);
+
+int pthread_mutex_init(pthread_mutex_t *mutex,
+                       const pthread_mutexattr_t *attr);
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+int pthread_cond_destroy(pthread_cond_t *cond);
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
+#endif
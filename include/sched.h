@@ -0,0 +1,19 @@
+#pragma once
+#include <sys/types.h>
+
+// Flags for clone(). The values match Linux.
+#define CLONE_VM 0x00000100 // Share the address space.
+#define CLONE_FS 0x00000200 // Accepted; the cwd is shared with CLONE_FILES.
+#define CLONE_FILES 0x00000400 // Share open files and the cwd.
+#define CLONE_SIGHAND 0x00000800 // Start with the caller's signal handlers.
+#define CLONE_VFORK 0x00004000 // Sleep until the child execs or exits.
+#define CLONE_THREAD 0x00010000 // Join the caller's thread group.
+#define CLONE_SETTLS 0x00080000 // Set the new thread's %fs base.
+#define CLONE_PARENT_SETTID 0x00100000 // Store the new TID at parent_tid.
+#define CLONE_CHILD_CLEARTID 0x00200000 // Zero child_tid and wake it on exit.
+#define CLONE_CHILD_SETTID 0x01000000 // Store the new TID at child_tid.
+
+#ifdef __RELIX_USER__
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, ...);
+int sched_yield(void);
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#include <signal.h>
+#include <sys/types.h>
+
+#define POSIX_SPAWN_RESETIDS 0x01
+#define POSIX_SPAWN_SETPGROUP 0x02
+#define POSIX_SPAWN_SETSIGDEF 0x04
+#define POSIX_SPAWN_SETSIGMASK 0x08
+
+typedef struct {
+	short __flags;
+	pid_t __pgroup;
+	sigset_t __sigdefault;
+	sigset_t __sigmask;
+} posix_spawnattr_t;
+
+struct __spawn_action;
+
+typedef struct {
+	int __count;
+	int __capacity;
+	struct __spawn_action *__actions;
+} posix_spawn_file_actions_t;
+
+#ifdef __RELIX_USER__
+int posix_spawn(pid_t *restrict pid, const char *restrict path,
+                const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *restrict attrp,
+                char *const argv[restrict], char *const envp[restrict]);
+int posix_spawnp(pid_t *restrict pid, const char *restrict file,
+                 const posix_spawn_file_actions_t *file_actions,
+                 const posix_spawnattr_t *restrict attrp,
+                 char *const argv[restrict], char *const envp[restrict]);
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_addopen(
+	posix_spawn_file_actions_t *restrict file_actions, int fildes,
+	const char *restrict path, int oflag, mode_t mode);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions,
+                                      int fildes);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions,
+                                     int fildes, int newfildes);
+
+int posix_spawnattr_init(posix_spawnattr_t *attr);
+int posix_spawnattr_destroy(posix_spawnattr_t *attr);
+int posix_spawnattr_getflags(const posix_spawnattr_t *restrict attr,
+                             short *restrict flags);
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags);
+int posix_spawnattr_getpgroup(const posix_spawnattr_t *restrict attr,
+                              pid_t *restrict pgroup);
+int posix_spawnattr_setpgroup(posix_spawnattr_t *attr, pid_t pgroup);
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t *restrict attr,
+                                  sigset_t *restrict sigdefault);
+int posix_spawnattr_setsigdefault(posix_spawnattr_t *restrict attr,
+                                  const sigset_t *restrict sigdefault);
+int posix_spawnattr_getsigmask(const posix_spawnattr_t *restrict attr,
+                               sigset_t *restrict sigmask);
+int posix_spawnattr_setsigmask(posix_spawnattr_t *restrict attr,
+                               const sigset_t *restrict sigmask);
+#endif
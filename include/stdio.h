@@ -11,7 +11,7 @@
 #include <bits/types.h>
 #include <bits/va_list.h>
 
-#define FOPEN_MAX OPEN_MAX
+#define FOPEN_MAX 256
 #define FILENAME_MAX __NAME_MAX
 #ifndef __NONNULL
 #define __NONNULL(...) __attribute__((__nonnull__(__VA_ARGS__)))
@@ -30,11 +30,14 @@ typedef __ssize_t ssize_t;
 typedef __off_t fpos_t;
 
 struct _IO_FILE {
-	char *write_buffer;
-	size_t write_buffer_size;
-	size_t write_buffer_index;
+	// One buffer serves reads or writes, whichever the stream did last.
+	// It is allocated on first use unless setvbuf() supplied one.
+	char *buffer;
+	size_t buffer_size;
+	size_t write_index; // Bytes waiting to be written.
+	size_t read_pos; // Next unread byte.
+	size_t read_end; // End of the bytes read ahead.
 	size_t static_table_index;
-	int previous_char;
 	int fd;
 	int mode;
 	int flags;
@@ -42,6 +45,7 @@ struct _IO_FILE {
 	_Bool eof;
 	_Bool error;
 	_Bool stdio_flush;
+	_Bool own_buffer; // We malloc()ed buffer and must free it.
 };
 
 #define NULL __NULL
@@ -50,7 +54,7 @@ struct _IO_FILE {
 #define _IONBF 0x3
 
 typedef struct _IO_FILE FILE;
-#define BUFSIZ 512
+#define BUFSIZ 4096
 extern FILE *stdin;
 extern FILE *stdout;
 extern FILE *stderr;
@@ -84,6 +88,10 @@ int setvbuf(FILE *restrict stream, char *restrict buf, int modes, size_t n)
 void setbuf(FILE *restrict stream, char *restrict buf) __NONNULL(1);
 
 int fgetc(FILE *stream) __NONNULL(1);
+ssize_t getdelim(char **restrict lineptr, size_t *restrict n, int delim,
+                 FILE *restrict stream) __NONNULL(1, 2, 4);
+ssize_t getline(char **restrict lineptr, size_t *restrict n,
+                FILE *restrict stream) __NONNULL(1, 2, 3);
 int getc(FILE *stream) __NONNULL(1);
 int getchar(void);
 
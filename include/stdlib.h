@@ -34,6 +34,10 @@ __attribute__((malloc, alloc_size(1))) void *malloc(size_t);
 __attribute__((malloc, alloc_size(1, 2))) void *calloc(size_t nmemb, size_t sz);
 __attribute__((malloc, alloc_size(2))) void *realloc(void *ptr, size_t size);
 void free(void *);
+__attribute__((malloc, alloc_size(2))) void *aligned_alloc(size_t alignment,
+                                                           size_t size);
+int posix_memalign(void **memptr, size_t alignment, size_t size);
+void malloc_stats(void);
 
 char *__findenv(const char *name, int len, int *offset);
 int putenv(char *str);
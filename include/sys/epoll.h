@@ -0,0 +1,42 @@
+#pragma once
+#include <poll.h>
+// The EPOLL* event bits are the same as the POLL* ones.
+#define EPOLLIN POLLIN
+#define EPOLLPRI POLLPRI
+#define EPOLLOUT POLLOUT
+#define EPOLLERR POLLERR
+#define EPOLLHUP POLLHUP
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLRDBAND POLLRDBAND
+#define EPOLLWRNORM POLLWRNORM
+#define EPOLLWRBAND POLLWRBAND
+// Report the item once, then disable it until EPOLL_CTL_MOD.
+#define EPOLLONESHOT (1u << 30)
+// Edge-triggered: report only when the item becomes ready again.
+#define EPOLLET (1u << 31)
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define EPOLL_CLOEXEC 0x400 // Same as O_CLOEXEC.
+
+typedef union epoll_data {
+	void *ptr;
+	int fd;
+	unsigned int u32;
+	unsigned long u64;
+} epoll_data_t;
+
+struct epoll_event {
+	unsigned int events;
+	epoll_data_t data;
+};
+
+#ifdef __RELIX_USER__
+int epoll_create(int size);
+int epoll_create1(int flags);
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout);
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+#define FUTEX_WAIT 0 // Sleep if *uaddr == val.
+#define FUTEX_WAKE 1 // Wake up to val waiters.
+// All futexes are private to their process; this is accepted and ignored.
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_WAIT_PRIVATE (FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAKE_PRIVATE (FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
+
+#ifdef __RELIX_USER__
+int futex(uint32_t *uaddr, int op, uint32_t val,
+          const struct timespec *timeout);
+#endif
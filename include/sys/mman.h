@@ -3,7 +3,14 @@
 #include <stddef.h>
 #include <sys/types.h>
 #define MMAP_FAILED ((void *)-1)
+#define MAP_FAILED MMAP_FAILED
 void *mmap(void *addr, size_t length, int prot, int flags, int fd,
            off_t offset);
 // Release memory mapping. You can do this even if the fd is closed!
 int munmap(void *addr, size_t length);
+int mprotect(void *addr, size_t length, int prot);
+// Write changes to a MAP_SHARED file mapping back to the file.
+int msync(void *addr, size_t length, int flags);
+int madvise(void *addr, size_t length, int advice);
+// Like madvise(), but returns the error instead of setting errno.
+int posix_madvise(void *addr, size_t length, int advice);
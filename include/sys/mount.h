@@ -0,0 +1,8 @@
+#pragma once
+
+#ifdef __RELIX_USER__
+// fstype is "relixfs", with source a /dev/sd* node, or "tmpfs".
+int mount(const char *source, const char *target, const char *fstype,
+          unsigned long flags, const void *data);
+int umount(const char *target);
+#endif
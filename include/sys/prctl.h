@@ -0,0 +1,8 @@
+#pragma once
+
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+
+#ifdef __RELIX_USER__
+int arch_prctl(int code, unsigned long addr);
+#endif
@@ -10,7 +10,27 @@ struct rlimit {
 	rlim_t rlim_max; // Max (hard) limit
 };
 
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN (-1)
+#define RUSAGE_THREAD 1
+
 struct rusage {
 	struct timeval ru_utime; // User time
 	struct timeval ru_stime; // System time
+	long ru_maxrss; // Unused
+	long ru_ixrss; // Unused
+	long ru_idrss; // Unused
+	long ru_isrss; // Unused
+	long ru_minflt; // Page faults without I/O
+	long ru_majflt; // Page faults with I/O
+	long ru_nswap; // Unused
+	long ru_inblock; // Blocks read
+	long ru_oublock; // Blocks written
+	long ru_msgsnd; // Unused
+	long ru_msgrcv; // Unused
+	long ru_nsignals; // Unused
+	long ru_nvcsw; // Voluntary context switches
+	long ru_nivcsw; // Involuntary context switches
 };
+
+int getrusage(int who, struct rusage *usage);
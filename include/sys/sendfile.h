@@ -0,0 +1,6 @@
+#pragma once
+#include <sys/types.h>
+
+#ifdef __RELIX_USER__
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 #include <sys/time.h>
 
+// In clock ticks, which are milliseconds.
 struct tms {
 	clock_t tms_utime;
 	clock_t tms_stime;
@@ -50,6 +50,10 @@ int execle(const char *path, const char *arg, ...);
 
 ssize_t write(int, const void *, size_t);
 ssize_t read(int, void *, size_t);
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                        size_t len, unsigned int flags);
 int close(int fd);
 int unlink(const char *pathname);
 int unlinkat(int dirfd, const char *pathname, int flags);
@@ -70,6 +74,7 @@ int dup3(int oldfd, int newfd, int flags);
 unsigned int alarm(unsigned int);
 
 pid_t getpid(void);
+pid_t gettid(void);
 pid_t getppid(void);
 pid_t getpgid(pid_t pid);
 pid_t getpgrp(void);
@@ -92,6 +97,10 @@ unsigned int sleep(unsigned int);
 // needs sys/reboot
 int reboot(int cmd);
 int fsync(int fd);
+int fdatasync(int fd);
+void sync(void);
+int ftruncate(int fd, off_t length);
+int truncate(const char *path, off_t length);
 extern char *optarg;
 extern int optind, opterr, optopt;
 int getopt(int argc, char *const argv[], const char *optstring);
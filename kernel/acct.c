@@ -0,0 +1,132 @@
+//
+// Resource accounting.
+//
+// Each CPU remembers the TSC at the last moment it charged time to
+// someone. At every boundary (entering the kernel from user mode,
+// going back, and switching to and from a process in scheduler()) it
+// charges what has passed since to whatever it was doing: the running
+// thread's user or system time, or its own idle time if nothing was
+// running. Nothing is sampled, so a thread that runs for less than a
+// tick still gets its time.
+//
+// The counts of switches, faults and blocks are kept where they
+// happen, on the thread they happen to. Threads that are gone are
+// added into their leader's gone, and processes that have been
+// waited for into their parent's cusage.
+//
+
+#include "acct.h"
+#include "dev/hpet.h"
+
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "time_units.h"
+#include "trap.h"
+#include "x86.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+static uint64_t khz;
+
+// The TSC's rate: measured once, across 10ms of the HPET or, without
+// one, across 10 timer ticks. 0 if neither can be done yet, which is
+// only with interrupts off and no HPET.
+uint64_t
+tsc_khz(void)
+{
+	volatile struct hpet_registers *hpet = hpet_get_regs();
+	uint64_t period_fs = hpet_get_counter_period_fs();
+
+	if (khz != 0) {
+		return khz;
+	}
+	if (hpet != NULL && period_fs != 0) {
+		uint64_t wait = nsec_to_fsec(10 * 1000 * 1000) / period_fs;
+		uint64_t c0 = hpet->main_counter_value;
+		uint64_t t0 = rdtsc();
+		uint64_t c1;
+		while ((c1 = hpet->main_counter_value) - c0 < wait) {
+			;
+		}
+		uint64_t t1 = rdtsc();
+		uint64_t ns = fsec_to_nsec((c1 - c0) * period_fs);
+		if (ns != 0) {
+			khz = (t1 - t0) * USEC_PER_SEC / ns;
+		}
+	} else if (readrflags() & FL_IF) {
+		volatile time_t *now = &ticks;
+		time_t t0 = *now;
+		// Start on the edge of a tick.
+		while (*now == t0) {
+			;
+		}
+		t0 = *now;
+		uint64_t c0 = rdtsc();
+		while (*now - t0 < 10) {
+			;
+		}
+		khz = (rdtsc() - c0) / 10;
+	}
+	return khz;
+}
+
+// Without a rate, take the TSC to run at 1GHz.
+uint64_t
+cycles_to_nsec(uint64_t cycles)
+{
+	uint64_t k = tsc_khz();
+
+	if (k == 0) {
+		return cycles;
+	}
+	// Split it so that hours of cycles do not overflow.
+	return cycles / k * 1000000 + cycles % k * 1000000 / k;
+}
+
+// Charge the time since the last charge on this CPU to the thread
+// running on it: to its user time if it was in user mode, else its
+// system time. With nothing running, it was idle.
+void
+acct_charge(bool user)
+{
+	pushcli();
+	struct cpu *c = mycpu();
+	struct proc *p = c->proc;
+	uint64_t now = rdtsc();
+	uint64_t delta = now - c->acct_tsc;
+	c->acct_tsc = now;
+	if (p == NULL) {
+		c->acct.idle += delta;
+	} else if (user) {
+		p->usage.utime += delta;
+		c->acct.user += delta;
+	} else {
+		p->usage.stime += delta;
+		c->acct.sys += delta;
+	}
+	popcli();
+}
+
+void
+acct_usage_add(struct proc_usage *to, const struct proc_usage *from)
+{
+	to->utime += from->utime;
+	to->stime += from->stime;
+	to->nvcsw += from->nvcsw;
+	to->nivcsw += from->nivcsw;
+	to->minflt += from->minflt;
+	to->majflt += from->majflt;
+	to->inblock += from->inblock;
+	to->oublock += from->oublock;
+}
+
+// Turn the times in u from cycles into nanoseconds, for handing out.
+// May spin for a while the first time; see tsc_khz().
+void
+acct_usage_export(struct proc_usage *u)
+{
+	u->utime = cycles_to_nsec(u->utime);
+	u->stime = cycles_to_nsec(u->stime);
+}
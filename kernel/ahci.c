@@ -1,9 +1,12 @@
 #include "ahci.h"
+#include "buf.h"
 #include "console.h"
+#include "dev/trace.h"
 #include "kalloc.h"
 #include "kernel_assert.h"
 #include "macros.h"
 #include "memlayout.h"
+#include "sleeplock.h"
 #include <errno.h>
 #include <pci.h>
 #include <stdint.h>
@@ -36,10 +39,16 @@
 
 #define ATA_CMD_READ_DMA_EX 0x25
 #define ATA_CMD_WRITE_DMA_EX 0x35
+#define ATA_CMD_WRITE_DMA_FUA_EX 0x3D
+#define ATA_CMD_FLUSH_CACHE_EX 0xEA
 
 #define ATA_CMD_IDENTIFY_PIO 0xEC
 
 static HBAMem *abar;
+// One command at a time: the port is polled until it finishes.
+static struct sleeplock ahcilock;
+// What the drive said it can do, for B_FLUSH and B_FUA.
+static bool have_flush_ext, have_fua;
 
 // Start command engine
 void
@@ -96,6 +105,7 @@ ahci_init(uint32_t abar_)
 {
 	pr_debug_file("Found AHCI device at %#x\n", abar_);
 	abar = (HBAMem *)IO2V((uintptr_t)abar_);
+	initsleeplock(&ahcilock, "ahci");
 	probe_port(abar);
 }
 
@@ -245,11 +255,17 @@ read_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf)
 		ata_setup_command_fis(cmdtbl, start, count, ATA_CMD_READ_DMA_EX);
 	(void)cmdfis;
 
-	return wait_on_disk(port, slot);
+	tracepoint(TRACE_BLOCK_SUBMIT, start, 0);
+	bool ok = wait_on_disk(port, slot);
+	tracepoint(TRACE_BLOCK_COMPLETE, start, 0);
+	return ok;
 }
 
+// With fua, the write is on the media, not only in the drive's
+// cache, when this returns.
 bool
-write_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf)
+write_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf,
+           bool fua)
 {
 	ata_clear_pending_interrupts(port);
 	int slot = find_cmdslot(port);
@@ -262,9 +278,37 @@ write_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf)
 	HBACmdTbl *cmdtbl = ata_setup_command_table(cmdheader, buf, &count);
 
 	FISRegH2D *cmdfis =
-		ata_setup_command_fis(cmdtbl, start, count, ATA_CMD_WRITE_DMA_EX);
+		ata_setup_command_fis(cmdtbl, start, count,
+	                      fua ? ATA_CMD_WRITE_DMA_FUA_EX : ATA_CMD_WRITE_DMA_EX);
 	(void)cmdfis;
 
+	tracepoint(TRACE_BLOCK_SUBMIT, start, 1);
+	bool ok = wait_on_disk(port, slot);
+	tracepoint(TRACE_BLOCK_COMPLETE, start, 1);
+	return ok;
+}
+
+// Write everything in the drive's cache to the media.
+bool
+flush_port(HBAPort *port)
+{
+	ata_clear_pending_interrupts(port);
+	int slot = find_cmdslot(port);
+	if (slot == -1) {
+		return false;
+	}
+
+	// No data, so no PRDT.
+	HBACmdHeader *cmdheader =
+		(HBACmdHeader *)((uintptr_t)P2V((uintptr_t)port->clb)) + slot;
+	cmdheader->cfl = sizeof(FISRegH2D) / sizeof(uint32_t);
+	cmdheader->w = 0;
+	cmdheader->prdtl = 0;
+	HBACmdTbl *cmdtbl = (HBACmdTbl *)P2V((uintptr_t)cmdheader->ctba |
+	                                     ((uintptr_t)cmdheader->ctbau << 32));
+	memset(cmdtbl, 0, sizeof(HBACmdTbl));
+	ata_setup_command_fis(cmdtbl, 0, 0, ATA_CMD_FLUSH_CACHE_EX);
+
 	return wait_on_disk(port, slot);
 }
 
@@ -378,6 +422,8 @@ ata_parse_identify_device_info(IdentifyDevicePIO *info)
 {
 	// Assures that ATA_CMD_READ_DMA_EX and ATA_CMD_WRITE_DMA_EX are aupported.
 	kernel_assert(info->commands_feature_sets_supported2 & (1 << 10));
+	have_flush_ext = info->commands_feature_sets_supported2 & (1 << 13);
+	have_fua = info->commands_feature_sets_supported3 & (1 << 6);
 
 	char model_num_buf[41];
 	memcpy(model_num_buf, info->model_number, 40);
@@ -577,3 +623,50 @@ ahci_read_disk(uint64_t start, uint16_t count, uint8_t *buf)
 	}
 	return -EIO;
 }
+
+bool
+ahci_present(void)
+{
+	return ahci_port != NULL;
+}
+
+// Sync buf with the SATA drive.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// B_FLUSH and B_FUA on a write are honored, and cleared with it.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+ahci_rw(struct block_buffer *b)
+{
+	if (!holdingsleep(&b->lock)) {
+		panic("ahci_rw: buf not locked");
+	}
+	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID) {
+		panic("ahci_rw: nothing to do");
+	}
+	if (ahci_port == NULL) {
+		panic("ahci_rw: no SATA drive");
+	}
+
+	const uint64_t sector = b->blockno * (BSIZE / 512);
+	bool ok;
+
+	acquiresleep(&ahcilock);
+	if (b->flags & B_DIRTY) {
+		// Without FUA, flushing after the write does the same.
+		const bool fua = (b->flags & B_FUA) != 0;
+		ok = !(b->flags & B_FLUSH) || !have_flush_ext || flush_port(ahci_port);
+		ok = ok && write_port(ahci_port, sector, BSIZE / 512, (uint16_t *)b->data,
+		                      fua && have_fua);
+		if (ok && fua && !have_fua && have_flush_ext) {
+			ok = flush_port(ahci_port);
+		}
+	} else {
+		ok = read_port(ahci_port, sector, BSIZE / 512, (uint16_t *)b->data);
+	}
+	releasesleep(&ahcilock);
+	if (!ok) {
+		panic("ahci_rw: I/O error on block %ld", b->blockno);
+	}
+	b->flags |= B_VALID;
+	b->flags &= ~(B_DIRTY | B_FLUSH | B_FUA);
+}
@@ -12,17 +12,22 @@
 // * Do not use the buffer after calling block_release.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Each disk has a cache of its own, so that one busy disk cannot
+// push another's blocks out or hold up its lookups.
 
 #include "buf.h"
 #include "console.h"
-#include "ide.h"
+#include "disk.h"
 #include "kernel_assert.h"
 #include "param.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "spinlock.h"
+#include <stdbool.h>
 #include <stdint.h>
 
-struct {
+struct block_cache {
 	struct spinlock lock;
 	struct block_buffer buf[NBUF];
 
@@ -30,26 +35,57 @@ struct {
 	// Sorted by how recently the buffer was used.
 	// head.next is most recent, head.prev is least.
 	struct block_buffer head;
-} block_cache;
+};
+
+static struct block_cache block_caches[NDISK];
+
+static struct block_cache *
+cache_of(dev_t dev)
+{
+	if (dev >= NDISK) {
+		panic("block cache: no disk %lu", dev);
+	}
+	return &block_caches[dev];
+}
 
 void
 block_init(void)
 {
-	initlock(&block_cache.lock, "block_cache");
-
-	// Create hash table of buffers
-	block_cache.head.next = &block_cache.head;
-	block_cache.head.prev = &block_cache.head;
+	for (struct block_cache *c = block_caches; c < block_caches + NDISK; c++) {
+		initlock(&c->lock, "block_cache");
+		lockstat_register(&c->lock);
+
+		// Create hash table of buffers
+		c->head.next = &c->head;
+		c->head.prev = &c->head;
+
+		for (struct block_buffer *b = c->buf; b < c->buf + NBUF; b++) {
+			b->dev = c - block_caches;
+			b->blockno = -1;
+			b->next = c->head.next;
+			b->prev = &c->head;
+
+			initsleeplock(&b->lock, "buffer");
+			c->head.next->prev = b;
+			c->head.next = b;
+		}
+	}
+}
 
-	for (struct block_buffer *b = block_cache.buf; b < block_cache.buf + NBUF;
-	     b++) {
-		b->next = block_cache.head.next;
-		b->prev = &block_cache.head;
+// Forget what is cached for dev, once its file system is unmounted.
+// Nothing may be using its buffers.
+void
+block_invalidate(dev_t dev)
+{
+	struct block_cache *c = cache_of(dev);
 
-		initsleeplock(&b->lock, "buffer");
-		block_cache.head.next->prev = b;
-		block_cache.head.next = b;
+	acquire(&c->lock);
+	for (struct block_buffer *b = c->buf; b < c->buf + NBUF; b++) {
+		kernel_assert(b->refcnt == 0 && (b->flags & B_DIRTY) == 0);
+		b->blockno = -1;
+		b->flags = 0;
 	}
+	release(&c->lock);
 }
 
 // Look through buffer cache for block on device dev.
@@ -58,15 +94,16 @@ block_init(void)
 static struct block_buffer *
 block_get(dev_t dev, uint64_t blockno) __acquires(&b->lock)
 {
+	struct block_cache *c = cache_of(dev);
 	struct block_buffer *b;
 
-	acquire(&block_cache.lock);
+	acquire(&c->lock);
 
 	// Is the block already cached?
-	for (b = block_cache.head.next; b != &block_cache.head; b = b->next) {
-		if (b->dev == dev && b->blockno == blockno) {
+	for (b = c->head.next; b != &c->head; b = b->next) {
+		if (b->blockno == blockno) {
 			b->refcnt++;
-			release(&block_cache.lock);
+			release(&c->lock);
 			acquiresleep(&b->lock);
 			return b;
 		}
@@ -74,13 +111,12 @@ block_get(dev_t dev, uint64_t blockno) __acquires(&b->lock)
 	// Not cached; recycle an unused buffer.
 	// Even if refcnt == 0, B_DIRTY indicates a buffer is in use
 	// because log.c has modified it but not yet committed it.
-	for (b = block_cache.head.prev; b != &block_cache.head; b = b->prev) {
+	for (b = c->head.prev; b != &c->head; b = b->prev) {
 		if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-			b->dev = dev;
 			b->blockno = blockno;
 			b->flags = 0;
 			b->refcnt = 1;
-			release(&block_cache.lock);
+			release(&c->lock);
 			acquiresleep(&b->lock);
 			return b;
 		}
@@ -88,6 +124,23 @@ block_get(dev_t dev, uint64_t blockno) __acquires(&b->lock)
 	panic("bget: no buffers");
 }
 
+// Count a block read or written against the thread that asked for
+// it. Nothing is running for the reads made while booting.
+static void
+charge_io(bool write)
+{
+	struct proc *p = myproc();
+
+	if (p == NULL) {
+		return;
+	}
+	if (write) {
+		p->usage.oublock++;
+	} else {
+		p->usage.inblock++;
+	}
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct block_buffer *
 block_read(dev_t dev, uint64_t blockno) __acquires(&b->lock)
@@ -95,7 +148,8 @@ block_read(dev_t dev, uint64_t blockno) __acquires(&b->lock)
 	struct block_buffer *b = block_get(dev, blockno);
 
 	if ((b->flags & B_VALID) == 0) {
-		iderw(b);
+		charge_io(false);
+		disk_rw(b);
 	}
 	return b;
 }
@@ -106,7 +160,8 @@ block_write(struct block_buffer *b) __must_hold(&b->lock)
 {
 	kernel_assert(holdingsleep(&b->lock));
 	b->flags |= B_DIRTY;
-	iderw(b);
+	charge_io(true);
+	disk_rw(b);
 }
 
 // Release a locked buffer.
@@ -118,15 +173,16 @@ block_release(struct block_buffer *b) __releases(&b->lock)
 
 	releasesleep(&b->lock);
 
-	acquire(&block_cache.lock);
+	struct block_cache *c = cache_of(b->dev);
+	acquire(&c->lock);
 	b->refcnt--;
 	if (b->refcnt == 0) {
 		b->next->prev = b->prev;
 		b->prev->next = b->next;
-		b->next = block_cache.head.next;
-		b->prev = &block_cache.head;
-		block_cache.head.next->prev = b;
-		block_cache.head.next = b;
+		b->next = c->head.next;
+		b->prev = &c->head;
+		c->head.next->prev = b;
+		c->head.next = b;
 	}
-	release(&block_cache.lock);
+	release(&c->lock);
 }
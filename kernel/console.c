@@ -7,6 +7,7 @@
 #include "dev/kbd.h"
 #include "dev/lapic.h"
 #include "file.h"
+#include "kernel_poll.h"
 #include "lib/compiler_attributes.h"
 #include "lib/queue.h"
 #include "macros.h"
@@ -262,10 +263,45 @@ __nonnull(1) void ksprintf(char *restrict str, const char *fmt, ...)
 	va_end(argp);
 }
 
+struct bounded_string {
+	char *str;
+	size_t size;
+	size_t len;
+};
+
+static void
+bounded_string_putc_wrapper(char c, char *buf)
+{
+	struct bounded_string *bs = (struct bounded_string *)buf;
+	if (bs->len + 1 < bs->size) {
+		bs->str[bs->len] = c;
+	}
+	bs->len++;
+}
+
+// Like snprintf(3): writes at most size bytes including the NUL, and
+// returns the length the full output would have had. Safe to call
+// concurrently since it keeps no global state and takes no lock.
+__attribute__((format(printf, 3, 4))) size_t
+ksnprintf(char *restrict str, size_t size, const char *fmt, ...)
+{
+	struct bounded_string bs = { .str = str, .size = size, .len = 0 };
+	va_list argp;
+	va_start(argp, fmt);
+	kernel_vprintf_template(bounded_string_putc_wrapper, ansi_noop, (char *)&bs,
+	                        fmt, argp, NULL, false, -1);
+	va_end(argp);
+	if (size != 0) {
+		str[bs.len < size ? bs.len : size - 1] = '\0';
+	}
+	return bs.len;
+}
+
 __cold void
 panic_print_before(bool locking)
 {
 	cli();
+	uart_panic();
 	if (locking) {
 		cons.locking = 1;
 	}
@@ -328,6 +364,7 @@ struct {
 	uint32_t r; // Read index
 	uint32_t w; // Write index
 	uint32_t e; // Edit index
+	struct pollhead pollhead; // Woken when a line becomes readable.
 } input;
 
 #define C(x) ((x) - '@') // Control-x
@@ -352,9 +389,7 @@ consoleintr(int (*getc)(void))
 
 	acquire(&cons.lock);
 	while ((c = getc()) >= 0) {
-		if (kbd_enqueue(c) == QUEUE_OOM) {
-			panic("Cannot allocate memory for kbd queue");
-		}
+		kbd_enqueue(c);
 		c = kbd_scancode_into_char(c);
 		switch (c) {
 		case C('P'): // Process listing.
@@ -398,6 +433,7 @@ consoleintr(int (*getc)(void))
 					}
 					input.w = input.e;
 					wakeup(&input.r);
+					pollwake(&input.pollhead, POLLIN);
 				}
 			}
 			break;
@@ -417,7 +453,7 @@ consoleintr(int (*getc)(void))
 	}
 }
 __nonnull(2, 3) static ssize_t
-	console_read(short minor, struct inode *ip, char *dst, size_t n)
+	console_read(short minor, struct inode *ip, char *dst, off_t off, size_t n)
 {
 	size_t target;
 	int c;
@@ -460,14 +496,25 @@ __nonnull(2, 3) static ssize_t
 console_write(short minor, struct inode *ip,
 																		 char *buf, size_t n)
 {
+	size_t run = 0; // Start of the characters not yet sent to the UART.
+
 	acquire(&cons.lock);
+	vga_begin_batch();
 	for (size_t i = 0; i < n; i++) {
 		if (buf[i] == '\033') {
+			// The serial side gets everything but the escape
+			// sequences, a run at a time.
+			uartwrite(buf + run, i - run);
 			i += let_rust_handle_it(buf + i);
+			run = i + 1;
 		} else {
-			vga_write_char(buf[i] & 0xff, static_foreg, static_backg);
+			vga_draw_char(buf[i] & 0xff, static_foreg, static_backg);
 		}
 	}
+	if (run < n) {
+		uartwrite(buf + run, n - run);
+	}
+	vga_end_batch();
 	release(&cons.lock);
 	return n;
 }
@@ -493,7 +540,7 @@ console_close(short minor)
 
 __nonnull(2, 3) static ssize_t
 	uart_read(short minor, __attribute__((unused)) struct inode *ip, char *buf,
-            size_t n)
+            __attribute__((unused)) off_t off, size_t n)
 {
 	return n;
 }
@@ -503,9 +550,7 @@ __nonnull(2, 3) static ssize_t
 uart_write(short minor, __attribute__((unused)) struct inode *ip,
 																		 char *buf, size_t n)
 {
-	for (size_t i = 0; i < n; i++) {
-		uartputc(buf[i]);
-	}
+	uartwrite(buf, n);
 	return n;
 }
 /* clang-format on */
@@ -530,12 +575,12 @@ uart_close(short minor)
 
 __nonnull(2, 3) static ssize_t
 	tty_read(short minor, __attribute__((unused)) struct inode *ip, char *buf,
-           size_t n)
+           off_t off, size_t n)
 {
 	if (minor >= MINOR_TTY_SERIAL) {
-		return uart_read(minor, ip, buf, n);
+		return uart_read(minor, ip, buf, off, n);
 	} else {
-		return console_read(minor, ip, buf, n);
+		return console_read(minor, ip, buf, off, n);
 	}
 }
 
@@ -580,6 +625,33 @@ tty_open(short minor, int flags)
 	}
 }
 
+static int
+console_poll(short minor, struct pollwaiter *w)
+{
+	int mask = POLLOUT | POLLWRNORM;
+
+	acquire(&cons.lock);
+	if (w != NULL) {
+		pollwaiter_add(&input.pollhead, w);
+	}
+	if (input.r != input.w) {
+		mask |= POLLIN | POLLRDNORM;
+	}
+	release(&cons.lock);
+	return mask;
+}
+
+static int
+tty_poll(short minor, struct pollwaiter *w)
+{
+	if (minor >= MINOR_TTY_SERIAL) {
+		// uart_read() never blocks.
+		return POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+	} else {
+		return console_poll(minor, w);
+	}
+}
+
 static int
 tty_close(short minor)
 {
@@ -594,18 +666,22 @@ void
 dev_console_init(void)
 {
 	initlock(&cons.lock, "console");
+	lockstat_register(&cons.lock);
+	pollhead_init(&input.pollhead);
 
 	devsw[DEV_CONSOLE].write = console_write;
 	devsw[DEV_CONSOLE].read = console_read;
 	devsw[DEV_CONSOLE].mmap = console_mmap;
 	devsw[DEV_CONSOLE].open = console_open;
 	devsw[DEV_CONSOLE].close = console_close;
+	devsw[DEV_CONSOLE].poll = console_poll;
 
 	devsw[DEV_TTY].write = tty_write;
 	devsw[DEV_TTY].read = tty_read;
 	devsw[DEV_TTY].mmap = tty_mmap;
 	devsw[DEV_TTY].open = tty_open;
 	devsw[DEV_TTY].close = tty_close;
+	devsw[DEV_TTY].poll = tty_poll;
 	cons.locking = 1;
 	// Notice: we start all terminals in echo mode.
 	struct termios termios = {
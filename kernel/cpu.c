@@ -18,11 +18,54 @@
 // I called this "XBV" instead of "xgetbv" or "xsetbv".
 #define XBV_XCR0 0
 enum {
+	XCR0_X87 = 1 << 0,
 	XCR0_SSE = 1 << 1,
 	XCR0_AVX = 1 << 2,
 };
 
-static uint8_t clean_fpu[512];
+// The state every process starts with, in the same layout as in
+// struct proc.
+static uint8_t clean_fpu[FPU_STATE_SIZE] __attribute__((aligned(64)));
+// If the CPU can XSAVE, the XCR0 bits we save and restore.
+static uint64_t xsave_mask = 0;
+static bool has_xsaveopt = false;
+
+enum MISC_CPU_FEATURES cpu_misc_features = 0;
+
+void
+fpu_save(uint8_t *state)
+{
+	if (xsave_mask == 0) {
+		__asm__ __volatile__("fxsave64 (%0)" : : "r"(state) : "memory");
+	} else if (has_xsaveopt) {
+		// Skips whatever has not changed since the last xrstor.
+		__asm__ __volatile__("xsaveopt64 (%0)"
+		                     :
+		                     : "r"(state), "a"((uint32_t)xsave_mask),
+		                       "d"((uint32_t)(xsave_mask >> 32))
+		                     : "memory");
+	} else {
+		__asm__ __volatile__("xsave64 (%0)"
+		                     :
+		                     : "r"(state), "a"((uint32_t)xsave_mask),
+		                       "d"((uint32_t)(xsave_mask >> 32))
+		                     : "memory");
+	}
+}
+
+void
+fpu_restore(const uint8_t *state)
+{
+	if (xsave_mask == 0) {
+		__asm__ __volatile__("fxrstor64 (%0)" : : "r"(state) : "memory");
+	} else {
+		__asm__ __volatile__("xrstor64 (%0)"
+		                     :
+		                     : "r"(state), "a"((uint32_t)xsave_mask),
+		                       "d"((uint32_t)(xsave_mask >> 32))
+		                     : "memory");
+	}
+}
 
 static void
 fpu_load_control_word(uint16_t control)
@@ -94,7 +137,35 @@ sse_init(CpuFeatures *features)
 	mxcsr |= (0b111010u << 7);
 	// Also, the rounding mode we set is 0b00, which is round to even.
 	__asm__ __volatile__("ldmxcsr %0" ::"m"(mxcsr));
-	__asm__ __volatile__("fxsave %0" : "=m"(clean_fpu));
+	__asm__ __volatile__("fxsave64 %0" : "=m"(*(uint8_t(*)[512])clean_fpu));
+}
+
+// Save and restore AVX state along with the rest, if we can.
+static void
+xsave_init(CpuFeatures *features)
+{
+	uint32_t a, b, c, d;
+	uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
+
+	if (!(read_cr4() & CR4_OSXSAVE)) {
+		return;
+	}
+	if (features->avx & AVX) {
+		xcr0 |= XCR0_AVX;
+	}
+	xsetbv(XBV_XCR0, xcr0);
+
+	// EBX is how much room the features now in XCR0 need.
+	cpuid(0xd, 0, &a, &b, &c, &d);
+	kernel_assert(b <= FPU_STATE_SIZE);
+	cpuid(0xd, 1, &a, &b, &c, &d);
+	has_xsaveopt = a & 1;
+	xsave_mask = xcr0;
+
+	// The x87 and SSE state come from the FXSAVE area above; the AVX
+	// state starts out zeroed because its bit is clear.
+	memset(clean_fpu + 512, 0, FPU_STATE_SIZE - 512);
+	*(uint64_t *)(clean_fpu + 512) = XCR0_X87 | XCR0_SSE;
 }
 
 static CpuFeatures
@@ -330,6 +401,9 @@ set_remaining_features(CpuFeatures *cpu_features)
 			case CPUID_FEAT_ECX_AVX:
 				cpu_features->avx |= AVX;
 				break;
+			case CPUID_FEAT_ECX_XSAVE:
+				cpu_features->fpu_misc.xsave = true;
+				break;
 			}
 		}
 	}
@@ -355,16 +429,13 @@ set_remaining_features(CpuFeatures *cpu_features)
 		if (c & cpuidstruct_ecx_0x80000001[i].feature &&
 		    cpuidstruct_ecx_0x80000001[i].feature_string != NULL) {
 			pr_debug("%s ", cpuidstruct_ecx_0x80000001[i].feature_string);
-			switch (cpuidstruct_ecx_1[i].feature) {
+			switch (cpuidstruct_ecx_0x80000001[i].feature) {
 			case CPUID_FEAT_ECX_EXT_SSE4A:
 				cpu_features->sse |= SSE4A;
 				break;
 			case CPUID_FEAT_ECX_EXT_MISALIGNED_SSE:
 				cpu_features->sse |= SSE_MISALIGNED;
 				break;
-			case CPUID_FEAT_ECX_XSAVE:
-				cpu_features->fpu_misc.xsave = true;
-				break;
 			}
 		}
 	}
@@ -387,6 +458,22 @@ set_remaining_features(CpuFeatures *cpu_features)
 			}
 		}
 	}
+	cpuid(0, 0, &a, &b, &c, &d);
+	if (a >= 7) {
+		cpuid(7, 0, &a, &b, &c, &d);
+		if (b & (1 << 5)) {
+			cpu_features->avx |= AVX2;
+			pr_debug("avx2 ");
+		}
+		if (b & (1 << 9)) {
+			cpu_features->misc |= MISC_FEATURE_ERMS;
+			pr_debug("erms ");
+		}
+		if (d & (1 << 4)) {
+			cpu_features->misc |= MISC_FEATURE_FSRM;
+			pr_debug("fsrm ");
+		}
+	}
 	cpuid(0x80000007, 0, &a, &b, &c, &d);
 	if (d & (1 << 8)) {
 		cpu_features->misc |= MISC_FEATURE_INVARIANT_TSC;
@@ -453,21 +540,13 @@ cpu_features_init(void)
 	fpu_init();
 	kernel_assert(cpu_features.sse >= SSE && cpu_features.fxsr >= FXSR);
 	sse_init(&cpu_features);
-	if (read_cr4() & CR4_OSXSAVE) {
-		xsetbv(XBV_XCR0, xgetbv(XBV_XCR0) | XCR0_SSE);
-	}
+	xsave_init(&cpu_features);
 
 	// If we even made it to this code and failed, I'd be surprised.
 	// All 64-bit CPUS are supposed to set this, and we execute 64-bit
 	// code waaaaay before we do this check.
 	kernel_assert(cpu_features.misc & MISC_FEATURE_LONG_MODE);
-
-// Wait on enabling AVX reg saving for a later date.
-#if 0
-	if (cpu_features->avx >= AVX) {
-		xsetbv(XBV_XCR0, xgetbv(XBV_XCR0) | XCR0_AVX);
-	}
-#endif
+	cpu_misc_features = cpu_features.misc;
 
 	model_family_stepping();
 }
@@ -11,7 +11,7 @@
 static struct multiboot_tag_framebuffer_common s_fb_common;
 
 static ssize_t
-fb_read(short minor, struct inode *ip, char *buf, size_t n)
+fb_read(short minor, struct inode *ip, char *buf, off_t off, size_t n)
 {
 	return (ssize_t)n;
 }
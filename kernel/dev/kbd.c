@@ -1,12 +1,13 @@
 #include "dev/kbd.h"
+#include "dev/trace.h"
 
-#include "lib/queue.h"
+#include "lib/ring_buffer.h"
 
 #include "console.h"
 #include "errno.h"
 #include "fs.h"
 #include "ioapic.h"
-#include "kalloc.h"
+#include "kernel_poll.h"
 #include "mman.h"
 #include "proc.h"
 #include "spinlock.h"
@@ -373,23 +374,15 @@ kbd_scancode_into_char(uint32_t data)
 	return c;
 }
 
-void
-display_queue(struct queue_unsigned_char *q)
-{
-	if (q == NULL) {
-		return;
-	}
-	uart_printf("elements: ");
-	unsigned char data;
-	int ret = dequeue_unsigned_char(q, &data, kfree);
-	while (ret != -1) {
-		uart_printf("%d (%c)", data, data);
-		ret = dequeue_unsigned_char(q, &data, kfree);
-	}
-	uart_printf("\n");
-}
+// Scancodes waiting for /dev/kbd. consoleintr() is the only producer,
+// and it runs under cons.lock; readers take kbdlock.lock to be the
+// only consumer, and to sleep on.
+#define KEYBOARD_QUEUE_SIZE 64
 
-#define KEYBOARD_QUEUE_SIZE 16
+struct kbd_event {
+	uint64_t tsc; // When the interrupt saw it.
+	unsigned char scancode;
+};
 
 void
 kbdintr(void)
@@ -399,40 +392,59 @@ kbdintr(void)
 
 struct {
 	struct spinlock lock;
-	struct queue_unsigned_char *kbd_queue;
+	struct spsc_ring ring;
+	struct kbd_event events[KEYBOARD_QUEUE_SIZE];
+	struct pollhead pollhead;
 } kbdlock;
 
-int
+// Called from interrupts. If no one is reading, the oldest
+// scancodes are kept and the new ones dropped.
+void
 kbd_enqueue(unsigned char value)
 {
-	int val;
+	struct kbd_event e = { rdtsc(), value };
+
+	if (!spsc_ring_push(&kbdlock.ring, &e)) {
+		return;
+	}
+	// The lock makes sure a reader that just found the ring empty is
+	// asleep before it is woken, and pollwake() wants it held.
 	acquire(&kbdlock.lock);
-	val = enqueue_unsigned_char(kbdlock.kbd_queue, value, kmalloc,
-	                            KEYBOARD_QUEUE_SIZE);
+	wakeup(&kbdlock.ring);
+	pollwake(&kbdlock.pollhead, POLLIN);
 	release(&kbdlock.lock);
-	return val;
 }
 
 __nonnull(2, 3) static ssize_t
-	kbdread(short minor, struct inode *ip, char *dst, size_t n)
+	kbdread(short minor, struct inode *ip, char *dst, off_t off, size_t n)
 {
-get_element:;
+	struct kbd_event e;
+	// dst may fault, which cannot be served under kbdlock.lock, so the
+	// scancodes wait here until it is released. The ring holds no
+	// more than this anyway.
+	char codes[KEYBOARD_QUEUE_SIZE];
+	size_t done = 0;
+
 	acquire(&kbdlock.lock);
-	unsigned char data;
-	int ret = dequeue_unsigned_char(kbdlock.kbd_queue, &data, kfree);
-	release(&kbdlock.lock);
-	if (ret != QUEUE_SUCCESS) {
+	while (spsc_ring_is_empty(&kbdlock.ring)) {
 		if ((ip->fattrs & O_NONBLOCK) == O_NONBLOCK) {
+			release(&kbdlock.lock);
 			return -EWOULDBLOCK;
-		} else {
-			// Let other processes do stuff while we sit here and spin.
-			yield();
-			// The default is spinning on the kbd queue.
-			goto get_element;
 		}
+		if (myproc()->killed) {
+			release(&kbdlock.lock);
+			return -EINTR;
+		}
+		sleep(&kbdlock.ring, &kbdlock.lock);
 	}
-	memcpy(dst, &data, sizeof(data));
-	return n;
+	while (done < n && done < sizeof(codes) &&
+	       spsc_ring_pop(&kbdlock.ring, &e)) {
+		codes[done++] = e.scancode;
+		tracepoint(TRACE_INPUT, 0, rdtsc() - e.tsc);
+	}
+	release(&kbdlock.lock);
+	memmove(dst, codes, done);
+	return done;
 }
 
 /* clang-format off */
@@ -450,6 +462,22 @@ kbdmmap_noop(short minor, size_t length, uintptr_t addr, int perm)
 	return (struct mmap_info){};
 }
 
+static int
+kbdpoll(short minor, struct pollwaiter *w)
+{
+	int mask = 0;
+
+	acquire(&kbdlock.lock);
+	if (w != NULL) {
+		pollwaiter_add(&kbdlock.pollhead, w);
+	}
+	if (!spsc_ring_is_empty(&kbdlock.ring)) {
+		mask |= POLLIN | POLLRDNORM;
+	}
+	release(&kbdlock.lock);
+	return mask;
+}
+
 static int kbd_file_ref = 0;
 
 static int
@@ -457,7 +485,7 @@ kbdopen(short minor, int flags)
 {
 	if (kbd_file_ref == 0) {
 		acquire(&kbdlock.lock);
-		clean_queue_unsigned_char(kbdlock.kbd_queue, kfree);
+		spsc_ring_clear(&kbdlock.ring);
 		release(&kbdlock.lock);
 	}
 	kbd_file_ref++;
@@ -475,18 +503,16 @@ void
 dev_kbd_init(void)
 {
 	initlock(&kbdlock.lock, "kbd");
-
-	kbdlock.kbd_queue = create_queue_unsigned_char(kmalloc);
-
-	if (kbdlock.kbd_queue == NULL) {
-		panic("Could not create kbd_queue");
-	}
+	pollhead_init(&kbdlock.pollhead);
+	spsc_ring_init(&kbdlock.ring, kbdlock.events, sizeof(struct kbd_event),
+	               KEYBOARD_QUEUE_SIZE);
 
 	devsw[DEV_KBD].write = kbdwrite;
 	devsw[DEV_KBD].read = kbdread;
 	devsw[DEV_KBD].mmap = kbdmmap_noop;
 	devsw[DEV_KBD].open = kbdopen;
 	devsw[DEV_KBD].close = kbdclose;
+	devsw[DEV_KBD].poll = kbdpoll;
 
 	ioapicenable(IRQ_KBD, 0);
 }
@@ -118,6 +118,19 @@ lapiceoi(void)
 	}
 }
 
+// Interrupt the CPU whose local APIC is apicid with vector.
+void
+lapicipi(uint8_t apicid, int vector)
+{
+	pushcli();
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS) {
+		;
+	}
+	popcli();
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
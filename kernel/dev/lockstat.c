@@ -0,0 +1,71 @@
+#include "dev/lockstat.h"
+
+#include "file.h"
+#include "fs.h"
+#include "kalloc.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#include <errno.h>
+#include <string.h>
+
+// Every read formats a fresh snapshot and hands back the part of it
+// that starts at off, so plain cat(1) works on the device.
+static ssize_t
+lockstat_read(short minor, struct inode *ip, char *buf, off_t off, size_t n)
+{
+	char *page = kpage_alloc();
+	if (page == NULL) {
+		return -ENOMEM;
+	}
+	size_t len = lockstat_format(page, PGSIZE);
+	if (len >= PGSIZE) {
+		len = PGSIZE - 1;
+	}
+	if (off < 0 || off >= len) {
+		kpage_free(page);
+		return 0;
+	}
+	if (n > len - off) {
+		n = len - off;
+	}
+	memcpy(buf, page + off, n);
+	kpage_free(page);
+	return n;
+}
+
+// Any write resets the counters.
+static ssize_t
+lockstat_write(short minor, struct inode *ip, char *buf, size_t n)
+{
+	lockstat_reset();
+	return n;
+}
+
+static struct mmap_info
+lockstat_mmap(short minor, size_t length, uintptr_t addr, int perm)
+{
+	return (struct mmap_info){};
+}
+
+static int
+lockstat_open(short minor, int flags)
+{
+	return 0;
+}
+
+static int
+lockstat_close(short minor)
+{
+	return 0;
+}
+
+void
+dev_lockstat_init(void)
+{
+	devsw[DEV_LOCKSTAT].read = lockstat_read;
+	devsw[DEV_LOCKSTAT].write = lockstat_write;
+	devsw[DEV_LOCKSTAT].mmap = lockstat_mmap;
+	devsw[DEV_LOCKSTAT].open = lockstat_open;
+	devsw[DEV_LOCKSTAT].close = lockstat_close;
+}
@@ -10,7 +10,7 @@ dev_null_write(short minor, struct inode *ip, char *buf, size_t n)
 }
 
 static ssize_t
-dev_null_read(short minor, struct inode *ip, char *buf, size_t n)
+dev_null_read(short minor, struct inode *ip, char *buf, off_t off, size_t n)
 {
 	return n;
 }
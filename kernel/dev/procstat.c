@@ -0,0 +1,118 @@
+//
+// Resource usage, for top(1) and friends: one struct proc_stat per
+// process from /dev/procstat and one struct cpu_stat per CPU from
+// /dev/cpustat. Every read takes a fresh snapshot and hands back the
+// part of it that starts at off, so read it all in one go.
+//
+
+#include "dev/procstat.h"
+
+#include "acct.h"
+#include "file.h"
+#include "kalloc.h"
+#include "param.h"
+#include "proc.h"
+#include "procstat.h"
+
+#include <errno.h>
+#include <string.h>
+
+// Hand back [off, off + n) of the len bytes at snap.
+static ssize_t
+copy_snapshot(char *buf, const void *snap, size_t len, off_t off, size_t n)
+{
+	if (off < 0) {
+		return -EINVAL;
+	}
+	if (off >= len) {
+		return 0;
+	}
+	if (n > len - off) {
+		n = len - off;
+	}
+	memcpy(buf, (const char *)snap + off, n);
+	return n;
+}
+
+static ssize_t
+procstat_read_procs(char *buf, off_t off, size_t n)
+{
+	struct proc_stat *st = kmalloc(NPROC * sizeof(*st));
+
+	if (st == NULL) {
+		return -ENOMEM;
+	}
+	size_t nproc = proc_stat_all(st, NPROC);
+	ssize_t ret = copy_snapshot(buf, st, nproc * sizeof(*st), off, n);
+	kfree(st);
+	return ret;
+}
+
+// The other CPUs are only up to their last trip into or out of the
+// kernel, which for a busy one is at most a tick ago.
+static ssize_t
+procstat_read_cpus(char *buf, off_t off, size_t n)
+{
+	struct cpu_stat *st = kmalloc(ncpu * sizeof(*st));
+
+	if (st == NULL) {
+		return -ENOMEM;
+	}
+	acct_charge(false);
+	for (int i = 0; i < ncpu; i++) {
+		st[i] = cpus[i].acct;
+		st[i].user = cycles_to_nsec(st[i].user);
+		st[i].sys = cycles_to_nsec(st[i].sys);
+		st[i].idle = cycles_to_nsec(st[i].idle);
+	}
+	ssize_t ret = copy_snapshot(buf, st, ncpu * sizeof(*st), off, n);
+	kfree(st);
+	return ret;
+}
+
+static ssize_t
+procstat_read(short minor, struct inode *ip, char *buf, off_t off, size_t n)
+{
+	switch (minor) {
+	case 0:
+		return procstat_read_procs(buf, off, n);
+	case 1:
+		return procstat_read_cpus(buf, off, n);
+	default:
+		return -ENODEV;
+	}
+}
+
+static ssize_t
+procstat_write(short minor, struct inode *ip, char *buf, size_t n)
+{
+	return -EINVAL;
+}
+
+static struct mmap_info
+procstat_mmap(short minor, size_t length, uintptr_t addr, int perm)
+{
+	return (struct mmap_info){};
+}
+
+static int
+procstat_open(short minor, int flags)
+{
+	return 0;
+}
+
+static int
+procstat_close(short minor)
+{
+	return 0;
+}
+
+void
+dev_procstat_init(void)
+{
+	devsw[DEV_PROCSTAT].read = procstat_read;
+	devsw[DEV_PROCSTAT].write = procstat_write;
+	devsw[DEV_PROCSTAT].mmap = procstat_mmap;
+	devsw[DEV_PROCSTAT].open = procstat_open;
+	devsw[DEV_PROCSTAT].close = procstat_close;
+}
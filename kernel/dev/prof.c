@@ -0,0 +1,307 @@
+//
+// A sampling profiler.
+//
+// While it is on, every CPU's timer interrupt records where that CPU
+// was and the return addresses up its stack, kernel and user. Each CPU
+// writes into its own ring and only readers of /dev/prof take samples
+// out, so the interrupt needs no lock: the head and tail are atomics,
+// each written by one side only.
+//
+
+#include "dev/prof.h"
+
+#include "file.h"
+#include "kalloc.h"
+#include "macros.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "param.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "symbols.h"
+#include "vm.h"
+#include "x86.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROF_RING_PAGES 32
+#define PROF_PER_PAGE (PGSIZE / sizeof(struct prof_sample))
+#define PROF_RING_SIZE (PROF_RING_PAGES * PROF_PER_PAGE)
+
+struct prof_ring {
+	struct prof_sample *pages[PROF_RING_PAGES];
+	_Atomic size_t head; // Samples written; only the CPU itself moves it.
+	_Atomic size_t tail; // Samples read; only readers move it.
+	size_t dropped; // Samples that found the ring full.
+	int countdown; // Ticks until the next sample.
+};
+
+static struct prof_ring rings[NCPU];
+static _Atomic bool prof_on;
+static int prof_interval;
+// Serializes readers, and starting and stopping.
+static struct spinlock prof_lock;
+
+static struct prof_sample *
+ring_slot(struct prof_ring *r, size_t i)
+{
+	i %= PROF_RING_SIZE;
+	return &r->pages[i / PROF_PER_PAGE][i % PROF_PER_PAGE];
+}
+
+// Read a word of user memory without faulting: the sample is taken in
+// an interrupt, which cannot wait for a page to come in.
+static bool
+user_peek(uintptr_t *pgdir, uintptr_t va, uint64_t *word)
+{
+	if (va % sizeof(*word) != 0 || va >= USER_MMAP_END) {
+		return false;
+	}
+	pte_t *pte = walkpgdir(pgdir, (void *)va, false);
+	if (pte == NULL || (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U)) {
+		return false;
+	}
+	*word = *(uint64_t *)((char *)p2v(PTE_ADDR(*pte)) + va % PGSIZE);
+	return true;
+}
+
+// Follow the user's frame pointers up from rbp.
+static size_t
+walk_user(struct proc *p, uint64_t rbp, uint64_t *pcs, size_t max)
+{
+	size_t n = 0;
+	uint64_t next, ret;
+
+	while (n < max && user_peek(p->mm->pgdir, rbp, &next) &&
+	       user_peek(p->mm->pgdir, rbp + 8, &ret) && ret != 0) {
+		pcs[n++] = ret;
+		// Callers' frames are further up the stack.
+		if (next <= rbp) {
+			break;
+		}
+		rbp = next;
+	}
+	return n;
+}
+
+// Follow the kernel's frame pointers up from rbp, as long as they stay
+// on p's kernel stack.
+static size_t
+walk_kernel(struct proc *p, uint64_t rbp, uint64_t *pcs, size_t max)
+{
+	size_t n = 0;
+
+	if (p == NULL) {
+		return 0;
+	}
+	uintptr_t lo = (uintptr_t)p->kstack;
+	uintptr_t hi = lo + KSTACKSIZE;
+	while (n < max && rbp % 8 == 0 && rbp >= lo && rbp + 16 <= hi) {
+		uint64_t *frame = (uint64_t *)rbp;
+		if (frame[1] == 0) {
+			break;
+		}
+		pcs[n++] = frame[1];
+		if (frame[0] <= rbp) {
+			break;
+		}
+		rbp = frame[0];
+	}
+	return n;
+}
+
+// Called from every CPU's timer interrupt.
+void
+prof_tick(struct trapframe *tf)
+{
+	if (!atomic_load_explicit(&prof_on, memory_order_acquire)) {
+		return;
+	}
+	struct prof_ring *r = &rings[my_cpu_id()];
+	if (--r->countdown > 0) {
+		return;
+	}
+	r->countdown = prof_interval;
+
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >=
+	    PROF_RING_SIZE) {
+		r->dropped++;
+		return;
+	}
+	struct prof_sample *s = ring_slot(r, head);
+	struct proc *p = myproc();
+	bool user = (tf->cs & 3) == DPL_USER;
+	size_t n = 1;
+
+	s->pid = p != NULL ? p->tgid : 0;
+	s->cpu = my_cpu_id();
+	s->user = user;
+	s->pcs[0] = tf->rip;
+	if (user) {
+		n += walk_user(p, tf->rbp, s->pcs + n, PROF_DEPTH - n);
+	} else {
+		n += walk_kernel(p, tf->rbp, s->pcs + n, PROF_DEPTH - n);
+		// Carry on into whatever the process was doing when it
+		// came into the kernel.
+		if (p != NULL && p->tf != NULL && (p->tf->cs & 3) == DPL_USER &&
+		    n < PROF_DEPTH) {
+			s->pcs[n++] = p->tf->rip;
+			n += walk_user(p, p->tf->rbp, s->pcs + n, PROF_DEPTH - n);
+		}
+	}
+	s->depth = n;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+int
+prof_start(int interval)
+{
+	int ret = 0;
+
+	if (interval <= 0) {
+		return -EINVAL;
+	}
+	acquire(&prof_lock);
+	if (atomic_load(&prof_on)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	// The rings are kept once made; stopping leaves the samples to be
+	// read.
+	for (int cpu = 0; cpu < ncpu; cpu++) {
+		struct prof_ring *r = &rings[cpu];
+		for (int i = 0; i < PROF_RING_PAGES; i++) {
+			if (r->pages[i] == NULL &&
+			    (r->pages[i] = (struct prof_sample *)kpage_alloc()) == NULL) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+		atomic_store(&r->tail, atomic_load(&r->head));
+		r->dropped = 0;
+		r->countdown = interval;
+	}
+	prof_interval = interval;
+	atomic_store_explicit(&prof_on, true, memory_order_release);
+out:
+	release(&prof_lock);
+	return ret;
+}
+
+int
+prof_stop(void)
+{
+	size_t dropped = 0;
+
+	acquire(&prof_lock);
+	atomic_store(&prof_on, false);
+	for (int cpu = 0; cpu < ncpu; cpu++) {
+		dropped += rings[cpu].dropped;
+	}
+	release(&prof_lock);
+	return dropped > INT32_MAX ? INT32_MAX : (int)dropped;
+}
+
+int
+prof_ksym(struct prof_symbol *sym)
+{
+	size_t offset;
+	const char *name = symbol_resolve(sym->addr, &offset);
+
+	if (name == NULL) {
+		return -ENOENT;
+	}
+	sym->offset = offset;
+	strncpy(sym->name, name, sizeof(sym->name) - 1);
+	sym->name[sizeof(sym->name) - 1] = '\0';
+	return 0;
+}
+
+// Take up to max samples out of the rings, a CPU at a time, into
+// out. Returns how many it took.
+static size_t
+prof_take(struct prof_sample *out, size_t max)
+{
+	size_t n = 0;
+
+	acquire(&prof_lock);
+	for (int cpu = 0; cpu < ncpu && n < max; cpu++) {
+		struct prof_ring *r = &rings[cpu];
+		if (r->pages[0] == NULL) {
+			continue;
+		}
+		size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+		while (tail != head && n < max) {
+			out[n++] = *ring_slot(r, tail++);
+		}
+		atomic_store_explicit(&r->tail, tail, memory_order_release);
+	}
+	release(&prof_lock);
+	return n;
+}
+
+// Hand out whole samples. Returns 0 once every ring is empty. They
+// go through a page of our own, since buf may fault and that cannot
+// be served under prof_lock.
+static ssize_t
+prof_read(short minor, struct inode *ip, char *buf, off_t off, size_t n)
+{
+	struct prof_sample *bounce = (struct prof_sample *)kpage_alloc();
+	size_t done = 0;
+
+	if (bounce == NULL) {
+		return -ENOMEM;
+	}
+	while (n - done >= sizeof(struct prof_sample)) {
+		size_t want = min((n - done) / sizeof(struct prof_sample), PROF_PER_PAGE);
+		size_t got = prof_take(bounce, want);
+		if (got == 0) {
+			break;
+		}
+		memmove(buf + done, bounce, got * sizeof(struct prof_sample));
+		done += got * sizeof(struct prof_sample);
+	}
+	kpage_free((char *)bounce);
+	return done;
+}
+
+static ssize_t
+prof_write(short minor, struct inode *ip, char *buf, size_t n)
+{
+	return -EINVAL;
+}
+
+static struct mmap_info
+prof_mmap(short minor, size_t length, uintptr_t addr, int perm)
+{
+	return (struct mmap_info){};
+}
+
+static int
+prof_open(short minor, int flags)
+{
+	return 0;
+}
+
+static int
+prof_close(short minor)
+{
+	return 0;
+}
+
+void
+dev_prof_init(void)
+{
+	initlock(&prof_lock, "prof");
+	devsw[DEV_PROF].read = prof_read;
+	devsw[DEV_PROF].write = prof_write;
+	devsw[DEV_PROF].mmap = prof_mmap;
+	devsw[DEV_PROF].open = prof_open;
+	devsw[DEV_PROF].close = prof_close;
+}
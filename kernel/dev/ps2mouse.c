@@ -1,11 +1,13 @@
 #include "dev/ps2mouse.h"
+#include "dev/trace.h"
 
 #include "lib/queue.h"
+#include "lib/ring_buffer.h"
 
 #include "console.h"
 #include "errno.h"
 #include "ioapic.h"
-#include "kalloc.h"
+#include "kernel_poll.h"
 #include "mman.h"
 #include "proc.h"
 #include "spinlock.h"
@@ -26,14 +28,24 @@
 #define WRITE_TO_AUX 0xD4
 #define MOUSEID 0xF2
 
-#define MOUSE_QUEUE_SIZE 16
+// Packets waiting for /dev/mouse. ps2mouseintr() is the only
+// producer; readers take mouselock.lock to be the only consumer, and
+// to sleep on.
+#define MOUSE_QUEUE_SIZE 128
+
+struct mouse_event {
+	uint64_t tsc; // When the interrupt finished the packet.
+	struct mouse_packet packet;
+};
 
 static uint8_t mouse_data[3];
 static uint8_t count = 0;
 
 struct {
 	struct spinlock lock;
-	struct queue_mouse_packet *mouse_queue;
+	struct spsc_ring ring;
+	struct mouse_event events[MOUSE_QUEUE_SIZE];
+	struct pollhead pollhead;
 } mouselock;
 
 static void
@@ -100,25 +112,35 @@ mouse_read(void)
 }
 
 __nonnull(2, 3) static ssize_t
-	mouseread(__unused short minor, struct inode *ip, char *dst, size_t n)
+	mouseread(__unused short minor, struct inode *ip, char *dst,
+	          __unused off_t off, size_t n)
 {
-get_element:;
+	struct mouse_event e;
+	size_t done = 0;
+
+	if (n < sizeof(e.packet)) {
+		return -EINVAL;
+	}
 	acquire(&mouselock.lock);
-	struct mouse_packet data;
-	int ret = dequeue_mouse_packet(mouselock.mouse_queue, &data, kfree);
-	release(&mouselock.lock);
-	if (ret != QUEUE_SUCCESS) {
+	while (spsc_ring_is_empty(&mouselock.ring)) {
 		if ((ip->fattrs & O_NONBLOCK) == O_NONBLOCK) {
+			release(&mouselock.lock);
 			return -EWOULDBLOCK;
-		} else {
-			// Let other processes do stuff while we sit here and spin.
-			yield();
-			// The default is spinning on the mouse queue.
-			goto get_element;
 		}
+		if (myproc()->killed) {
+			release(&mouselock.lock);
+			return -EINTR;
+		}
+		sleep(&mouselock.ring, &mouselock.lock);
 	}
-	memcpy(dst, &data, sizeof(data));
-	return n;
+	// Whole packets only.
+	while (n - done >= sizeof(e.packet) && spsc_ring_pop(&mouselock.ring, &e)) {
+		memcpy(dst + done, &e.packet, sizeof(e.packet));
+		done += sizeof(e.packet);
+		tracepoint(TRACE_INPUT, 1, rdtsc() - e.tsc);
+	}
+	release(&mouselock.lock);
+	return done;
 }
 
 /* clang-format off */
@@ -137,6 +159,22 @@ mousemmap_noop(__unused short minor, __unused size_t length,
 	return (struct mmap_info){};
 }
 
+static int
+mousepoll(__unused short minor, struct pollwaiter *w)
+{
+	int mask = 0;
+
+	acquire(&mouselock.lock);
+	if (w != NULL) {
+		pollwaiter_add(&mouselock.pollhead, w);
+	}
+	if (!spsc_ring_is_empty(&mouselock.ring)) {
+		mask |= POLLIN | POLLRDNORM;
+	}
+	release(&mouselock.lock);
+	return mask;
+}
+
 static int mouse_file_ref = 0;
 
 static int
@@ -144,7 +182,7 @@ mouseopen(__unused short minor, __unused int flags)
 {
 	if (mouse_file_ref == 0) {
 		acquire(&mouselock.lock);
-		clean_queue_mouse_packet(mouselock.mouse_queue, kfree);
+		spsc_ring_clear(&mouselock.ring);
 		release(&mouselock.lock);
 	}
 	mouse_file_ref++;
@@ -185,18 +223,16 @@ ps2mouseinit(void)
 	mouse_read(); // ACK
 
 	initlock(&mouselock.lock, "mouse");
-
-	mouselock.mouse_queue = create_queue_mouse_packet(kmalloc);
-
-	if (mouselock.mouse_queue == NULL) {
-		panic("Could not create mouse_queue");
-	}
+	pollhead_init(&mouselock.pollhead);
+	spsc_ring_init(&mouselock.ring, mouselock.events, sizeof(struct mouse_event),
+	               MOUSE_QUEUE_SIZE);
 
 	devsw[DEV_MOUSE].write = mousewrite;
 	devsw[DEV_MOUSE].read = mouseread;
 	devsw[DEV_MOUSE].mmap = mousemmap_noop;
 	devsw[DEV_MOUSE].open = mouseopen;
 	devsw[DEV_MOUSE].close = mouseclose;
+	devsw[DEV_MOUSE].poll = mousepoll;
 	ioapicenable(IRQ_PS2_MOUSE, 0);
 }
 
@@ -213,16 +249,18 @@ ps2mouseintr(void)
 		if (count == 3) {
 			count = 0;
 
-			struct mouse_packet coords = { .data = { mouse_data[0], mouse_data[1],
-				                                       mouse_data[2] } };
-			int val;
-			acquire(&mouselock.lock);
-			val = enqueue_mouse_packet(mouselock.mouse_queue, coords, kmalloc,
-			                           MOUSE_QUEUE_SIZE);
-			release(&mouselock.lock);
-
-			if (val == QUEUE_OOM) {
-				panic("Cannot allocate memory for mouse queue");
+			struct mouse_event e = {
+				rdtsc(), { .data = { mouse_data[0], mouse_data[1], mouse_data[2] } }
+			};
+			// With no one reading, new packets are dropped.
+			if (spsc_ring_push(&mouselock.ring, &e)) {
+				// The lock makes sure a reader that just found the
+				// ring empty is asleep before it is woken, and
+				// pollwake() wants it held.
+				acquire(&mouselock.lock);
+				wakeup(&mouselock.ring);
+				pollwake(&mouselock.pollhead, POLLIN);
+				release(&mouselock.lock);
 			}
 		}
 	}
@@ -8,7 +8,6 @@
 // not implemented
 #include "sata.h"
 #else
-// not implemented
 #include "ramfs.h"
 #endif
 
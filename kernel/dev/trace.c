@@ -0,0 +1,289 @@
+//
+// System call latency statistics and tracepoints.
+//
+// Both are off until someone starts them through /dev/trace, and
+// while off each site costs one load and a branch. While on, every CPU
+// keeps its own counters and its own ring of events, touched with
+// interrupts off, so nothing here takes a lock on the way in; readers
+// of /dev/trace and /dev/sysstat do the adding up.
+//
+
+#include "dev/trace.h"
+
+#include "acct.h"
+#include "file.h"
+#include "kalloc.h"
+#include "mmu.h"
+#include "param.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "x86.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NSYSSTAT (SYSCALL_AMT + 1)
+#define STATS_PER_PAGE (PGSIZE / sizeof(struct syscall_stat))
+#define STAT_PAGES ((NSYSSTAT + STATS_PER_PAGE - 1) / STATS_PER_PAGE)
+
+#define TRACE_RING_PAGES 8
+#define TRACE_PER_PAGE (PGSIZE / sizeof(struct trace_event))
+#define TRACE_RING_SIZE (TRACE_RING_PAGES * TRACE_PER_PAGE)
+
+struct trace_cpu {
+	struct syscall_stat *stats[STAT_PAGES];
+	struct trace_event *events[TRACE_RING_PAGES];
+	_Atomic size_t head; // Events written; only the CPU itself moves it.
+	_Atomic size_t tail; // Events read; only readers move it.
+	size_t dropped;
+};
+
+_Atomic uint32_t trace_mask;
+static struct trace_cpu trace_cpus[NCPU];
+// Serializes readers, and starting and stopping.
+static struct spinlock trace_lock;
+
+static struct syscall_stat *
+stat_slot(struct trace_cpu *t, size_t num)
+{
+	return &t->stats[num / STATS_PER_PAGE][num % STATS_PER_PAGE];
+}
+
+static struct trace_event *
+event_slot(struct trace_cpu *t, size_t i)
+{
+	i %= TRACE_RING_SIZE;
+	return &t->events[i / TRACE_PER_PAGE][i % TRACE_PER_PAGE];
+}
+
+void
+trace_syscall(size_t num, uint64_t cycles)
+{
+	size_t bucket = cycles == 0 ? 0 : 63 - __builtin_clzll(cycles);
+
+	if (bucket >= SYSSTAT_BUCKETS) {
+		bucket = SYSSTAT_BUCKETS - 1;
+	}
+	// The process can move to another CPU at any time before this.
+	// It only has to stay put while it touches this CPU's counters.
+	pushcli();
+	struct syscall_stat *s = stat_slot(&trace_cpus[my_cpu_id()], num);
+	s->count++;
+	s->cycles += cycles;
+	if (cycles > s->max) {
+		s->max = cycles;
+	}
+	s->hist[bucket]++;
+	popcli();
+}
+
+void
+trace_record(uint16_t type, uint64_t arg0, uint64_t arg1)
+{
+	uint64_t tsc = rdtsc();
+
+	pushcli();
+	struct trace_cpu *t = &trace_cpus[my_cpu_id()];
+	size_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&t->tail, memory_order_acquire) >=
+	    TRACE_RING_SIZE) {
+		t->dropped++;
+		popcli();
+		return;
+	}
+	struct trace_event *e = event_slot(t, head);
+	struct proc *p = mycpu()->proc;
+	e->tsc = tsc;
+	e->type = type;
+	e->cpu = my_cpu_id();
+	e->pid = p != NULL ? p->pid : 0;
+	e->arg0 = arg0;
+	e->arg1 = arg1;
+	atomic_store_explicit(&t->head, head + 1, memory_order_release);
+	popcli();
+}
+
+int
+trace_start(uint32_t mask)
+{
+	int ret = 0;
+
+	if (mask == 0) {
+		return -EINVAL;
+	}
+	// Measure it now, while nothing is held.
+	tsc_khz();
+	acquire(&trace_lock);
+	if (atomic_load(&trace_mask) != 0) {
+		ret = -EBUSY;
+		goto out;
+	}
+	// The pages are kept once made: a CPU that saw the mask just
+	// before it was cleared may still be writing to them.
+	for (int cpu = 0; cpu < ncpu; cpu++) {
+		struct trace_cpu *t = &trace_cpus[cpu];
+		for (int i = 0; i < STAT_PAGES; i++) {
+			if (t->stats[i] == NULL &&
+			    (t->stats[i] = (struct syscall_stat *)kpage_alloc()) == NULL) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			memset(t->stats[i], 0, PGSIZE);
+		}
+		for (int i = 0; i < TRACE_RING_PAGES; i++) {
+			if (t->events[i] == NULL &&
+			    (t->events[i] = (struct trace_event *)kpage_alloc()) == NULL) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+		atomic_store(&t->tail, atomic_load(&t->head));
+		t->dropped = 0;
+	}
+	atomic_store_explicit(&trace_mask, mask, memory_order_release);
+out:
+	release(&trace_lock);
+	return ret;
+}
+
+int
+trace_stop(void)
+{
+	acquire(&trace_lock);
+	atomic_store(&trace_mask, 0);
+	release(&trace_lock);
+	return 0;
+}
+
+int
+trace_info(struct trace_info *info)
+{
+	info->tsc_khz = tsc_khz();
+	info->tsc = rdtsc();
+	info->mask = atomic_load(&trace_mask);
+	info->nsyscalls = NSYSSTAT;
+	info->dropped = 0;
+	for (int cpu = 0; cpu < ncpu; cpu++) {
+		info->dropped += trace_cpus[cpu].dropped;
+	}
+	return 0;
+}
+
+// Minor 0, /dev/trace: hand out whole events, a CPU at a time.
+static ssize_t
+trace_read_events(char *buf, size_t n)
+{
+	size_t done = 0;
+
+	acquire(&trace_lock);
+	for (int cpu = 0; cpu < ncpu; cpu++) {
+		struct trace_cpu *t = &trace_cpus[cpu];
+		if (t->events[0] == NULL) {
+			continue;
+		}
+		size_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+		while (tail != head && n - done >= sizeof(struct trace_event)) {
+			memcpy(buf + done, event_slot(t, tail++), sizeof(struct trace_event));
+			done += sizeof(struct trace_event);
+		}
+		atomic_store_explicit(&t->tail, tail, memory_order_release);
+	}
+	release(&trace_lock);
+	return done;
+}
+
+// Minor 1, /dev/sysstat: an array of struct syscall_stat indexed by
+// system call number, added up over the CPUs as it is read.
+static ssize_t
+trace_read_stats(char *buf, off_t off, size_t n)
+{
+	struct syscall_stat sum;
+	size_t done = 0;
+
+	if (off < 0) {
+		return -EINVAL;
+	}
+	acquire(&trace_lock);
+	while (done < n && off < NSYSSTAT * sizeof(sum)) {
+		size_t num = off / sizeof(sum);
+		size_t from = off % sizeof(sum);
+		size_t len = sizeof(sum) - from;
+		if (len > n - done) {
+			len = n - done;
+		}
+		memset(&sum, 0, sizeof(sum));
+		for (int cpu = 0; cpu < ncpu; cpu++) {
+			struct trace_cpu *t = &trace_cpus[cpu];
+			if (t->stats[0] == NULL) {
+				continue;
+			}
+			struct syscall_stat *s = stat_slot(t, num);
+			sum.count += s->count;
+			sum.cycles += s->cycles;
+			if (s->max > sum.max) {
+				sum.max = s->max;
+			}
+			for (int i = 0; i < SYSSTAT_BUCKETS; i++) {
+				sum.hist[i] += s->hist[i];
+			}
+		}
+		memcpy(buf + done, (char *)&sum + from, len);
+		done += len;
+		off += len;
+	}
+	release(&trace_lock);
+	return done;
+}
+
+static ssize_t
+trace_read(short minor, struct inode *ip, char *buf, off_t off, size_t n)
+{
+	switch (minor) {
+	case 0:
+		return trace_read_events(buf, n);
+	case 1:
+		return trace_read_stats(buf, off, n);
+	default:
+		return -ENODEV;
+	}
+}
+
+static ssize_t
+trace_write(short minor, struct inode *ip, char *buf, size_t n)
+{
+	return -EINVAL;
+}
+
+static struct mmap_info
+trace_mmap(short minor, size_t length, uintptr_t addr, int perm)
+{
+	return (struct mmap_info){};
+}
+
+static int
+trace_open(short minor, int flags)
+{
+	return 0;
+}
+
+static int
+trace_close(short minor)
+{
+	return 0;
+}
+
+void
+dev_trace_init(void)
+{
+	initlock(&trace_lock, "trace");
+	devsw[DEV_TRACE].read = trace_read;
+	devsw[DEV_TRACE].write = trace_write;
+	devsw[DEV_TRACE].mmap = trace_mmap;
+	devsw[DEV_TRACE].open = trace_open;
+	devsw[DEV_TRACE].close = trace_close;
+}
@@ -1,22 +1,68 @@
 #include "disk.h"
 #include "config.h"
 
-#if defined(CONFIG_IDE)
+#include "ahci.h"
+#include "console.h"
 #include "ide.h"
-#elif defined(CONFIG_SATA)
-#include "sata.h"
-#else
+#include "param.h"
 #include "ramfs.h"
-#endif
+
+dev_t rootdev;
 
 void
 disk_init(void)
 {
+	// A RAM disk is there whenever the boot loader loaded one.
+	bool ramdisk = ramfs_disk_init() == 0;
+
 #if defined(CONFIG_IDE)
 	ide_disk_init();
+	rootdev = ROOTDEV;
 #elif defined(CONFIG_SATA)
-	sata_disk_init();
+	// ahci_init() finds the drive during pci_init().
+	rootdev = SATADEV;
 #else
-	ramfs_disk_init();
+	if (!ramdisk) {
+		panic("disk_init: no file system image was loaded");
+	}
+	rootdev = RAMDEV;
 #endif
 }
+
+// Is there a disk behind dev?
+bool
+disk_present(dev_t dev)
+{
+	switch (dev) {
+	case 0:
+	case 1:
+		return ide_present(dev);
+	case SATADEV:
+		return ahci_present();
+	case RAMDEV:
+		return ramfs_present();
+	default:
+		return false;
+	}
+}
+
+// Sync buf with the disk it belongs to. Each disk has its own
+// driver and queue, so I/O to one does not wait for another.
+void
+disk_rw(struct block_buffer *b)
+{
+	switch (b->dev) {
+	case 0:
+	case 1:
+		iderw(b);
+		break;
+	case SATADEV:
+		ahci_rw(b);
+		break;
+	case RAMDEV:
+		ramfs_rw(b);
+		break;
+	default:
+		panic("disk_rw: no disk %lu", b->dev);
+	}
+}
@@ -0,0 +1,351 @@
+//
+// epoll: a persistent set of watched descriptors.
+//
+// Each item stays queued on its object's pollhead for as long as it is
+// in the set, and the wakeup callback moves it onto a ready list. So
+// epoll_wait() only looks at items that changed, instead of polling
+// every descriptor like poll() does.
+//
+
+#include "file.h"
+#include "kalloc.h"
+#include "kernel_poll.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "spinlock.h"
+#include "trap.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define EP_HASH_SIZE 64
+// Event bits that describe readiness, as opposed to EPOLLET/EPOLLONESHOT.
+#define EP_EVENT_MASK (~(EPOLLET | EPOLLONESHOT))
+
+struct epitem {
+	struct pollwaiter w; // Must come first.
+	struct eventpoll *ep;
+	struct file *file; // We hold a reference.
+	int fd;
+	struct epoll_event event;
+	bool ready; // On the ready list, or being looked at by epoll_wait().
+	bool pending; // Woken up since epoll_wait() took it off the ready list.
+	bool requeue;
+	struct epitem *hash_next;
+	struct epitem *ready_next;
+};
+
+struct eventpoll {
+	// Serializes epoll_ctl() against epoll_wait() going through the
+	// ready list, so that items cannot vanish under it.
+	struct sleeplock mtx;
+	// Protects the ready list and the items' ready/pending flags.
+	// Taken from wakeup callbacks.
+	struct spinlock lock;
+	struct epitem *ready_first;
+	struct epitem *ready_last;
+	int waiters;
+	struct pollhead pollhead; // For poll() on the epoll descriptor itself.
+	struct epitem *hash[EP_HASH_SIZE];
+};
+
+static void
+ep_ready_append(struct eventpoll *ep, struct epitem *it)
+{
+	it->ready_next = NULL;
+	if (ep->ready_last != NULL) {
+		ep->ready_last->ready_next = it;
+	} else {
+		ep->ready_first = it;
+	}
+	ep->ready_last = it;
+}
+
+// Mark it ready and wake up epoll_wait(). ep->lock must be held.
+static void
+ep_make_ready(struct eventpoll *ep, struct epitem *it)
+{
+	if (it->ready) {
+		it->pending = true;
+		return;
+	}
+	it->ready = true;
+	ep_ready_append(ep, it);
+	if (ep->waiters != 0) {
+		wakeup(ep);
+	}
+	pollwake(&ep->pollhead, POLLIN);
+}
+
+static void
+ep_wake_func(struct pollwaiter *w, int events)
+{
+	struct epitem *it = (struct epitem *)w;
+	struct eventpoll *ep = it->ep;
+
+	acquire(&ep->lock);
+	// Disabled by EPOLLONESHOT, or not interested in what happened.
+	if ((it->event.events & EP_EVENT_MASK) != 0 &&
+	    (events == 0 ||
+	     (events & (it->event.events | POLLERR | POLLHUP)) != 0)) {
+		ep_make_ready(ep, it);
+	}
+	release(&ep->lock);
+}
+
+static struct epitem **
+ep_find(struct eventpoll *ep, int fd, struct file *f)
+{
+	struct epitem **pp = &ep->hash[(unsigned int)fd % EP_HASH_SIZE];
+	for (; *pp != NULL; pp = &(*pp)->hash_next) {
+		if ((*pp)->fd == fd && (*pp)->file == f) {
+			break;
+		}
+	}
+	return pp;
+}
+
+// Check whether the item is ready right now, and if so queue it.
+static void
+ep_check(struct eventpoll *ep, struct epitem *it, struct pollwaiter *w)
+{
+	int mask = vfs_poll(it->file, w);
+	acquire(&ep->lock);
+	if ((mask & (it->event.events | POLLERR | POLLHUP)) != 0 &&
+	    (it->event.events & EP_EVENT_MASK) != 0) {
+		ep_make_ready(ep, it);
+	}
+	release(&ep->lock);
+}
+
+struct file *
+epoll_create(int flags)
+{
+	struct eventpoll *ep;
+	struct file *f;
+
+	if ((ep = kmalloc(sizeof(*ep))) == NULL) {
+		return NULL;
+	}
+	memset(ep, 0, sizeof(*ep));
+	initsleeplock(&ep->mtx, "epoll");
+	initlock(&ep->lock, "epoll");
+	pollhead_init(&ep->pollhead);
+
+	if ((f = filealloc()) == NULL) {
+		kfree(ep);
+		return NULL;
+	}
+	f->type = FD_EPOLL;
+	f->flags = flags;
+	f->readable = 0;
+	f->writable = 0;
+	f->pipe = NULL;
+	f->ip = NULL;
+	f->ep = ep;
+	f->off = 0;
+	return f;
+}
+
+int
+epoll_ctl(struct file *epf, int op, int fd, struct epoll_event *event)
+{
+	struct eventpoll *ep = epf->ep;
+	struct file *f = fd_to_struct_file(fd);
+	int ret = 0;
+
+	if (f == NULL) {
+		return -EBADF;
+	}
+	// Nesting epoll sets could create wakeup cycles.
+	if (f->type == FD_EPOLL) {
+		return -EINVAL;
+	}
+
+	acquiresleep(&ep->mtx);
+	struct epitem **pp = ep_find(ep, fd, f);
+	struct epitem *it = *pp;
+
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (it != NULL) {
+			ret = -EEXIST;
+			break;
+		}
+		if ((it = kmalloc(sizeof(*it))) == NULL) {
+			ret = -ENOMEM;
+			break;
+		}
+		memset(it, 0, sizeof(*it));
+		it->w.func = ep_wake_func;
+		it->ep = ep;
+		it->file = filedup(f, f->flags);
+		it->fd = fd;
+		it->event = *event;
+		*pp = it;
+		ep_check(ep, it, &it->w);
+		break;
+	case EPOLL_CTL_MOD:
+		if (it == NULL) {
+			ret = -ENOENT;
+			break;
+		}
+		acquire(&ep->lock);
+		it->event = *event;
+		release(&ep->lock);
+		ep_check(ep, it, NULL);
+		break;
+	case EPOLL_CTL_DEL:
+		if (it == NULL) {
+			ret = -ENOENT;
+			break;
+		}
+		pollwaiter_remove(&it->w);
+		*pp = it->hash_next;
+		acquire(&ep->lock);
+		if (it->ready) {
+			struct epitem *prev = NULL;
+			for (struct epitem *r = ep->ready_first; r != it; r = r->ready_next) {
+				prev = r;
+			}
+			if (prev != NULL) {
+				prev->ready_next = it->ready_next;
+			} else {
+				ep->ready_first = it->ready_next;
+			}
+			if (ep->ready_last == it) {
+				ep->ready_last = prev;
+			}
+		}
+		release(&ep->lock);
+		(void)vfs_close(it->file);
+		kfree(it);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	releasesleep(&ep->mtx);
+	return ret;
+}
+
+// Go through the ready list once, copying out up to maxevents events.
+static int
+ep_collect(struct eventpoll *ep, struct epoll_event *events, int maxevents)
+{
+	struct epitem *list;
+	int n = 0;
+
+	acquiresleep(&ep->mtx);
+	acquire(&ep->lock);
+	list = ep->ready_first;
+	ep->ready_first = ep->ready_last = NULL;
+	for (struct epitem *it = list; it != NULL; it = it->ready_next) {
+		it->pending = false;
+	}
+	release(&ep->lock);
+
+	// The items stay marked ready while we look at them, so callbacks
+	// only set pending instead of queueing them a second time.
+	// Checking readiness takes the objects' locks, which rank above
+	// ep->lock, so this happens without it.
+	for (struct epitem *it = list; it != NULL; it = it->ready_next) {
+		it->requeue = true;
+		if (n == maxevents) {
+			continue;
+		}
+		int mask = vfs_poll(it->file, NULL) &
+		           (it->event.events | POLLERR | POLLHUP) & EP_EVENT_MASK;
+		if (mask == 0 || (it->event.events & EP_EVENT_MASK) == 0) {
+			it->requeue = false;
+			continue;
+		}
+		events[n].events = mask;
+		events[n].data = it->event.data;
+		n++;
+		if (it->event.events & EPOLLONESHOT) {
+			acquire(&ep->lock);
+			it->event.events &= ~EP_EVENT_MASK;
+			release(&ep->lock);
+			it->requeue = false;
+		} else if (it->event.events & EPOLLET) {
+			it->requeue = false;
+		}
+	}
+
+	acquire(&ep->lock);
+	struct epitem *next;
+	for (struct epitem *it = list; it != NULL; it = next) {
+		next = it->ready_next;
+		if (it->requeue || it->pending) {
+			ep_ready_append(ep, it);
+		} else {
+			it->ready = false;
+		}
+	}
+	release(&ep->lock);
+	releasesleep(&ep->mtx);
+	return n;
+}
+
+int
+epoll_wait(struct file *epf, struct epoll_event *events, int maxevents,
+           long timeout_ms)
+{
+	struct eventpoll *ep = epf->ep;
+	time_t deadline = timeout_ms > 0 ? ticks + timeout_ms : 0;
+	int n;
+
+	for (;;) {
+		if ((n = ep_collect(ep, events, maxevents)) != 0 || timeout_ms == 0) {
+			return n;
+		}
+		if (deadline != 0 && ticks >= deadline) {
+			return 0;
+		}
+		acquire(&ep->lock);
+		ep->waiters++;
+		while (ep->ready_first == NULL && !myproc()->killed &&
+		       (deadline == 0 || ticks < deadline)) {
+			sleep_until(ep, &ep->lock, deadline);
+		}
+		ep->waiters--;
+		release(&ep->lock);
+		if (myproc()->killed) {
+			return -EINTR;
+		}
+	}
+}
+
+int
+epoll_poll(struct eventpoll *ep, struct pollwaiter *w)
+{
+	int mask = 0;
+
+	acquire(&ep->lock);
+	if (w != NULL) {
+		pollwaiter_add(&ep->pollhead, w);
+	}
+	if (ep->ready_first != NULL) {
+		mask |= POLLIN | POLLRDNORM;
+	}
+	release(&ep->lock);
+	return mask;
+}
+
+// Called when the last reference to the epoll descriptor goes away.
+void
+epoll_close(struct eventpoll *ep)
+{
+	for (int i = 0; i < EP_HASH_SIZE; i++) {
+		struct epitem *next;
+		for (struct epitem *it = ep->hash[i]; it != NULL; it = next) {
+			next = it->hash_next;
+			pollwaiter_remove(&it->w);
+			(void)vfs_close(it->file);
+			kfree(it);
+		}
+	}
+	kfree(ep);
+}
@@ -7,6 +7,7 @@
 #include "param.h"
 #include "proc.h"
 #include "vm.h"
+#include "vma.h"
 #include "x86.h"
 #include <bits/fcntl_constants.h>
 #include <elf.h>
@@ -235,10 +236,25 @@ ok:
 	}
 	__safestrcpy(curproc->name, last, sizeof(curproc->name));
 
+	// Other threads would be left running on the old image.
+	if ((return_errno = kill_other_threads()) < 0) {
+		goto bad;
+	}
+	// Somebody else may still share the old address space (see
+	// CLONE_VM), and then we need a fresh one.
+	struct mm *oldmm = curproc->mm;
+	struct mm *mm = oldmm;
+	if (oldmm->ref > 1 && (mm = mm_alloc()) == NULL) {
+		return_errno = -ENOMEM;
+		goto bad;
+	}
+
 	// Commit to the user image.
-	oldpgdir = curproc->pgdir;
-	curproc->pgdir = pgdir;
-	curproc->sz = sz;
+	oldpgdir = mm->pgdir;
+	mm->pgdir = pgdir;
+	mm->sz = sz;
+	curproc->mm = mm;
+	curproc->fs_base = 0;
 	curproc->tf->rip = elf.e_entry; // main
 
 	// FIXME does this corrupt the stack?
@@ -247,8 +263,10 @@ ok:
 	// The "-8" is needed for alignment to 16 bytes.
 	// Without it, we are only aligned to 8 bytes.
 	curproc->tf->rsp = ROUND_UP(sp, 16) - 8;
-	memset(curproc->mmap_info, 0, sizeof(curproc->mmap_info));
-	curproc->mmap_count = 0;
+	// The old mappings go away with the old image.
+	if (mm == oldmm) {
+		mm_unmap_all(mm, oldpgdir);
+	}
 
 	// If parent is NULL, it's also possible we are init.
 	// TODO this needs to be a copy, not a reference
@@ -257,15 +275,23 @@ ok:
 	}
 
 	// Only close files if we were passed O_CLOEXEC.
+	struct file **ofile = curproc->files->ofile;
 	for (int i = 0; i < OPEN_MAX; i++) {
-		if (curproc->ofile[i] != NULL && curproc->ofile[i]->ref > 0 &&
-		    curproc->ofile[i]->flags == O_CLOEXEC) {
-			(void)vfs_close(curproc->ofile[i]);
+		if (ofile[i] != NULL && ofile[i]->ref > 0 &&
+		    ofile[i]->flags == O_CLOEXEC) {
+			(void)vfs_close(ofile[i]);
+			ofile[i] = NULL;
 		}
 	}
 
 	switchuvm(curproc);
-	freevm(oldpgdir);
+	if (mm != oldmm) {
+		mm_put(oldmm);
+	} else {
+		freevm(oldpgdir);
+	}
+	// A vfork() parent can have its memory back.
+	vfork_done(curproc);
 	return 0;
 
 bad:
@@ -5,10 +5,15 @@
 #include "file.h"
 #include "console.h"
 #include "fs.h"
+#include "kalloc.h"
 #include "kernel_assert.h"
+#include "kernel_poll.h"
 #include "lib/ring_buffer.h"
 #include "limits.h"
 #include "log.h"
+#include "macros.h"
+#include "mmu.h"
+#include "mount.h"
 #include "param.h"
 #include "pipe.h"
 #include "proc.h"
@@ -37,13 +42,14 @@ fd_to_struct_file(int fd)
 	if (fd < 0 || fd >= OPEN_MAX) {
 		return NULL;
 	}
-	return myproc()->ofile[fd];
+	return myproc()->files->ofile[fd];
 }
 
 void
 fileinit(void)
 {
 	initlock(&file_table.lock, "ftable");
+	lockstat_register(&file_table.lock);
 }
 
 // Allocate a file structure.
@@ -89,8 +95,8 @@ fdalloc(struct file *f)
 	struct proc *curproc = myproc();
 
 	for (int fd = 0; fd < OPEN_MAX; fd++) {
-		if (curproc->ofile[fd] == NULL) {
-			curproc->ofile[fd] = f;
+		if (curproc->files->ofile[fd] == NULL) {
+			curproc->files->ofile[fd] = f;
 			return fd;
 		}
 	}
@@ -104,11 +110,11 @@ fdalloc2(struct file *f, int fd)
 {
 	struct proc *curproc = myproc();
 
-	if (curproc->ofile[fd] != NULL) {
-		PROPOGATE_ERR(vfs_close(curproc->ofile[fd]));
+	if (curproc->files->ofile[fd] != NULL) {
+		PROPOGATE_ERR(vfs_close(curproc->files->ofile[fd]));
 	}
 
-	curproc->ofile[fd] = f;
+	curproc->files->ofile[fd] = f;
 	return fd;
 }
 
@@ -202,8 +208,10 @@ vfs_locked_inode_create(int dirfd, char *path, mode_t mode, dev_t dev)
 		return NULL;
 	}
 
+	// The tmpfs can run out of inodes.
 	if ((ip = inode_alloc(dp->dev, mode)) == NULL) {
-		panic("create: inode_alloc");
+		inode_unlockput(dp);
+		return NULL;
 	}
 
 	inode_lock(ip);
@@ -420,19 +428,20 @@ vfs_openat(int dirfd, char *path, int flags, mode_t mode)
 	// That is why it is released down here.
 get_fd:
 
-	if ((f = filealloc()) == NULL || (fd = fdalloc(f)) < 0) {
-		// Fileclose returns int but
-		// we ignore it because we error out regardless.
-		if (f) {
-			(void)vfs_close(f);
-		}
+	if ((f = filealloc()) == NULL) {
 		inode_unlockput(ip);
 		end_op();
 		return -EMFILE;
 	}
+	bool trunc = (flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY &&
+	             S_ISREG(ip->mode);
 	// Don't put because we keep the reference in f->ip.
 	inode_unlock(ip);
 	end_op();
+	// That may take more than one transaction.
+	if (trunc) {
+		(void)inode_truncate(ip, 0);
+	}
 
 	// If this is a pipe, pipeopen() updates this value later.
 	f->type = FD_INODE;
@@ -442,6 +451,14 @@ get_fd:
 	              ((flags & O_ACCMODE) == O_RDWR);
 	f->writable = ((flags & O_ACCMODE) == O_WRONLY) ||
 	              ((flags & O_ACCMODE) == O_RDWR);
+	// Only publish f once it is fully set up: the truncate above can
+	// sleep, and another thread could use the fd in the meantime.
+	if ((fd = fdalloc(f)) < 0) {
+		// Fileclose returns int but
+		// we ignore it because we error out regardless.
+		(void)vfs_close(f);
+		return fd;
+	}
 	return fd;
 }
 // Close file f.  (Decrement ref count, close when reaches 0.)
@@ -458,7 +475,7 @@ vfs_close(struct file *f)
 		release(&file_table.lock);
 		return 0;
 	}
-	if (S_ISCHR(f->ip->mode)) {
+	if (f->type == FD_INODE && S_ISCHR(f->ip->mode)) {
 		if (f->ip->major < 0 || f->ip->major >= NDEV ||
 		    devsw[f->ip->major].close == NULL) {
 			release(&file_table.lock);
@@ -484,6 +501,8 @@ vfs_close(struct file *f)
 		begin_op();
 		inode_put(ff.ip);
 		end_op();
+	} else if (ff.type == FD_EPOLL) {
+		epoll_close(ff.ep);
 	}
 	return 0;
 }
@@ -493,7 +512,7 @@ int
 vfs_stat(struct file *f, struct stat *st)
 {
 	if (f->type == FD_INODE || f->type == FD_FIFO || f->type == FD_PIPE) {
-		inode_lock(f->ip);
+		inode_lock_shared(f->ip);
 		inode_stat(f->ip, st);
 		inode_unlock(f->ip);
 		return 0;
@@ -501,30 +520,68 @@ vfs_stat(struct file *f, struct stat *st)
 	return -ENOENT;
 }
 
-// Read from file f.
+// Read from file f into the iovecs, stopping at the first short
+// read. If pos is NULL, read at f->off and advance it; otherwise read
+// at *pos and leave f->off alone.
 ssize_t
-vfs_read(struct file *f, char *addr, size_t n)
+vfs_readv(struct file *f, const struct iovec *iov, int iovcnt, const off_t *pos)
 {
 	if (f->readable == 0) {
 		return -EINVAL;
 	}
 	if (f->type == FD_PIPE || f->type == FD_FIFO) {
-		return piperead(f->pipe, addr, n);
+		if (pos != NULL) {
+			return -ESPIPE;
+		}
+		return pipereadv(f->pipe, iov, iovcnt);
 	} else if (f->type == FD_INODE) {
-		inode_lock(f->ip);
-		ssize_t r;
-		if ((r = inode_read(f->ip, addr, f->off, n)) > 0) {
+		// Device drivers may drop and retake the inode lock, and
+		// expect to serialize their readers, so only files and
+		// directories are read under the shared lock. Readers of
+		// f->off need the exclusive one too, or two of them sharing
+		// f could read from the same offset.
+		bool shared = pos != NULL && !S_ISCHR(f->ip->mode);
+		if (shared) {
+			inode_lock_shared(f->ip);
+		} else {
+			inode_lock(f->ip);
+		}
+		off_t off = pos != NULL ? *pos : f->off;
+		ssize_t total = 0;
+		for (int i = 0; i < iovcnt; i++) {
+			ssize_t r = inode_read(f->ip, iov[i].iov_base, off, iov[i].iov_len);
+			if (r < 0) {
+				if (total == 0) {
+					total = r;
+				}
+				break;
+			}
+			total += r;
+			off += r;
+			if ((size_t)r < iov[i].iov_len) {
+				break;
+			}
+		}
+		if (pos == NULL && total > 0) {
 			// We have read this many bytes, so
 			// increase the offset.
-			f->off += r;
+			f->off = off;
 		}
 		inode_unlock(f->ip);
 
-		return r;
+		return total;
 	}
 	panic("fileread");
 }
 
+// Read from file f.
+ssize_t
+vfs_read(struct file *f, char *addr, size_t n)
+{
+	return vfs_readv(f, &(const struct iovec){ addr, n }, 1, NULL);
+}
+
+// Move f's offset and return the new one.
 off_t
 fileseek(struct file *f, off_t n, int whence)
 {
@@ -534,68 +591,145 @@ fileseek(struct file *f, off_t n, int whence)
 	} else if (whence == SEEK_SET) {
 		offset = n;
 	} else if (whence == SEEK_END) {
-		// Not sure if this is right.
-		offset = f->ip->size;
+		offset = f->ip->size + n;
 	} else {
 		return -EINVAL;
 	}
+	if (offset < 0) {
+		return -EINVAL;
+	}
 	f->off = offset;
-	return 0;
+	return offset;
 }
 
-// Write to file f.
+// Write the iovecs to file f. pos works like in vfs_readv().
 ssize_t
-vfs_write(struct file *f, char *addr, size_t n)
+vfs_writev(struct file *f, const struct iovec *iov, int iovcnt,
+           const off_t *pos)
 {
 	if (f->writable == 0) {
 		return -EROFS;
 	}
 	if (f->type == FD_PIPE || f->type == FD_FIFO) {
-		return pipewrite(f->pipe, addr, n);
+		if (pos != NULL) {
+			return -ESPIPE;
+		}
+		return pipewritev(f->pipe, iov, iovcnt);
 	}
 	if (f->type == FD_INODE) {
 		// write a few blocks at a time to avoid exceeding
-		// the maximum log transaction size, including
-		// i-node, indirect block, allocation blocks,
-		// and 2 blocks of slop for non-aligned writes.
+		// the maximum log transaction size; see MAXOPBYTES.
 		// this really belongs lower down, since inode_write()
 		// might be writing a device like the console.
-		size_t max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512;
-		size_t i = 0;
-		while (i < n) {
-			size_t n1 = n - i;
-			if (n1 > max) {
-				n1 = max;
-			}
-
+		// The iovecs land back to back in the file, so as many of
+		// them as fit in that budget share one transaction.
+		const size_t max = MAXOPBYTES;
+		ssize_t total = 0;
+		ssize_t r = 0;
+		size_t done = 0; // Bytes of iov[i] already written.
+		int i = 0;
+		while (i < iovcnt && r >= 0) {
 			// begin_op()/end_op() is here because
 			// we only need to setup the log
 			// in the event of a write.
 			begin_op();
 			inode_lock(f->ip);
-			ssize_t r;
-			if ((r = inode_write(f->ip, addr + i, f->off, n1))) {
-				f->off += r;
+			off_t off = pos != NULL ? *pos + total : f->off;
+			size_t budget = max;
+			while (i < iovcnt && budget > 0) {
+				size_t n1 = min(iov[i].iov_len - done, budget);
+				if (n1 > 0) {
+					r = inode_write(f->ip, (char *)iov[i].iov_base + done, off, n1);
+					if (r < 0) {
+						break;
+					}
+					if (r != n1) {
+						panic("short filewrite: r=%ld, n1=%lu\n", r, n1);
+					}
+					off += r;
+					total += r;
+					budget -= r;
+					done += r;
+				}
+				if (done == iov[i].iov_len) {
+					i++;
+					done = 0;
+				}
+			}
+			if (pos == NULL) {
+				f->off = off;
 			}
 			inode_unlock(f->ip);
 			end_op();
-
-			if (r < 0) {
-				break;
-			}
-
-			if (r != n1) {
-				panic("short filewrite: r=%ld, n1=%lu\n", r, n1);
-			}
-			i += r;
 		}
 		// Short writes are acceptable and may happen
 		// for various reasons according to the standard.
-		return (ssize_t)i;
+		if (total == 0 && r < 0) {
+			return r;
+		}
+		return total;
 	}
 	panic("filewrite");
 }
 
+// Write to file f.
+ssize_t
+vfs_write(struct file *f, char *addr, size_t n)
+{
+	return vfs_writev(f, &(const struct iovec){ addr, n }, 1, NULL);
+}
+
+// Move up to len bytes from in to out without a round trip through
+// user memory. in_off and out_off work like pos in vfs_readv(), and are
+// advanced past the bytes moved. Data goes through one kernel page at a
+// time. The transfer stops early at end of file, once a pipe has been
+// drained, or if the process is killed.
+ssize_t
+vfs_splice(struct file *in, off_t *in_off, struct file *out, off_t *out_off,
+           size_t len)
+{
+	char *buf;
+	ssize_t total = 0;
+	ssize_t r = 0;
+
+	if (in->readable == 0 || out->writable == 0) {
+		return -EBADF;
+	}
+	if ((in->type != FD_INODE && in->type != FD_PIPE && in->type != FD_FIFO) ||
+	    (out->type != FD_INODE && out->type != FD_PIPE &&
+	     out->type != FD_FIFO)) {
+		return -EINVAL;
+	}
+	if ((buf = kpage_alloc()) == NULL) {
+		return -ENOMEM;
+	}
+
+	while ((size_t)total < len && !myproc()->killed) {
+		size_t n = min(len - total, PGSIZE);
+		if ((r = vfs_readv(in, &(const struct iovec){ buf, n }, 1, in_off)) <= 0) {
+			break;
+		}
+		if (in_off != NULL) {
+			*in_off += r;
+		}
+		ssize_t w = vfs_writev(out, &(const struct iovec){ buf, r }, 1, out_off);
+		if (w < 0) {
+			r = w;
+			break;
+		}
+		if (out_off != NULL) {
+			*out_off += w;
+		}
+		total += w;
+		// Don't block a second time on a pipe, and stop at EOF.
+		if (w < r || (size_t)r < n || in->type != FD_INODE) {
+			break;
+		}
+	}
+	kpage_free(buf);
+	return total > 0 ? total : r;
+}
+
 static int
 name_of_inode(struct inode *ip, struct inode *parent, char buf[static DIRSIZ],
               size_t n)
@@ -623,7 +757,7 @@ inode_to_path(char *buf, size_t n, struct inode *ip)
 		struct inode *tmp_ip = namei("/");
 		kernel_assert(tmp_ip != NULL);
 		// Inode number does not need to be protected by a lock.
-		isroot = ip->inum == tmp_ip->inum;
+		isroot = ip->dev == tmp_ip->dev && ip->inum == tmp_ip->inum;
 		inode_put(tmp_ip);
 	}
 	inode_lock(ip);
@@ -635,6 +769,15 @@ inode_to_path(char *buf, size_t n, struct inode *ip)
 		buf[1] = '\0';
 		return buf;
 	} else if (isdir) {
+		// The root of a mounted file system goes by the name of what
+		// it is mounted on.
+		struct inode *covered = mount_cross_up(inode_dup(ip));
+		if (covered != ip) {
+			char *s = inode_to_path(buf, n, covered);
+			inode_put(covered);
+			return s;
+		}
+		inode_put(covered);
 		inode_lock(ip);
 		parent = dirlookup(ip, "..", NULL);
 		inode_unlock(ip);
@@ -14,15 +14,20 @@
 #include "bio.h"
 #include "buf.h"
 #include "console.h"
+#include "disk.h"
 #include "file.h"
 #include "fs.h"
+#include "kalloc.h"
 #include "kernel_assert.h"
 #include "log.h"
 #include "macros.h"
+#include "mmu.h"
+#include "mount.h"
 #include "param.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "spinlock.h"
+#include "tmpfs.h"
 
 #include <dirent.h>
 #include <errno.h>
@@ -34,10 +39,10 @@
 #include <sys/sysmacros.h>
 #include <time.h>
 
-static void inode_truncate(struct inode *);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock global_sb;
+static void pcache_free(struct inode *);
+static void pcache_zero(struct inode *ip, off_t off, off_t end);
+// One per disk with a file system mounted, indexed by device.
+static struct superblock superblocks[NDISK];
 
 // Read the super block.
 void
@@ -50,49 +55,62 @@ read_superblock(dev_t dev, struct superblock *sb)
 	block_release(bp);
 }
 
-// Zero a block.
+// Zero a block. With direct, the zeroes go straight to the disk
+// rather than into the log (see block_alloc()).
 static void
-block_zero(dev_t dev, uint64_t bno)
+block_zero(dev_t dev, uint64_t bno, bool direct)
 {
 	struct block_buffer *bp;
 
 	bp = block_read(dev, bno);
 	memset(bp->data, 0, BSIZE);
-	log_write(bp);
+	if (direct) {
+		block_write(bp);
+	} else {
+		log_write(bp);
+	}
 	block_release(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, or return 0 if the disk is full.
+// Zeroes that are about to be written over anyway are best logged,
+// since the log absorbs them into the write; for a block that
+// nothing will write to, direct keeps them out of the log. That is
+// safe because nothing on disk points at the block until the
+// transaction that allocates it commits, and the commit flushes the
+// disk's cache first (see write_head()).
 static uintptr_t
-block_alloc(dev_t dev)
+block_alloc(dev_t dev, bool direct)
 {
 	size_t bi, m;
 	struct block_buffer *bp = NULL;
 
-	for (size_t b = 0; b < global_sb.size; b += BPB) {
-		bp = block_read(dev, BBLOCK(b, global_sb));
-		for (bi = 0; bi < BPB && b + bi < global_sb.size; bi++) {
+	const struct superblock *sb = &superblocks[dev];
+
+	for (size_t b = 0; b < sb->size; b += BPB) {
+		bp = block_read(dev, BBLOCK(b, *sb));
+		for (bi = 0; bi < BPB && b + bi < sb->size; bi++) {
 			m = 1 << (bi % 8);
 			if ((bp->data[bi / 8] & m) == 0) { // Is block free?
 				bp->data[bi / 8] |= m; // Mark block in use.
 				log_write(bp);
 				block_release(bp);
-				block_zero(dev, b + bi);
+				block_zero(dev, b + bi, direct);
 				return b + bi;
 			}
 		}
 		block_release(bp);
 	}
-	return -ENOSPC;
+	return 0;
 }
 
 // Free a disk block.
 static void
 block_free(dev_t dev, uint64_t b)
 {
-	struct block_buffer *bp = block_read(dev, BBLOCK(b, global_sb));
+	struct block_buffer *bp = block_read(dev, BBLOCK(b, superblocks[dev]));
 	const size_t bi = b % BPB;
 	const size_t m = 1 << (bi % 8);
 
@@ -112,7 +130,7 @@ block_free(dev_t dev, uint64_t b)
 // list of blocks holding the file's content.
 //
 // The inodes are laid out sequentially on disk at
-// global_sb.startinode. Each inode has a number, indicating its
+// sb.inodestart. Each inode has a number, indicating its
 // position on the disk.
 //
 // The kernel keeps a cache of in-use inodes in memory
@@ -182,27 +200,67 @@ static struct {
 	struct inode inode[NINODE];
 } inode_table;
 
+// Inodes that inode_put() found with no links and no other users,
+// for inode_reclaim() to free. Each keeps the last reference.
+static struct {
+	struct spinlock lock;
+	struct inode *inodes[NINODE];
+	size_t n;
+} reclaim;
+
 void
-inode_init(dev_t dev)
+inode_init(void)
 {
 	initlock(&inode_table.lock, "inode_cache");
+	lockstat_register(&inode_table.lock);
+	initlock(&reclaim.lock, "reclaim");
+	lockstat_register(&reclaim.lock);
 
 	for (size_t i = 0; i < NINODE; i++) {
-		initsleeplock(&inode_table.inode[i].lock, "inode");
+		initrwsleeplock(&inode_table.inode[i].lock, "inode");
 	}
+}
 
-	read_superblock(dev, &global_sb);
+// Read and check the superblock of the file system on dev, which
+// is about to be mounted. Returns -EINVAL if it is not RelixFS.
+int
+fs_mount(dev_t dev)
+{
+	struct superblock *sb = &superblocks[dev];
 
-	if (memcmp(global_sb.signature, "RELIXFS0", 8) == 0) {
-		cprintf("RelixFS found\n");
-		cprintf(
-			"superblock: size %lu nblocks %lu ninodes %lu nlog %lu logstart %lu "
-			"inodestart %lu bmap start %lu\n",
-			global_sb.size, global_sb.nblocks, global_sb.ninodes, global_sb.nlog,
-			global_sb.logstart, global_sb.inodestart, global_sb.bmapstart);
-	} else {
-		panic("Cannot find any recognized filesytem.");
+	read_superblock(dev, sb);
+	if (memcmp(sb->signature, "RELIXFS0", 8) != 0) {
+		return -EINVAL;
+	}
+	cprintf("RelixFS found on disk %lu\n", dev);
+	cprintf("superblock: size %lu nblocks %lu ninodes %lu nlog %lu logstart %lu "
+	        "inodestart %lu bmap start %lu\n",
+	        sb->size, sb->nblocks, sb->ninodes, sb->nlog, sb->logstart,
+	        sb->inodestart, sb->bmapstart);
+	return 0;
+}
+
+// The file system on dev is being unmounted: forget its inodes.
+// Returns -EBUSY, and forgets nothing, if any of them is in use.
+int
+inode_unmount(dev_t dev)
+{
+	struct inode *ip;
+
+	acquire(&inode_table.lock);
+	for (ip = inode_table.inode; ip < &inode_table.inode[NINODE]; ip++) {
+		if (ip->ref > 0 && ip->dev == dev) {
+			release(&inode_table.lock);
+			return -EBUSY;
+		}
+	}
+	for (ip = inode_table.inode; ip < &inode_table.inode[NINODE]; ip++) {
+		if (ip->dev == dev) {
+			ip->valid = 0;
+		}
 	}
+	release(&inode_table.lock);
+	return 0;
 }
 
 // Allocate an inode on device dev.
@@ -211,8 +269,12 @@ inode_init(dev_t dev)
 struct inode *
 inode_alloc(dev_t dev, mode_t mode)
 {
-	for (ino_t inum = 1; inum < global_sb.ninodes; inum++) {
-		struct block_buffer *bp = block_read(dev, IBLOCK(inum, global_sb));
+	if (dev == TMPFSDEV) {
+		return tmpfs_alloc(mode);
+	}
+	log_join(dev);
+	for (ino_t inum = 1; inum < superblocks[dev].ninodes; inum++) {
+		struct block_buffer *bp = block_read(dev, IBLOCK(inum, superblocks[dev]));
 		struct dinode *dip = (struct dinode *)bp->data + inum % IPB;
 
 		if (!S_ISANY(dip->mode)) { // a free inode
@@ -239,7 +301,12 @@ inode_alloc(dev_t dev, mode_t mode)
 void
 inode_update(struct inode *ip)
 {
-	struct block_buffer *bp = block_read(ip->dev, IBLOCK(ip->inum, global_sb));
+	if (tmpfs_inode(ip)) {
+		tmpfs_update(ip);
+		return;
+	}
+	struct block_buffer *bp =
+		block_read(ip->dev, IBLOCK(ip->inum, superblocks[ip->dev]));
 	struct dinode *dip = (struct dinode *)bp->data + ip->inum % IPB;
 
 	dip->major = ip->major;
@@ -254,6 +321,7 @@ inode_update(struct inode *ip)
 	memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
 	log_write(bp);
 	block_release(bp);
+	ip->tid = log_tid(ip->dev);
 }
 
 // Find the inode with number inum on device dev
@@ -289,6 +357,8 @@ inode_get(dev_t dev, ino_t inum)
 	ip->inum = inum;
 	ip->ref = 1;
 	ip->valid = 0;
+	// Whatever last changed it may not have committed yet.
+	ip->tid = ip->data_tid = log_tid(dev);
 	release(&inode_table.lock);
 
 	return ip;
@@ -305,7 +375,7 @@ inode_dup(struct inode *ip)
 	return ip;
 }
 
-// Lock the given inode.
+// Lock the given inode for writing.
 // Reads the inode from disk if necessary.
 void
 inode_lock(struct inode *ip) __acquires(&ip->lock)
@@ -315,12 +385,19 @@ inode_lock(struct inode *ip) __acquires(&ip->lock)
 	} else if (ip->ref < 1) {
 		panic("inode_lock: ip->ref < 1: %d", ip->ref);
 	}
-	kernel_assert(!holdingsleep(&ip->lock));
+	kernel_assert(!holdingrwsleep_write(&ip->lock));
 
-	acquiresleep(&ip->lock);
+	// Whatever is done with the inode from here may go in the log,
+	// so take part in it before holding anything it may wait for.
+	log_join(ip->dev);
+	acquirerwsleep_write(&ip->lock);
 
-	if (ip->valid == 0) {
-		struct block_buffer *bp = block_read(ip->dev, IBLOCK(ip->inum, global_sb));
+	if (ip->valid == 0 && tmpfs_inode(ip)) {
+		tmpfs_load(ip);
+		ip->valid = 1;
+	} else if (ip->valid == 0) {
+		struct block_buffer *bp =
+			block_read(ip->dev, IBLOCK(ip->inum, superblocks[ip->dev]));
 		struct dinode *dip = (struct dinode *)bp->data + ip->inum % IPB;
 		ip->major = dip->major;
 		ip->minor = dip->minor;
@@ -342,46 +419,68 @@ inode_lock(struct inode *ip) __acquires(&ip->lock)
 	}
 }
 
-// Unlock the given inode.
+// Lock the given inode for reading only. Other readers may hold
+// it at the same time.
+// Reads the inode from disk if necessary.
+void
+inode_lock_shared(struct inode *ip) __acquires(&ip->lock)
+{
+	if (ip == NULL) {
+		panic("inode_lock_shared: ip == NULL");
+	} else if (ip->ref < 1) {
+		panic("inode_lock_shared: ip->ref < 1: %d", ip->ref);
+	}
+
+	acquirerwsleep_read(&ip->lock);
+	if (ip->valid == 0) {
+		// Filling in the inode needs the exclusive side.
+		releaserwsleep_read(&ip->lock);
+		inode_lock(ip);
+		downgraderwsleep(&ip->lock);
+	}
+}
+
+// Unlock the given inode, whichever way it was locked.
 void
 inode_unlock(struct inode *ip) __releases(&ip->lock)
 {
 	if (ip == 0 || ip->ref < 1) {
 		panic("inode_unlock");
 	}
-	kernel_assert(holdingsleep(&ip->lock));
-
-	releasesleep(&ip->lock);
+	releaserwsleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
-// All calls to inode_put() must be inside a transaction in
-// case it has to free the inode.
+// to it, free the inode (and its content) on disk. A large file
+// takes many transactions to free, so that waits for the end of
+// the system call (see inode_reclaim()).
 void
 inode_put(struct inode *ip)
 {
 	acquire(&inode_table.lock);
 	if (ip->ref == 1 && ip->valid && ip->nlink == 0) {
-		// inode has no links and no other references: truncate and free.
-
-		// ip->ref == 1 means no other process can have ip locked,
-		// so this acquiresleep() won't block or deadlock.
-		acquiresleep(&ip->lock);
-
+		// inode has no links and no other references: hand it, and
+		// the reference, over to be freed.
 		release(&inode_table.lock);
 
-		inode_truncate(ip);
-		ip->mode = 0;
-		inode_update(ip);
-		ip->valid = 0;
-
-		releasesleep(&ip->lock);
-
-		acquire(&inode_table.lock);
+		acquire(&reclaim.lock);
+		reclaim.inodes[reclaim.n++] = ip;
+		release(&reclaim.lock);
+		if (myproc()->fsop_depth == 0) {
+			inode_reclaim();
+		}
+		return;
+	}
+	if (ip->ref == 1) {
+		// Nothing can have the file mapped any more. On the tmpfs,
+		// the pages are the file, so they stay.
+		if (tmpfs_inode(ip)) {
+			tmpfs_release(ip);
+		}
+		pcache_free(ip);
 	}
 	ip->ref--;
 	release(&inode_table.lock);
@@ -399,140 +498,176 @@ inode_unlockput(struct inode *ip) __releases(&ip->lock)
 //
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// are listed in ip->addrs[]. The rest hang off trees of
+// indirect blocks, each holding NINDIRECT block numbers:
+// ip->addrs[NDIRECT] is a singly indirect block, listing the
+// next NINDIRECT blocks, ip->addrs[NDIRECT + 1] a doubly and
+// ip->addrs[NDIRECT + 2] a triply indirect one.
+// A block number of 0 is a hole, which reads as zeroes.
+
+// How many blocks of the file a tree of levels indirect blocks maps.
+static uint64_t
+tree_span(int levels)
+{
+	uint64_t span = 1;
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+	while (levels-- > 0) {
+		span *= NINDIRECT;
+	}
+	return span;
+}
 
-// Caller must hold ip->lock.
-static uintptr_t
-bmap(struct inode *ip, uint64_t bn) __must_hold(&ip->lock)
+// The first block of the file that ip->addrs[slot] maps, and how
+// many levels of indirect blocks it is the top of.
+static uint64_t
+tree_base(size_t slot, int *levels)
 {
-	uintptr_t addr, *a;
-	struct block_buffer *bp;
-
-	kernel_assert(holdingsleep(&ip->lock));
-	if (bn < NDIRECT) {
-		if ((addr = ip->addrs[bn]) == 0) {
-			ip->addrs[bn] = addr = block_alloc(ip->dev);
-		}
-		return addr;
+	if (slot < NDIRECT) {
+		*levels = 0;
+		return slot;
+	}
+	uint64_t base = NDIRECT;
+	*levels = 1;
+	for (size_t i = NDIRECT; i < slot; i++) {
+		base += tree_span((*levels)++);
 	}
-	bn -= NDIRECT;
+	return base;
+}
 
-	if (bn < NINDIRECT) {
-		// Load indirect block, allocating if necessary.
-		if ((addr = ip->addrs[NDIRECT]) == 0) {
-			ip->addrs[NDIRECT] = addr = block_alloc(ip->dev);
-		}
-		bp = block_read(ip->dev, addr);
-		a = (uintptr_t *)bp->data;
-		if ((addr = a[bn]) == 0) {
-			a[bn] = addr = block_alloc(ip->dev);
-			log_write(bp);
+// What bmap() does about a block that is not there.
+enum bmap_how {
+	BMAP_LOOKUP, // Nothing: return 0 for the hole.
+	BMAP_WRITE, // Allocate it, for the caller to write to.
+	BMAP_ZERO, // Allocate it, zeroed on disk (see block_alloc()).
+};
+
+// Return the disk block address of the nth block in inode ip,
+// doing what how says if there is no such block. Returns 0 if it
+// is a hole, or if the disk is full.
+// Caller must hold ip->lock, exclusively unless how is BMAP_LOOKUP.
+static uintptr_t
+bmap(struct inode *ip, uint64_t bn, enum bmap_how how) __must_hold(&ip->lock)
+{
+	size_t slot;
+	int levels;
+	uint64_t base;
+
+	kernel_assert(holdingrwsleep(&ip->lock));
+	kernel_assert(how == BMAP_LOOKUP || holdingrwsleep_write(&ip->lock));
+	if (bn >= MAXFILE) {
+		panic("bmap: out of range");
+	}
+	for (slot = NADDRS - 1; (base = tree_base(slot, &levels)) > bn; slot--)
+		;
+	bn -= base;
+
+	uintptr_t addr = ip->addrs[slot];
+	if (addr == 0 && how != BMAP_LOOKUP) {
+		ip->addrs[slot] = addr =
+			block_alloc(ip->dev, levels == 0 && how == BMAP_ZERO);
+	}
+	for (; addr != 0 && levels > 0; levels--) {
+		uint64_t below = tree_span(levels - 1);
+		struct block_buffer *bp = block_read(ip->dev, addr);
+		uintptr_t *a = (uintptr_t *)bp->data;
+
+		if ((addr = a[bn / below]) == 0 && how != BMAP_LOOKUP) {
+			addr = block_alloc(ip->dev, levels == 1 && how == BMAP_ZERO);
+			if (addr != 0) {
+				a[bn / below] = addr;
+				log_write(bp);
+			}
 		}
 		block_release(bp);
-		return addr;
+		bn %= below;
 	}
-	bn -= NINDIRECT;
+	return addr;
+}
 
-	// if (bn >= NINDIRECT * NINDIRECT)
-	//	bn -= NINDIRECT * NINDIRECT;
-	if (bn < NINDIRECT * NINDIRECT) {
-		// Load indirect block, allocating if necessary.
-		if ((addr = ip->addrs[NDIRECT + 1]) == 0) {
-			ip->addrs[NDIRECT + 1] = addr = block_alloc(ip->dev);
-		}
-		bp = block_read(ip->dev, addr);
-		a = (uintptr_t *)bp->data;
-		uintptr_t double_index = bn / NINDIRECT;
+// Log blocks one step of freeing may need: a bitmap block, the
+// indirect blocks on the way down and the inode.
+#define FREE_STEP_BLOCKS (1 + 3 + 1)
 
-		if ((addr = a[double_index]) == 0) {
-			a[double_index] = addr = block_alloc(ip->dev);
-			log_write(bp);
+// Free the blocks of ip's file from from up to *to, last first, that
+// the tree under *addr maps: levels of indirect blocks, mapping the
+// blocks from base on. Indirect blocks left empty go too, and *addr
+// is cleared if the whole tree does. Stops when the log is full;
+// *to comes down as blocks are freed, so that nothing is left from
+// it on. Returns whether it got down to from.
+// Caller must hold ip->lock.
+static bool
+free_tree(struct inode *ip, uintptr_t *addr, int levels, uint64_t base,
+          uint64_t from, uint64_t *to) __must_hold(&ip->lock)
+{
+	uint64_t span = tree_span(levels);
+	uint64_t lo = max(from, base);
+	uint64_t top = *to;
+
+	if (base + span <= from || lo >= *to) {
+		return true;
+	}
+	if (*addr == 0) {
+		*to = lo;
+		return true;
+	}
+	if (levels == 0) {
+		if (!log_room(ip->dev, FREE_STEP_BLOCKS)) {
+			return false;
 		}
-		block_release(bp);
+		block_free(ip->dev, *addr);
+		*addr = 0;
+		*to = lo;
+		return true;
+	}
 
-		bp = block_read(ip->dev, addr);
-		a = (uintptr_t *)bp->data;
-		uintptr_t pos = bn % NINDIRECT;
+	struct block_buffer *bp = block_read(ip->dev, *addr);
+	uintptr_t *a = (uintptr_t *)bp->data;
+	uint64_t below = span / NINDIRECT;
+	bool done = true, changed = false, empty = true;
 
-		// load doubly indirect block
-		if ((addr = a[pos]) == 0) {
-			a[pos] = addr = block_alloc(ip->dev);
-			log_write(bp);
-		}
+	for (size_t i = NINDIRECT; done && i-- > 0;) {
+		uintptr_t was = a[i];
+		done = free_tree(ip, &a[i], levels - 1, base + i * below, from, to);
+		changed |= a[i] != was;
+	}
+	for (size_t i = 0; empty && i < NINDIRECT; i++) {
+		empty = a[i] == 0;
+	}
+	if (empty && log_room(ip->dev, FREE_STEP_BLOCKS)) {
 		block_release(bp);
-		return addr;
+		block_free(ip->dev, *addr);
+		*addr = 0;
+		return done;
 	}
-
-	panic("bmap: out of range");
+	if (empty) {
+		// Come back for the block itself.
+		*to = min(top, base + span);
+		done = false;
+	}
+	if (changed) {
+		log_write(bp);
+	}
+	block_release(bp);
+	return done;
 }
 
-// Truncate inode (discard contents).
-// Only called when the inode has no links
-// to it (no directory entries referring to it)
-// and has no in-memory reference to it (is
-// not an open file or current directory).
-static void
-inode_truncate(struct inode *ip)
+// Free ip's blocks from from up to *to, as far as one transaction
+// gets (see free_tree()). Returns whether it got down to from.
+// Caller must hold ip->lock, and updates the inode.
+static bool
+free_blocks(struct inode *ip, uint64_t from, uint64_t *to)
+	__must_hold(&ip->lock)
 {
-	struct block_buffer *bp;
-	uintptr_t *a;
+	kernel_assert(holdingrwsleep_write(&ip->lock));
+	for (size_t slot = NADDRS; slot-- > 0;) {
+		int levels;
+		uint64_t base = tree_base(slot, &levels);
 
-	for (int i = 0; i < NDIRECT; i++) {
-		if (ip->addrs[i]) {
-			block_free(ip->dev, ip->addrs[i]);
-			ip->addrs[i] = 0;
+		if (!free_tree(ip, &ip->addrs[slot], levels, base, from, to)) {
+			return false;
 		}
 	}
-
-	if (ip->addrs[NDIRECT]) {
-		bp = block_read(ip->dev, ip->addrs[NDIRECT]);
-		a = (uintptr_t *)bp->data;
-		for (size_t j = 0; j < NINDIRECT; j++) {
-			if (a[j]) {
-				block_free(ip->dev, a[j]);
-			} else {
-				// TODO: Is this a performance optimization?
-				// Or does it limit file deletion functionality?
-				break;
-			}
-		}
-		block_release(bp);
-		block_free(ip->dev, ip->addrs[NDIRECT]);
-		ip->addrs[NDIRECT] = 0;
-	}
-	if (ip->addrs[NDIRECT + 1]) {
-		// get doubly indirect block
-		bp = block_read(ip->dev, ip->addrs[NDIRECT + 1]);
-		a = (uintptr_t *)bp->data;
-		for (size_t i = 0; i < NINDIRECT; i++) {
-			// get indirect block
-			if (a[i]) {
-				struct block_buffer *bp2 = block_read(ip->dev, a[i]);
-				uintptr_t *a2 = (uintptr_t *)bp2->data;
-				for (size_t j = 0; j < NINDIRECT; j++) {
-					// free block
-					if (a2[j]) {
-						block_free(ip->dev, a2[j]);
-					} else {
-						break;
-					}
-				}
-				// free indirect block
-				block_release(bp2);
-				block_free(ip->dev, a[i]);
-			}
-		}
-		block_release(bp);
-		block_free(ip->dev, ip->addrs[NDIRECT + 1]);
-		ip->addrs[NDIRECT + 1] = 0;
-	}
-
-	ip->size = 0;
-	inode_update(ip);
+	return true;
 }
 
 // Copy stat information from inode.
@@ -540,9 +675,8 @@ inode_truncate(struct inode *ip)
 void
 inode_stat(struct inode *ip, struct stat *st) __must_hold(&ip->lock)
 {
-	kernel_assert(holdingsleep(&ip->lock));
-	// TODO: add this when we support multiple filesystems.
-	st->st_dev = 0;
+	kernel_assert(holdingrwsleep(&ip->lock));
+	st->st_dev = ip->dev;
 	st->st_rdev = makedev(ip->major, ip->minor);
 	st->st_ino = ip->inum;
 	st->st_nlink = ip->nlink;
@@ -563,7 +697,7 @@ ssize_t
 inode_read(struct inode *ip, char *dst, off_t off, size_t n)
 	__must_hold(&ip->lock)
 {
-	kernel_assert(holdingsleep(&ip->lock));
+	kernel_assert(holdingrwsleep(&ip->lock));
 	uint64_t m = 0;
 	struct block_buffer *bp;
 
@@ -571,7 +705,7 @@ inode_read(struct inode *ip, char *dst, off_t off, size_t n)
 		if (ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read) {
 			return -ENODEV;
 		}
-		return devsw[ip->major].read(ip->minor, ip, dst, n);
+		return devsw[ip->major].read(ip->minor, ip, dst, off, n);
 	}
 
 	off_t result;
@@ -582,13 +716,36 @@ inode_read(struct inode *ip, char *dst, off_t off, size_t n)
 		n = ip->size - off;
 	}
 
+	if (tmpfs_inode(ip)) {
+		// Pages never written to are holes.
+		for (uint64_t tot = 0; tot < n; tot += m, off += (off_t)m, dst += m) {
+			char *page = pcache_lookup(ip, off);
+			m = min(n - tot, PGSIZE - off % PGSIZE);
+			if (page != NULL) {
+				memmove(dst, page + off % PGSIZE, m);
+			} else {
+				memset(dst, 0, m);
+			}
+		}
+		return (off_t)n;
+	}
+
 	for (uint64_t tot = 0; tot < n; tot += m, off += (off_t)m, dst += m) {
-		uintptr_t map = bmap(ip, off / BSIZE);
+		// A shared mapping may have written to the cached page since
+		// it was last written back.
+		char *page = pcache_lookup(ip, off);
+		if (page != NULL) {
+			m = min(n - tot, PGSIZE - off % PGSIZE);
+			memmove(dst, page + off % PGSIZE, m);
+			continue;
+		}
+		m = min(n - tot, BSIZE - off % BSIZE);
+		uintptr_t map = bmap(ip, off / BSIZE, BMAP_LOOKUP);
 		if (map == 0) {
-			return -ENOSPC;
+			memset(dst, 0, m);
+			continue;
 		}
 		bp = block_read(ip->dev, map);
-		m = min(n - tot, BSIZE - off % BSIZE);
 		memmove(dst, bp->data + off % BSIZE, m);
 		block_release(bp);
 	}
@@ -601,7 +758,7 @@ ssize_t
 inode_write(struct inode *ip, char *src, off_t off, size_t n)
 	__must_hold(&ip->lock)
 {
-	kernel_assert(holdingsleep(&ip->lock));
+	kernel_assert(holdingrwsleep_write(&ip->lock));
 	uint64_t m;
 	struct block_buffer *bp;
 
@@ -612,16 +769,33 @@ inode_write(struct inode *ip, char *src, off_t off, size_t n)
 		return devsw[ip->major].write(ip->minor, ip, src, n);
 	}
 
+	// Writing past the end leaves a hole in between.
 	off_t result;
-	if (off > ip->size || ckd_add(&result, off, n)) {
+	if (off < 0 || ckd_add(&result, off, n)) {
 		return -EDOM;
 	}
 	if (off + n > MAXFILE * BSIZE) {
 		return -EDOM;
 	}
 
+	if (tmpfs_inode(ip)) {
+		for (uint64_t tot = 0; tot < n; tot += m, off += (off_t)m, src += m) {
+			char *page = pcache_get(ip, off);
+			if (page == NULL) {
+				return -ENOSPC;
+			}
+			m = min(n - tot, PGSIZE - off % PGSIZE);
+			memmove(page + off % PGSIZE, src, m);
+		}
+		if (n > 0 && off > ip->size) {
+			ip->size = off;
+			inode_update(ip);
+		}
+		return (off_t)n;
+	}
+
 	for (uint64_t tot = 0; tot < n; tot += m, off += (off_t)m, src += m) {
-		uintptr_t map = bmap(ip, off / BSIZE);
+		uintptr_t map = bmap(ip, off / BSIZE, BMAP_WRITE);
 		if (map == 0) {
 			return -ENOSPC;
 		}
@@ -630,15 +804,416 @@ inode_write(struct inode *ip, char *src, off_t off, size_t n)
 		memmove(bp->data + off % BSIZE, src, m);
 		log_write(bp);
 		block_release(bp);
+		// Keep mappings of the file up to date, unless this is the
+		// cached page being written back.
+		char *page = pcache_lookup(ip, off);
+		if (page != NULL && page + off % PGSIZE != src) {
+			memmove(page + off % PGSIZE, src, m);
+		}
 	}
 
-	if (n > 0 && off > ip->size) {
-		ip->size = off;
+	// Even if the size did not change, bmap() may have added a block
+	// to ip->addrs[].
+	if (n > 0) {
+		ip->size = max(ip->size, off);
 		inode_update(ip);
+		ip->data_tid = ip->tid;
 	}
 	return (off_t)n;
 }
 
+// Make what has been done to ip durable, by waiting for the log
+// transaction that last changed it to commit. With datasync, changes
+// that only touched its metadata, not its data or size, need not be.
+int
+inode_sync(struct inode *ip, bool datasync)
+{
+	// The tmpfs has nothing to put on a disk.
+	if (tmpfs_inode(ip)) {
+		return 0;
+	}
+	inode_lock_shared(ip);
+	uint64_t tid = datasync ? ip->data_tid : ip->tid;
+	inode_unlock(ip);
+	log_force(ip->dev, tid);
+	return 0;
+}
+
+// Zero ip's data from off up to end, which is within one block,
+// where it is on disk. Caller must hold ip->lock.
+static void
+zero_part(struct inode *ip, off_t off, off_t end) __must_hold(&ip->lock)
+{
+	uintptr_t addr = bmap(ip, off / BSIZE, BMAP_LOOKUP);
+
+	if (addr == 0) {
+		return;
+	}
+	struct block_buffer *bp = block_read(ip->dev, addr);
+	memset(bp->data + off % BSIZE, 0, end - off);
+	log_write(bp);
+	block_release(bp);
+}
+
+// Make ip's file length bytes long. Shrinking it frees the blocks
+// past the end a transaction at a time, bringing the size down with
+// them, so that it never covers a block that is gone.
+// Caller holds a reference to ip, and must not be in a transaction.
+int
+inode_truncate(struct inode *ip, off_t length)
+{
+	if (length < 0) {
+		return -EINVAL;
+	}
+	if ((uint64_t)length > MAXFILE * BSIZE) {
+		return -EFBIG;
+	}
+	uint64_t from = ROUND_UP((uint64_t)length, BSIZE) / BSIZE;
+	uint64_t to = MAXFILE;
+
+	begin_op();
+	inode_lock(ip);
+	bool shrink = (uint64_t)length < ip->size;
+	if (shrink) {
+		pcache_zero(ip, length, ip->size);
+		// The rest of the last block must read as zeroes if the
+		// file grows again.
+		if (length % BSIZE != 0 && !tmpfs_inode(ip)) {
+			zero_part(ip, length, ROUND_UP(length, BSIZE));
+		}
+	}
+	while (1) {
+		bool done = !shrink || tmpfs_inode(ip) || free_blocks(ip, from, &to);
+
+		ip->size = done ? (uint64_t)length : min(ip->size, to * BSIZE);
+		inode_update(ip);
+		ip->data_tid = ip->tid;
+		inode_unlock(ip);
+		if (done) {
+			break;
+		}
+		log_yield();
+		inode_lock(ip);
+	}
+	end_op();
+	return 0;
+}
+
+// Free the blocks of ip's file from off for len bytes, so that it
+// reads as zeroes there, leaving its size alone. Parts of blocks at
+// the edges are zeroed. Caller holds a reference to ip, and must
+// not be in a transaction.
+int
+inode_punch(struct inode *ip, off_t off, off_t len)
+{
+	off_t end;
+
+	if (off < 0 || len <= 0 || ckd_add(&end, off, len)) {
+		return -EINVAL;
+	}
+	end = min((uint64_t)end, MAXFILE * BSIZE);
+	off_t head_end = min(end, ROUND_UP(off, BSIZE));
+	off_t tail = max(head_end, ROUND_DOWN(end, BSIZE));
+	uint64_t from = head_end / BSIZE;
+	uint64_t to = tail / BSIZE;
+
+	begin_op();
+	inode_lock(ip);
+	pcache_zero(ip, off, end);
+	if (!tmpfs_inode(ip)) {
+		if (off < head_end) {
+			zero_part(ip, off, head_end);
+		}
+		if (tail < end) {
+			zero_part(ip, tail, end);
+		}
+	}
+	while (1) {
+		bool done = tmpfs_inode(ip) || from >= to || free_blocks(ip, from, &to);
+
+		inode_update(ip);
+		ip->data_tid = ip->tid;
+		inode_unlock(ip);
+		if (done) {
+			break;
+		}
+		log_yield();
+		inode_lock(ip);
+	}
+	end_op();
+	return 0;
+}
+
+// Log blocks one step of preallocating may need: a bitmap block and
+// the new indirect blocks on the way down, and the blocks they go
+// in, and the inode.
+#define ALLOC_STEP_BLOCKS (1 + 3 * 2 + 1)
+
+// Allocate ip's file the blocks from off for len bytes that it does
+// not have, zeroed, so that writing there cannot run out of space.
+// Unless keep_size, the file grows to cover them. Caller holds a
+// reference to ip, and must not be in a transaction.
+int
+inode_fallocate(struct inode *ip, off_t off, off_t len, bool keep_size)
+{
+	off_t end;
+	int ret = 0;
+
+	if (off < 0 || len <= 0 || ckd_add(&end, off, len)) {
+		return -EINVAL;
+	}
+	if ((uint64_t)end > MAXFILE * BSIZE) {
+		return -EFBIG;
+	}
+	uint64_t bn = off / BSIZE;
+	uint64_t last = ROUND_UP((uint64_t)end, BSIZE) / BSIZE;
+
+	begin_op();
+	while (1) {
+		off_t done = end;
+
+		inode_lock(ip);
+		if (tmpfs_inode(ip)) {
+			for (off_t o = ROUND_DOWN(off, PGSIZE); o < end; o += PGSIZE) {
+				if (pcache_get(ip, o) == NULL) {
+					ret = -ENOSPC;
+					done = o;
+					break;
+				}
+			}
+		} else {
+			while (bn < last && log_room(ip->dev, ALLOC_STEP_BLOCKS)) {
+				if (bmap(ip, bn, BMAP_ZERO) == 0) {
+					ret = -ENOSPC;
+					break;
+				}
+				bn++;
+			}
+			done = min(end, (off_t)(bn * BSIZE));
+		}
+		if (!keep_size) {
+			ip->size = max(ip->size, (uint64_t)done);
+		}
+		inode_update(ip);
+		ip->data_tid = ip->tid;
+		inode_unlock(ip);
+		if (ret < 0 || done == end) {
+			break;
+		}
+		log_yield();
+	}
+	end_op();
+	return ret;
+}
+
+// Free the inodes that inode_put() left for it, and their blocks,
+// taking as many transactions as that needs. end_op() calls this
+// when a system call is out of its transaction, holding nothing.
+void
+inode_reclaim(void)
+{
+	struct inode *ip;
+
+	acquire(&reclaim.lock);
+	bool none = reclaim.n == 0;
+	release(&reclaim.lock);
+	if (none) {
+		return;
+	}
+
+	begin_op();
+	while (1) {
+		acquire(&reclaim.lock);
+		ip = reclaim.n > 0 ? reclaim.inodes[--reclaim.n] : NULL;
+		release(&reclaim.lock);
+		if (ip == NULL) {
+			break;
+		}
+
+		uint64_t to = MAXFILE;
+		while (1) {
+			inode_lock(ip);
+			bool done = tmpfs_inode(ip) || free_blocks(ip, 0, &to);
+			if (done) {
+				ip->size = 0;
+				ip->mode = 0;
+			} else {
+				ip->size = min(ip->size, to * BSIZE);
+			}
+			inode_update(ip);
+			if (done) {
+				ip->valid = 0;
+			}
+			inode_unlock(ip);
+			if (done) {
+				break;
+			}
+			log_yield();
+		}
+		// Not valid any more, so this only drops the reference.
+		inode_put(ip);
+	}
+	end_op();
+}
+
+// Page cache
+//
+// mmap() maps files a page at a time straight from the page cache.
+// Writes through a shared mapping land in the cached page, and go
+// to disk on msync(), munmap() or exit; read() and write() look at
+// the cache first, so they agree with the mappings in the meantime.
+// On the tmpfs, the page cache is where the data lives.
+
+#define PCACHE_FANOUT (PGSIZE / sizeof(char *))
+
+// Return the cached page holding the data at off, or NULL if it
+// is not cached. Caller must hold ip->lock.
+char *
+pcache_lookup(struct inode *ip, off_t off) __must_hold(&ip->lock)
+{
+	size_t index = off / PGSIZE;
+
+	if (ip->pcache == NULL || index >= PCACHE_FANOUT * PCACHE_FANOUT) {
+		return NULL;
+	}
+	char **leaf = ip->pcache[index / PCACHE_FANOUT];
+	return leaf != NULL ? leaf[index % PCACHE_FANOUT] : NULL;
+}
+
+// Allocate a zeroed page for the page cache's use.
+static void *
+pcache_zalloc(void)
+{
+	char *page = kpage_alloc();
+	if (page != NULL) {
+		memset(page, 0, PGSIZE);
+	}
+	return page;
+}
+
+// Return the cached page holding the data at off, reading it in
+// from disk if necessary. The part of it past the end of the file
+// is zeroes. Returns NULL if out of memory.
+// Caller must hold ip->lock exclusively.
+char *
+pcache_get(struct inode *ip, off_t off) __must_hold(&ip->lock)
+{
+	kernel_assert(holdingrwsleep_write(&ip->lock));
+	size_t index = off / PGSIZE;
+
+	if (off < 0 || index >= PCACHE_FANOUT * PCACHE_FANOUT) {
+		return NULL;
+	}
+	if (ip->pcache == NULL && (ip->pcache = pcache_zalloc()) == NULL) {
+		return NULL;
+	}
+	char ***leaf = &ip->pcache[index / PCACHE_FANOUT];
+	if (*leaf == NULL && (*leaf = pcache_zalloc()) == NULL) {
+		return NULL;
+	}
+	char **page = &(*leaf)[index % PCACHE_FANOUT];
+	if (*page == NULL) {
+		char *data = pcache_zalloc();
+		if (data == NULL) {
+			return NULL;
+		}
+		off = (off_t)(index * PGSIZE);
+		if (off < ip->size &&
+		    inode_read(ip, data, off, min(ip->size - off, PGSIZE)) < 0) {
+			kpage_free(data);
+			return NULL;
+		}
+		*page = data;
+	}
+	return *page;
+}
+
+// Write the cached page holding the data at off back to disk, as
+// far as it lies within the file.
+int
+pcache_writeback(struct inode *ip, off_t off)
+{
+	// The tmpfs has nowhere else to write it.
+	if (tmpfs_inode(ip)) {
+		return 0;
+	}
+	const size_t max = MAXOPBYTES;
+	off = PGROUNDDOWN(off);
+
+	for (size_t done = 0; done < PGSIZE;) {
+		begin_op();
+		inode_lock(ip);
+		char *page = pcache_lookup(ip, off);
+		ssize_t n = 0;
+		if (page != NULL && off + done < ip->size) {
+			n = inode_write(ip, page + done, off + done,
+			                min(min(PGSIZE - done, max), ip->size - (off + done)));
+		}
+		inode_unlock(ip);
+		end_op();
+		if (n <= 0) {
+			return n;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+// Zero what the page cache has of ip's data from off up to end.
+// Caller must hold ip->lock exclusively.
+static void
+pcache_zero(struct inode *ip, off_t off, off_t end) __must_hold(&ip->lock)
+{
+	kernel_assert(holdingrwsleep_write(&ip->lock));
+	if (ip->pcache == NULL) {
+		return;
+	}
+	end = min(end, (off_t)(PCACHE_FANOUT * PCACHE_FANOUT * PGSIZE));
+	while (off < end) {
+		size_t index = off / PGSIZE;
+		char **leaf = ip->pcache[index / PCACHE_FANOUT];
+		if (leaf == NULL) {
+			off = ROUND_UP(index + 1, PCACHE_FANOUT) * PGSIZE;
+			continue;
+		}
+		off_t next = min(end, (off_t)((index + 1) * PGSIZE));
+		if (leaf[index % PCACHE_FANOUT] != NULL) {
+			memset(leaf[index % PCACHE_FANOUT] + off % PGSIZE, 0, next - off);
+		}
+		off = next;
+	}
+}
+
+// Give back every page in a page cache table, and the table.
+void
+pcache_destroy(char ***pcache)
+{
+	if (pcache == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < PCACHE_FANOUT; i++) {
+		char **leaf = pcache[i];
+		if (leaf == NULL) {
+			continue;
+		}
+		for (size_t j = 0; j < PCACHE_FANOUT; j++) {
+			if (leaf[j] != NULL) {
+				kpage_free(leaf[j]);
+			}
+		}
+		kpage_free((char *)leaf);
+	}
+	kpage_free((char *)pcache);
+}
+
+// Give back every cached page of ip. Nothing may have them mapped.
+static void
+pcache_free(struct inode *ip)
+{
+	pcache_destroy(ip->pcache);
+	ip->pcache = NULL;
+}
+
 // Directories
 
 int
@@ -654,7 +1229,7 @@ struct inode *
 dirlookup(struct inode *dp, const char *name, uint64_t *poff)
 	__must_hold(&dp->lock)
 {
-	kernel_assert(holdingsleep(&dp->lock));
+	kernel_assert(holdingrwsleep(&dp->lock));
 	ino_t inum;
 	struct dirent de;
 
@@ -769,17 +1344,20 @@ namex(int dirfd, const char *path, int nameiparent, char *name)
 	// an absolute path.
 	// Otherwise, it is treated as a relative path.
 	if (*path == '/') {
-		ip = inode_get(ROOTDEV, ROOTINO);
+		ip = inode_get(rootdev, ROOTINO);
 	} else {
 		if (dirfd == AT_FDCWD) {
-			ip = inode_dup(myproc()->cwd); // increase refcount
+			ip = inode_dup(myproc()->files->cwd); // increase refcount
 		} else {
 			ip = inode_dup(fd_to_struct_file(dirfd)->ip);
 		}
 	}
 
 	while ((path = skipelem(path, name)) != NULL) {
-		inode_lock(ip);
+		if (namecmp(name, "..") == 0) {
+			ip = mount_cross_up(ip);
+		}
+		inode_lock_shared(ip);
 		if (!S_ISDIR(ip->mode)) {
 			inode_unlockput(ip);
 			return NULL;
@@ -794,7 +1372,7 @@ namex(int dirfd, const char *path, int nameiparent, char *name)
 			return NULL;
 		}
 		inode_unlockput(ip);
-		ip = next;
+		ip = mount_cross_down(next);
 	}
 	if (nameiparent) {
 		inode_put(ip);
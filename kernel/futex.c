@@ -0,0 +1,153 @@
+//
+// Fast user-space mutexes.
+//
+// A futex is just a 32-bit word in user memory. Threads that want to
+// block on it are queued in a hash table keyed by the address space
+// and the word's address, so that waking one only has to look at one
+// bucket instead of at every sleeping process.
+//
+
+#include "futex.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trap.h"
+#include "vm.h"
+#include "vma.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FUTEX_HASH_SIZE 64
+
+struct futex_waiter {
+	struct mm *mm;
+	uintptr_t addr;
+	bool woken;
+	struct futex_waiter *next;
+};
+
+static struct futex_bucket {
+	struct spinlock lock;
+	struct futex_waiter *first;
+} futex_table[FUTEX_HASH_SIZE];
+
+void
+futexinit(void)
+{
+	for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+		initlock(&futex_table[i].lock, "futex");
+	}
+}
+
+static struct futex_bucket *
+futex_bucket(struct mm *mm, uintptr_t addr)
+{
+	uintptr_t h = (addr >> 2) ^ ((uintptr_t)mm >> 6);
+	h ^= h >> 16;
+	return &futex_table[h % FUTEX_HASH_SIZE];
+}
+
+// The word has to be aligned and lie in the process's memory.
+bool
+futex_addr_ok(struct mm *mm, uintptr_t addr)
+{
+	if (addr % sizeof(uint32_t) != 0) {
+		return false;
+	}
+	return mm_user_range(mm, addr, sizeof(uint32_t), false) == 0;
+}
+
+static void
+futex_unqueue(struct futex_bucket *b, struct futex_waiter *w)
+{
+	for (struct futex_waiter **pp = &b->first; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == w) {
+			*pp = w->next;
+			return;
+		}
+	}
+}
+
+// Sleep until someone calls futex_wake() on uaddr, as long as it
+// still holds val. A negative timeout waits forever.
+int
+futex_wait(uint32_t *uaddr, uint32_t val, long timeout_ms)
+{
+	struct proc *curproc = myproc();
+	struct mm *mm = curproc->mm;
+	uintptr_t addr = (uintptr_t)uaddr;
+
+	if (!futex_addr_ok(mm, addr)) {
+		return -EFAULT;
+	}
+
+	struct futex_bucket *b = futex_bucket(mm, addr);
+	struct futex_waiter w = { mm, addr, false, NULL };
+	time_t deadline = timeout_ms > 0 ? ticks + timeout_ms : 0;
+
+	// futex_wake() takes the bucket lock too, so checking the value
+	// under it means a wakeup between the check and the sleep cannot
+	// be lost. futex_addr_ok() faulted the word in, but another thread
+	// may unmap it, and nothing can be faulted in under a spinlock, so
+	// read it with copy_from_user(), which fails rather than panics.
+	uint32_t cur;
+	acquire(&b->lock);
+	if (copy_from_user(&cur, uaddr, sizeof(cur)) < 0) {
+		release(&b->lock);
+		return -EFAULT;
+	}
+	if (cur != val) {
+		release(&b->lock);
+		return -EAGAIN;
+	}
+	if (timeout_ms == 0) {
+		release(&b->lock);
+		return -ETIMEDOUT;
+	}
+	w.next = b->first;
+	b->first = &w;
+	while (!w.woken && !curproc->killed &&
+	       (deadline == 0 || ticks < deadline)) {
+		sleep_until(&w, &b->lock, deadline);
+	}
+	if (!w.woken) {
+		futex_unqueue(b, &w);
+	}
+	release(&b->lock);
+
+	if (w.woken) {
+		return 0;
+	}
+	return curproc->killed ? -EINTR : -ETIMEDOUT;
+}
+
+// Wake up to n threads waiting on uaddr, and return how many woke.
+int
+futex_wake(uint32_t *uaddr, int n)
+{
+	struct mm *mm = myproc()->mm;
+	uintptr_t addr = (uintptr_t)uaddr;
+	struct futex_bucket *b = futex_bucket(mm, addr);
+	int woken = 0;
+
+	if (!futex_addr_ok(mm, addr)) {
+		return -EFAULT;
+	}
+
+	acquire(&b->lock);
+	struct futex_waiter **pp = &b->first;
+	while (*pp != NULL && woken < n) {
+		struct futex_waiter *w = *pp;
+		if (w->mm != mm || w->addr != addr) {
+			pp = &w->next;
+			continue;
+		}
+		*pp = w->next;
+		w->woken = true;
+		wakeup(w);
+		woken++;
+	}
+	release(&b->lock);
+	return woken;
+}
@@ -2,6 +2,7 @@
 
 #include "buf.h"
 #include "console.h"
+#include "dev/trace.h"
 #include "file.h"
 #include "fs.h"
 #include "ioapic.h"
@@ -24,6 +25,7 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_FLUSH 0xe7
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -31,8 +33,12 @@
 
 static struct spinlock idelock;
 static struct block_buffer *idequeue;
+// Which command of its request the disk is running: a write with
+// B_FLUSH is preceded by a FLUSH CACHE, and one with B_FUA is
+// followed by one.
+static enum { IDE_PREFLUSH, IDE_DATA, IDE_POSTFLUSH } idestage;
 
-static int havedisk1;
+static bool havedisk[2];
 static void idestart(struct block_buffer *);
 
 // Wait for IDE disk to become ready.
@@ -62,7 +68,7 @@ ideclose(short minor)
 }
 
 static ssize_t
-ideread(short minor, struct inode *ip, char *buf, size_t len)
+ideread(short minor, struct inode *ip, char *buf, off_t off, size_t len)
 {
 	return len;
 }
@@ -83,20 +89,26 @@ __cold void
 ide_disk_init(void)
 {
 	initlock(&idelock, "ide");
+	lockstat_register(&idelock);
 	ioapicenable(IRQ_IDE, ncpu - 1);
 	idewait(0);
 
-	// Check if disk 1 is present
-	outb(0x1f6, 0xe0 | (1 << 4));
-	for (int i = 0; i < 1000; i++) {
-		if (inb(0x1f7) != 0) {
-			havedisk1 = 1;
-			break;
+	// Check which disks are present, leaving disk 0 selected.
+	for (int disk = 1; disk >= 0; disk--) {
+		outb(0x1f6, 0xe0 | (disk << 4));
+		for (int i = 0; i < 1000; i++) {
+			if (inb(0x1f7) != 0) {
+				havedisk[disk] = true;
+				break;
+			}
 		}
 	}
+}
 
-	// Switch back to disk 0.
-	outb(0x1f6, 0xe0 | (0 << 4));
+bool
+ide_present(dev_t dev)
+{
+	return dev < 2 && havedisk[dev];
 }
 
 void
@@ -109,22 +121,26 @@ ide_init(void)
 	devsw[DEV_SD].mmap = idemmap;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Have the disk b is on write its cache out. Caller must hold idelock.
 static void
-idestart(struct block_buffer *b)
+ideflush(struct block_buffer *b)
+{
+	idewait(0);
+	outb(0x3f6, 0); // generate interrupt
+	outb(0x1f6, 0xe0 | ((b->dev & 1) << 4));
+	outb(0x1f7, IDE_CMD_FLUSH);
+}
+
+// Start the transfer for b.  Caller must hold idelock.
+static void
+idetransfer(struct block_buffer *b)
 {
-	if (__unlikely(b == NULL)) {
-		panic("idestart");
-	}
-	if (b->blockno >= FSSIZE) {
-		uart_printf("blockno: %ld\n", b->blockno);
-		panic("incorrect blockno");
-	}
 	const int sector_per_block = BSIZE / SECTOR_SIZE;
 	size_t sector = b->blockno * sector_per_block;
 	int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
 	int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
+	tracepoint(TRACE_BLOCK_SUBMIT, sector, (b->flags & B_DIRTY) != 0);
 	idewait(0);
 	outb(0x3f6, 0); // generate interrupt
 	outb(0x1f2, sector_per_block); // number of sectors
@@ -140,6 +156,26 @@ idestart(struct block_buffer *b)
 	}
 }
 
+// Start the request for b.  Caller must hold idelock.
+static void
+idestart(struct block_buffer *b)
+{
+	if (__unlikely(b == NULL)) {
+		panic("idestart");
+	}
+	if (b->blockno >= FSSIZE) {
+		uart_printf("blockno: %ld\n", b->blockno);
+		panic("incorrect blockno");
+	}
+	if ((b->flags & (B_DIRTY | B_FLUSH)) == (B_DIRTY | B_FLUSH)) {
+		idestage = IDE_PREFLUSH;
+		ideflush(b);
+	} else {
+		idestage = IDE_DATA;
+		idetransfer(b);
+	}
+}
+
 // Interrupt handler.
 void
 ideintr(void)
@@ -153,16 +189,38 @@ ideintr(void)
 		release(&idelock);
 		return;
 	}
-	idequeue = b->qnext;
 
-	// Read data if needed.
-	if (!(b->flags & B_DIRTY) && idewait(1) >= 0) {
-		insl(0x1f0, b->data, BSIZE / 4);
+	switch (idestage) {
+	case IDE_PREFLUSH:
+		idestage = IDE_DATA;
+		idetransfer(b);
+		release(&idelock);
+		return;
+	case IDE_DATA:
+		// Read data if needed.
+		if (!(b->flags & B_DIRTY) && idewait(1) >= 0) {
+			insl(0x1f0, b->data, BSIZE / 4);
+		}
+
+		tracepoint(TRACE_BLOCK_COMPLETE, b->blockno * (BSIZE / SECTOR_SIZE),
+		           (b->flags & B_DIRTY) != 0);
+
+		// PIO has no FUA write, so flush the cache after it.
+		if ((b->flags & (B_DIRTY | B_FUA)) == (B_DIRTY | B_FUA)) {
+			idestage = IDE_POSTFLUSH;
+			ideflush(b);
+			release(&idelock);
+			return;
+		}
+		break;
+	case IDE_POSTFLUSH:
+		break;
 	}
+	idequeue = b->qnext;
 
 	// Wake process waiting for this buf.
 	b->flags |= B_VALID;
-	b->flags &= ~B_DIRTY;
+	b->flags &= ~(B_DIRTY | B_FLUSH | B_FUA);
 	wakeup(b);
 
 	// Start disk on next buf in queue.
@@ -176,6 +234,7 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// B_FLUSH and B_FUA on a write are honored, and cleared with it.
 void
 iderw(struct block_buffer *b)
 {
@@ -187,8 +246,8 @@ iderw(struct block_buffer *b)
 	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID) {
 		panic("iderw: nothing to do");
 	}
-	if (b->dev != 0 && !havedisk1) {
-		panic("iderw: ide disk 1 not present");
+	if (!ide_present(b->dev)) {
+		panic("iderw: ide disk %lu not present", b->dev);
 	}
 
 	acquire(&idelock); // DOC:acquire-lock
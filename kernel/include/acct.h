@@ -0,0 +1,26 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include "proc.h"
+#include "procstat.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+uint64_t tsc_khz(void);
+uint64_t cycles_to_nsec(uint64_t cycles);
+void acct_charge(bool user);
+void acct_usage_add(struct proc_usage *to, const struct proc_usage *from);
+void acct_usage_export(struct proc_usage *u);
+
+// p has had a page fault served. It was major if it read from disk
+// while at it; inblock is what p->usage.inblock was before.
+static inline void
+acct_fault(struct proc *p, uint64_t inblock)
+{
+	if (p->usage.inblock != inblock) {
+		p->usage.majflt++;
+	} else {
+		p->usage.minflt++;
+	}
+}
+#endif
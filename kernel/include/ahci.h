@@ -1,5 +1,6 @@
 #pragma once
 #if __RELIX_KERNEL__
+#include <buf.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -519,7 +520,11 @@ typedef struct IdentifyDevicePIO {
 } IdentifyDevicePIO;
 
 bool read_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf);
-bool write_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf);
+bool write_port(HBAPort *port, uint64_t start, uint16_t count, uint16_t *buf,
+                bool fua);
+bool flush_port(HBAPort *port);
 void ahci_init(uint32_t abar_);
 int ahci_read_disk(uint64_t start, uint16_t count, uint8_t *buf);
+bool ahci_present(void);
+void ahci_rw(struct block_buffer *);
 #endif
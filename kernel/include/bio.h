@@ -9,4 +9,5 @@ struct block_buffer *block_read(dev_t dev, uint64_t blockno)
 	__acquires(&b->lock);
 void block_release(struct block_buffer *b) __releases(&b->lock);
 void block_write(struct block_buffer *b) __must_hold(&b->lock);
+void block_invalidate(dev_t dev);
 #endif
@@ -95,6 +95,7 @@ extern uint64_t available_memory;
 extern uint64_t top_memory;
 
 struct multiboot_tag_framebuffer *get_multiboot_framebuffer(void);
+struct multiboot_tag_module *get_multiboot_module(void);
 
 typedef unsigned char multiboot_uint8_t;
 typedef unsigned short multiboot_uint16_t;
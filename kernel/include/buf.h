@@ -16,4 +16,7 @@ struct block_buffer {
 };
 #define B_VALID 0x2 // buffer has been read from disk
 #define B_DIRTY 0x4 // buffer needs to be written to disk
+// Barriers, for writes. The driver clears them along with B_DIRTY.
+#define B_FLUSH 0x8 // everything written before is on the media first
+#define B_FUA 0x10 // the write is on the media when it completes
 #endif
@@ -1,2 +1,5 @@
 #pragma once
+// Which disk the root file system is on. With neither CONFIG_IDE nor
+// CONFIG_SATA, it is a RAM disk loaded by the boot loader (see
+// ramfs.c).
 #define CONFIG_IDE 1
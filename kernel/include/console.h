@@ -22,6 +22,8 @@ __attribute__((format(printf, 1, 2)))
 __nonnull(1) void uart_printf_unlocked(const char *fmt, ...);
 __attribute__((format(printf, 2, 3)))
 __nonnull(1) void ksprintf(char *restrict str, const char *fmt, ...);
+__attribute__((format(printf, 3, 4))) size_t
+ksnprintf(char *restrict str, size_t size, const char *fmt, ...);
 
 #if __RELIX_KERNEL_DEBUG__ && defined(__FILE_NAME__)
 #define pr_debug_file(...) uart_printf(__FILE_NAME__ ": " __VA_ARGS__)
@@ -28,6 +28,10 @@ enum MISC_CPU_FEATURES {
 	MISC_FEATURE_LONG_MODE = 1 << 0,
 	MISC_FEATURE_CPUID = 1 << 1,
 	MISC_FEATURE_INVARIANT_TSC = 1 << 2,
+	// Enhanced "rep movsb"/"rep stosb".
+	MISC_FEATURE_ERMS = 1 << 3,
+	// Fast short "rep movsb".
+	MISC_FEATURE_FSRM = 1 << 4,
 };
 /*
  * CPU Features tree for determining what we can use.
@@ -174,6 +178,21 @@ enum {
 
 };
 
+// The size of the saved FPU state in struct proc: the FXSAVE area, the
+// XSAVE header and the AVX state.
+#define FPU_STATE_SIZE (512 + 64 + 256)
+
+// Copied out of CpuFeatures for code that checks it on hot paths,
+// like memcpy().
+extern enum MISC_CPU_FEATURES cpu_misc_features;
+
+#if __RELIX_KERNEL_DEBUG__
+// In kernel_string.c.
+void kernel_string_benchmark(void);
+#endif
+
 void cpu_features_init(void);
 uint8_t *cpu_clean_fpu(void);
+void fpu_save(uint8_t *state);
+void fpu_restore(const uint8_t *state);
 #endif /* CPU_H */
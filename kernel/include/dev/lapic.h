@@ -57,6 +57,7 @@ extern volatile uint32_t *lapic;
 time_t rtc_now(void);
 uint8_t lapicid(void);
 void lapiceoi(void);
+void lapicipi(uint8_t apicid, int vector);
 void lapicinit(void);
 __suppress_sanitizer("alignment") void lapicstartap(uint8_t a, uint32_t b);
 void lapicw(int index, int value);
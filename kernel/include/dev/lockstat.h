@@ -0,0 +1,4 @@
+#pragma once
+#if __RELIX_KERNEL__
+void dev_lockstat_init(void);
+#endif
@@ -0,0 +1,4 @@
+#pragma once
+#if __RELIX_KERNEL__
+void dev_procstat_init(void);
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include "profiler.h"
+
+struct trapframe;
+
+void dev_prof_init(void);
+void prof_tick(struct trapframe *tf);
+int prof_start(int interval);
+int prof_stop(void);
+int prof_ksym(struct prof_symbol *sym);
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include "lib/compiler_attributes.h"
+#include "tracing.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// TRACE_* bits that are on. Zero when nothing is being traced.
+extern _Atomic uint32_t trace_mask;
+
+void dev_trace_init(void);
+int trace_start(uint32_t mask);
+int trace_stop(void);
+int trace_info(struct trace_info *info);
+void trace_syscall(size_t num, uint64_t cycles);
+void trace_record(uint16_t type, uint64_t arg0, uint64_t arg1);
+
+static inline bool
+trace_enabled(uint32_t bits)
+{
+	return __unlikely(atomic_load_explicit(&trace_mask, memory_order_acquire) &
+	                  bits);
+}
+
+static inline void
+tracepoint(uint16_t type, uint64_t arg0, uint64_t arg1)
+{
+	if (trace_enabled(TRACE_BIT(type))) {
+		trace_record(type, arg0, arg1);
+	}
+}
+#endif
@@ -1,2 +1,13 @@
 #pragma once
+#if __RELIX_KERNEL__
+#include <buf.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// The disk the root file system is on.
+extern dev_t rootdev;
+
 void disk_init(void);
+bool disk_present(dev_t dev);
+void disk_rw(struct block_buffer *);
+#endif
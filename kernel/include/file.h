@@ -6,6 +6,7 @@
 #include "param.h"
 #include <stdint.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #if __RELIX_KERNEL__
 struct file {
 	enum {
@@ -13,6 +14,7 @@ struct file {
 		FD_PIPE,
 		FD_INODE,
 		FD_FIFO,
+		FD_EPOLL,
 	} type;
 	int flags; // Flags like O_CLOEXEC.
 	int ref; // reference count
@@ -20,18 +22,25 @@ struct file {
 	bool writable;
 	struct pipe *pipe;
 	struct inode *ip;
+	struct eventpoll *ep;
 	off_t off;
 };
 
+struct pollwaiter;
+
 // table mapping major device number to
 // device functions
 struct devsw {
 	int (*open)(short minor, int);
 	int (*close)(short minor);
-	ssize_t (*read)(short minor, struct inode *, char *, size_t);
+	ssize_t (*read)(short minor, struct inode *, char *, off_t, size_t);
 	ssize_t (*write)(short minor, struct inode *, char *, size_t);
 	struct mmap_info (*mmap)(short minor, size_t length, uintptr_t addr,
 	                         int perm);
+	// Optional. Returns the POLL* events that apply now, and queues the
+	// waiter (if not NULL) on the device's pollhead. Devices without it
+	// are always ready.
+	int (*poll)(short minor, struct pollwaiter *);
 };
 #endif
 
@@ -52,6 +61,15 @@ enum {
 	DEV_TTY = 6,
 	// The mouse's packets. /dev/mouse[0-9]*
 	DEV_MOUSE = 7,
+	// Spinlock contention statistics. /dev/lockstat
+	DEV_LOCKSTAT = 8,
+	// Sampling profiler. /dev/prof
+	DEV_PROF = 9,
+	// Tracepoint events and system call statistics. /dev/trace (0),
+	// /dev/sysstat (1)
+	DEV_TRACE = 10,
+	// Resource usage. /dev/procstat (0), /dev/cpustat (1)
+	DEV_PROCSTAT = 11,
 	__DEVSW_last,
 };
 
@@ -80,6 +98,12 @@ void fileinit(void);
 ssize_t vfs_read(struct file *file, char *buf, size_t n);
 int vfs_stat(struct file *file, struct stat *);
 ssize_t vfs_write(struct file *file, char *buf, size_t n);
+ssize_t vfs_readv(struct file *file, const struct iovec *iov, int iovcnt,
+                  const off_t *pos);
+ssize_t vfs_writev(struct file *file, const struct iovec *iov, int iovcnt,
+                   const off_t *pos);
+ssize_t vfs_splice(struct file *in, off_t *in_off, struct file *out,
+                   off_t *out_off, size_t len);
 off_t fileseek(struct file *f, off_t offset, int whence);
 ssize_t filereadlinkat(int dirfd, const char *restrict pathname, char *buf,
                        size_t bufsiz);
@@ -21,6 +21,9 @@
 #define NDIRECT __NDIRECT
 #define NINDIRECT __NINDIRECT
 #define MAXFILE __MAXFILE
+// Block addresses in an inode: NDIRECT data blocks, then the singly,
+// doubly and triply indirect blocks.
+#define NADDRS (NDIRECT + 3)
 #define NDINDIRECT_PER_ENTRY __NDINDIRECT_PER_ENTRY
 #define NDINDIRECT_ENTRY __NDIRECT
 #define BSIZE __BSIZE
@@ -64,8 +67,9 @@ struct inode {
 
 	/*
 	 * Protects all fields other than ref, dev, and inum.
+	 * Reading the inode's contents only needs the shared side.
 	 */
-	struct sleeplock lock;
+	struct rwsleeplock lock;
 	int valid; // inode has been read from disk?
 
 	uint64_t ctime; // change
@@ -75,11 +79,21 @@ struct inode {
 	mode_t mode; // File type and permissions
 	uint16_t gid;
 	uint16_t uid;
-	uint64_t addrs[NDIRECT + 1 + 1]; // Data block addresses
+	uint64_t addrs[NADDRS]; // Data block addresses
 	short major; // Major device number
 	short minor; // Minor device number
 	short nlink; // Number of links to inode in file system
 	/* 2 bytes of padding */
+
+	// Pages of the file's data that mmap() has asked for, in a two
+	// level table indexed by page number (see pcache_get()). They live
+	// as long as the inode has references, and mappings hold those.
+	char ***pcache;
+
+	// The log transactions that last changed the inode, and its data
+	// or size, for fsync() and fdatasync().
+	uint64_t tid;
+	uint64_t data_tid;
 };
 // On-disk inode structure
 struct dinode {
@@ -90,7 +104,7 @@ struct dinode {
 	mode_t mode; // File type and permissions
 	uint16_t gid;
 	uint16_t uid;
-	uint64_t addrs[NDIRECT + 1 + 1]; // Data block addresses
+	uint64_t addrs[NADDRS]; // Data block addresses
 	short major; // Major device number
 	short minor; // Minor device number
 	short nlink; // Number of links to inode in file system
@@ -110,6 +124,7 @@ struct dinode {
 #define BBLOCK(b, sb) ((b) / BPB + (sb).bmapstart)
 
 #if !defined(USE_HOST_TOOLS) || __RELIX_KERNEL__
+#include <stdbool.h>
 #include <sys/stat.h>
 void read_superblock(dev_t dev, struct superblock *sb);
 // Directory is a file containing a sequence of dirent structures.
@@ -117,8 +132,11 @@ int dirlink(struct inode *, const char *, uint32_t);
 struct inode *dirlookup(struct inode *, const char *, uint64_t *);
 struct inode *inode_alloc(dev_t, mode_t);
 struct inode *inode_dup(struct inode *);
-void inode_init(dev_t dev);
+void inode_init(void);
+int fs_mount(dev_t dev);
+int inode_unmount(dev_t dev);
 void inode_lock(struct inode *ip) __acquires(&ip->lock);
+void inode_lock_shared(struct inode *ip) __acquires(&ip->lock);
 void inode_put(struct inode *);
 void inode_unlock(struct inode *ip) __releases(&ip->lock);
 void inode_unlockput(struct inode *ip) __releases(&ip->lock);
@@ -134,6 +152,15 @@ ssize_t inode_read(struct inode *ip, char *, off_t off, size_t n)
 void inode_stat(struct inode *ip, struct stat *) __must_hold(&ip->lock);
 ssize_t inode_write(struct inode *ip, char *, off_t off, size_t n)
 	__must_hold(&ip->lock);
+char *pcache_lookup(struct inode *ip, off_t off) __must_hold(&ip->lock);
+char *pcache_get(struct inode *ip, off_t off) __must_hold(&ip->lock);
+int pcache_writeback(struct inode *ip, off_t off);
+void pcache_destroy(char ***pcache);
+int inode_sync(struct inode *ip, bool datasync);
+int inode_truncate(struct inode *ip, off_t length);
+int inode_punch(struct inode *ip, off_t off, off_t len);
+int inode_fallocate(struct inode *ip, off_t off, off_t len, bool keep_size);
+void inode_reclaim(void);
 #endif
 #endif
 #endif // !_FS_H
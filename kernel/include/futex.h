@@ -0,0 +1,13 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mm;
+
+void futexinit(void);
+bool futex_addr_ok(struct mm *mm, uintptr_t addr);
+
+int futex_wait(uint32_t *uaddr, uint32_t val, long timeout_ms);
+int futex_wake(uint32_t *uaddr, int n);
+#endif
@@ -1,9 +1,11 @@
 #pragma once
 #if __RELIX_KERNEL__
 #include <buf.h>
+#include <stdbool.h>
 
 void ide_init(void);
 void ide_disk_init(void);
 void ideintr(void);
 void iderw(struct block_buffer *);
+bool ide_present(dev_t dev);
 #endif
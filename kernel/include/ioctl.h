@@ -1,6 +1,8 @@
 #pragma once
 /* Exported to userspace */
 #include "fb.h"
+#include "profiler.h"
+#include "tracing.h"
 #include <pci.h>
 #include <sys/types.h>
 #include <termios.h>
@@ -56,3 +58,20 @@
 // Set/clear the current tty.
 #define TIOCSCTTY _IOC('T', _IOC_RW, sizeof(void), 18)
 #define TIOCNOTTY _IOC('T', _IOC_RW, sizeof(void), 19)
+
+// Profiler (/dev/prof).
+// Start sampling every arg timer ticks on each CPU, dropping whatever
+// was collected before.
+#define PROFIOCSTART _IOC('p', _IOC_WO, sizeof(int), 0)
+// Stop sampling. Returns how many samples were lost to full buffers.
+#define PROFIOCSTOP _IOC('p', _IOC_NONE, sizeof(void), 1)
+// Look up a kernel address.
+#define PROFIOCKSYM _IOC('p', _IOC_RW, sizeof(struct prof_symbol), 2)
+
+// Tracing (/dev/trace).
+// Turn on the TRACE_* bits in arg, clearing the statistics and
+// dropping the events that were collected before.
+#define TRACEIOCSTART _IOC('t', _IOC_WO, sizeof(int), 0)
+// Turn everything off. What was collected stays to be read.
+#define TRACEIOCSTOP _IOC('t', _IOC_NONE, sizeof(void), 1)
+#define TRACEIOCINFO _IOC('t', _IOC_RO, sizeof(struct trace_info), 2)
@@ -5,3 +5,5 @@ extern char __kernel_begin[]; // first address before kernel loaded from ELF
 extern char __kernel_end[]; // first address after kernel loaded from ELF file
 extern char __kernel_data[];
 extern char __kernel_edata[];
+extern char __start_ex_table[];
+extern char __stop_ex_table[];
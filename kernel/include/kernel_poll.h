@@ -0,0 +1,46 @@
+#pragma once
+#include "spinlock.h"
+#include <poll.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+struct eventpoll;
+struct file;
+struct pollhead;
+struct pollwaiter;
+
+// Called when the object a waiter is queued on changes state.
+// events is a hint of what happened, or 0 if unknown.
+typedef void (*pollwaiter_func)(struct pollwaiter *w, int events);
+
+// One waiter on one pollhead. Whoever embeds it owns its memory, and must
+// remove it from the pollhead before freeing it.
+struct pollwaiter {
+	struct pollwaiter *next;
+	struct pollwaiter *prev;
+	struct pollhead *head; // Queue we are on, or NULL.
+	pollwaiter_func func;
+};
+
+// Wait queue embedded in every object that can be polled.
+struct pollhead {
+	struct spinlock lock;
+	struct pollwaiter *first;
+};
+
+void pollhead_init(struct pollhead *ph);
+void pollwaiter_add(struct pollhead *ph, struct pollwaiter *w);
+void pollwaiter_remove(struct pollwaiter *w);
+void pollwake(struct pollhead *ph, int events);
+
+int vfs_poll(struct file *f, struct pollwaiter *w);
+int do_poll(struct pollfd *fds, nfds_t nfds, long timeout_ms);
+
+struct file *epoll_create(int flags);
+int epoll_ctl(struct file *epf, int op, int fd, struct epoll_event *event);
+int epoll_wait(struct file *epf, struct epoll_event *events, int maxevents,
+               long timeout_ms);
+int epoll_poll(struct eventpoll *ep, struct pollwaiter *w);
+void epoll_close(struct eventpoll *ep);
+
@@ -2,8 +2,18 @@
 #if __RELIX_KERNEL__
 #include "lib/compiler_attributes.h"
 #include <buf.h>
+#include <stdbool.h>
+#include <stdint.h>
+void log_init(void);
 void initlog(dev_t dev);
+int log_unmount(dev_t dev);
+void log_join(dev_t dev);
 void log_write(struct block_buffer *);
+uint64_t log_tid(dev_t dev);
+void log_force(dev_t dev, uint64_t tid);
+void log_sync(void);
+bool log_room(dev_t dev, size_t need);
+void log_yield(void);
 void begin_op(void) __acquires(op);
 void end_op(void) __releases(op);
 #endif
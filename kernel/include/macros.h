@@ -1,6 +1,7 @@
 #pragma once
 #if __RELIX_KERNEL__
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 #define swap(a, b)              \
 	do {                          \
 		__typeof__(a) __temp_a = a; \
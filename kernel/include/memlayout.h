@@ -30,6 +30,12 @@
 #define KERNBASE (ULONG_MAX - PHYSLIMIT + 1) // 0xFFFFFFFF80000000ULL
 // First device virtual address
 #define DEVBASE (KERNBASE - 1 * GiB) // 0xFFFFFFFF40000000ULL
+// End of the lower canonical half; user memory is always below this.
+#define USER_ADDR_LIMIT 0x0000800000000000ULL
+// mmap() places mappings below here: the most a process's page
+// directory covers, less the two entries that point back up to the
+// other levels (see setupkvm).
+#define USER_MMAP_END (510 * 2 * MiB)
 #endif
 
 #ifndef __ASSEMBLER__
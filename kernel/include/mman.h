@@ -2,14 +2,38 @@
 #define _MMAN_H
 #pragma once
 /* Exported to userspace */
+#define PROT_NONE 0x0
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
+// Accepted, but there is no way to stop execution anyway.
+#define PROT_EXEC 0x4
 #define MAP_SHARED 0x1
 
 // POSIX 2024
 #define MAP_ANONYMOUS 0x2
 #define MAP_ANON MAP_ANONYMOUS
 
+#define MAP_PRIVATE 0x4
+#define MAP_FIXED 0x10
+
+// msync()
+#define MS_ASYNC 0x1
+#define MS_INVALIDATE 0x2
+#define MS_SYNC 0x4
+
+// madvise()
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
+#define MADV_DONTNEED 4
+
+#define POSIX_MADV_NORMAL MADV_NORMAL
+#define POSIX_MADV_RANDOM MADV_RANDOM
+#define POSIX_MADV_SEQUENTIAL MADV_SEQUENTIAL
+#define POSIX_MADV_WILLNEED MADV_WILLNEED
+#define POSIX_MADV_DONTNEED MADV_DONTNEED
+
 #if __RELIX_KERNEL__
 #include "file.h"
 #include <stddef.h>
@@ -205,8 +205,10 @@ struct segdesc {
 #define PTE_AVL (0b111 << 9) // Available/Unused
 // Custom PTE flags (contained within PTE_AVL).
 #define PTE_COW (1 << 9)
-#define PTE_UNUSED10 (1 << 10)
-#define PTE_UNUSED11 (1 << 11)
+// The page belongs to the page cache, not to this page table.
+#define PTE_PCACHE (1 << 10)
+// A write should copy the page first (a private file mapping).
+#define PTE_COPY (1 << 11)
 
 // Page directory entry flags.
 #define PDE_P (1 << 0) // Present
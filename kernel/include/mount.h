@@ -0,0 +1,15 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include "fs.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+void mount_init(void);
+void mount_root(dev_t dev);
+int mount_fs(dev_t dev, struct inode *target);
+int umount_fs(struct inode *root);
+struct inode *mount_cross_down(struct inode *ip);
+struct inode *mount_cross_up(struct inode *ip);
+bool mount_is_covered(struct inode *ip);
+#endif
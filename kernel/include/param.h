@@ -3,16 +3,24 @@
 #define NPROC 64 // maximum number of processes
 #define KSTACKSIZE 4096 // size of per-process kernel stack
 #define NCPU 128 // maximum number of CPUs
-#define NFILE 100 // open files per system
+#define NFILE 8192 // open files per system
 #define NINODE 50 // maximum number of active i-nodes
-#define NDEV 10 // maximum major device number
-#define ROOTDEV 1 // device number of file system root disk
+#define NDEV 12 // maximum major device number
+#define ROOTDEV 1 // IDE drive the root file system is on with CONFIG_IDE
+#define SATADEV 2 // device number of the first AHCI SATA drive
+#define RAMDEV 3 // device number of the RAM disk
+#define NDISK 4 // number of block devices; IDE drives are 0 and 1
+#define TMPFSDEV NDISK // device number of the tmpfs, which has no disk
+#define NMOUNT 8 // maximum number of mounted file systems
 #define MAXARG 32 // max exec arguments
 #define MAXOPBLOCKS 10U // max # of blocks any FS op writes
+// Max bytes of file data one FS op writes: what is left of MAXOPBLOCKS
+// after the i-node, an indirect block and 2 blocks of slop for
+// non-aligned writes, halved for the allocation blocks.
+#define MAXOPBYTES (((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512)
 #define LOGSIZE (MAXOPBLOCKS * 3LU) // max data blocks in on-disk log
-#define NBUF (MAXOPBLOCKS * 3LU) // size of disk block cache
+#define NBUF (MAXOPBLOCKS * 5LU) // size of each disk's block cache; > LOGSIZE
 #define FSSIZE (10 * 2048LU) // size of file system in blocks
 #define MAXENV 32
 #define MAX_PCI_DEVICES 32
-#define NMMAP 10 // maximum number of mmap()'s allowed per process
 #define NTTY 128 // maximum number of TTYs.
@@ -1,16 +1,22 @@
 #pragma once
 #if __RELIX_KERNEL__
 #include <file.h>
+#include "kernel_poll.h"
+#include <sys/uio.h>
 
 struct pipe {
 	struct spinlock lock;
 	int readopen; // read fd is still open
 	int writeopen; // write fd is still open
 	struct ring_buf *ring_buffer;
+	struct pollhead pollhead;
 };
 
 int pipealloc(struct file **, struct file **);
 void pipeclose(struct pipe *, int);
 ssize_t piperead(struct pipe *, char *, size_t n);
 ssize_t pipewrite(struct pipe *, char *, size_t n);
+ssize_t pipereadv(struct pipe *, const struct iovec *, int iovcnt);
+ssize_t pipewritev(struct pipe *, const struct iovec *, int iovcnt);
+int pipepoll(struct pipe *, struct file *, struct pollwaiter *);
 #endif
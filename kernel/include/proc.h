@@ -7,6 +7,8 @@
 #include "mman.h"
 #include "mmu.h"
 #include "param.h"
+#include "procstat.h"
+#include "sleeplock.h"
 #include "spinlock.h"
 #include "syscall.h"
 #include <limits.h>
@@ -43,6 +45,14 @@ struct cpu {
 #if __x86_64__
 	void *local;
 #endif
+	struct mcs_node mcs_node; // Our place in a contended spinlock's queue.
+	// Where the time went, in TSC cycles; see acct.c.
+	struct cpu_stat acct;
+	uint64_t acct_tsc; // When time was last charged to someone.
+	// TLB flushes asked of this CPU, and how many it has done; see
+	// tlb_shootdown().
+	uint64_t tlb_req;
+	uint64_t tlb_done;
 };
 
 extern struct cpu cpus[NCPU];
@@ -73,38 +83,67 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE, STOPPED };
 
-// Per-process state
-struct proc {
+// A user address space. Threads created with CLONE_VM share one.
+struct mm {
+	int ref; // Protected by ptable.lock.
+	int exited; // How many of those have exited; ptable.lock too.
+	struct sleeplock lock; // Serializes growing, mapping and faults.
 	uintptr_t sz; // Size of process memory (bytes)
 	uintptr_t *pgdir; // Page table
+	struct vma *vmas; // mmap()ed regions; see vma.h
+	uintptr_t heap; // Where mmap() starts looking for room.
+};
+
+// Open files and working directory. Threads created with
+// CLONE_FILES share one.
+struct files {
+	struct spinlock lock; // Protects ref and the ofile slots.
+	int ref;
+	struct file *ofile[OPEN_MAX]; // Open files
+	struct inode *cwd; // Current directory
+};
+
+// Per-process state. Each thread of a process has its own.
+struct proc {
+	struct mm *mm; // Address space
+	struct files *files; // Open files and current directory
 	char *kstack; // Bottom of kernel stack for this process
 	enum procstate state; // Process state
-	pid_t pid; // Process ID
+	pid_t pid; // Process ID; the thread ID for threads
+	pid_t tgid; // Thread group ID, which is what getpid() returns
+	struct proc *group_leader; // First thread of the group
+	bool group_exiting; // Set on the leader once any thread calls exit()
 	pid_t pgid; // Process Group ID
 	pid_t sid; // Session ID
 #define PROC_HAS_NO_CTTY (~((dev_t)0))
 	dev_t ctty; // Controlling terminal for this session ID
 	int status;
 	struct proc *parent; // Parent process
+	struct proc *vfork_parent; // Asleep in vfork() until we exec or exit
 	struct trapframe *tf; // Trap frame for current syscall
 	struct context *context; // swtch() here to run process
 	void *chan; // If non-zero, sleeping on chan
+	time_t sleep_deadline; // If non-zero, also wake up at this tick
 	int killed; // If non-zero, have been killed
-	struct file *ofile[OPEN_MAX]; // Open files
-	struct inode *cwd; // Current directory
+	int fsop_depth; // begin_op() calls not yet ended
+	uint32_t fslogs; // Logs that FS call has joined, by disk
+	uintptr_t fs_base; // User %fs base, for thread-local storage
+	pid_t *clear_child_tid; // Zeroed and futex-woken when the thread exits
 	struct cred cred; // user's credentials for the process.
+	struct proc_usage usage; // This thread's; see acct.c.
+	struct proc_usage gone; // Threads of the process that are gone.
+	struct proc_usage cusage; // Children it has waited for.
 	char name[16]; // Process name (debugging)
 	char ptrace_mask_ptr[SYSCALL_AMT + 1]; // mask for tracing syscalls
-	struct mmap_info mmap_info[NMMAP];
-	size_t mmap_count;
-	uintptr_t heap; // Location of the heap.
-	uintptr_t heapsz;
 	sighandler_t sig_handlers[NSIG];
 	int last_signal;
 	mode_t umask;
-	uint8_t legacy_fpu_state[512] __attribute__((aligned(16)));
-	uint8_t fpu_header[64] __attribute__((aligned(16)));
-	uint8_t extended_fpu_state[0] __attribute__((aligned(16)));
+	// Saved FPU, SSE and AVX registers, laid out the way XSAVE wants
+	// them: the legacy FXSAVE area, the XSAVE header, then the upper
+	// halves of the YMM registers.
+	uint8_t legacy_fpu_state[512] __attribute__((aligned(64)));
+	uint8_t fpu_header[64];
+	uint8_t extended_fpu_state[256];
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -115,7 +154,15 @@ struct proc {
 
 int my_cpu_id(void);
 void exit(int) __attribute__((noreturn));
+void thread_exit(int) __attribute__((noreturn));
 pid_t fork(void);
+pid_t clone(unsigned long flags, uintptr_t stack, pid_t *parent_tid,
+            pid_t *child_tid, uintptr_t tls);
+int kill_other_threads(void);
+void vfork_done(struct proc *);
+struct mm *mm_alloc(void);
+void mm_put(struct mm *);
+void mm_exit(struct mm *);
 int growproc(intptr_t);
 int kill(pid_t, int);
 
@@ -126,13 +173,17 @@ struct proc *myproc(void);
 
 void pinit(void);
 void procdump(void);
+int proc_getrusage(struct proc *curproc, int who, struct proc_usage *u);
+size_t proc_stat_all(struct proc_stat *st, size_t max);
 void scheduler(void) __attribute__((noreturn));
 void sched(void);
 void setproc(struct proc *);
 void sleep(void *, struct spinlock *);
+void sleep_until(void *, struct spinlock *, time_t deadline);
 void userinit(void);
 int waitpid(pid_t pid, int *status, int options);
 void wakeup(void *);
+void wakeup_timer(void *chan, time_t now);
 void sleep_on_ms(time_t ms);
 void yield(void);
 bool is_in_group(gid_t group, struct cred *cred);
@@ -0,0 +1,41 @@
+#pragma once
+/* Exported to userspace */
+#include <stdint.h>
+#include <sys/types.h>
+
+// What a thread, a process or the children it has waited for used.
+// The kernel counts time in TSC cycles; everything handed out is in
+// nanoseconds.
+struct proc_usage {
+	uint64_t utime; // In user mode.
+	uint64_t stime; // In the kernel on its behalf.
+	uint64_t nvcsw; // Gave up the CPU to wait for something.
+	uint64_t nivcsw; // Had the CPU taken away.
+	uint64_t minflt; // Page faults served without I/O.
+	uint64_t majflt; // Page faults that read from disk.
+	uint64_t inblock; // Blocks read from disk.
+	uint64_t oublock; // Blocks written to disk.
+};
+
+// One per process, read from /dev/procstat. read() returns whole
+// ones.
+struct proc_stat {
+	pid_t pid;
+	pid_t ppid;
+	uid_t uid;
+	char state; // R, S, Z, T, or E while it is being made.
+	int8_t cpu; // Where it is running, or -1.
+	uint16_t nthreads;
+	uint64_t size; // Bytes of memory below the break.
+	char name[16];
+	struct proc_usage usage; // Every thread, dead ones included.
+	struct proc_usage cusage; // Children it has waited for.
+};
+
+// One per CPU, read from /dev/cpustat, indexed by CPU number.
+struct cpu_stat {
+	uint64_t user; // Nanoseconds running user code.
+	uint64_t sys; // Running the kernel for a process.
+	uint64_t idle; // With nothing to run, scheduler included.
+	uint64_t nswitch; // Processes switched to.
+};
@@ -0,0 +1,27 @@
+#pragma once
+/* Exported to userspace */
+#include <stdint.h>
+#include <sys/types.h>
+
+// How many return addresses a sample keeps.
+#define PROF_DEPTH 15
+
+// One sample from /dev/prof. read() returns whole ones.
+struct prof_sample {
+	pid_t pid; // The process that was running, or 0 if none was.
+	uint16_t cpu;
+	uint8_t user; // Whether it was running in user mode.
+	uint8_t depth; // How many of pcs are filled in.
+	// pcs[0] is where it was; the rest are its callers. Kernel
+	// samples taken during a system call go on into the user stack.
+	uint64_t pcs[PROF_DEPTH];
+};
+
+#define PROF_SYMLEN 64
+
+// For PROFIOCKSYM: the kernel function that addr is in.
+struct prof_symbol {
+	uint64_t addr; // In.
+	uint64_t offset; // Out: how far into the function addr is.
+	char name[PROF_SYMLEN]; // Out.
+};
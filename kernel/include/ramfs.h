@@ -0,0 +1,10 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include <buf.h>
+#include <stdbool.h>
+
+void ramfs_init(void);
+int ramfs_disk_init(void);
+bool ramfs_present(void);
+void ramfs_rw(struct block_buffer *);
+#endif
@@ -5,20 +5,54 @@
 #ifndef USE_HOST_TOOLS
 #include <stdatomic.h>
 #endif
-// Long-term locks for processes
+struct proc;
+
+// Long-term locks for processes.
+// Adaptive: a contended acquire spins for a while as long as the owner
+// is running on another CPU, and only sleeps once that stops paying off.
 struct sleeplock {
 	atomic_int locked; // Is the lock held?
-	struct spinlock lk; // spinlock protecting this sleep lock
+	atomic_int waiters; // Processes asleep (or about to be) on this lock.
+	_Atomic(struct proc *) owner; // Process holding lock
+	struct spinlock lk; // spinlock protecting the sleep/wakeup handoff
 
 	// For debugging:
 	const char *name; // Name of lock.
 	int pid; // Process holding lock
 };
+
+// Long-term reader/writer lock for processes.
+// Any number of readers, or a single writer. Waiting writers hold off
+// new readers so they cannot be starved. Adaptive like struct
+// sleeplock while a writer holds it; readers are not tracked, so
+// waiting for them always sleeps.
+struct rwsleeplock {
+	struct spinlock lk; // spinlock protecting this lock
+	int readers; // Number of shared holders
+	int writer; // Held exclusively?
+	_Atomic(struct proc *) owner; // The writer, if any
+	int writers_waiting;
+	int readers_waiting;
+
+	// For debugging:
+	const char *name; // Name of lock.
+	int pid; // Process holding lock exclusively
+};
 #if __RELIX_KERNEL__
 void acquiresleep(struct sleeplock *s) __acquires(s);
 void releasesleep(struct sleeplock *s) __releases(s);
 int holdingsleep(struct sleeplock *);
 void initsleeplock(struct sleeplock *, const char *);
 
+void initrwsleeplock(struct rwsleeplock *, const char *);
+void acquirerwsleep_write(struct rwsleeplock *s) __acquires(s);
+void releaserwsleep_write(struct rwsleeplock *s) __releases(s);
+void acquirerwsleep_read(struct rwsleeplock *s) __acquires(s);
+void releaserwsleep_read(struct rwsleeplock *s) __releases(s);
+void releaserwsleep(struct rwsleeplock *s) __releases(s);
+void downgraderwsleep(struct rwsleeplock *s);
+int holdingrwsleep_write(struct rwsleeplock *);
+int holdingrwsleep(struct rwsleeplock *);
+
 #endif
 #endif // !_SLEEPLOCK_H
@@ -13,15 +13,42 @@
 #endif
 #include "lib/compiler_attributes.h"
 #include <stdatomic.h>
+#include <stdbool.h>
+
+// Queue node for a CPU waiting on a contended spinlock.
+// Each waiter spins on its own node instead of on the lock word, so
+// a release only touches the cache line of the next waiter (MCS).
+// Spinlocks are taken with interrupts off, so a CPU waits on at most
+// one lock at a time and one node per CPU is enough.
+struct mcs_node {
+	_Atomic(struct mcs_node *) next;
+	atomic_int locked; // Set by our predecessor when we are the queue head.
+};
+
+// Contention counters. Only kept for locks passed to lockstat_register(),
+// and only written by the CPU holding the lock.
+struct lock_stats {
+	uint64_t acquisitions;
+	uint64_t contended; // Acquisitions that had to take the slow path.
+	uint64_t spins; // Pause iterations spent waiting.
+	uint64_t max_hold; // Longest hold time, in TSC cycles.
+	uint64_t acquired_at; // TSC value when the current holder got the lock.
+};
+
 // Mutual exclusion lock.
 struct spinlock {
 	atomic_int locked;
+	_Atomic(struct mcs_node *) tail; // Last waiter in the queue, or NULL.
 
 	// For debugging:
 	const char *name; // Name of lock.
 	struct cpu *cpu; // The cpu holding the lock.
 	uintptr_t pcs[10]; // The call stack (an array of program counters)
-	                   // that locked the lock.
+	                   // that locked the lock. Only filled in debug builds.
+
+	bool tracked; // Whether stats are being collected.
+	struct lock_stats stats;
+	struct spinlock *stats_next; // Next lock in the lockstat registry.
 };
 #if __RELIX_KERNEL__
 void acquire(struct spinlock *s) __acquires(s);
@@ -33,5 +60,9 @@ void release(struct spinlock *s) __releases(s);
 void pushcli(void);
 void popcli(void);
 
+void lockstat_register(struct spinlock *lk);
+void lockstat_reset(void);
+size_t lockstat_format(char *buf, size_t n);
+
 #endif
 #endif /* _SPINLOCK_H */
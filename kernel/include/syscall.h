@@ -63,7 +63,37 @@
 #define SYS_getgroups 60
 #define SYS_getsid 61
 #define SYS_setsid 62
-#define SYSCALL_AMT 62
+#define SYS_poll 63
+#define SYS_ppoll 64
+#define SYS_epoll_create1 65
+#define SYS_epoll_ctl 66
+#define SYS_epoll_wait 67
+#define SYS_readv 68
+#define SYS_preadv 69
+#define SYS_pwritev 70
+#define SYS_pread 71
+#define SYS_pwrite 72
+#define SYS_sendfile 73
+#define SYS_splice 74
+#define SYS_copy_file_range 75
+#define SYS_clone 76
+#define SYS_exit_thread 77
+#define SYS_gettid 78
+#define SYS_futex 79
+#define SYS_arch_prctl 80
+#define SYS_sched_yield 81
+#define SYS_vfork 82
+#define SYS_mprotect 83
+#define SYS_msync 84
+#define SYS_madvise 85
+#define SYS_mount 86
+#define SYS_umount 87
+#define SYS_fdatasync 88
+#define SYS_sync 89
+#define SYS_ftruncate 90
+#define SYS_fallocate 91
+#define SYS_getrusage 92
+#define SYSCALL_AMT 92
 #ifndef __ASSEMBLER__
 #include <stddef.h>
 #include <sys/types.h>
@@ -131,6 +161,36 @@ __attribute__((unused)) static const char *syscall_names[SYSCALL_AMT + 1] = {
 	[SYS_getgroups] = "getgroups",
 	[SYS_setsid] = "setsid",
 	[SYS_getsid] = "getsid",
+	[SYS_poll] = "poll",
+	[SYS_ppoll] = "ppoll",
+	[SYS_epoll_create1] = "epoll_create1",
+	[SYS_epoll_ctl] = "epoll_ctl",
+	[SYS_epoll_wait] = "epoll_wait",
+	[SYS_readv] = "readv",
+	[SYS_preadv] = "preadv",
+	[SYS_pwritev] = "pwritev",
+	[SYS_pread] = "pread",
+	[SYS_pwrite] = "pwrite",
+	[SYS_sendfile] = "sendfile",
+	[SYS_splice] = "splice",
+	[SYS_copy_file_range] = "copy_file_range",
+	[SYS_clone] = "clone",
+	[SYS_exit_thread] = "exit_thread",
+	[SYS_gettid] = "gettid",
+	[SYS_futex] = "futex",
+	[SYS_arch_prctl] = "arch_prctl",
+	[SYS_sched_yield] = "sched_yield",
+	[SYS_vfork] = "vfork",
+	[SYS_mprotect] = "mprotect",
+	[SYS_msync] = "msync",
+	[SYS_madvise] = "madvise",
+	[SYS_mount] = "mount",
+	[SYS_umount] = "umount",
+	[SYS_fdatasync] = "fdatasync",
+	[SYS_sync] = "sync",
+	[SYS_ftruncate] = "ftruncate",
+	[SYS_fallocate] = "fallocate",
+	[SYS_getrusage] = "getrusage",
 };
 #endif
 #if __RELIX_KERNEL__ && !defined(__ASSEMBLER__)
@@ -160,6 +220,7 @@ int fetchunsigned_long(uintptr_t, unsigned long *);
 int fetchuintptr_t(uintptr_t addr, uintptr_t *ip);
 
 int argptr(int, char **, int);
+int argptr_out(int, char **, int);
 ssize_t argstr(int, char **);
 ssize_t fetchstr(uintptr_t, char **);
 
@@ -0,0 +1,23 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include "fs.h"
+#include "param.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+void tmpfs_init(void);
+int tmpfs_mount(void);
+void tmpfs_unmount(void);
+struct inode *tmpfs_alloc(mode_t mode);
+void tmpfs_load(struct inode *ip) __must_hold(&ip->lock);
+void tmpfs_update(struct inode *ip) __must_hold(&ip->lock);
+void tmpfs_release(struct inode *ip);
+
+// Does ip live on the tmpfs, with no disk blocks behind it?
+static inline bool
+tmpfs_inode(const struct inode *ip)
+{
+	return ip->dev == TMPFSDEV;
+}
+#endif
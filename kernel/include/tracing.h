@@ -0,0 +1,60 @@
+#pragma once
+/* Exported to userspace */
+#include <stdint.h>
+#include <sys/types.h>
+
+// Bits for TRACEIOCSTART. Bit 0 turns on the system call statistics;
+// the others turn on the tracepoint of that number.
+#define TRACE_SYSCALLS (1u << 0)
+#define TRACE_BIT(type) (1u << (type))
+#define TRACE_ALL 0xffffffffu
+
+// Tracepoints. What arg0 and arg1 are depends on the type.
+enum {
+	// arg0: pid switched to, arg1: pid switched from. 0 is the
+	// scheduler.
+	TRACE_SCHED_SWITCH = 1,
+	// arg0: first sector, arg1: 1 for a write, 0 for a read.
+	TRACE_BLOCK_SUBMIT = 2,
+	TRACE_BLOCK_COMPLETE = 3,
+	// arg0: faulting address, arg1: error code.
+	TRACE_PAGE_FAULT = 4,
+	// arg0: blocks in the transaction, arg1: TSC cycles it took.
+	TRACE_LOG_COMMIT = 5,
+	// arg0: 0 for the keyboard, 1 for the mouse, arg1: TSC cycles
+	// from the interrupt to the read that took the event.
+	TRACE_INPUT = 6,
+	TRACE_NTYPES,
+};
+
+// Latency histogram buckets: bucket i counts calls that took
+// [2^i, 2^(i+1)) TSC cycles, and the last one everything longer.
+#define SYSSTAT_BUCKETS 40
+
+// One per system call number, read from /dev/sysstat: the array
+// is indexed by SYS_*, summed over every CPU.
+struct syscall_stat {
+	uint64_t count;
+	uint64_t cycles; // Total.
+	uint64_t max;
+	uint64_t hist[SYSSTAT_BUCKETS];
+};
+
+// One event from /dev/trace. read() returns whole ones.
+struct trace_event {
+	uint64_t tsc;
+	uint16_t type;
+	uint16_t cpu;
+	pid_t pid; // What was running, or 0 if nothing was.
+	uint64_t arg0;
+	uint64_t arg1;
+};
+
+// For TRACEIOCINFO.
+struct trace_info {
+	uint64_t tsc_khz; // 0 if there was nothing to measure it against.
+	uint64_t tsc; // Now.
+	uint32_t mask; // What is on.
+	uint32_t nsyscalls; // Entries in /dev/sysstat.
+	uint64_t dropped; // Events that found their ring full.
+};
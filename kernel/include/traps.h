@@ -40,6 +40,7 @@
 #define IRQ_PS2_MOUSE 12
 #define IRQ_IDE 14
 #define IRQ_ERROR 19
+#define IRQ_TLB 30 // TLB shootdown IPI; see tlb_shootdown()
 #define IRQ_SPURIOUS 31
 #define IRQ_SATA 10
 #endif
@@ -1,7 +1,12 @@
 #pragma once
 #if __RELIX_KERNEL__
+#include <stddef.h>
+
 void uartinit1(void);
 void uartinit2(void);
+void uartinit3(void);
 void uartintr(void);
 void uartputc(int);
+void uartwrite(const char *buf, size_t n);
+void uart_panic(void);
 #endif
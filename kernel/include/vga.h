@@ -41,6 +41,9 @@ struct vga_rectangle {
 };
 void vga_init(struct multiboot_tag_framebuffer *tag);
 void vga_write_char(int c, uint32_t foreground, uint32_t background);
+void vga_draw_char(int c, uint32_t foreground, uint32_t background);
+void vga_begin_batch(void);
+void vga_end_batch(void);
 void vga_reset_char_index(void);
 // Raw pixel writing.
 void vga_fill_rect(struct vga_rectangle rect, uint32_t hex_color);
@@ -1,8 +1,11 @@
 #pragma once
 #if __RELIX_KERNEL__
+#include "mmu.h"
 #include "proc.h"
+#include <stdbool.h>
 #include <stdint.h>
 void seginit(void);
+pte_t *walkpgdir(uintptr_t *pgdir, const void *va, bool alloc);
 void kvmalloc(void);
 uintptr_t *setupkvm(void);
 char *uva2ka(uintptr_t *, char *);
@@ -17,7 +20,13 @@ int loaduvm(uintptr_t *pgdir, char *addr, struct inode *ip, off_t offset,
 uintptr_t *copyuvm(uintptr_t *, size_t);
 void switchuvm(struct proc *);
 void switchkvm(void);
+void tlb_shootdown(struct mm *mm);
+void tlb_shootdown_intr(void);
 int copyout(uintptr_t *pgdir, uintptr_t va, void *pa, size_t len);
+size_t __copy_user(void *dst, const void *src, size_t n);
+int copy_to_user(void *udst, const void *src, size_t n);
+int copy_from_user(void *dst, const void *usrc, size_t n);
+uintptr_t exception_fixup(uintptr_t rip);
 void setpteu(uintptr_t *pgdir, char *uva);
 void clearpteu(uintptr_t *pgdir, char *uva);
 int mappages(uintptr_t *pgdir, void *va, uintptr_t size, uintptr_t pa,
@@ -0,0 +1,50 @@
+#pragma once
+#if __RELIX_KERNEL__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct file;
+struct mm;
+
+// One mmap()ed region of an address space. An mm keeps its regions
+// in an AVL tree ordered by address; they never overlap.
+struct vma {
+	uintptr_t start; // Page aligned.
+	uintptr_t end; // Page aligned, one past the last byte.
+	int prot; // PROT_*
+	int flags; // MAP_*
+	int advice; // MADV_*
+	// What is mapped: anonymous memory if file is NULL, physical
+	// memory from phys on if file is a device, and otherwise the
+	// file's page cache from offset on.
+	struct file *file;
+	off_t offset;
+	uintptr_t phys;
+
+	struct vma *left;
+	struct vma *right;
+	int height;
+};
+
+struct vma *vma_find(struct vma *root, uintptr_t addr);
+struct vma *vma_next(struct vma *root, uintptr_t addr);
+void vma_insert(struct vma **root, struct vma *vma);
+void vma_remove(struct vma **root, struct vma *vma);
+
+// These need mm->lock.
+ssize_t mm_map(struct mm *mm, uintptr_t addr, size_t length, int prot,
+               int flags, struct file *file, off_t offset);
+int mm_unmap(struct mm *mm, uintptr_t addr, size_t length);
+int mm_protect(struct mm *mm, uintptr_t addr, size_t length, int prot);
+int mm_sync(struct mm *mm, uintptr_t addr, size_t length, int flags);
+int mm_advise(struct mm *mm, uintptr_t addr, size_t length, int advice);
+int mm_copy(struct mm *dst, struct mm *src);
+
+// These take it themselves, or do without.
+void mm_unmap_all(struct mm *mm, uintptr_t *pgdir);
+uintptr_t mm_region_end(struct mm *mm, uintptr_t addr);
+int mm_user_range(struct mm *mm, uintptr_t addr, size_t len, bool write);
+int mm_fault(struct mm *mm, uintptr_t addr, bool write);
+#endif
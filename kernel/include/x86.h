@@ -118,7 +118,7 @@ write_gs(uint16_t v)
 }
 
 static __always_inline void
-stosb(void *addr, int data, int cnt)
+stosb(void *addr, int data, size_t cnt)
 {
 	__asm__ __volatile__("cld; rep stosb"
 	                     : "=D"(addr), "=c"(cnt)
@@ -134,8 +134,16 @@ stosl(void *addr, int data, int cnt)
 	                     : "0"(addr), "1"(cnt), "a"(data)
 	                     : "memory", "cc");
 }
+static __always_inline void
+stosq(void *addr, uint64_t data, size_t cnt)
+{
+	__asm__ __volatile__("cld; rep stosq"
+	                     : "=D"(addr), "=c"(cnt)
+	                     : "0"(addr), "1"(cnt), "a"(data)
+	                     : "memory", "cc");
+}
 static __always_inline void *
-movsq(uint64_t *dst, uint64_t *src, size_t size)
+movsq(uint64_t *dst, const uint64_t *src, size_t size)
 {
 	__asm__ __volatile__("rep movsq"
 	                     : "+D"(dst), "+S"(src), "+c"(size)
@@ -144,7 +152,7 @@ movsq(uint64_t *dst, uint64_t *src, size_t size)
 	return dst;
 }
 static __always_inline void *
-movsb(uint8_t *dst, uint8_t *src, size_t size)
+movsb(uint8_t *dst, const uint8_t *src, size_t size)
 {
 	__asm__ __volatile__("rep movsb"
 	                     : "+D"(dst), "+S"(src), "+c"(size)
@@ -255,6 +263,20 @@ lcr3(uintptr_t val)
 	__asm__ __volatile__("movq %0,%%cr3" : : "r"(val));
 }
 
+static __always_inline uintptr_t
+rcr3(void)
+{
+	uintptr_t val;
+	__asm__ __volatile__("mov %%cr3,%0" : "=r"(val));
+	return val;
+}
+
+static __always_inline void
+invlpg(const void *addr)
+{
+	__asm__ __volatile__("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
 static __always_inline void
 hlt(void)
 {
@@ -40,6 +40,7 @@ void
 kinit1(void *vstart, void *vend)
 {
 	initlock(&kmem.lock, "kmem");
+	lockstat_register(&kmem.lock);
 	kmem.use_lock = false;
 	freerange(vstart, vend);
 }
@@ -55,9 +56,15 @@ void
 freerange(void *vstart, void *vend)
 {
 	char *p = (char *)PGROUNDUP((uintptr_t)vstart);
+	// Leave alone what the boot loader loaded, such as a RAM disk.
+	struct multiboot_tag_module *mod = get_multiboot_module();
 	// If this fails, this will cause a page fault
 	// instead of a panic due to the memory for the VGA not being mapped.
 	for (; p + PGSIZE <= (char *)vend; p += PGSIZE) {
+		if (mod != NULL && V2P(p) + PGSIZE > mod->mod_start &&
+		    V2P(p) < mod->mod_end) {
+			continue;
+		}
 		kpage_free(p);
 	}
 }
@@ -21,12 +21,17 @@ printint(void (*put_function)(char, char *), char *put_func_buf, int64_t xx,
          int base, bool sgn, int flags, int padding)
 {
 	static const char digits[] = "0123456789abcdef";
-	char buf[4096];
+	// 64 binary digits, a "0b" prefix and a sign, plus room for padding.
+	// Kernel stacks are only a page, so wider padding is clamped.
+	char buf[128];
 	int i = 0;
 	int neg = 0;
 	uint64_t x;
 	int ret;
 
+	if (padding > (int)sizeof(buf) - 4) {
+		padding = sizeof(buf) - 4;
+	}
 	if (sgn && xx < 0) {
 		neg = 1;
 		x = -xx;
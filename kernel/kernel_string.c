@@ -1,7 +1,13 @@
+#include "console.h"
+#include "cpu.h"
+#include "kalloc.h"
+#include "kernel_assert.h"
 #include "macros.h"
+#include "mmu.h"
 #include "x86.h"
 #include <ctype.h>
 #include <dirent.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -181,67 +187,176 @@ strtok(char *restrict str, const char *restrict delimeter)
 	return start;
 }
 
+// memset(), memcmp(), memmove() and memcpy() below sit under every
+// pipe, block cache and exec copy. Small sizes are done with a couple
+// of possibly overlapping word moves. Bigger ones use the string
+// instructions, which on CPUs with ERMS (fast "rep movsb"/"rep stosb")
+// or FSRM (fast for short lengths too) beat anything we could write
+// without SSE.
+typedef uint64_t u64u __attribute__((aligned(1), may_alias));
+typedef uint32_t u32u __attribute__((aligned(1), may_alias));
+typedef uint16_t u16u __attribute__((aligned(1), may_alias));
+
+// Without ERMS, "rep movsb" is slow and we move words instead. With
+// only ERMS, it still has a startup cost that short copies notice.
+#define ERMS_THRESHOLD 256
+
+static __always_inline bool
+use_rep_movsb(size_t n)
+{
+	if (cpu_misc_features & MISC_FEATURE_FSRM) {
+		return true;
+	}
+	return (cpu_misc_features & MISC_FEATURE_ERMS) && n >= ERMS_THRESHOLD;
+}
+
+// Copy up to 32 bytes. Everything is loaded before anything is
+// stored, so this is safe for overlapping buffers too.
+static __always_inline void
+copy_upto_32(char *d, const char *s, size_t n)
+{
+	if (n >= 16) {
+		uint64_t a = *(const u64u *)s, b = *(const u64u *)(s + 8);
+		uint64_t y = *(const u64u *)(s + n - 16), z = *(const u64u *)(s + n - 8);
+		*(u64u *)d = a;
+		*(u64u *)(d + 8) = b;
+		*(u64u *)(d + n - 16) = y;
+		*(u64u *)(d + n - 8) = z;
+	} else if (n >= 8) {
+		uint64_t a = *(const u64u *)s, z = *(const u64u *)(s + n - 8);
+		*(u64u *)d = a;
+		*(u64u *)(d + n - 8) = z;
+	} else if (n >= 4) {
+		uint32_t a = *(const u32u *)s, z = *(const u32u *)(s + n - 4);
+		*(u32u *)d = a;
+		*(u32u *)(d + n - 4) = z;
+	} else if (n >= 2) {
+		uint16_t a = *(const u16u *)s, z = *(const u16u *)(s + n - 2);
+		*(u16u *)d = a;
+		*(u16u *)(d + n - 2) = z;
+	} else if (n == 1) {
+		*d = *s;
+	}
+}
+
+// Copy from the front. Also correct when dst is below src, since every
+// byte is read before the copy gets far enough to overwrite it.
+static __always_inline void
+copy_forward(char *d, const char *s, size_t n)
+{
+	if (n <= 32) {
+		copy_upto_32(d, s, n);
+		return;
+	}
+	if (use_rep_movsb(n)) {
+		movsb((uint8_t *)d, (const uint8_t *)s, n);
+		return;
+	}
+	// The last word is read up front and covers the leftover bytes.
+	uint64_t tail = *(const u64u *)(s + n - 8);
+	movsq((uint64_t *)d, (const uint64_t *)s, n / 8);
+	*(u64u *)(d + n - 8) = tail;
+}
+
 void *
 memset(void *dst, int c, size_t n)
 {
-	if ((size_t)dst % 4 == 0 && n % 4 == 0) {
-		c &= 0xFF;
-		stosl(dst, (c << 24) | (c << 16) | (c << 8) | c, n / 4);
+	char *d = dst;
+	uint64_t v = (uint8_t)c * 0x0101010101010101ULL;
+
+	if (n >= 16 && n <= 32) {
+		*(u64u *)d = v;
+		*(u64u *)(d + 8) = v;
+		*(u64u *)(d + n - 16) = v;
+		*(u64u *)(d + n - 8) = v;
+	} else if (n >= 8 && n < 16) {
+		*(u64u *)d = v;
+		*(u64u *)(d + n - 8) = v;
+	} else if (n >= 4 && n < 8) {
+		*(u32u *)d = (uint32_t)v;
+		*(u32u *)(d + n - 4) = (uint32_t)v;
+	} else if (n < 4) {
+		if (n >= 2) {
+			*(u16u *)d = (uint16_t)v;
+			*(u16u *)(d + n - 2) = (uint16_t)v;
+		} else if (n == 1) {
+			*d = (char)c;
+		}
+	} else if (use_rep_movsb(n)) {
+		stosb(d, (uint8_t)c, n);
 	} else {
-		stosb(dst, c, n);
+		stosq(d, v, n / 8);
+		*(u64u *)(d + n - 8) = v;
 	}
 	return dst;
 }
 
+// Compare a word at a time. The first differing byte decides the
+// result, and on little-endian that is the lowest one, so swapping the
+// bytes lets a plain integer compare find it.
 int
 memcmp(const void *v1, const void *v2, size_t n)
 {
-	const uint8_t *dst, *s2;
+	const uint8_t *a = v1, *b = v2;
 
-	dst = v1;
-	s2 = v2;
-	while (n-- > 0) {
-		if (*dst != *s2) {
-			return *dst - *s2;
+	if (n < 8) {
+		for (size_t i = 0; i < n; i++) {
+			if (a[i] != b[i]) {
+				return a[i] - b[i];
+			}
+		}
+		return 0;
+	}
+	for (size_t i = 0;; i += 8) {
+		// The last word may overlap the one before it, whose bytes
+		// already compared equal.
+		if (i > n - 8) {
+			i = n - 8;
+		}
+		uint64_t x = *(const u64u *)(a + i), y = *(const u64u *)(b + i);
+		if (x != y) {
+			return __builtin_bswap64(x) < __builtin_bswap64(y) ? -1 : 1;
+		}
+		if (i == n - 8) {
+			return 0;
 		}
-		dst++, s2++;
 	}
-
-	return 0;
 }
+
 __deprecated("Removed in POSIX.1-2008") int bcmp(const void *v1, const void *v2,
                                                  size_t n)
 {
 	return memcmp(v1, v2, n);
 }
 
-// Based on code from https://libc11.org/string/memmove.html (public domain)
-void *
+// The loop copies words from the end; GCC must not turn it back into
+// a call to memmove().
+__attribute__((optimize("no-tree-loop-distribute-patterns"))) void *
 memmove(void *dst, const void *src, size_t n)
 {
-	char *dest = (char *)dst;
-	const char *source = (const char *)src;
-	if (dest == source || n == 0) {
+	char *d = dst;
+	const char *s = src;
+
+	if (d == s || n == 0) {
 		return dst;
 	}
-
-	if (dest == NULL) {
-		return NULL;
+	// Going forwards is safe unless dst starts inside src.
+	if (d < s || d >= s + n) {
+		copy_forward(d, s, n);
+		return dst;
 	}
-	// If source is lower than dest in memory,
-	// we don't have to worry about clobbering it going forwards.
-	if (dest < source) {
-		while (n--) {
-			*dest++ = *source++;
-		}
-	} else {
-		// We may clobber going forwards, so let's go backwards.
-		source += n;
-		dest += n;
-		while (n--) {
-			*--dest = *--source;
-		}
+	if (n <= 32) {
+		copy_upto_32(d, s, n);
+		return dst;
 	}
+	// Backwards a word at a time. The first word is read up front and
+	// covers the bytes left over at the start.
+	uint64_t head = *(const u64u *)s;
+	size_t i;
+	for (i = n; i >= 8; i -= 8) {
+		*(u64u *)(d + i - 8) = *(const u64u *)(s + i - 8);
+	}
+	*(u64u *)d = head;
 	return dst;
 }
 
@@ -254,11 +369,8 @@ mempcpy(void *dst, const void *src, size_t n)
 void *
 memcpy(void *dst, const void *src, size_t n)
 {
-	if (n % 8 == 0) {
-		return movsq((uint64_t *)dst, (uint64_t *)src, n / sizeof(uint64_t)) - n;
-	} else {
-		return movsb((uint8_t *)dst, (uint8_t *)src, n / sizeof(uint8_t)) - n;
-	}
+	copy_forward(dst, src, n);
+	return dst;
 }
 
 char *
@@ -377,3 +489,83 @@ strpbrk(const char *s1, const char *s2)
 	}
 	return NULL;
 }
+
+#if __RELIX_KERNEL_DEBUG__
+// Byte-at-a-time versions to compare against, kept from being turned
+// into calls to the functions they are measuring.
+__attribute__((noinline, optimize("no-tree-loop-distribute-patterns"))) static void
+bytewise_copy(char *d, const char *s, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		d[i] = s[i];
+	}
+}
+
+__attribute__((noinline, optimize("no-tree-loop-distribute-patterns"))) static int
+bytewise_cmp(const uint8_t *a, const uint8_t *b, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (a[i] != b[i]) {
+			return a[i] - b[i];
+		}
+	}
+	return 0;
+}
+
+// Time the copy primitives on a page at a time, and check that they
+// agree with the byte loops while we are at it.
+void
+kernel_string_benchmark(void)
+{
+	static const size_t sizes[] = { 16, 64, 512, PGSIZE };
+	enum { ROUNDS = 256 };
+	char *a = kpage_alloc(), *b = kpage_alloc();
+
+	if (a == NULL || b == NULL) {
+		goto out;
+	}
+	for (size_t i = 0; i < PGSIZE; i++) {
+		a[i] = (char)(i * 7);
+	}
+	memcpy(b, a, PGSIZE);
+	kernel_assert(bytewise_cmp((uint8_t *)a, (uint8_t *)b, PGSIZE) == 0);
+	memmove(b + 1, b, PGSIZE - 1);
+	kernel_assert(memcmp(b + 1, a, PGSIZE - 1) == 0);
+	b[PGSIZE - 1] ^= 1;
+	kernel_assert(memcmp(a, b + 1, PGSIZE - 1) != 0);
+
+	pr_debug_file("cycles per call (bytewise/tuned), erms=%d fsrm=%d\n",
+	              (cpu_misc_features & MISC_FEATURE_ERMS) != 0,
+	              (cpu_misc_features & MISC_FEATURE_FSRM) != 0);
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t n = sizes[i];
+		uint64_t t0 = rdtsc();
+		for (int r = 0; r < ROUNDS; r++) {
+			bytewise_copy(b, a, n);
+		}
+		uint64_t t1 = rdtsc();
+		for (int r = 0; r < ROUNDS; r++) {
+			memcpy(b, a, n);
+		}
+		uint64_t t2 = rdtsc();
+		for (int r = 0; r < ROUNDS; r++) {
+			kernel_assert(bytewise_cmp((uint8_t *)a, (uint8_t *)b, n) == 0);
+		}
+		uint64_t t3 = rdtsc();
+		for (int r = 0; r < ROUNDS; r++) {
+			kernel_assert(memcmp(a, b, n) == 0);
+		}
+		uint64_t t4 = rdtsc();
+		pr_debug_file("%4zu bytes: memcpy %lu/%lu memcmp %lu/%lu\n", n,
+		              (t1 - t0) / ROUNDS, (t2 - t1) / ROUNDS, (t3 - t2) / ROUNDS,
+		              (t4 - t3) / ROUNDS);
+	}
+out:
+	if (a != NULL) {
+		kpage_free(a);
+	}
+	if (b != NULL) {
+		kpage_free(b);
+	}
+}
+#endif
@@ -2,10 +2,15 @@
 #include "bio.h"
 #include "buf.h"
 #include "console.h"
+#include "dev/trace.h"
 #include "fs.h"
+#include "kernel_assert.h"
 #include "param.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "trap.h"
+#include "x86.h"
+#include <errno.h>
 #include <string.h>
 
 // Simple logging that allows concurrent FS system calls.
@@ -20,7 +25,13 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log commits.
+//
+// end_op() does not wait for the commit, so a transaction collects
+// the updates of one system call after another. It commits once the
+// log is getting full, once it is LOG_COMMIT_TICKS old, or when
+// log_force() wants it on disk for fsync() or sync(). Until then, a
+// crash loses it whole.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -29,7 +40,17 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous. The header write that commits is a
+// barrier: the log blocks are on the media before it, and it is
+// before the blocks are installed. So is the one that clears the log
+// again, so that the next transaction cannot overwrite log blocks
+// that a stale header still points to.
+//
+// Every mounted disk has a log of its own, which commits on its own.
+// begin_op() does not know yet which file systems the call will
+// change, so the call joins a log the first time it locks an inode
+// on that file system for writing (see log_join()), and end_op()
+// leaves every log it joined.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -44,14 +65,48 @@ struct log {
 	size_t size;
 	size_t outstanding; // how many FS sys calls are executing.
 	int committing; // in commit(), please wait.
+	int forcing; // log_force() is waiting; commit as soon as possible.
 	dev_t dev;
+	uint64_t tid; // The open transaction.
+	uint64_t committed; // The last transaction on disk.
+	time_t opened; // ticks when the open transaction got its first block.
 	struct logheader lh;
 };
-static struct log log;
 
-static void recover_from_log(void);
-static void commit(void);
+// Oldest a transaction gets before end_op() commits it.
+#define LOG_COMMIT_TICKS 5000
+
+// One per disk, indexed by device. size is 0 unless a file system
+// on the disk is mounted.
+static struct log logs[NDISK];
+
+static void recover_from_log(struct log *log);
+static void commit(struct log *log);
+static void log_commit_locked(struct log *log);
 
+void
+log_init(void)
+{
+	for (dev_t dev = 0; dev < NDISK; dev++) {
+		initlock(&logs[dev].lock, "log");
+		lockstat_register(&logs[dev].lock);
+		logs[dev].dev = dev;
+		logs[dev].tid = 1;
+	}
+}
+
+// The log of the file system on dev, or NULL if it has none.
+static struct log *
+log_of(dev_t dev)
+{
+	if (dev >= NDISK || logs[dev].size == 0) {
+		return NULL;
+	}
+	return &logs[dev];
+}
+
+// Start logging for the file system on dev, which is being mounted,
+// and replay whatever a crash left in its log.
 void
 initlog(dev_t dev)
 {
@@ -60,23 +115,43 @@ initlog(dev_t dev)
 	}
 
 	struct superblock sb;
-	initlock(&log.lock, "log");
+	struct log *log = &logs[dev];
 	read_superblock(dev, &sb);
-	log.start = sb.logstart;
-	log.size = sb.nlog;
-	log.dev = dev;
-	recover_from_log();
+	log->start = sb.logstart;
+	log->size = sb.nlog;
+	recover_from_log(log);
+}
+
+// Stop logging for dev, which is being unmounted. Returns -EBUSY if
+// a file system call is still part of its transaction.
+int
+log_unmount(dev_t dev)
+{
+	struct log *log = &logs[dev];
+	int ret = 0;
+
+	acquire(&log->lock);
+	if (log->outstanding > 0 || log->committing) {
+		ret = -EBUSY;
+	} else {
+		if (log->lh.n > 0) {
+			log_commit_locked(log);
+		}
+		log->size = 0;
+	}
+	release(&log->lock);
+	return ret;
 }
 
 // Copy committed blocks from log to their home location
 static void
-install_trans(void)
+install_trans(struct log *log)
 {
-	for (size_t tail = 0; tail < log.lh.n; tail++) {
+	for (size_t tail = 0; tail < log->lh.n; tail++) {
 		struct block_buffer *lbuf =
-			block_read(log.dev, log.start + tail + 1); // read log block
-		struct block_buffer *dbuf = block_read(log.dev, log.lh.block[tail]); // read
-		                                                                     // dst
+			block_read(log->dev, log->start + tail + 1); // read log block
+		struct block_buffer *dbuf =
+			block_read(log->dev, log->lh.block[tail]); // read dst
 		memmove(dbuf->data, lbuf->data, BSIZE); // copy block to dst
 		block_write(dbuf); // write dst to disk
 		block_release(lbuf);
@@ -86,13 +161,13 @@ install_trans(void)
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct log *log)
 {
-	struct block_buffer *buf = block_read(log.dev, log.start);
+	struct block_buffer *buf = block_read(log->dev, log->start);
 	struct logheader *lh = (struct logheader *)(buf->data);
-	log.lh.n = lh->n;
-	for (size_t i = 0; i < log.lh.n; i++) {
-		log.lh.block[i] = lh->block[i];
+	log->lh.n = lh->n;
+	for (size_t i = 0; i < log->lh.n; i++) {
+		log->lh.block[i] = lh->block[i];
 	}
 	block_release(buf);
 }
@@ -100,90 +175,245 @@ read_head(void)
 // Write in-memory log header to disk.
 // This is the true point at which the
 // current transaction commits.
+// Everything written before it reaches the media first.
 static void
-write_head(void)
+write_head(struct log *log)
 {
-	struct block_buffer *buf = block_read(log.dev, log.start);
+	struct block_buffer *buf = block_read(log->dev, log->start);
 	struct logheader *hb = (struct logheader *)(buf->data);
-	hb->n = log.lh.n;
-	for (size_t i = 0; i < log.lh.n; i++) {
-		hb->block[i] = log.lh.block[i];
+	hb->n = log->lh.n;
+	for (size_t i = 0; i < log->lh.n; i++) {
+		hb->block[i] = log->lh.block[i];
 	}
+	buf->flags |= B_FLUSH | B_FUA;
 	block_write(buf);
 	block_release(buf);
 }
 
 static void
-recover_from_log(void)
+recover_from_log(struct log *log)
 {
-	read_head();
-	install_trans(); // if committed, copy from log to disk
-	log.lh.n = 0;
-	write_head(); // clear the log
+	read_head(log);
+	install_trans(log); // if committed, copy from log to disk
+	log->lh.n = 0;
+	write_head(log); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
-	acquire(&log.lock);
+	myproc()->fsop_depth++;
+}
+
+// Take part in the transaction of the file system on dev, if the
+// current FS system call has not already. Waits if that log is
+// committing or might run out of space.
+void
+log_join(dev_t dev)
+{
+	struct proc *p = myproc();
+	struct log *log = log_of(dev);
+
+	if (p == NULL || p->fsop_depth == 0 || log == NULL ||
+	    (p->fslogs & (1U << dev))) {
+		return;
+	}
+	acquire(&log->lock);
 	while (1) {
-		if (log.committing) {
-			sleep(&log, &log.lock);
-		} else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
-			// this op might exhaust log space; wait for commit.
-			sleep(&log, &log.lock);
+		if (log->committing || log->forcing) {
+			sleep(log, &log->lock);
+		} else if (log->lh.n + (log->outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
+			// this op might exhaust log space; wait for commit,
+			// or commit now if nothing else is in the transaction.
+			if (log->outstanding == 0) {
+				log_commit_locked(log);
+			} else {
+				sleep(log, &log->lock);
+			}
 		} else {
-			log.outstanding += 1;
-			release(&log.lock);
+			log->outstanding += 1;
+			release(&log->lock);
 			break;
 		}
 	}
+	p->fslogs |= 1U << dev;
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
-void
-end_op(void)
+// Should the open transaction commit once nothing is in it?
+static bool
+log_due(struct log *log)
 {
-	int do_commit = 0;
+	if (log->forcing) {
+		return true;
+	}
+	// Commit before the next operation would have to wait for room.
+	if (log->lh.n + 2 * MAXOPBLOCKS > LOGSIZE) {
+		return true;
+	}
+	return log->lh.n > 0 && ticks - log->opened >= LOG_COMMIT_TICKS;
+}
 
-	acquire(&log.lock);
-	log.outstanding -= 1;
-	if (log.committing) {
+// Leave log, committing if this was its last outstanding operation
+// and the transaction is due.
+static void
+log_leave(struct log *log)
+{
+	acquire(&log->lock);
+	log->outstanding -= 1;
+	if (log->committing) {
 		panic("log.committing");
 	}
-	if (log.outstanding == 0) {
-		do_commit = 1;
-		log.committing = 1;
+	if (log->outstanding == 0 && log_due(log)) {
+		log_commit_locked(log);
 	} else {
-		// begin_op() may be waiting for log space,
-		// and decrementing log.outstanding has decreased
+		// log_join() may be waiting for log space,
+		// and decrementing log->outstanding has decreased
 		// the amount of reserved space.
-		wakeup(&log);
+		wakeup(log);
 	}
-	release(&log.lock);
+	release(&log->lock);
+}
+
+// Commit the open transaction and open the next one. Caller holds
+// log->lock, which is let go while the commit writes, and nothing
+// may be in the transaction.
+static void
+log_commit_locked(struct log *log)
+{
+	kernel_assert(log->outstanding == 0 && !log->committing);
+	log->committing = 1;
+	release(&log->lock);
+	// call commit w/o holding locks, since not allowed
+	// to sleep with locks.
+	commit(log);
+	acquire(&log->lock);
+	log->committed = log->tid++;
+	log->committing = 0;
+	log->forcing = 0;
+	wakeup(log);
+}
+
+// The open transaction of the log on dev, which an operation that
+// has joined the log is part of. 0 if dev has no log.
+uint64_t
+log_tid(dev_t dev)
+{
+	struct log *log = log_of(dev);
 
-	if (do_commit) {
-		// call commit w/o holding locks, since not allowed
-		// to sleep with locks.
-		commit();
-		acquire(&log.lock);
-		log.committing = 0;
-		wakeup(&log);
-		release(&log.lock);
+	return log != NULL ? log->tid : 0;
+}
+
+// Return once transaction tid of the log on dev is on disk,
+// committing it if it is still open. Must not be called from inside
+// an FS system call, which would be waiting for itself.
+void
+log_force(dev_t dev, uint64_t tid)
+{
+	struct log *log = log_of(dev);
+
+	if (log == NULL) {
+		return;
+	}
+	kernel_assert(myproc()->fsop_depth == 0);
+	acquire(&log->lock);
+	while (log->committed < tid) {
+		if (log->committing) {
+			sleep(log, &log->lock);
+		} else if (log->outstanding > 0) {
+			// Hold off new operations so that it drains.
+			log->forcing = 1;
+			sleep(log, &log->lock);
+		} else {
+			log_commit_locked(log);
+		}
+	}
+	release(&log->lock);
+}
+
+// Commit every log that has anything in it.
+void
+log_sync(void)
+{
+	for (dev_t dev = 0; dev < NDISK; dev++) {
+		struct log *log = log_of(dev);
+		if (log != NULL && log->lh.n > 0) {
+			log_force(dev, log->tid);
+		}
+	}
+}
+
+// Leave every log p has joined.
+static void
+log_leave_all(struct proc *p)
+{
+	for (dev_t dev = 0; dev < NDISK; dev++) {
+		if (p->fslogs & (1U << dev)) {
+			log_leave(&logs[dev]);
+		}
 	}
+	p->fslogs = 0;
+}
+
+// called at the end of each FS system call.
+// commits every log it was the last outstanding operation of.
+// Nested calls leave it to the outermost, which then frees what
+// the call unlinked (see inode_reclaim()).
+void
+end_op(void)
+{
+	struct proc *p = myproc();
+
+	kernel_assert(p->fsop_depth > 0);
+	if (--p->fsop_depth > 0) {
+		return;
+	}
+	log_leave_all(p);
+	inode_reclaim();
+}
+
+// For FS system calls with more to write than one operation may:
+// can the caller, which has joined the log on dev, write need more
+// blocks to it? That leaves room for everything else in the
+// transaction to write as many as it may.
+bool
+log_room(dev_t dev, size_t need)
+{
+	struct log *log = log_of(dev);
+
+	if (log == NULL) {
+		return true;
+	}
+	acquire(&log->lock);
+	size_t cap = LOGSIZE < log->size - 1 ? LOGSIZE : log->size - 1;
+	bool room = log->lh.n + need + (log->outstanding - 1) * MAXOPBLOCKS <= cap;
+	release(&log->lock);
+	return room;
+}
+
+// Leave the logs that the calling FS system call has joined, so that
+// they can commit, and carry on with the call: it joins them again as
+// it locks inodes. It does what it has to in steps, with log_room()
+// saying when a step is full; everything up to here may commit
+// without the rest. Only the outermost call may, holding nothing.
+void
+log_yield(void)
+{
+	struct proc *p = myproc();
+
+	kernel_assert(p->fsop_depth == 1);
+	log_leave_all(p);
 }
 
 // Copy modified blocks from cache to log.
 static void
-write_log(void)
+write_log(struct log *log)
 {
-	for (size_t tail = 0; tail < log.lh.n; tail++) {
+	for (size_t tail = 0; tail < log->lh.n; tail++) {
 		struct block_buffer *to =
-			block_read(log.dev, log.start + tail + 1); // log block
+			block_read(log->dev, log->start + tail + 1); // log block
 		struct block_buffer *from =
-			block_read(log.dev, log.lh.block[tail]); // cache block
+			block_read(log->dev, log->lh.block[tail]); // cache block
 		memmove(to->data, from->data, BSIZE);
 		block_write(to); // write the log
 		block_release(from);
@@ -192,14 +422,17 @@ write_log(void)
 }
 
 static void
-commit(void)
+commit(struct log *log)
 {
-	if (log.lh.n > 0) {
-		write_log(); // Write modified blocks from cache to log
-		write_head(); // Write header to disk -- the real commit
-		install_trans(); // Now install writes to home locations
-		log.lh.n = 0;
-		write_head(); // Erase the transaction from the log
+	if (log->lh.n > 0) {
+		uint64_t start = rdtsc();
+		size_t n = log->lh.n;
+		write_log(log); // Write modified blocks from cache to log
+		write_head(log); // Write header to disk -- the real commit
+		install_trans(log); // Now install writes to home locations
+		log->lh.n = 0;
+		write_head(log); // Erase the transaction from the log
+		tracepoint(TRACE_LOG_COMMIT, n, rdtsc() - start);
 	}
 }
 
@@ -216,24 +449,31 @@ void
 log_write(struct block_buffer *b)
 {
 	size_t i;
+	struct log *log = log_of(b->dev);
 
-	if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) {
+	if (log == NULL) {
+		panic("log_write: no log on disk %lu", b->dev);
+	}
+	if (log->lh.n >= LOGSIZE || log->lh.n >= log->size - 1) {
 		panic("too big a transaction");
 	}
-	if (log.outstanding < 1) {
+	if (log->outstanding < 1 || !(myproc()->fslogs & (1U << b->dev))) {
 		panic("log_write outside of trans");
 	}
 
-	acquire(&log.lock);
-	for (i = 0; i < log.lh.n; i++) {
-		if (log.lh.block[i] == b->blockno) { // log absorbtion
+	acquire(&log->lock);
+	for (i = 0; i < log->lh.n; i++) {
+		if (log->lh.block[i] == b->blockno) { // log absorbtion
 			break;
 		}
 	}
-	log.lh.block[i] = b->blockno;
-	if (i == log.lh.n) {
-		log.lh.n++;
+	log->lh.block[i] = b->blockno;
+	if (i == log->lh.n) {
+		if (log->lh.n == 0) {
+			log->opened = ticks;
+		}
+		log->lh.n++;
 	}
 	b->flags |= B_DIRTY; // prevent eviction
-	release(&log.lock);
+	release(&log->lock);
 }
@@ -6,8 +6,12 @@
 #include "dev/fb.h"
 #include "dev/kbd.h"
 #include "dev/lapic.h"
+#include "dev/lockstat.h"
 #include "dev/mouse.h"
 #include "dev/null.h"
+#include "dev/procstat.h"
+#include "dev/prof.h"
+#include "dev/trace.h"
 #include "dev/sd.h"
 
 #include "bio.h"
@@ -15,16 +19,20 @@
 #include "cpu.h"
 #include "disk.h"
 #include "file.h"
+#include "futex.h"
 #include "ioapic.h"
 #include "kalloc.h"
 #include "kernel_assert.h"
 #include "kernel_ld_syms.h"
+#include "log.h"
 #include "memlayout.h"
+#include "mount.h"
 #include "mp.h"
 #include "param.h"
 #include "pci.h"
 #include "picirq.h"
 #include "proc.h"
+#include "tmpfs.h"
 #include "uart.h"
 #include "vga.h"
 #include "vm.h"
@@ -50,10 +58,12 @@ main(struct multiboot_info *mbinfo)
 	| uart-only printing zone |
 	\*-----------------------*/
 	uartinit1(); // serial port
+	// Before kinit1(), so that it knows which memory the boot loader
+	// put modules in.
+	parse_multiboot(mbinfo);
 	// 8MiB allocated just for the kernel.
 	// This is to be considered an "early allocator".
 	kinit1(__kernel_end, P2V(8 * MiB)); // phys page allocator
-	parse_multiboot(mbinfo);
 	kernel_assert(available_memory != 0);
 	// Past kvmalloc, addresses need to be virtual.
 	kvmalloc(); // kernel page table
@@ -83,9 +93,17 @@ main(struct multiboot_info *mbinfo)
 	dev_mouse_init();
 	dev_sd_init();
 	dev_fb_init();
+	dev_lockstat_init();
+	dev_prof_init();
+	dev_trace_init();
+	dev_procstat_init();
 	pinit(); // process table
 	block_init(); // buffer cache
+	log_init(); // per-disk logs
+	mount_init(); // mount table
+	tmpfs_init(); // tmpfs nodes
 	fileinit(); // file table
+	futexinit(); // futex wait queues
 	disk_init();
 	// timerinit();
 	pci_init();
@@ -93,6 +111,7 @@ main(struct multiboot_info *mbinfo)
 	early_init = 0;
 	kinit2(P2V(8 * MiB), P2V(available_memory)); // must come after startothers()
 	userinit(); // first user process
+	uartinit3(); // buffered serial output
 	mpmain(); // finish this processor's setup
 }
 
@@ -113,6 +132,11 @@ mpmain(void)
 {
 	vga_cprintf("\033[97;44mcpu%d: starting\033[m\n", my_cpu_id());
 	cpu_features_init();
+#if __RELIX_KERNEL_DEBUG__
+	if (my_cpu_id() == 0) {
+		kernel_string_benchmark();
+	}
+#endif
 	xchg(&(mycpu()->started), 1); // tell startothers() we're up
 	scheduler(); // start running processes
 }
@@ -0,0 +1,922 @@
+//
+// mmap()ed memory.
+//
+// Each address space keeps its mappings in an AVL tree of struct vma,
+// ordered by address, so a process can have as many as it likes.
+//
+// Anonymous memory is allocated up front, since the kernel touches
+// user buffers with spinlocks held and cannot wait for a page then.
+// File mappings are filled in from the page cache as they fault, a
+// few pages at a time. Private ones map the cached page read-only and
+// copy it on the first write; shared ones write straight into it, and
+// msync(), munmap() and exit write the pages they dirtied back.
+// Device mappings map the device's memory directly.
+//
+
+#include "console.h"
+#include "file.h"
+#include "fs.h"
+#include "kalloc.h"
+#include "kernel_assert.h"
+#include "macros.h"
+#include "memlayout.h"
+#include "mman.h"
+#include "mmu.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "vm.h"
+#include "vma.h"
+#include "x86.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// The AVL tree.
+
+static int
+vma_height(const struct vma *v)
+{
+	return v != NULL ? v->height : 0;
+}
+
+static void
+vma_update(struct vma *v)
+{
+	v->height = 1 + max(vma_height(v->left), vma_height(v->right));
+}
+
+static struct vma *
+vma_rotate_right(struct vma *v)
+{
+	struct vma *l = v->left;
+	v->left = l->right;
+	l->right = v;
+	vma_update(v);
+	vma_update(l);
+	return l;
+}
+
+static struct vma *
+vma_rotate_left(struct vma *v)
+{
+	struct vma *r = v->right;
+	v->right = r->left;
+	r->left = v;
+	vma_update(v);
+	vma_update(r);
+	return r;
+}
+
+// Restore the balance of the subtree at v, one of whose children
+// has just grown or shrunk by one level. Returns its new root.
+static struct vma *
+vma_balance(struct vma *v)
+{
+	vma_update(v);
+	int balance = vma_height(v->left) - vma_height(v->right);
+	if (balance > 1) {
+		if (vma_height(v->left->left) < vma_height(v->left->right)) {
+			v->left = vma_rotate_left(v->left);
+		}
+		return vma_rotate_right(v);
+	}
+	if (balance < -1) {
+		if (vma_height(v->right->right) < vma_height(v->right->left)) {
+			v->right = vma_rotate_right(v->right);
+		}
+		return vma_rotate_left(v);
+	}
+	return v;
+}
+
+static struct vma *
+vma_insert1(struct vma *root, struct vma *v)
+{
+	if (root == NULL) {
+		v->left = NULL;
+		v->right = NULL;
+		v->height = 1;
+		return v;
+	}
+	if (v->start < root->start) {
+		root->left = vma_insert1(root->left, v);
+	} else {
+		root->right = vma_insert1(root->right, v);
+	}
+	return vma_balance(root);
+}
+
+void
+vma_insert(struct vma **root, struct vma *v)
+{
+	*root = vma_insert1(*root, v);
+}
+
+// Unlink the leftmost node under root into *min.
+static struct vma *
+vma_remove_min(struct vma *root, struct vma **min)
+{
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
+	}
+	root->left = vma_remove_min(root->left, min);
+	return vma_balance(root);
+}
+
+static struct vma *
+vma_remove1(struct vma *root, struct vma *v)
+{
+	if (root == NULL) {
+		panic("vma_remove: not in tree");
+	}
+	if (v->start < root->start) {
+		root->left = vma_remove1(root->left, v);
+	} else if (v->start > root->start) {
+		root->right = vma_remove1(root->right, v);
+	} else {
+		if (root->right == NULL) {
+			return root->left;
+		}
+		struct vma *min;
+		struct vma *right = vma_remove_min(root->right, &min);
+		min->left = root->left;
+		min->right = right;
+		return vma_balance(min);
+	}
+	return vma_balance(root);
+}
+
+void
+vma_remove(struct vma **root, struct vma *v)
+{
+	*root = vma_remove1(*root, v);
+}
+
+// Return the lowest mapping that ends above addr, or NULL.
+// Mappings do not overlap, so they are in order of their ends too.
+struct vma *
+vma_next(struct vma *root, uintptr_t addr)
+{
+	struct vma *best = NULL;
+
+	while (root != NULL) {
+		if (root->end > addr) {
+			best = root;
+			root = root->left;
+		} else {
+			root = root->right;
+		}
+	}
+	return best;
+}
+
+// Return the mapping that addr lies in, or NULL.
+struct vma *
+vma_find(struct vma *root, uintptr_t addr)
+{
+	struct vma *v = vma_next(root, addr);
+	return v != NULL && v->start <= addr ? v : NULL;
+}
+
+// Mappings.
+
+static bool
+vma_is_device(const struct vma *v)
+{
+	return v->file != NULL && S_ISCHR(v->file->ip->mode);
+}
+
+static bool
+vma_is_file(const struct vma *v)
+{
+	return v->file != NULL && !S_ISCHR(v->file->ip->mode);
+}
+
+// How many pages one fault fills in, by advice.
+static const int fault_pages[] = {
+	[MADV_NORMAL] = 4,
+	[MADV_RANDOM] = 1,
+	[MADV_SEQUENTIAL] = 32,
+};
+
+// The PTE bits for a page of v. Page cache pages are only written
+// through shared mappings; private ones copy them first.
+static int
+vma_pte_perm(const struct vma *v, bool pcache)
+{
+	int perm = PTE_P;
+
+	if (v->prot != PROT_NONE) {
+		perm |= PTE_U;
+	}
+	if (pcache) {
+		perm |= PTE_PCACHE;
+		if (v->prot & PROT_WRITE) {
+			perm |= (v->flags & MAP_SHARED) ? PTE_W : PTE_COPY;
+		}
+	} else if (v->prot & PROT_WRITE) {
+		perm |= PTE_W;
+	}
+	return perm;
+}
+
+// Forget any stale translation of va, if pgdir is the one in use.
+// Other CPUs running threads of the same process are told by
+// tlb_shootdown(), once for a whole batch of pages.
+static void
+flush_page(uintptr_t *pgdir, uintptr_t va)
+{
+	struct proc *p = myproc();
+	if (p != NULL && p->mm != NULL && p->mm->pgdir == pgdir) {
+		invlpg((void *)va);
+	}
+}
+
+// Return the PTE for va in pgdir if its page is present. Otherwise
+// return NULL, and if there is no page table there at all, move va
+// on to the last page that table would have covered.
+static pte_t *
+present_pte(uintptr_t *pgdir, uintptr_t *va)
+{
+	pte_t *pte = walkpgdir(pgdir, (void *)*va, false);
+
+	if (pte == NULL) {
+		*va = (*va & ~((uintptr_t)NPTENTRIES * PGSIZE - 1)) +
+		      (uintptr_t)(NPTENTRIES - 1) * PGSIZE;
+		return NULL;
+	}
+	return (*pte & PTE_P) ? pte : NULL;
+}
+
+// Bring the present pages of v in [start, end) in line with v->prot.
+// Access that was taken away is gone from every CPU on return; access
+// that was added is picked up by the fault a stale entry causes.
+static void
+vma_set_perm(struct mm *mm, struct vma *v, uintptr_t start, uintptr_t end)
+{
+	bool narrowed = false;
+
+	for (uintptr_t va = start; va < end; va += PGSIZE) {
+		pte_t *pte = present_pte(mm->pgdir, &va);
+		if (pte == NULL) {
+			continue;
+		}
+		pte_t old = *pte;
+		int perm = vma_pte_perm(v, (old & PTE_PCACHE) != 0);
+		*pte = (old & ~(pte_t)(PTE_U | PTE_W | PTE_COPY)) | perm;
+		narrowed |= (old & ~*pte & (PTE_U | PTE_W)) != 0;
+		flush_page(mm->pgdir, va);
+	}
+	if (narrowed) {
+		tlb_shootdown(mm);
+	}
+}
+
+// Pages of one vma that have been taken out of, or cleaned in, its
+// page table, and that other CPUs may still reach through their TLBs
+// until the next tlb_shootdown(). Kept small, as it lives on the
+// kernel stack.
+#define PAGE_BATCH 16
+struct page_batch {
+	int n;
+	uintptr_t va[PAGE_BATCH];
+	pte_t pte[PAGE_BATCH]; // What the PTE was.
+};
+
+// Flush b's pages out of every TLB, then write back the shared file
+// pages that were dirty, and if unmapped, free the pages that were
+// ours. Returns the first error from writing back.
+static int
+page_batch_flush(struct mm *mm, struct vma *v, struct page_batch *b,
+                 bool unmapped)
+{
+	int ret = 0;
+
+	if (b->n == 0) {
+		return 0;
+	}
+	tlb_shootdown(mm);
+	for (int i = 0; i < b->n; i++) {
+		pte_t old = b->pte[i];
+		if (old & PTE_PCACHE) {
+			if ((old & PTE_D) && (v->flags & MAP_SHARED)) {
+				int err = pcache_writeback(
+					v->file->ip, v->offset + (off_t)(b->va[i] - v->start));
+				if (ret == 0) {
+					ret = err;
+				}
+			}
+		} else if (unmapped && !vma_is_device(v)) {
+			kpage_free(p2v(PTE_ADDR(old)));
+		}
+	}
+	b->n = 0;
+	return ret;
+}
+
+// Add the page at va, whose PTE was old, to b, flushing b first if it
+// is full.
+static int
+page_batch_add(struct mm *mm, struct vma *v, struct page_batch *b,
+               uintptr_t va, pte_t old, bool unmapped)
+{
+	int ret = 0;
+
+	if (b->n == PAGE_BATCH) {
+		ret = page_batch_flush(mm, v, b, unmapped);
+	}
+	b->va[b->n] = va;
+	b->pte[b->n++] = old;
+	return ret;
+}
+
+// Take the pages of v in [start, end) out of pgdir, which is mm's or
+// was: write back what a shared file mapping dirtied, and free what
+// was ours.
+static void
+vma_unmap_pages(struct mm *mm, uintptr_t *pgdir, struct vma *v,
+                uintptr_t start, uintptr_t end)
+{
+	struct page_batch b = { 0 };
+
+	for (uintptr_t va = start; va < end; va += PGSIZE) {
+		pte_t *pte = present_pte(pgdir, &va);
+		if (pte == NULL) {
+			continue;
+		}
+		pte_t old = __atomic_exchange_n(pte, 0, __ATOMIC_SEQ_CST);
+		flush_page(pgdir, va);
+		(void)page_batch_add(mm, v, &b, va, old, true);
+	}
+	(void)page_batch_flush(mm, v, &b, true);
+}
+
+static void
+vma_free(struct vma *v)
+{
+	if (v->file != NULL) {
+		(void)vfs_close(v->file);
+	}
+	kfree(v);
+}
+
+// Cut v in two at at, and return the upper half.
+static struct vma *
+vma_split(struct mm *mm, struct vma *v, uintptr_t at)
+{
+	struct vma *upper = kmalloc(sizeof(*upper));
+	if (upper == NULL) {
+		return NULL;
+	}
+	*upper = *v;
+	upper->start = at;
+	upper->offset += at - v->start;
+	if (upper->phys != 0) {
+		upper->phys += at - v->start;
+	}
+	if (upper->file != NULL) {
+		filedup(upper->file, upper->file->flags);
+	}
+	// v keeps its start, so it stays where it is in the tree.
+	v->end = at;
+	vma_insert(&mm->vmas, upper);
+	return upper;
+}
+
+// Check that [addr, addr + length) is a range that mappings could be
+// in, and set *end to its end, rounded up to a whole page.
+static int
+mm_range(uintptr_t addr, size_t length, uintptr_t *end)
+{
+	if (addr % PGSIZE != 0 || length == 0 || length > USER_MMAP_END ||
+	    addr > USER_MMAP_END - PGROUNDUP(length)) {
+		return -EINVAL;
+	}
+	*end = addr + PGROUNDUP(length);
+	return 0;
+}
+
+// Is all of [addr, end) mapped?
+static bool
+mm_range_mapped(struct mm *mm, uintptr_t addr, uintptr_t end)
+{
+	for (struct vma *v; addr < end; addr = v->end) {
+		if ((v = vma_find(mm->vmas, addr)) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Find the lowest free range of length bytes at or above the heap.
+static uintptr_t
+mm_find_gap(struct mm *mm, size_t length)
+{
+	uintptr_t addr = mm->heap;
+	struct vma *v;
+
+	while ((v = vma_next(mm->vmas, addr)) != NULL && v->start < addr + length) {
+		addr = v->end;
+	}
+	return addr <= USER_MMAP_END - length ? addr : 0;
+}
+
+// Let the write that faulted on the page at pte go ahead, by giving
+// the private mapping a copy of the page cache page, so that the file
+// stays as it was. This takes nothing that can sleep, so it works
+// wherever the fault happened, spinlocks or not. Returns 0 if the
+// access can be retried.
+static int
+pte_make_writable(pte_t *pte, uintptr_t va)
+{
+	pte_t old = *pte;
+
+	if (!(old & PTE_P) || (old & PTE_W)) {
+		return 0;
+	}
+	// mprotect() may have taken PROT_WRITE away since the fault.
+	if (!(old & PTE_COPY)) {
+		return -EFAULT;
+	}
+	char *mem = kpage_alloc();
+	if (mem == NULL) {
+		return -ENOMEM;
+	}
+	memmove(mem, p2v(PTE_ADDR(old)), PGSIZE);
+	pte_t new = V2P(mem) | PTE_W |
+	            (PTE_FLAGS(old) & ~(PTE_PCACHE | PTE_COPY | PTE_A | PTE_D));
+	// Another thread may have got there first, or unmapped the page.
+	if (!__atomic_compare_exchange_n(pte, &old, new, false, __ATOMIC_SEQ_CST,
+	                                 __ATOMIC_SEQ_CST)) {
+		kpage_free(mem);
+	}
+	invlpg((void *)va);
+	return 0;
+}
+
+// Fill in the page of file mapping v at va, which is not present,
+// and as many after it as v's advice asks for.
+static int
+vma_fault_file(struct mm *mm, struct vma *v, uintptr_t va, bool write)
+{
+	struct inode *ip = v->file->ip;
+	int ret = 0;
+
+	inode_lock(ip);
+	for (int i = 0; i < fault_pages[v->advice] && va < v->end;
+	     i++, va += PGSIZE) {
+		off_t off = v->offset + (off_t)(va - v->start);
+		pte_t *pte = walkpgdir(mm->pgdir, (void *)va, true);
+		// Read ahead only as far as the file goes, and stop at
+		// the first page that is already there.
+		if (i > 0 && (pte == NULL || (*pte & PTE_P) || off >= ip->size)) {
+			break;
+		}
+		char *page = pte != NULL ? pcache_get(ip, off) : NULL;
+		if (page == NULL) {
+			ret = i == 0 ? -ENOMEM : 0;
+			break;
+		}
+		if (i == 0 && write && !(v->flags & MAP_SHARED)) {
+			char *mem = kpage_alloc();
+			if (mem == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			memmove(mem, page, PGSIZE);
+			*pte = V2P(mem) | vma_pte_perm(v, false);
+		} else {
+			*pte = V2P(page) | vma_pte_perm(v, true);
+		}
+	}
+	inode_unlock(ip);
+	return ret;
+}
+
+// Handle an access to va in v that faulted. mm->lock must be held.
+static int
+vma_fault(struct mm *mm, struct vma *v, uintptr_t va, bool write)
+{
+	va = PGROUNDDOWN(va);
+	if (v->prot == PROT_NONE || (write && !(v->prot & PROT_WRITE))) {
+		return -EFAULT;
+	}
+	pte_t *pte = walkpgdir(mm->pgdir, (void *)va, false);
+	if (pte != NULL && (*pte & PTE_P)) {
+		if (write && (*pte & PTE_COPY)) {
+			return pte_make_writable(pte, va);
+		}
+		// Someone else filled it in first, or it really is read-only.
+		return !write || (*pte & PTE_W) ? 0 : -EFAULT;
+	}
+	if (v->file == NULL) {
+		// Anonymous memory that MADV_DONTNEED gave back.
+		char *mem = kpage_alloc();
+		if (mem == NULL) {
+			return -ENOMEM;
+		}
+		memset(mem, 0, PGSIZE);
+		if (mappages(mm->pgdir, (void *)va, PGSIZE, V2P(mem),
+		             vma_pte_perm(v, false)) < 0) {
+			kpage_free(mem);
+			return -ENOMEM;
+		}
+		return 0;
+	}
+	if (vma_is_device(v)) {
+		return -EFAULT;
+	}
+	return vma_fault_file(mm, v, va, write);
+}
+
+// Make sure the pages of v in [start, end) are present.
+static int
+vma_populate(struct mm *mm, struct vma *v, uintptr_t start, uintptr_t end)
+{
+	for (uintptr_t va = PGROUNDDOWN(start); va < end; va += PGSIZE) {
+		pte_t *pte = walkpgdir(mm->pgdir, (void *)va, false);
+		if (pte == NULL || !(*pte & PTE_P)) {
+			PROPOGATE_ERR(vma_fault(mm, v, va, false));
+		}
+	}
+	return 0;
+}
+
+// Resolve a page fault at addr in mm. Returns 0 if the access can be
+// retried, or a negative errno if it was bad.
+int
+mm_fault(struct mm *mm, uintptr_t addr, bool write)
+{
+	if (mm == NULL || addr >= USER_MMAP_END) {
+		return -EFAULT;
+	}
+	// A write to a private file page, from user code or the kernel,
+	// copies it. Read-only memory stays read-only: argptr_out() has
+	// already turned such buffers away from system calls.
+	pte_t *pte = walkpgdir(mm->pgdir, (void *)addr, false);
+	if (write && pte != NULL && (*pte & PTE_P) && (*pte & PTE_COPY)) {
+		return pte_make_writable(pte, PGROUNDDOWN(addr));
+	}
+	// Anything else may have to wait for the disk, which the kernel
+	// cannot do while it holds a spinlock.
+	if (mycpu()->ncli != 0 || holdingsleep(&mm->lock)) {
+		return -EFAULT;
+	}
+	acquiresleep(&mm->lock);
+	struct vma *v = vma_find(mm->vmas, addr);
+	int ret = v != NULL ? vma_fault(mm, v, addr, write) : -EFAULT;
+	releasesleep(&mm->lock);
+	return ret;
+}
+
+// Map length bytes of file (or anonymous memory if file is NULL) from
+// offset on at addr, or wherever there is room if addr is 0 or taken
+// and flags do not say MAP_FIXED. Returns the address.
+ssize_t
+mm_map(struct mm *mm, uintptr_t addr, size_t length, int prot, int flags,
+       struct file *file, off_t offset)
+{
+	struct mmap_info info = {};
+	uintptr_t end;
+
+	if (length == 0 || addr % PGSIZE != 0 || offset < 0 ||
+	    offset % PGSIZE != 0 || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))) {
+		return -EINVAL;
+	}
+	struct vma *v = kmalloc(sizeof(*v));
+	if (v == NULL) {
+		return -ENOMEM;
+	}
+	*v = (struct vma){
+		.prot = prot,
+		.flags = flags,
+		.advice = MADV_NORMAL,
+		.file = file,
+		.offset = offset,
+	};
+	int ret = 0;
+	if (file != NULL) {
+		struct inode *ip = file->ip;
+		if (file->type != FD_INODE) {
+			ret = -ENODEV;
+		} else if (!file->readable || ((flags & MAP_SHARED) &&
+		                               (prot & PROT_WRITE) && !file->writable)) {
+			ret = -EACCES;
+		} else if (S_ISCHR(ip->mode)) {
+			// "The file has been locked, or too much memory has been locked"
+			if (ip->lock.writer || ip->lock.readers != 0) {
+				ret = -EAGAIN;
+			} else if (ip->major < 0 || ip->major >= NDEV ||
+			           !devsw[ip->major].mmap) {
+				ret = -ENODEV;
+			} else {
+				info = devsw[ip->major].mmap(ip->minor, length, addr,
+				                             vma_pte_perm(v, false));
+				length = info.length;
+				v->phys = info.addr;
+				ret = length != 0 ? 0 : -ENODEV;
+			}
+		} else if (!S_ISREG(ip->mode)) {
+			ret = -ENODEV;
+		}
+	}
+	if (ret == 0 && length > USER_MMAP_END - mm->heap) {
+		ret = -ENOMEM;
+	}
+	if (ret < 0) {
+		kfree(v);
+		return ret;
+	}
+
+	length = PGROUNDUP(length);
+	if (flags & MAP_FIXED) {
+		if (addr < mm->heap || mm_range(addr, length, &end) < 0 ||
+		    (ret = mm_unmap(mm, addr, length)) < 0) {
+			kfree(v);
+			return ret < 0 ? ret : -EINVAL;
+		}
+	} else if (addr < mm->heap || mm_range(addr, length, &end) < 0 ||
+	           (vma_next(mm->vmas, addr) != NULL &&
+	            vma_next(mm->vmas, addr)->start < end)) {
+		// The hint is no good, so go anywhere.
+		if ((addr = mm_find_gap(mm, length)) == 0) {
+			kfree(v);
+			return -ENOMEM;
+		}
+	}
+	v->start = addr;
+	v->end = addr + length;
+
+	if (file == NULL) {
+		ret = alloc_user_bytes(mm->pgdir, length, addr, NULL);
+		if (ret == 0 && prot != (PROT_READ | PROT_WRITE)) {
+			vma_set_perm(mm, v, v->start, v->end);
+		}
+	} else if (vma_is_device(v)) {
+		ret = mappages(mm->pgdir, (void *)addr, length, info.addr, info.perm);
+	}
+	if (ret < 0) {
+		kfree(v);
+		return -ENOMEM;
+	}
+	if (file != NULL) {
+		filedup(file, file->flags);
+	}
+	vma_insert(&mm->vmas, v);
+	return (ssize_t)addr;
+}
+
+// Remove whatever is mapped in [addr, addr + length).
+int
+mm_unmap(struct mm *mm, uintptr_t addr, size_t length)
+{
+	uintptr_t end;
+	struct vma *v;
+
+	PROPOGATE_ERR(mm_range(addr, length, &end));
+	while ((v = vma_next(mm->vmas, addr)) != NULL && v->start < end) {
+		if (v->start < addr) {
+			if (vma_split(mm, v, addr) == NULL) {
+				return -ENOMEM;
+			}
+			continue;
+		}
+		if (v->end > end && vma_split(mm, v, end) == NULL) {
+			return -ENOMEM;
+		}
+		vma_remove(&mm->vmas, v);
+		vma_unmap_pages(mm, mm->pgdir, v, v->start, v->end);
+		vma_free(v);
+	}
+	return 0;
+}
+
+// Take down every mapping of mm, whose pages are in pgdir. Nothing
+// else may be using mm. This can sleep, to write back shared file
+// mappings and to close files.
+void
+mm_unmap_all(struct mm *mm, uintptr_t *pgdir)
+{
+	struct vma *v;
+
+	while ((v = mm->vmas) != NULL) {
+		vma_remove(&mm->vmas, v);
+		vma_unmap_pages(mm, pgdir, v, v->start, v->end);
+		vma_free(v);
+	}
+}
+
+// Change the protection of [addr, addr + length) to prot.
+int
+mm_protect(struct mm *mm, uintptr_t addr, size_t length, int prot)
+{
+	uintptr_t end;
+	struct vma *v;
+
+	PROPOGATE_ERR(mm_range(addr, length, &end));
+	if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		return -EINVAL;
+	}
+	if (!mm_range_mapped(mm, addr, end)) {
+		return -ENOMEM;
+	}
+	// Check it all before changing any of it.
+	for (v = vma_find(mm->vmas, addr); v != NULL && v->start < end;
+	     v = vma_next(mm->vmas, v->end)) {
+		if (vma_is_file(v) && (v->flags & MAP_SHARED) && (prot & PROT_WRITE) &&
+		    !v->file->writable) {
+			return -EACCES;
+		}
+	}
+	for (v = vma_find(mm->vmas, addr); v != NULL && v->start < end;
+	     v = vma_next(mm->vmas, v->end)) {
+		if (v->start < addr && (v = vma_split(mm, v, addr)) == NULL) {
+			return -ENOMEM;
+		}
+		if (v->end > end && vma_split(mm, v, end) == NULL) {
+			return -ENOMEM;
+		}
+		v->prot = prot;
+		vma_set_perm(mm, v, v->start, v->end);
+	}
+	return 0;
+}
+
+// Write what shared file mappings in [addr, addr + length) have
+// changed back to their files.
+int
+mm_sync(struct mm *mm, uintptr_t addr, size_t length, int flags)
+{
+	uintptr_t end;
+
+	PROPOGATE_ERR(mm_range(addr, length, &end));
+	if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) ||
+	    (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+		return -EINVAL;
+	}
+	if (!mm_range_mapped(mm, addr, end)) {
+		return -ENOMEM;
+	}
+	// There is nowhere to queue the writes, so MS_ASYNC does them now
+	// too. The page cache is the only copy in memory, so MS_INVALIDATE
+	// has nothing to do.
+	for (struct vma *v = vma_find(mm->vmas, addr); v != NULL && v->start < end;
+	     v = vma_next(mm->vmas, v->end)) {
+		if (!vma_is_file(v) || !(v->flags & MAP_SHARED)) {
+			continue;
+		}
+		uintptr_t stop = min(end, v->end);
+		struct page_batch b = { 0 };
+		int ret = 0;
+		for (uintptr_t va = max(addr, v->start); va < stop && ret == 0;
+		     va += PGSIZE) {
+			pte_t *pte = present_pte(mm->pgdir, &va);
+			if (pte == NULL || !(*pte & PTE_D)) {
+				continue;
+			}
+			// Clean it first, so that writes from now on count again.
+			pte_t old = __atomic_fetch_and(pte, ~(pte_t)PTE_D, __ATOMIC_SEQ_CST);
+			flush_page(mm->pgdir, va);
+			ret = page_batch_add(mm, v, &b, va, old, false);
+		}
+		int err = page_batch_flush(mm, v, &b, false);
+		PROPOGATE_ERR(ret);
+		PROPOGATE_ERR(err);
+	}
+	return 0;
+}
+
+// Take advice about how [addr, addr + length) will be used.
+int
+mm_advise(struct mm *mm, uintptr_t addr, size_t length, int advice)
+{
+	uintptr_t end;
+
+	PROPOGATE_ERR(mm_range(addr, length, &end));
+	if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+		return -EINVAL;
+	}
+	if (!mm_range_mapped(mm, addr, end)) {
+		return -ENOMEM;
+	}
+	for (struct vma *v = vma_find(mm->vmas, addr); v != NULL && v->start < end;
+	     v = vma_next(mm->vmas, v->end)) {
+		uintptr_t start = max(addr, v->start);
+		uintptr_t stop = min(end, v->end);
+		switch (advice) {
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			// Faults go by this, so it has to cover just the range.
+			if (v->start < addr && (v = vma_split(mm, v, addr)) == NULL) {
+				return -ENOMEM;
+			}
+			if (v->end > end && vma_split(mm, v, end) == NULL) {
+				return -ENOMEM;
+			}
+			v->advice = advice;
+			break;
+		case MADV_WILLNEED:
+			// Read it all in now, rather than a few pages per fault.
+			if (vma_is_file(v) && v->prot != PROT_NONE) {
+				PROPOGATE_ERR(vma_populate(mm, v, start, stop));
+			}
+			break;
+		case MADV_DONTNEED:
+			// Drop the pages. They come back from the file, or zeroed,
+			// so changes to private pages are lost.
+			if (vma_is_device(v)) {
+				return -EINVAL;
+			}
+			vma_unmap_pages(mm, mm->pgdir, v, start, stop);
+			break;
+		}
+	}
+	return 0;
+}
+
+// Give dst, a fresh copy of src's program image, src's mappings too.
+// Anonymous memory and private copies are copied; the page cache and
+// devices are shared. src->lock must be held.
+int
+mm_copy(struct mm *dst, struct mm *src)
+{
+	for (struct vma *v = vma_next(src->vmas, 0); v != NULL;
+	     v = vma_next(src->vmas, v->end)) {
+		struct vma *copy = kmalloc(sizeof(*copy));
+		if (copy == NULL) {
+			return -ENOMEM;
+		}
+		*copy = *v;
+		if (copy->file != NULL) {
+			filedup(copy->file, copy->file->flags);
+		}
+		vma_insert(&dst->vmas, copy);
+
+		bool device = vma_is_device(v);
+		for (uintptr_t va = v->start; va < v->end; va += PGSIZE) {
+			pte_t *pte = present_pte(src->pgdir, &va);
+			if (pte == NULL) {
+				continue;
+			}
+			uintptr_t pa = PTE_ADDR(*pte);
+			char *mem = NULL;
+			if (!device && !(*pte & PTE_PCACHE)) {
+				if ((mem = kpage_alloc()) == NULL) {
+					return -ENOMEM;
+				}
+				memmove(mem, p2v(pa), PGSIZE);
+				pa = V2P(mem);
+			}
+			if (mappages(dst->pgdir, (void *)va, PGSIZE, pa,
+			             PTE_FLAGS(*pte) & ~(PTE_A | PTE_D)) < 0) {
+				if (mem != NULL) {
+					kpage_free(mem);
+				}
+				return -ENOMEM;
+			}
+		}
+	}
+	return 0;
+}
+
+// Return the end of the part of mm that addr lies in: the program
+// image or one of its mappings. Returns 0 if addr is not mapped.
+uintptr_t
+mm_region_end(struct mm *mm, uintptr_t addr)
+{
+	if (addr < mm->sz) {
+		return mm->sz;
+	}
+	acquiresleep(&mm->lock);
+	struct vma *v = vma_find(mm->vmas, addr);
+	uintptr_t end = v != NULL && v->prot != PROT_NONE ? v->end : 0;
+	releasesleep(&mm->lock);
+	return end;
+}
+
+// Check that the kernel may use [addr, addr + len) of mm: that it lies
+// within the program image or one mapping, which has to be writable
+// if the kernel is going to write to it. Fault in whatever part of
+// it is not there yet, since the kernel touches user memory with
+// locks held and cannot always wait for a page then.
+int
+mm_user_range(struct mm *mm, uintptr_t addr, size_t len, bool write)
+{
+	if (addr < mm->sz) {
+		return len <= mm->sz - addr ? 0 : -EFAULT;
+	}
+	acquiresleep(&mm->lock);
+	struct vma *v = vma_find(mm->vmas, addr);
+	int ret = -EFAULT;
+	if (v != NULL && v->prot != PROT_NONE && len <= v->end - addr &&
+	    (!write || (v->prot & PROT_WRITE))) {
+		ret = vma_is_device(v) ? 0 : vma_populate(mm, v, addr, addr + len);
+	}
+	releasesleep(&mm->lock);
+	return ret;
+}
@@ -0,0 +1,248 @@
+// Mount table.
+//
+// Every mounted file system has an entry here: the device it is on
+// and the directory it covers. The root file system covers nothing.
+// namex() asks mount_cross_down() about every directory it steps
+// into and mount_cross_up() about every ".." it follows, so a file
+// system hides the directory it is mounted on until it is unmounted.
+//
+// A device is a disk (see disk.h) with RelixFS on it, each with its
+// own superblock, buffer cache and log, or TMPFSDEV.
+
+#include "bio.h"
+#include "console.h"
+#include "disk.h"
+#include "fs.h"
+#include "log.h"
+#include "mount.h"
+#include "param.h"
+#include "sleeplock.h"
+#include "spinlock.h"
+#include "tmpfs.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+struct mount {
+	bool used;
+	dev_t dev;
+	// The directory it is mounted on, which the entry holds a
+	// reference to. NULL for the root file system.
+	struct inode *covered;
+};
+
+static struct {
+	// Protects the entries. mount_fs() and umount_fs() also hold
+	// the sleeplock the whole way through, so only one of them runs
+	// at a time.
+	struct spinlock lock;
+	struct sleeplock busy;
+	struct mount mounts[NMOUNT];
+} mtable;
+
+void
+mount_init(void)
+{
+	initlock(&mtable.lock, "mount");
+	lockstat_register(&mtable.lock);
+	initsleeplock(&mtable.busy, "mount");
+}
+
+// Mount the root file system. Called from the first process, since
+// recovering the log sleeps.
+void
+mount_root(dev_t dev)
+{
+	if (fs_mount(dev) < 0) {
+		panic("Cannot find any recognized filesytem.");
+	}
+	initlog(dev);
+	mtable.mounts[0] = (struct mount){ .used = true, .dev = dev };
+}
+
+// The entry for dev, or NULL. Caller holds mtable.lock.
+static struct mount *
+mount_of(dev_t dev)
+{
+	for (struct mount *m = mtable.mounts; m < mtable.mounts + NMOUNT; m++) {
+		if (m->used && m->dev == dev) {
+			return m;
+		}
+	}
+	return NULL;
+}
+
+// Mount the file system on dev on the directory target. If it works,
+// the mount takes over the caller's reference to target. Called
+// inside a transaction.
+int
+mount_fs(dev_t dev, struct inode *target)
+{
+	struct mount *m = NULL;
+	int ret = 0;
+
+	inode_lock_shared(target);
+	bool isdir = S_ISDIR(target->mode);
+	inode_unlock(target);
+	if (!isdir) {
+		return -ENOTDIR;
+	}
+
+	acquiresleep(&mtable.busy);
+	acquire(&mtable.lock);
+	if (mount_of(dev) != NULL) {
+		ret = -EBUSY;
+	}
+	for (struct mount *e = mtable.mounts; ret == 0 && e < mtable.mounts + NMOUNT;
+	     e++) {
+		if (!e->used) {
+			m = e;
+			break;
+		}
+	}
+	release(&mtable.lock);
+	if (ret == 0 && m == NULL) {
+		ret = -ENOSPC;
+	}
+	if (ret < 0) {
+		goto out;
+	}
+
+	if (dev == TMPFSDEV) {
+		ret = tmpfs_mount();
+	} else if (!disk_present(dev)) {
+		ret = -ENXIO;
+	} else if ((ret = fs_mount(dev)) == 0) {
+		initlog(dev);
+	}
+	if (ret < 0) {
+		goto out;
+	}
+
+	acquire(&mtable.lock);
+	*m = (struct mount){ .used = true, .dev = dev, .covered = target };
+	release(&mtable.lock);
+	releasesleep(&mtable.busy);
+	return 0;
+
+out:
+	releasesleep(&mtable.busy);
+	return ret;
+}
+
+// Unmount the file system whose root is root, dropping the caller's
+// reference to it. Returns -EBUSY if anything else is using it.
+// Called inside a transaction.
+int
+umount_fs(struct inode *root)
+{
+	dev_t dev = root->dev;
+	struct mount *m;
+	struct inode *covered;
+	int ret;
+
+	acquiresleep(&mtable.busy);
+	acquire(&mtable.lock);
+	m = mount_of(dev);
+	if (m == NULL || m->covered == NULL || root->inum != ROOTINO) {
+		release(&mtable.lock);
+		releasesleep(&mtable.busy);
+		inode_put(root);
+		return -EINVAL;
+	}
+	// Take it out of the tree first, so that nothing new can wander
+	// in while it is checked for users.
+	covered = m->covered;
+	m->used = false;
+	release(&mtable.lock);
+
+	inode_put(root);
+	ret = inode_unmount(dev);
+	if (ret == 0 && dev != TMPFSDEV) {
+		ret = log_unmount(dev);
+	}
+	if (ret < 0) {
+		acquire(&mtable.lock);
+		m->used = true;
+		release(&mtable.lock);
+		releasesleep(&mtable.busy);
+		return ret;
+	}
+
+	if (dev == TMPFSDEV) {
+		tmpfs_unmount();
+	} else {
+		block_invalidate(dev);
+	}
+	releasesleep(&mtable.busy);
+	inode_put(covered);
+	return 0;
+}
+
+// If a file system is mounted on ip, return a reference to its root
+// in place of ip's. Otherwise return ip.
+struct inode *
+mount_cross_down(struct inode *ip)
+{
+	while (1) {
+		dev_t dev = 0;
+		bool found = false;
+
+		acquire(&mtable.lock);
+		for (struct mount *m = mtable.mounts; m < mtable.mounts + NMOUNT; m++) {
+			if (m->used && m->covered == ip) {
+				dev = m->dev;
+				found = true;
+				break;
+			}
+		}
+		release(&mtable.lock);
+		if (!found) {
+			return ip;
+		}
+		inode_put(ip);
+		ip = inode_get(dev, ROOTINO);
+	}
+}
+
+// If ip is the root of a mounted file system, return a reference to
+// the directory it is mounted on in place of ip's, so that ".." leads
+// out of it. Otherwise return ip.
+struct inode *
+mount_cross_up(struct inode *ip)
+{
+	while (ip->inum == ROOTINO) {
+		struct inode *covered = NULL;
+
+		acquire(&mtable.lock);
+		struct mount *m = mount_of(ip->dev);
+		if (m != NULL && m->covered != NULL) {
+			covered = inode_dup(m->covered);
+		}
+		release(&mtable.lock);
+		if (covered == NULL) {
+			break;
+		}
+		inode_put(ip);
+		ip = covered;
+	}
+	return ip;
+}
+
+// Is a file system mounted on ip?
+bool
+mount_is_covered(struct inode *ip)
+{
+	bool covered = false;
+
+	acquire(&mtable.lock);
+	for (struct mount *m = mtable.mounts; m < mtable.mounts + NMOUNT; m++) {
+		if (m->used && m->covered == ip) {
+			covered = true;
+			break;
+		}
+	}
+	release(&mtable.lock);
+	return covered;
+}
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 static struct multiboot_tag_framebuffer mb_fb;
+static struct multiboot_tag_module mb_module;
 
 struct multiboot_tag_framebuffer *
 get_multiboot_framebuffer(void)
@@ -11,6 +12,14 @@ get_multiboot_framebuffer(void)
 	return &mb_fb;
 }
 
+// The first module the boot loader loaded, or NULL if there was
+// none. Its memory is never given to the page allocator.
+struct multiboot_tag_module *
+get_multiboot_module(void)
+{
+	return mb_module.mod_end > mb_module.mod_start ? &mb_module : NULL;
+}
+
 const char *
 multiboot_mmap_type(uint32_t type)
 {
@@ -146,6 +155,14 @@ parse_multiboot(struct multiboot_info *mbinfo)
 			}
 			break;
 		}
+		case MULTIBOOT_TAG_TYPE_MODULE: {
+			struct multiboot_tag_module *mod = (struct multiboot_tag_module *)tag;
+			log_printf("Module %#x-%#x \"%s\"\n", mod->mod_start, mod->mod_end, mod->cmdline);
+			if (get_multiboot_module() == NULL) {
+				mb_module = *mod;
+			}
+			break;
+		}
 		case MULTIBOOT_TAG_TYPE_ELF_SECTIONS: {
 			struct multiboot_tag_elf_sections *sections = (struct multiboot_tag_elf_sections *)tag;
 			symbol_table_init((Elf64_Shdr *)sections->section_headers,
@@ -2,12 +2,17 @@
 #include "errno.h"
 #include "file.h"
 #include "kalloc.h"
+#include "kernel_poll.h"
 #include "lib/ring_buffer.h"
+#include "macros.h"
 #include "proc.h"
 #include "spinlock.h"
 #include <limits.h>
+#include <string.h>
 
-#define PIPESIZE PIPE_BUF
+// PIPE_BUF is only the limit for atomic writes; buffer a whole page so
+// that bulk transfers move a page per wakeup.
+#define PIPESIZE 4096
 
 int
 pipealloc(struct file **f0, struct file **f1)
@@ -30,6 +35,7 @@ pipealloc(struct file **f0, struct file **f1)
 	p->readopen = 1;
 	p->writeopen = 1;
 	initlock(&p->lock, "pipe");
+	pollhead_init(&p->pollhead);
 
 	(*f0)->type = FD_PIPE;
 	(*f0)->readable = 1;
@@ -70,6 +76,7 @@ pipeclose(struct pipe *p, int writable)
 		p->readopen--;
 		wakeup(&p->ring_buffer->nwrite);
 	}
+	pollwake(&p->pollhead, writable ? POLLHUP : POLLERR);
 	if (p->readopen == 0 && p->writeopen == 0) {
 		release(&p->lock);
 		ring_buffer_destroy(p->ring_buffer, kfree);
@@ -79,9 +86,39 @@ pipeclose(struct pipe *p, int writable)
 	}
 }
 
+// Copy n bytes into the ring, in at most two pieces.
+// There must be room for them.
+static void
+pipe_copyin(struct ring_buf *rb, const char *src, size_t n)
+{
+	size_t start = rb->nwrite % rb->size;
+	size_t first = min(n, rb->size - start);
+
+	memmove(rb->data + start, src, first);
+	memmove(rb->data, src + first, n - first);
+	rb->nwrite += n;
+}
+
+// Copy n bytes out of the ring, in at most two pieces.
+static void
+pipe_copyout(struct ring_buf *rb, char *dst, size_t n)
+{
+	size_t start = rb->nread % rb->size;
+	size_t first = min(n, rb->size - start);
+
+	memmove(dst, rb->data + start, first);
+	memmove(dst + first, rb->data, n - first);
+	rb->nread += n;
+}
+
+// Write every byte of the iovecs, blocking while the pipe is full.
+// The lock is held across the whole batch, so the iovecs are not
+// interleaved with other writers' data unless the pipe fills up.
 ssize_t
-pipewrite(struct pipe *p, char *addr, size_t n)
+pipewritev(struct pipe *p, const struct iovec *iov, int iovcnt)
 {
+	ssize_t total = 0;
+
 	acquire(&p->lock);
 
 	// The pipe is not open for reading and
@@ -91,28 +128,47 @@ pipewrite(struct pipe *p, char *addr, size_t n)
 		kill(myproc()->pid, SIGPIPE);
 		return -EPIPE;
 	}
-	for (int i = 0; i < n; i++) {
-		while (p->ring_buffer->nwrite ==
-		       p->ring_buffer->nread + p->ring_buffer->size) {
-			if (p->readopen == 0 || myproc()->killed) {
-				release(&p->lock);
-				return -EPIPE;
+	for (int v = 0; v < iovcnt; v++) {
+		char *addr = iov[v].iov_base;
+		size_t left = iov[v].iov_len;
+		while (left > 0) {
+			while (p->ring_buffer->nwrite ==
+			       p->ring_buffer->nread + p->ring_buffer->size) {
+				if (p->readopen == 0 || myproc()->killed) {
+					release(&p->lock);
+					return -EPIPE;
+				}
+				wakeup(&p->ring_buffer->nread);
+				pollwake(&p->pollhead, POLLIN);
+				sleep(&p->ring_buffer->nwrite, &p->lock);
 			}
-			wakeup(&p->ring_buffer->nread);
-			sleep(&p->ring_buffer->nwrite, &p->lock);
+			size_t room = p->ring_buffer->size -
+			              (p->ring_buffer->nwrite - p->ring_buffer->nread);
+			size_t n = min(left, room);
+			pipe_copyin(p->ring_buffer, addr, n);
+			addr += n;
+			left -= n;
 		}
-		p->ring_buffer->data[p->ring_buffer->nwrite++ % p->ring_buffer->size] =
-			addr[i];
+		total += iov[v].iov_len;
 	}
 	wakeup(&p->ring_buffer->nread);
+	pollwake(&p->pollhead, POLLIN);
 	release(&p->lock);
-	return n;
+	return total;
 }
 
 ssize_t
-piperead(struct pipe *p, char *addr, size_t n)
+pipewrite(struct pipe *p, char *addr, size_t n)
 {
-	ssize_t i;
+	return pipewritev(p, &(const struct iovec){ addr, n }, 1);
+}
+
+// Wait until the pipe has data, then fill the iovecs in order with
+// whatever is available.
+ssize_t
+pipereadv(struct pipe *p, const struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
 
 	acquire(&p->lock);
 
@@ -123,14 +179,55 @@ piperead(struct pipe *p, char *addr, size_t n)
 		}
 		sleep(&p->ring_buffer->nread, &p->lock);
 	}
-	for (i = 0; i < n; i++) {
-		if (p->ring_buffer->nread == p->ring_buffer->nwrite) {
+	for (int v = 0; v < iovcnt; v++) {
+		size_t avail = p->ring_buffer->nwrite - p->ring_buffer->nread;
+		size_t n = min(iov[v].iov_len, avail);
+		pipe_copyout(p->ring_buffer, iov[v].iov_base, n);
+		total += n;
+		if (n < iov[v].iov_len) {
 			break;
 		}
-		addr[i] =
-			p->ring_buffer->data[p->ring_buffer->nread++ % p->ring_buffer->size];
 	}
 	wakeup(&p->ring_buffer->nwrite);
+	if (total > 0) {
+		pollwake(&p->pollhead, POLLOUT);
+	}
+	release(&p->lock);
+	return total;
+}
+
+ssize_t
+piperead(struct pipe *p, char *addr, size_t n)
+{
+	return pipereadv(p, &(const struct iovec){ addr, n }, 1);
+}
+
+int
+pipepoll(struct pipe *p, struct file *f, struct pollwaiter *w)
+{
+	int mask = 0;
+
+	acquire(&p->lock);
+	if (w != NULL) {
+		pollwaiter_add(&p->pollhead, w);
+	}
+	if (f->readable) {
+		if (p->ring_buffer->nread != p->ring_buffer->nwrite) {
+			mask |= POLLIN | POLLRDNORM;
+		}
+		if (!p->writeopen) {
+			mask |= POLLHUP;
+		}
+	}
+	if (f->writable) {
+		if (p->ring_buffer->nwrite !=
+		    p->ring_buffer->nread + p->ring_buffer->size) {
+			mask |= POLLOUT | POLLWRNORM;
+		}
+		if (!p->readopen) {
+			mask |= POLLERR;
+		}
+	}
 	release(&p->lock);
-	return i;
+	return mask;
 }
@@ -0,0 +1,288 @@
+//
+// Readiness notification: wait queues and poll().
+//
+// Every object that can block a reader or writer (pipes, TTYs, the
+// keyboard and mouse queues) embeds a pollhead. poll() and epoll hang a
+// pollwaiter on it, and the object calls pollwake() whenever its state
+// changes. Unlike sleep()/wakeup(), one waiter can watch any number of
+// objects at once.
+//
+
+#include "file.h"
+#include "fs.h"
+#include "kalloc.h"
+#include "kernel_poll.h"
+#include "mmu.h"
+#include "pipe.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trap.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	initlock(&ph->lock, "pollhead");
+	ph->first = NULL;
+}
+
+// Queue w on ph. The caller must hold the lock that guards the
+// object's state, the same one held around pollwake().
+void
+pollwaiter_add(struct pollhead *ph, struct pollwaiter *w)
+{
+	acquire(&ph->lock);
+	w->head = ph;
+	w->prev = NULL;
+	w->next = ph->first;
+	if (ph->first != NULL) {
+		ph->first->prev = w;
+	}
+	ph->first = w;
+	release(&ph->lock);
+}
+
+// Take w off whatever queue it is on, if any.
+void
+pollwaiter_remove(struct pollwaiter *w)
+{
+	struct pollhead *ph = w->head;
+	if (ph == NULL) {
+		return;
+	}
+	acquire(&ph->lock);
+	if (w->prev != NULL) {
+		w->prev->next = w->next;
+	} else {
+		ph->first = w->next;
+	}
+	if (w->next != NULL) {
+		w->next->prev = w->prev;
+	}
+	w->head = NULL;
+	w->next = w->prev = NULL;
+	release(&ph->lock);
+}
+
+// Tell everyone waiting on ph that the object changed state.
+// The callbacks run with ph->lock held and must not block.
+void
+pollwake(struct pollhead *ph, int events)
+{
+	// Waiters are only added under the object's lock, which our caller
+	// holds, so an empty queue stays empty until we return.
+	if (ph->first == NULL) {
+		return;
+	}
+	acquire(&ph->lock);
+	for (struct pollwaiter *w = ph->first; w != NULL; w = w->next) {
+		w->func(w, events);
+	}
+	release(&ph->lock);
+}
+
+// Return which of POLLIN, POLLOUT, POLLERR and POLLHUP apply to f right
+// now. If w is not NULL, also queue it on the object behind f so that
+// w->func runs the next time that changes.
+int
+vfs_poll(struct file *f, struct pollwaiter *w)
+{
+	switch (f->type) {
+	case FD_PIPE:
+	case FD_FIFO:
+		return pipepoll(f->pipe, f, w);
+	case FD_EPOLL:
+		return epoll_poll(f->ep, w);
+	case FD_INODE:
+		if (S_ISCHR(f->ip->mode)) {
+			if (f->ip->major < 0 || f->ip->major >= NDEV) {
+				return POLLNVAL;
+			}
+			if (devsw[f->ip->major].poll != NULL) {
+				return devsw[f->ip->major].poll(f->ip->minor, w);
+			}
+		}
+		// Regular files and directories never block.
+		return POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+	default:
+		return POLLNVAL;
+	}
+}
+
+// poll() keeps one of these per pollfd. They live in whole pages,
+// since a poll() over thousands of descriptors does not fit in a
+// kmalloc() allocation.
+struct poll_entry {
+	struct pollwaiter w; // Must come first.
+	struct poll_wait *pw;
+	// The file w is queued on. Held, like an epitem's, so that a
+	// close() from another thread cannot free it under w.
+	struct file *file;
+};
+
+#define POLL_ENTRIES_PER_PAGE (PGSIZE / sizeof(struct poll_entry))
+#define POLL_MAX_PAGES \
+	((OPEN_MAX + POLL_ENTRIES_PER_PAGE - 1) / POLL_ENTRIES_PER_PAGE)
+
+struct poll_wait {
+	struct spinlock lock;
+	bool triggered; // Something changed since the last scan.
+	struct poll_entry *pages[POLL_MAX_PAGES];
+};
+
+static void
+poll_wake_func(struct pollwaiter *w, int events)
+{
+	struct poll_wait *pw = ((struct poll_entry *)w)->pw;
+
+	acquire(&pw->lock);
+	pw->triggered = true;
+	wakeup(pw);
+	release(&pw->lock);
+}
+
+static struct poll_entry *
+poll_entry(struct poll_wait *pw, nfds_t i)
+{
+	return &pw->pages[i / POLL_ENTRIES_PER_PAGE][i % POLL_ENTRIES_PER_PAGE];
+}
+
+static void
+poll_free(struct poll_wait *pw, nfds_t nfds)
+{
+	for (nfds_t i = 0; i < nfds; i++) {
+		if (pw->pages[i / POLL_ENTRIES_PER_PAGE] == NULL) {
+			break;
+		}
+		struct poll_entry *e = poll_entry(pw, i);
+		pollwaiter_remove(&e->w);
+		if (e->file != NULL) {
+			(void)vfs_close(e->file);
+		}
+	}
+	for (size_t i = 0; i < POLL_MAX_PAGES; i++) {
+		if (pw->pages[i] != NULL) {
+			kpage_free((char *)pw->pages[i]);
+		}
+	}
+}
+
+static int
+poll_alloc(struct poll_wait *pw, nfds_t nfds)
+{
+	for (size_t i = 0; i * POLL_ENTRIES_PER_PAGE < nfds; i++) {
+		if ((pw->pages[i] = (struct poll_entry *)kpage_alloc()) == NULL) {
+			return -ENOMEM;
+		}
+		memset(pw->pages[i], 0, PGSIZE);
+	}
+	for (nfds_t i = 0; i < nfds; i++) {
+		poll_entry(pw, i)->w.func = poll_wake_func;
+		poll_entry(pw, i)->pw = pw;
+	}
+	return 0;
+}
+
+// Fill in revents for every entry and return how many are ready.
+// If pw is not NULL, also start watching each descriptor.
+static int
+poll_scan(struct pollfd *fds, nfds_t nfds, struct poll_wait *pw)
+{
+	int count = 0;
+
+	for (nfds_t i = 0; i < nfds; i++) {
+		fds[i].revents = 0;
+		if (fds[i].fd < 0) {
+			continue;
+		}
+		struct file *f = fd_to_struct_file(fds[i].fd);
+		if (f == NULL) {
+			fds[i].revents = POLLNVAL;
+			count++;
+			continue;
+		}
+		// Hold f while it is looked at, and for as long as a waiter
+		// is queued on it.
+		f = filedup(f, f->flags);
+		struct pollwaiter *w = NULL;
+		if (pw != NULL) {
+			w = &poll_entry(pw, i)->w;
+			poll_entry(pw, i)->file = f;
+		}
+		int mask = vfs_poll(f, w);
+		if (w == NULL) {
+			(void)vfs_close(f);
+		}
+		fds[i].revents = mask & (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+		if (fds[i].revents != 0) {
+			count++;
+		}
+	}
+	return count;
+}
+
+// Wait until one of fds is ready, or timeout_ms milliseconds pass.
+// A negative timeout waits forever.
+int
+do_poll(struct pollfd *fds, nfds_t nfds, long timeout_ms)
+{
+	if (nfds > OPEN_MAX) {
+		return -EINVAL;
+	}
+
+	// Fast path: don't bother setting up waiters if something is
+	// already ready or the caller does not want to wait.
+	int count = poll_scan(fds, nfds, NULL);
+	if (count != 0 || timeout_ms == 0) {
+		return count;
+	}
+
+	struct poll_wait *pw = kmalloc(sizeof(*pw));
+	if (pw == NULL) {
+		return -ENOMEM;
+	}
+	memset(pw, 0, sizeof(*pw));
+	initlock(&pw->lock, "poll");
+	time_t deadline = timeout_ms > 0 ? ticks + timeout_ms : 0;
+	if ((count = poll_alloc(pw, nfds)) < 0) {
+		goto out;
+	}
+
+	for (bool first = true;; first = false) {
+		acquire(&pw->lock);
+		pw->triggered = false;
+		release(&pw->lock);
+
+		// Only the first scan has to register; the waiters stay queued.
+		if ((count = poll_scan(fds, nfds, first ? pw : NULL)) != 0) {
+			break;
+		}
+
+		acquire(&pw->lock);
+		while (!pw->triggered && !myproc()->killed &&
+		       (deadline == 0 || ticks < deadline)) {
+			sleep_until(pw, &pw->lock, deadline);
+		}
+		release(&pw->lock);
+
+		if (myproc()->killed) {
+			count = -EINTR;
+			break;
+		}
+		if (deadline != 0 && ticks >= deadline) {
+			count = poll_scan(fds, nfds, NULL);
+			break;
+		}
+	}
+
+out:
+	poll_free(pw, nfds);
+	kfree(pw);
+	return count;
+}
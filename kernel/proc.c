@@ -1,18 +1,23 @@
 #include "dev/lapic.h"
+#include "dev/trace.h"
 
 #include "lib/compiler_attributes.h"
 
+#include "acct.h"
 #include "console.h"
 #include "cpu.h"
 #include "defs.h"
+#include "disk.h"
 #include "file.h"
 #include "fs.h"
+#include "futex.h"
 #include "kalloc.h"
 #include "kernel_assert.h"
 #include "kernel_signal.h"
 #include "log.h"
 #include "mman.h"
 #include "mmu.h"
+#include "mount.h"
 #include "param.h"
 #include "proc.h"
 #include "spinlock.h"
@@ -20,14 +25,17 @@
 #include "syscall.h"
 #include "trap.h"
 #include "vm.h"
+#include "vma.h"
 #include "x86.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -50,6 +58,7 @@ void
 pinit(void)
 {
 	initlock(&ptable.lock, "ptable");
+	lockstat_register(&ptable.lock);
 }
 
 // Must be called with interrupts disabled
@@ -140,6 +149,13 @@ allocproc(void)
 found:
 	p->state = EMBRYO;
 	p->pid = nextpid++;
+	p->mm = NULL;
+	p->files = NULL;
+	p->fsop_depth = 0;
+	p->fslogs = 0;
+	memset(&p->usage, 0, sizeof(p->usage));
+	memset(&p->gone, 0, sizeof(p->gone));
+	memset(&p->cusage, 0, sizeof(p->cusage));
 	p->pgid = p->pid;
 	p->sid = p->pgid;
 
@@ -188,27 +204,172 @@ found:
 	p->context = (struct context *)sp;
 	memset(p->context, 0, sizeof *p->context);
 	p->context->rip = (uintptr_t)forkret;
-	p->mmap_count = 0;
-	memcpy(p->legacy_fpu_state, cpu_clean_fpu(), sizeof(p->legacy_fpu_state));
+	memcpy(p->legacy_fpu_state, cpu_clean_fpu(), FPU_STATE_SIZE);
+	p->tgid = p->pid;
+	p->group_leader = p;
+	p->group_exiting = false;
+	p->fs_base = 0;
+	p->clear_child_tid = NULL;
+	p->vfork_parent = NULL;
 
+	p->umask = S_IWGRP | S_IWOTH;
+
+	memset(p->ptrace_mask_ptr, 0, SYSCALL_AMT);
+
+	for (int i = 0; i < NSIG; i++) {
+		p->sig_handlers[i] = SIG_DFL;
+	}
+	p->last_signal = 0;
+
+	return p;
+}
+
+// Allocate an empty address space with one reference.
+struct mm *
+mm_alloc(void)
+{
+	struct mm *mm = kmalloc(sizeof(*mm));
+	if (mm == NULL) {
+		return NULL;
+	}
+	memset(mm, 0, sizeof(*mm));
+	mm->ref = 1;
+	initsleeplock(&mm->lock, "mm");
 	// FIXME: This is an arbitrary number.
 	// Right now, the virtual memory system isn't
 	// good enough to just randomize this due to
 	// not having leveled page tables generate as
 	// needed.
-	p->heap = 0x2c000000;
-	p->heapsz = 0;
+	mm->heap = 0x2c000000;
+	return mm;
+}
 
-	p->umask = S_IWGRP | S_IWOTH;
+// Drop a reference to mm, freeing it with the last one.
+// The caller must hold ptable.lock, and must not be running on mm.
+// Its mappings are gone by then, since taking them down can sleep;
+// see mm_exit().
+static void
+mm_put_locked(struct mm *mm)
+{
+	if (--mm->ref > 0) {
+		return;
+	}
+	kernel_assert(mm->vmas == NULL);
+	if (mm->pgdir != NULL) {
+		freevm(mm->pgdir);
+	}
+	kfree(mm);
+}
 
-	memset(p->ptrace_mask_ptr, 0, SYSCALL_AMT);
+// Drop a reference to mm from somewhere that can sleep. If only
+// exited threads are left on it, take its mappings down first.
+void
+mm_put(struct mm *mm)
+{
+	acquire(&ptable.lock);
+	if (mm->ref - 1 == mm->exited) {
+		release(&ptable.lock);
+		mm_unmap_all(mm, mm->pgdir);
+		acquire(&ptable.lock);
+	}
+	mm_put_locked(mm);
+	release(&ptable.lock);
+}
+
+// Called by each exiting thread of mm while it can still sleep. The
+// last one to stop using mm takes its mappings down, writing back
+// shared file pages and closing files, which mm_put_locked() cannot.
+void
+mm_exit(struct mm *mm)
+{
+	acquire(&ptable.lock);
+	bool last = ++mm->exited == mm->ref;
+	release(&ptable.lock);
+	if (last) {
+		mm_unmap_all(mm, mm->pgdir);
+	}
+}
+
+static struct files *
+files_alloc(void)
+{
+	struct files *files = kmalloc(sizeof(*files));
+	if (files == NULL) {
+		return NULL;
+	}
+	memset(files, 0, sizeof(*files));
+	initlock(&files->lock, "files");
+	files->ref = 1;
+	return files;
+}
+
+// Duplicate the open files and working directory of old for a new
+// process, leaving out O_CLOFORK files.
+static struct files *
+files_copy(struct files *old)
+{
+	struct files *files = files_alloc();
+	if (files == NULL) {
+		return NULL;
+	}
+	acquire(&old->lock);
+	for (int i = 0; i < OPEN_MAX; i++) {
+		if (old->ofile[i] != NULL && old->ofile[i]->ref > 0 &&
+		    old->ofile[i]->flags != O_CLOFORK) {
+			files->ofile[i] = filedup(old->ofile[i], 0);
+		}
+	}
+	release(&old->lock);
+	files->cwd = inode_dup(old->cwd);
+	return files;
+}
+
+// Drop a reference to files. The last one closes everything.
+static void
+files_put(struct files *files)
+{
+	acquire(&files->lock);
+	int ref = --files->ref;
+	release(&files->lock);
+	if (ref > 0) {
+		return;
+	}
+
+	// Close all open files.
+	for (int fd = 0; fd < OPEN_MAX; fd++) {
+		if (files->ofile[fd] != NULL && files->ofile[fd]->ref > 0) {
+			(void)vfs_close(files->ofile[fd]);
+		}
+	}
+	begin_op();
+	inode_put(files->cwd);
+	end_op();
+	kfree(files);
+}
 
+// Return a proc slot to the pool. The caller must hold ptable.lock,
+// and p must not be running.
+static void
+freeproc(struct proc *p)
+{
+	kpage_free(p->kstack);
+	p->kstack = NULL;
+	// It went through mm_exit() on the way out.
+	p->mm->exited--;
+	mm_put_locked(p->mm);
+	p->mm = NULL;
+	p->files = NULL;
+	p->pid = 0;
+	p->tgid = 0;
+	p->group_leader = NULL;
+	p->parent = NULL;
+	p->name[0] = 0;
+	p->killed = 0;
+	p->last_signal = 0;
 	for (int i = 0; i < NSIG; i++) {
 		p->sig_handlers[i] = SIG_DFL;
 	}
-	p->last_signal = 0;
-
-	return p;
+	p->state = UNUSED;
 }
 
 // Set up first user process.
@@ -224,12 +385,13 @@ userinit(void)
 	}
 
 	initproc = p;
-	if ((p->pgdir = setupkvm()) == NULL) {
+	if ((p->mm = mm_alloc()) == NULL || (p->files = files_alloc()) == NULL ||
+	    (p->mm->pgdir = setupkvm()) == NULL) {
 		panic("userinit: out of memory?");
 	}
-	inituvm(p->pgdir, _binary_bin_initcode_start,
+	inituvm(p->mm->pgdir, _binary_bin_initcode_start,
 	        (uintptr_t)_binary_bin_initcode_size);
-	p->sz = PGSIZE;
+	p->mm->sz = PGSIZE;
 	memset(p->tf, 0, sizeof(*p->tf));
 	p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
 	p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -238,7 +400,7 @@ userinit(void)
 	p->tf->rip = 0; // beginning of initcode.S
 
 	__safestrcpy(p->name, "initcode", sizeof(p->name));
-	p->cwd = namei("/");
+	p->files->cwd = namei("/");
 
 	// this assignment to p->state lets other cores
 	// run this process. the acquire forces the above
@@ -258,77 +420,110 @@ growproc(intptr_t n)
 {
 	uintptr_t sz;
 	struct proc *curproc = myproc();
+	struct mm *mm = curproc->mm;
 
-	sz = curproc->sz;
+	acquiresleep(&mm->lock);
+	sz = mm->sz;
 	if (n > 0) {
-		if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0) {
+		if ((sz = allocuvm(mm->pgdir, sz, sz + n)) == 0) {
+			releasesleep(&mm->lock);
 			return -ENOMEM;
 		}
 	} else if (n < 0) {
-		if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0) {
+		if ((sz = deallocuvm(mm->pgdir, sz, sz + n)) == 0) {
+			releasesleep(&mm->lock);
 			return -EFAULT;
 		}
 	}
-	curproc->sz = sz;
+	mm->sz = sz;
+	releasesleep(&mm->lock);
 	switchuvm(curproc);
 	return 0;
 }
 
-// Create a new process copying p as the parent.
+// Create a new process or thread, running a copy of the current one.
 // Sets up stack to return as if from system call.
-// Caller must set state of returned proc to RUNNABLE.
-// POSIX.1-2008: fork returns a "signed integer type".
+// flags choose what is shared with the caller; see <sched.h>.
+// With CLONE_THREAD, the new thread joins the caller's thread group
+// and is never waited for: it is reaped as soon as it exits.
 pid_t
-fork(void)
+clone(unsigned long flags, uintptr_t stack, pid_t *parent_tid,
+      pid_t *child_tid, uintptr_t tls)
 {
 	pid_t pid;
 	struct proc *np;
 	struct proc *curproc = myproc();
 
+	if ((flags & CLONE_THREAD) &&
+	    (flags & (CLONE_VM | CLONE_FILES)) != (CLONE_VM | CLONE_FILES)) {
+		return -EINVAL;
+	}
+	// Threads leave through thread_exit(), which would never give a
+	// vfork() parent its memory back.
+	if ((flags & (CLONE_VFORK | CLONE_THREAD)) == (CLONE_VFORK | CLONE_THREAD)) {
+		return -EINVAL;
+	}
+
 	// Allocate process.
 	if ((np = allocproc()) == NULL) {
 		return -ENOMEM;
 	}
 
-	// Copy process state from proc.
-	if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == NULL) {
-		kpage_free(np->kstack);
-		np->kstack = NULL;
-		np->state = UNUSED;
-		return -EIO;
+	if (flags & CLONE_VM) {
+		acquire(&ptable.lock);
+		np->mm = curproc->mm;
+		np->mm->ref++;
+		release(&ptable.lock);
+	} else {
+		// Copy process state from proc.
+		struct mm *mm = curproc->mm;
+		if ((np->mm = mm_alloc()) == NULL) {
+			goto bad;
+		}
+		acquiresleep(&mm->lock);
+		if ((np->mm->pgdir = copyuvm(mm->pgdir, mm->sz)) == NULL) {
+			releasesleep(&mm->lock);
+			goto bad;
+		}
+		np->mm->sz = mm->sz;
+		np->mm->heap = mm->heap;
+		// Anonymous memory is private, so the child gets its own copy;
+		// files and devices map the same memory again.
+		int err = mm_copy(np->mm, mm);
+		releasesleep(&mm->lock);
+		if (err < 0) {
+			goto bad;
+		}
 	}
-	np->sz = curproc->sz;
 
-	np->heap = curproc->heap;
-	np->heapsz = curproc->heapsz;
+	if (flags & CLONE_FILES) {
+		np->files = curproc->files;
+		acquire(&np->files->lock);
+		np->files->ref++;
+		release(&np->files->lock);
+	} else if ((np->files = files_copy(curproc->files)) == NULL) {
+		goto bad;
+	}
 
-	np->mmap_count = curproc->mmap_count;
-	memcpy(np->mmap_info, curproc->mmap_info, sizeof(np->mmap_info));
-	// Copying the info isn't enough. We also need to map it.
-	for (int j = 0; np->mmap_info[j].length != 0; j++) {
-		struct mmap_info info = np->mmap_info[j];
-		if (mappages(np->pgdir, (void *)info.virt_addr, info.length, info.addr,
-		             info.perm) < 0) {
-			panic("Could not map page");
-		}
+	if (flags & CLONE_THREAD) {
+		np->tgid = curproc->tgid;
+		np->group_leader = curproc->group_leader;
+		np->parent = curproc->group_leader;
+	} else {
+		np->parent = curproc;
 	}
-	np->parent = curproc;
 	*np->tf = *curproc->tf;
 
 	// Clear %rax so that fork returns 0 in the child.
 	np->tf->rax = 0;
-
-	// Only close files if we were passed O_CLOFORK.
-	for (int i = 0; i < OPEN_MAX; i++) {
-		if (curproc->ofile[i] != NULL && curproc->ofile[i]->ref > 0) {
-			if (curproc->ofile[i]->flags == O_CLOFORK) {
-				(void)vfs_close(curproc->ofile[i]);
-			} else {
-				np->ofile[i] = filedup(curproc->ofile[i], 0);
-			}
-		}
+	if (stack != 0) {
+		np->tf->rsp = stack;
+	}
+	np->fs_base = (flags & CLONE_SETTLS) ? tls : curproc->fs_base;
+	if (flags & CLONE_CHILD_CLEARTID) {
+		np->clear_child_tid = child_tid;
 	}
-	np->cwd = inode_dup(curproc->cwd);
+
 	np->cred.uid = curproc->cred.uid;
 	np->cred.euid = curproc->cred.euid;
 	np->cred.gid = curproc->cred.gid;
@@ -338,6 +533,12 @@ fork(void)
 	memcpy(np->cred.gids, curproc->cred.gids, sizeof(np->cred.gids));
 	np->ctty = curproc->ctty;
 	np->umask = curproc->umask;
+	// Threads start out with the process's handlers, but each keeps
+	// its own copy.
+	if (flags & CLONE_SIGHAND) {
+		memcpy(np->sig_handlers, curproc->sig_handlers,
+		       sizeof(np->sig_handlers));
+	}
 
 	__safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -345,13 +546,196 @@ fork(void)
 	memmove(np->ptrace_mask_ptr, curproc->ptrace_mask_ptr, SYSCALL_AMT);
 	pid = np->pid;
 
+	// Both of these point into memory the new thread shares with us
+	// (or a copy of it), so they can be written before it runs.
+	if (flags & CLONE_PARENT_SETTID) {
+		*parent_tid = pid;
+	}
+	if (flags & CLONE_CHILD_SETTID) {
+		if (flags & CLONE_VM) {
+			*child_tid = pid;
+		} else if (copyout(np->mm->pgdir, (uintptr_t)child_tid, &pid,
+		                   sizeof(pid)) < 0) {
+			goto bad;
+		}
+	}
+
 	acquire(&ptable.lock);
 
 	np->state = RUNNABLE;
+	if (flags & CLONE_VFORK) {
+		// The child is running on our memory, and on our stack if it
+		// shares the address space, so stay out of its way until it
+		// has an image of its own.
+		np->vfork_parent = curproc;
+		while (np->vfork_parent == curproc) {
+			sleep(&np->vfork_parent, &ptable.lock);
+		}
+	}
 
 	release(&ptable.lock);
 
 	return pid;
+
+bad:
+	if (np->files != NULL) {
+		files_put(np->files);
+	}
+	// A copy of our mappings has to go while we can still sleep.
+	if (np->mm != NULL && !(flags & CLONE_VM)) {
+		mm_unmap_all(np->mm, np->mm->pgdir);
+	}
+	acquire(&ptable.lock);
+	if (np->mm != NULL) {
+		mm_put_locked(np->mm);
+	}
+	np->mm = NULL;
+	np->files = NULL;
+	kpage_free(np->kstack);
+	np->kstack = NULL;
+	np->state = UNUSED;
+	release(&ptable.lock);
+	return -ENOMEM;
+}
+
+// Create a new process copying p as the parent.
+// Caller must set state of returned proc to RUNNABLE.
+// POSIX.1-2008: fork returns a "signed integer type".
+pid_t
+fork(void)
+{
+	return clone(0, 0, NULL, NULL, 0);
+}
+
+// Wake a parent sleeping in vfork() on p. The caller must hold
+// ptable.lock.
+static void
+vfork_done1(struct proc *p)
+{
+	if (p->vfork_parent != NULL) {
+		p->vfork_parent = NULL;
+		wakeup1(&p->vfork_parent);
+	}
+}
+
+// p has stopped using its parent's memory: it either has a new
+// image or is on its way out.
+void
+vfork_done(struct proc *p)
+{
+	acquire(&ptable.lock);
+	vfork_done1(p);
+	release(&ptable.lock);
+}
+
+// Count the threads in curproc's group other than itself that have
+// not exited yet. The caller must hold ptable.lock.
+static int
+other_threads(struct proc *curproc)
+{
+	int n = 0;
+	for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p != curproc && p->state != UNUSED && p->state != ZOMBIE &&
+		    p->tgid == curproc->tgid) {
+			n++;
+		}
+	}
+	return n;
+}
+
+// Kill every other thread in the caller's group and wait for them to
+// go away. Only the group leader may do this; returns -EBUSY otherwise,
+// unless the caller is alone anyway.
+int
+kill_other_threads(void)
+{
+	struct proc *curproc = myproc();
+
+	acquire(&ptable.lock);
+	if (other_threads(curproc) == 0) {
+		release(&ptable.lock);
+		return 0;
+	}
+	if (curproc->group_leader != curproc) {
+		release(&ptable.lock);
+		return -EBUSY;
+	}
+	for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p != curproc && p->tgid == curproc->tgid && p->state != UNUSED) {
+			p->killed = 1;
+			if (p->state == SLEEPING) {
+				p->state = RUNNABLE;
+			}
+		}
+	}
+	while (other_threads(curproc) != 0) {
+		// Exiting threads wake up their group leader.
+		sleep(curproc, &ptable.lock);
+	}
+	release(&ptable.lock);
+	return 0;
+}
+
+// Undo CLONE_CHILD_CLEARTID: tell a pthread_join() that we are gone.
+static void
+clear_child_tid(struct proc *curproc)
+{
+	if (curproc->clear_child_tid == NULL) {
+		return;
+	}
+	uint32_t *uaddr = (uint32_t *)curproc->clear_child_tid;
+	uint32_t zero = 0;
+	// The word may have been unmapped or made read-only since clone().
+	if (futex_addr_ok(curproc->mm, (uintptr_t)uaddr) &&
+	    copy_to_user(uaddr, &zero, sizeof(zero)) == 0) {
+		futex_wake(uaddr, 1);
+	}
+	curproc->clear_child_tid = NULL;
+}
+
+// Exit the calling thread. Does not return.
+// The last thread of a process to go exits the whole process.
+// Other threads are reaped by the scheduler once they stop running.
+__noreturn void
+thread_exit(int status)
+{
+	struct proc *curproc = myproc();
+
+	if (curproc->group_leader == curproc) {
+		// The leader stands for the process, which lives on until
+		// every thread is gone.
+		acquire(&ptable.lock);
+		while (other_threads(curproc) != 0) {
+			sleep(curproc, &ptable.lock);
+		}
+		release(&ptable.lock);
+		exit(status);
+	}
+
+	clear_child_tid(curproc);
+	files_put(curproc->files);
+	curproc->files = NULL;
+	mm_exit(curproc->mm);
+
+	acquire(&ptable.lock);
+
+	// The leader might be waiting for us in exit().
+	wakeup1(curproc->group_leader);
+
+	// Children of this thread now belong to the leader.
+	for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p->parent == curproc) {
+			p->parent = curproc->group_leader;
+			if (p->state == ZOMBIE) {
+				wakeup1(curproc->group_leader);
+			}
+		}
+	}
+
+	// The scheduler frees us once it is off our stack.
+	curproc->state = ZOMBIE;
+	sched();
+	panic("zombie thread exit");
 }
 
 // Exit the current process.  Does not return.
@@ -361,27 +745,45 @@ __noreturn void
 exit(int status)
 {
 	struct proc *curproc = myproc();
+	struct proc *leader = curproc->group_leader;
 
-	if (curproc == initproc) {
+	if (leader == initproc) {
 		panic("init exiting");
 	}
 
-	// Close all open files.
-	for (int fd = 0; fd < OPEN_MAX; fd++) {
-		if (curproc->ofile[fd] != NULL && curproc->ofile[fd]->ref > 0) {
-			(void)vfs_close(curproc->ofile[fd]);
+	// Take every other thread down with us. The first exit() in a
+	// process decides its status.
+	acquire(&ptable.lock);
+	if (!leader->group_exiting) {
+		leader->group_exiting = true;
+		leader->status = status;
+		for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+			if (p != curproc && p->tgid == curproc->tgid && p->state != UNUSED) {
+				p->killed = 1;
+				if (p->state == SLEEPING) {
+					p->state = RUNNABLE;
+				}
+			}
 		}
 	}
+	if (curproc != leader) {
+		release(&ptable.lock);
+		thread_exit(status);
+	}
+	while (other_threads(curproc) != 0) {
+		sleep(curproc, &ptable.lock);
+	}
+	release(&ptable.lock);
 
-	begin_op();
-	inode_put(curproc->cwd);
-	end_op();
-	curproc->cwd = NULL;
-	curproc->status = status;
+	clear_child_tid(curproc);
+	files_put(curproc->files);
+	curproc->files = NULL;
+	mm_exit(curproc->mm);
 
 	acquire(&ptable.lock);
 
-	// Parent might be sleeping in wait().
+	// Parent might be sleeping in vfork() or wait().
+	vfork_done1(curproc);
 	wakeup1(curproc->parent);
 
 	// Pass abandoned children to init.
@@ -415,7 +817,8 @@ waitpid(pid_t pid, int *wstatus, int options)
 		// Scan through table looking for exited children.
 		havekids = 0;
 		for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-			if (p->parent != curproc) {
+			// Threads are reaped by the scheduler, not by wait().
+			if (p->parent != curproc || p->group_leader != p) {
 				continue;
 			}
 			havekids = 1;
@@ -425,20 +828,11 @@ waitpid(pid_t pid, int *wstatus, int options)
 					*wstatus = W_EXITCODE(p->status, p->last_signal);
 				}
 				ret_pid = p->pid;
-				kpage_free(p->kstack);
-				p->kstack = NULL;
-				memset(p->mmap_info, 0, sizeof(p->mmap_info));
-				p->mmap_count = 0;
-				freevm(p->pgdir);
-				p->pid = 0;
-				p->parent = NULL;
-				p->name[0] = 0;
-				p->killed = 0;
-				p->last_signal = 0;
-				for (int i = 0; i < NSIG; i++) {
-					p->sig_handlers[i] = SIG_DFL;
-				}
-				p->state = UNUSED;
+				struct proc_usage *to = &curproc->group_leader->cusage;
+				acct_usage_add(to, &p->usage);
+				acct_usage_add(to, &p->gone);
+				acct_usage_add(to, &p->cusage);
+				freeproc(p);
 				release(&ptable.lock);
 				return ret_pid;
 			}
@@ -473,8 +867,11 @@ scheduler(void)
 {
 	struct cpu *c = mycpu();
 	c->proc = 0;
+	c->acct_tsc = rdtsc();
 
 	for (;;) {
+		// Back from hlt(), or through the whole table.
+		acct_charge(false);
 		// Enable interrupts on this processor.
 		sti();
 
@@ -488,21 +885,33 @@ scheduler(void)
 			// Switch to chosen process.  It is the process's job
 			// to release ptable.lock and then reacquire it
 			// before jumping back to us.
+			acct_charge(false);
+			c->acct.nswitch++;
 			c->proc = p;
 			switchuvm(p);
 			p->state = RUNNING;
 
-			// Depending on the bits set, this may also set the extended state.
 			// Restore the state we have saved for userspace.
-			// WARNING: do not use the FPU between fxrstor and swtch!
-			__asm__ __volatile__("fxrstor %0" : : "m"(c->proc->legacy_fpu_state));
+			// WARNING: do not use the FPU between fpu_restore and swtch!
+			fpu_restore(c->proc->legacy_fpu_state);
+			tracepoint(TRACE_SCHED_SWITCH, p->pid, 0);
 			swtch(&(c->scheduler), p->context);
-			__asm__ __volatile__("fxsave %0" : "=m"(c->proc->legacy_fpu_state));
+			acct_charge(false);
+			tracepoint(TRACE_SCHED_SWITCH, 0, p->pid);
+			fpu_save(c->proc->legacy_fpu_state);
 			switchkvm();
 
 			// Process is done running for now.
 			// It should have changed its p->state before coming back.
 			c->proc = NULL;
+
+			// Nobody waits for threads, so free them here, now that we
+			// are off their stack. This happens under the same hold of
+			// ptable.lock as thread_exit(), so no one sees the zombie.
+			if (p->state == ZOMBIE && p->group_leader != p) {
+				acct_usage_add(&p->group_leader->gone, &p->usage);
+				freeproc(p);
+			}
 		}
 		release(&ptable.lock);
 		// Don't burn up the processor doing nothing.
@@ -549,6 +958,7 @@ yield(void)
 {
 	acquire(&ptable.lock); // DOC: yieldlock
 	myproc()->state = RUNNABLE;
+	myproc()->usage.nivcsw++;
 	sched();
 	release(&ptable.lock);
 }
@@ -568,10 +978,11 @@ forkret(void)
 		// of a regular process (e.g., they call sleep), and thus cannot
 		// be run from main().
 		first = 0;
-		inode_init(ROOTDEV);
-		initlog(ROOTDEV);
+		inode_init();
+		mount_root(rootdev);
 	}
 
+	acct_charge(false);
 	// Return to "caller", actually trapret (see allocproc).
 }
 
@@ -603,6 +1014,7 @@ sleep(void *chan, struct spinlock *lk)
 	// Go to sleep.
 	p->chan = chan;
 	p->state = SLEEPING;
+	p->usage.nvcsw++;
 
 	sched();
 
@@ -616,6 +1028,19 @@ sleep(void *chan, struct spinlock *lk)
 	}
 }
 
+// Like sleep(), but give up once ticks reaches deadline, even if
+// nobody calls wakeup(chan). The caller has to check the time itself
+// to tell the two apart. A deadline of 0 means no timeout.
+void
+sleep_until(void *chan, struct spinlock *lk, time_t deadline)
+{
+	struct proc *p = myproc();
+
+	p->sleep_deadline = deadline;
+	sleep(chan, lk);
+	p->sleep_deadline = 0;
+}
+
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
@@ -637,6 +1062,23 @@ wakeup(void *chan)
 	release(&ptable.lock);
 }
 
+// Called by the timer interrupt. Wakes up the processes sleeping on
+// chan, and those whose sleep_until() deadline has passed, in one pass
+// over the process table.
+void
+wakeup_timer(void *chan, time_t now)
+{
+	acquire(&ptable.lock);
+	for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p->state == SLEEPING &&
+		    (p->chan == chan ||
+		     (p->sleep_deadline != 0 && p->sleep_deadline <= now))) {
+			p->state = RUNNABLE;
+		}
+	}
+	release(&ptable.lock);
+}
+
 // When we enter the signal handler, we SHOULDN'T have to
 // pop anything off of the stack. %rdi will contain the one
 // argument, and so we put the signal in there. %rip should
@@ -649,7 +1091,7 @@ copy_signal_to_stack(struct proc *proc, int signal)
 	uintptr_t ustack = proc->tf->rip;
 
 	sp -= sizeof(uintptr_t);
-	if (copyout(proc->pgdir, sp, &ustack, sizeof(ustack)) < 0) {
+	if (copyout(proc->mm->pgdir, sp, &ustack, sizeof(ustack)) < 0) {
 		panic("failed to copyout");
 	}
 	proc->tf->rdi = signal;
@@ -856,6 +1298,95 @@ procdump(void)
 	}
 }
 
+// What curproc's whole process has used (RUSAGE_SELF), what the
+// children it has waited for used (RUSAGE_CHILDREN), or what curproc
+// alone has used (RUSAGE_THREAD).
+int
+proc_getrusage(struct proc *curproc, int who, struct proc_usage *u)
+{
+	struct proc *leader = curproc->group_leader;
+
+	// Up to now, not up to the last trip into the kernel.
+	acct_charge(false);
+	acquire(&ptable.lock);
+	switch (who) {
+	case RUSAGE_SELF:
+		*u = leader->gone;
+		for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+			if (p->state != UNUSED && p->tgid == curproc->tgid) {
+				acct_usage_add(u, &p->usage);
+			}
+		}
+		break;
+	case RUSAGE_CHILDREN:
+		*u = leader->cusage;
+		break;
+	case RUSAGE_THREAD:
+		*u = curproc->usage;
+		break;
+	default:
+		release(&ptable.lock);
+		return -EINVAL;
+	}
+	release(&ptable.lock);
+	acct_usage_export(u);
+	return 0;
+}
+
+// Fill in st for as many processes as fit in max, and return how
+// many that was.
+size_t
+proc_stat_all(struct proc_stat *st, size_t max)
+{
+	size_t n = 0;
+
+	acct_charge(false);
+	acquire(&ptable.lock);
+	for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC] && n < max; p++) {
+		if (p->state == UNUSED || p->group_leader != p) {
+			continue;
+		}
+		struct proc_stat *s = &st[n++];
+		memset(s, 0, sizeof(*s));
+		s->pid = p->tgid;
+		s->ppid = p->parent != NULL ? p->parent->tgid : 0;
+		s->uid = p->cred.uid;
+		s->size = p->mm != NULL ? p->mm->sz : 0;
+		__safestrcpy(s->name, p->name, sizeof(s->name));
+		s->usage = p->gone;
+		s->cusage = p->cusage;
+		s->cpu = -1;
+
+		static const char states[] = {
+			[EMBRYO] = 'E',  [SLEEPING] = 'S', [RUNNABLE] = 'R',
+			[RUNNING] = 'R', [ZOMBIE] = 'Z',   [STOPPED] = 'T',
+		};
+		s->state = states[p->state];
+		for (struct proc *t = ptable.proc; t < &ptable.proc[NPROC]; t++) {
+			if (t->state == UNUSED || t->tgid != p->tgid) {
+				continue;
+			}
+			s->nthreads++;
+			acct_usage_add(&s->usage, &t->usage);
+			// A process is runnable if any of its threads is.
+			if (t->state == RUNNABLE || t->state == RUNNING) {
+				s->state = 'R';
+			}
+		}
+		for (int i = 0; i < ncpu; i++) {
+			if (cpus[i].proc != NULL && cpus[i].proc->tgid == p->tgid) {
+				s->cpu = i;
+			}
+		}
+	}
+	release(&ptable.lock);
+	for (size_t i = 0; i < n; i++) {
+		acct_usage_export(&st[i].usage);
+		acct_usage_export(&st[i].cusage);
+	}
+	return n;
+}
+
 void
 sleep_on_ms(time_t ms)
 {
@@ -0,0 +1,136 @@
+// RAM disk: a file system image that lives in memory instead of on
+// a disk. The boot loader loads it as the first multiboot module,
+// so that with
+//	module2 /boot/fs.img
+// in grub.cfg, a kernel built without CONFIG_IDE and CONFIG_SATA
+// boots with no disk at all. Otherwise it is RAMDEV, to be mounted
+// wherever. Changes are lost on reboot.
+
+#include "boot/multiboot2.h"
+
+#include "buf.h"
+#include "console.h"
+#include "dev/trace.h"
+#include "file.h"
+#include "fs.h"
+#include "lib/compiler_attributes.h"
+#include "macros.h"
+#include "memlayout.h"
+#include "mman.h"
+#include "param.h"
+#include "ramfs.h"
+#include "sleeplock.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define SECTOR_SIZE 512
+
+static struct {
+	char *data;
+	size_t nblocks;
+} ramdisk;
+
+static int
+ramfsopen(short minor, int flags)
+{
+	return 0;
+}
+
+static int
+ramfsclose(short minor)
+{
+	return 0;
+}
+
+static ssize_t
+ramfsread(short minor, struct inode *ip, char *buf, off_t off, size_t len)
+{
+	size_t size = ramdisk.nblocks * BSIZE;
+
+	if (off < 0 || off >= size) {
+		return 0;
+	}
+	len = min(len, size - off);
+	memmove(buf, ramdisk.data + off, len);
+	return len;
+}
+
+// Writes come without an offset to put them at.
+static ssize_t
+ramfswrite(short minor, struct inode *ip, char *buf, size_t len)
+{
+	return -EROFS;
+}
+
+static struct mmap_info
+ramfsmmap(short minor, size_t length, uintptr_t addr, int perm)
+{
+	return (struct mmap_info){};
+}
+
+// Returns -ENODEV if the boot loader did not load an image.
+__cold int
+ramfs_disk_init(void)
+{
+	struct multiboot_tag_module *mod = get_multiboot_module();
+
+	if (mod == NULL) {
+		return -ENODEV;
+	}
+	ramdisk.data = P2V((uintptr_t)mod->mod_start);
+	ramdisk.nblocks = (mod->mod_end - mod->mod_start) / BSIZE;
+	cprintf("ramfs: %lu blocks at %#x\n", ramdisk.nblocks, mod->mod_start);
+	return 0;
+}
+
+bool
+ramfs_present(void)
+{
+	return ramdisk.nblocks != 0;
+}
+
+void
+ramfs_init(void)
+{
+	devsw[DEV_SD].open = ramfsopen;
+	devsw[DEV_SD].close = ramfsclose;
+	devsw[DEV_SD].read = ramfsread;
+	devsw[DEV_SD].write = ramfswrite;
+	devsw[DEV_SD].mmap = ramfsmmap;
+}
+
+// Sync buf with the RAM disk. Nothing is queued: the copy is done
+// before this returns.
+// If B_DIRTY is set, write buf, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf, set B_VALID.
+// Memory has no cache to flush, so barriers are already met.
+void
+ramfs_rw(struct block_buffer *b)
+{
+	if (!holdingsleep(&b->lock)) {
+		panic("ramfs_rw: buf not locked");
+	}
+	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID) {
+		panic("ramfs_rw: nothing to do");
+	}
+	if (b->blockno < 0 || b->blockno >= ramdisk.nblocks) {
+		panic("ramfs_rw: blockno %ld out of range", b->blockno);
+	}
+
+	const size_t sector = b->blockno * (BSIZE / SECTOR_SIZE);
+	const bool write = (b->flags & B_DIRTY) != 0;
+	char *data = ramdisk.data + b->blockno * BSIZE;
+
+	tracepoint(TRACE_BLOCK_SUBMIT, sector, write);
+	if (write) {
+		memmove(data, b->data, BSIZE);
+	} else {
+		memmove(b->data, data, BSIZE);
+	}
+	tracepoint(TRACE_BLOCK_COMPLETE, sector, write);
+
+	b->flags |= B_VALID;
+	b->flags &= ~(B_DIRTY | B_FLUSH | B_FUA);
+}
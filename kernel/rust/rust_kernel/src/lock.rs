@@ -10,12 +10,9 @@ pub struct SpinLock<T> {
 
 impl<T: Default> SpinLock<T> {
     pub const fn new() -> Self {
-        let inner: spinlock = spinlock {
-            locked: 0,
-            name: core::ptr::null(),
-            cpu: core::ptr::null_mut(),
-            pcs: [0; 10],
-        };
+        // An all-zero spinlock is unlocked, untracked and has an empty
+        // waiter queue, the same state initlock() leaves it in.
+        let inner: spinlock = unsafe { core::mem::MaybeUninit::zeroed().assume_init() };
 
         Self {
             data: unsafe { core::mem::MaybeUninit::zeroed().assume_init() },
@@ -1,48 +1,235 @@
 // Sleeping locks
 
 #include "sleeplock.h"
+#include "console.h"
 #include "proc.h"
 #include "spinlock.h"
 #include <stdatomic.h>
 
+// How many pause iterations a contended acquiresleep() may spend
+// waiting on a running owner before it goes to sleep.
+#define SLEEPLOCK_SPIN_MAX 4096
+
 void
 initsleeplock(struct sleeplock *lk, const char *name)
 {
 	initlock(&lk->lk, "sleep lock");
 	lk->name = name;
 	lk->locked = 0;
+	lk->waiters = 0;
+	lk->owner = NULL;
 	lk->pid = 0;
 }
 
+static inline bool
+trylocksleep(struct sleeplock *lk)
+{
+	int expected = 0;
+	return atomic_compare_exchange_strong_explicit(
+		&lk->locked, &expected, 1, memory_order_acquire, memory_order_relaxed);
+}
+
+// Spin while the owner is on a CPU, since it is likely to release
+// the lock sooner than we could sleep and be woken up again.
+static bool
+spinsleep(struct sleeplock *lk)
+{
+	for (int i = 0; i < SLEEPLOCK_SPIN_MAX; i++) {
+		struct proc *owner = atomic_load_explicit(&lk->owner, memory_order_relaxed);
+		if (owner == NULL) {
+			if (trylocksleep(lk)) {
+				return true;
+			}
+		} else if (owner->state != RUNNING || owner == myproc()) {
+			return false;
+		}
+		__asm__ __volatile__("pause" ::: "memory");
+	}
+	return false;
+}
+
 void
 acquiresleep(struct sleeplock *lk) __acquires(lk)
 {
+	if (!trylocksleep(lk) && !spinsleep(lk)) {
+		acquire(&lk->lk);
+		// Announce ourselves before the final attempt, so that a
+		// releaser that saw no waiters is guaranteed to have
+		// unlocked before our attempt.
+		atomic_fetch_add(&lk->waiters, 1);
+		while (!trylocksleep(lk)) {
+			sleep(lk, &lk->lk);
+		}
+		atomic_fetch_sub(&lk->waiters, 1);
+		release(&lk->lk);
+	}
+	atomic_store_explicit(&lk->owner, myproc(), memory_order_relaxed);
+	lk->pid = myproc()->pid;
+}
+
+void
+releasesleep(struct sleeplock *lk) __releases(lk)
+{
+	lk->pid = 0;
+	atomic_store_explicit(&lk->owner, NULL, memory_order_relaxed);
+	atomic_store(&lk->locked, 0);
+	// Skip the process table scan in wakeup() when nobody sleeps here.
+	if (atomic_load(&lk->waiters) != 0) {
+		acquire(&lk->lk);
+		wakeup(lk);
+		release(&lk->lk);
+	}
+}
+
+int
+holdingsleep(struct sleeplock *lk)
+{
+	return atomic_load(&lk->locked) &&
+	       atomic_load_explicit(&lk->owner, memory_order_relaxed) == myproc();
+}
+
+void
+initrwsleeplock(struct rwsleeplock *lk, const char *name)
+{
+	initlock(&lk->lk, "rw sleep lock");
+	lk->name = name;
+	lk->readers = 0;
+	lk->writer = 0;
+	lk->owner = NULL;
+	lk->writers_waiting = 0;
+	lk->readers_waiting = 0;
+	lk->pid = 0;
+}
+
+// Like spinsleep(): while a writer holds lk and is on a CPU, wait for
+// it to let go rather than sleep.
+static void
+spinrwsleep(struct rwsleeplock *lk)
+{
+	for (int i = 0; i < SLEEPLOCK_SPIN_MAX; i++) {
+		struct proc *owner = atomic_load_explicit(&lk->owner, memory_order_relaxed);
+		if (owner == NULL || owner->state != RUNNING || owner == myproc()) {
+			return;
+		}
+		__asm__ __volatile__("pause" ::: "memory");
+	}
+}
+
+void
+acquirerwsleep_write(struct rwsleeplock *lk) __acquires(lk)
+{
+	spinrwsleep(lk);
 	acquire(&lk->lk);
-	while (atomic_load(&lk->locked)) {
+	while (lk->writer || lk->readers != 0) {
+		lk->writers_waiting++;
 		sleep(lk, &lk->lk);
+		lk->writers_waiting--;
 	}
-	atomic_exchange_explicit(&lk->locked, 1, memory_order_acquire);
+	lk->writer = 1;
+	atomic_store_explicit(&lk->owner, myproc(), memory_order_relaxed);
 	lk->pid = myproc()->pid;
 	release(&lk->lk);
 }
 
+// Wake whoever should go next: a waiting writer if the lock is free,
+// otherwise (no writers queued) all waiting readers.
+static void
+rwsleep_wakeup(struct rwsleeplock *lk)
+{
+	if (lk->writers_waiting != 0) {
+		if (lk->readers == 0) {
+			wakeup(lk);
+		}
+	} else if (lk->readers_waiting != 0) {
+		wakeup(&lk->readers);
+	}
+}
+
+static void
+releaserwsleep_write_locked(struct rwsleeplock *lk)
+{
+	lk->writer = 0;
+	atomic_store_explicit(&lk->owner, NULL, memory_order_relaxed);
+	lk->pid = 0;
+	rwsleep_wakeup(lk);
+}
+
+void
+releaserwsleep_write(struct rwsleeplock *lk) __releases(lk)
+{
+	acquire(&lk->lk);
+	releaserwsleep_write_locked(lk);
+	release(&lk->lk);
+}
+
 void
-releasesleep(struct sleeplock *lk) __releases(lk)
+acquirerwsleep_read(struct rwsleeplock *lk) __acquires(lk)
 {
+	spinrwsleep(lk);
 	acquire(&lk->lk);
-	atomic_store_explicit(&lk->locked, 0, memory_order_release);
-	lk->pid = 0;
-	wakeup(lk);
+	while (lk->writer || lk->writers_waiting != 0) {
+		lk->readers_waiting++;
+		sleep(&lk->readers, &lk->lk);
+		lk->readers_waiting--;
+	}
+	lk->readers++;
 	release(&lk->lk);
 }
 
-int
-holdingsleep(struct sleeplock *lk)
+void
+releaserwsleep_read(struct rwsleeplock *lk) __releases(lk)
 {
-	int r;
+	acquire(&lk->lk);
+	lk->readers--;
+	rwsleep_wakeup(lk);
+	release(&lk->lk);
+}
 
+// Release lk, whichever way this process holds it.
+void
+releaserwsleep(struct rwsleeplock *lk) __releases(lk)
+{
 	acquire(&lk->lk);
-	r = atomic_load(&lk->locked) && (lk->pid == myproc()->pid);
+	if (lk->writer && lk->owner == myproc()) {
+		releaserwsleep_write_locked(lk);
+	} else if (lk->readers != 0) {
+		lk->readers--;
+		rwsleep_wakeup(lk);
+	} else {
+		panic("releaserwsleep: %s not held", lk->name);
+	}
 	release(&lk->lk);
-	return r;
+}
+
+// Turn an exclusive hold into a shared one without letting a
+// writer in between.
+void
+downgraderwsleep(struct rwsleeplock *lk)
+{
+	acquire(&lk->lk);
+	lk->writer = 0;
+	atomic_store_explicit(&lk->owner, NULL, memory_order_relaxed);
+	lk->pid = 0;
+	lk->readers++;
+	if (lk->writers_waiting == 0 && lk->readers_waiting != 0) {
+		wakeup(&lk->readers);
+	}
+	release(&lk->lk);
+}
+
+// Is the lock held exclusively by this process? Only this process
+// can make owner itself, so no lock is needed to check.
+int
+holdingrwsleep_write(struct rwsleeplock *lk)
+{
+	return atomic_load_explicit(&lk->owner, memory_order_relaxed) == myproc();
+}
+
+// Is the lock held in a way that allows reading? Readers are not
+// tracked individually, so any shared hold counts.
+int
+holdingrwsleep(struct rwsleeplock *lk)
+{
+	return atomic_load_explicit(&lk->owner, memory_order_relaxed) == myproc() ||
+	       __atomic_load_n(&lk->readers, __ATOMIC_RELAXED) != 0;
 }
@@ -1,4 +1,10 @@
 // Mutual exclusion spin locks.
+//
+// The lock word is taken with a single compare-and-swap when it is free.
+// Under contention, waiters line up in an MCS queue: each CPU spins on
+// its own mcs_node, and only the head of the queue polls the lock word
+// (test-and-test-and-set with exponential backoff). This keeps hot locks
+// like ptable.lock from bouncing one cache line between every waiting CPU.
 
 #include "spinlock.h"
 #include "console.h"
@@ -13,12 +19,91 @@
 #include <stdint.h>
 #include <string.h>
 
+// Upper bound on the pause loop of the queue head, in iterations.
+#define SPIN_BACKOFF_MAX 64
+
+// Locks whose contention statistics show up in /dev/lockstat.
+static _Atomic(struct spinlock *) lockstat_head;
+
 void
 initlock(struct spinlock *lk, const char *name)
 {
 	lk->name = name;
 	lk->locked = 0;
+	lk->tail = NULL;
 	lk->cpu = NULL;
+	lk->tracked = false;
+	memset(&lk->stats, 0, sizeof(lk->stats));
+	lk->stats_next = NULL;
+}
+
+static __always_inline void
+cpu_relax(void)
+{
+	__asm__ __volatile__("pause" ::: "memory");
+}
+
+static __always_inline bool
+try_lock(struct spinlock *lk)
+{
+	int expected = 0;
+	return atomic_compare_exchange_strong_explicit(
+		&lk->locked, &expected, 1, memory_order_acquire, memory_order_relaxed);
+}
+
+// Contended path: queue up behind the other waiters, then compete
+// for the lock word once we reach the head of the queue.
+// Returns the number of pause iterations spent waiting.
+static uint64_t
+acquire_slow(struct spinlock *lk)
+{
+	struct mcs_node *node = &mycpu()->mcs_node;
+	struct mcs_node *prev, *next;
+	uint64_t spins = 0;
+
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&node->locked, 0, memory_order_relaxed);
+
+	prev = atomic_exchange_explicit(&lk->tail, node, memory_order_acq_rel);
+	if (prev != NULL) {
+		atomic_store_explicit(&prev->next, node, memory_order_release);
+		while (!atomic_load_explicit(&node->locked, memory_order_acquire)) {
+			cpu_relax();
+			spins++;
+		}
+	}
+
+	// We are the head of the queue. Only we (and uncontended fast-path
+	// callers) touch the lock word now, so back off between attempts
+	// instead of hammering it.
+	for (uint32_t backoff = 1;;) {
+		if (atomic_load_explicit(&lk->locked, memory_order_relaxed) == 0 &&
+		    try_lock(lk)) {
+			break;
+		}
+		for (uint32_t i = 0; i < backoff; i++) {
+			cpu_relax();
+		}
+		spins += backoff;
+		if (backoff < SPIN_BACKOFF_MAX) {
+			backoff <<= 1;
+		}
+	}
+
+	// Leave the queue, handing the head position to our successor.
+	struct mcs_node *expected = node;
+	if (!atomic_compare_exchange_strong_explicit(&lk->tail, &expected, NULL,
+	                                             memory_order_release,
+	                                             memory_order_relaxed)) {
+		// Someone swapped themselves in as the tail but has not linked
+		// themselves to us yet.
+		while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) ==
+		       NULL) {
+			cpu_relax();
+		}
+		atomic_store_explicit(&next->locked, 1, memory_order_release);
+	}
+	return spins;
 }
 
 // Acquire the lock.
@@ -28,19 +113,33 @@ initlock(struct spinlock *lk, const char *name)
 void
 acquire(struct spinlock *lk) __acquires(lk)
 {
+	uint64_t spins = 0;
+	bool contended = false;
+
 	pushcli(); // disable interrupts to avoid deadlock.
 	kernel_assert(!holding(lk));
 
-	while (atomic_exchange_explicit(&lk->locked, 1, memory_order_acquire) != 0)
-		;
+	// Don't barge past CPUs that are already queued.
+	if (atomic_load_explicit(&lk->tail, memory_order_relaxed) != NULL ||
+	    !try_lock(lk)) {
+		spins = acquire_slow(lk);
+		contended = true;
+	}
 	__acquire(lk);
-	// Tell the C compiler and the processor to not move loads or stores
-	// past this point, to ensure that the critical section's memory
-	// references happen after the lock is acquired.
-	atomic_thread_fence(memory_order_seq_cst);
+	// The acquire ordering of the compare-and-swap keeps the critical
+	// section's memory references from moving above this point.
+
 	// Record info about lock acquisition for debugging.
 	lk->cpu = mycpu();
+#if __RELIX_KERNEL_DEBUG__
 	getcallerpcs(lk->pcs);
+#endif
+	if (lk->tracked) {
+		lk->stats.acquisitions++;
+		lk->stats.contended += contended;
+		lk->stats.spins += spins;
+		lk->stats.acquired_at = rdtsc();
+	}
 }
 
 // Release the lock.
@@ -49,17 +148,19 @@ release(struct spinlock *lk) __releases(lk)
 {
 	kernel_assert_unlocked(holding(lk));
 
+	if (lk->tracked) {
+		uint64_t held = rdtsc() - lk->stats.acquired_at;
+		if (held > lk->stats.max_hold) {
+			lk->stats.max_hold = held;
+		}
+	}
+
 	lk->pcs[0] = 0;
 	lk->cpu = NULL;
 
-	// Tell the C compiler and the processor to not move loads or stores
-	// past this point, to ensure that all the stores in the critical
-	// section are visible to other cores before the lock is released.
-	// Both the C compiler and the hardware may re-order loads and
-	// stores; atomic_thread_fence() tells them both not to.
-	atomic_thread_fence(memory_order_seq_cst);
-
 	// Release the lock, equivalent to lk->locked = 0.
+	// The release ordering makes all the stores in the critical
+	// section visible to other cores before the lock is seen as free.
 	// This code can't use a C assignment, since it might
 	// not be atomic.
 	atomic_store_explicit(&lk->locked, 0, memory_order_release);
@@ -68,6 +169,51 @@ release(struct spinlock *lk) __releases(lk)
 	popcli();
 }
 
+// Start collecting contention statistics for lk and list it in
+// /dev/lockstat. The lock must live for the rest of the kernel's
+// lifetime, as there is no way to unregister it.
+void
+lockstat_register(struct spinlock *lk)
+{
+	struct spinlock *head = atomic_load(&lockstat_head);
+	lk->tracked = true;
+	do {
+		lk->stats_next = head;
+	} while (!atomic_compare_exchange_weak(&lockstat_head, &head, lk));
+}
+
+// Zero the counters of every registered lock.
+void
+lockstat_reset(void)
+{
+	for (struct spinlock *lk = atomic_load(&lockstat_head); lk != NULL;
+	     lk = lk->stats_next) {
+		acquire(lk);
+		uint64_t acquired_at = lk->stats.acquired_at;
+		memset(&lk->stats, 0, sizeof(lk->stats));
+		lk->stats.acquired_at = acquired_at;
+		release(lk);
+	}
+}
+
+// Write a table of the registered locks' statistics into buf.
+// Returns the length of the full table, which may exceed n.
+size_t
+lockstat_format(char *buf, size_t n)
+{
+	size_t len = ksnprintf(buf, n, "%-16s %-14s %-12s %-14s %s\n", "name",
+	                       "acquisitions", "contended", "spins", "max_hold");
+	for (struct spinlock *lk = atomic_load(&lockstat_head); lk != NULL;
+	     lk = lk->stats_next) {
+		// Racy snapshot; the counters are only updated by the holder.
+		struct lock_stats st = lk->stats;
+		len += ksnprintf(len < n ? buf + len : NULL, len < n ? n - len : 0,
+		                 "%-16s %-14lu %-12lu %-14lu %lu\n", lk->name,
+		                 st.acquisitions, st.contended, st.spins, st.max_hold);
+	}
+	return len;
+}
+
 // Record the current call stack in pcs[] by following the %rbp chain.
 void
 getcallerpcs(uintptr_t pcs[])
@@ -5,6 +5,7 @@
 #include "console.h"
 #include "kalloc.h"
 #include "kernel_assert.h"
+#include "sorting.h"
 
 #include <elf.h>
 #include <stddef.h>
@@ -37,6 +38,14 @@ static int s_symbol_num = 0;
 static size_t s_symlen_max = 0;
 static elf_symbol_t *s_symbols = NULL;
 
+static int
+symbol_compare(const void *a, const void *b)
+{
+	uintptr_t x = ((const elf_symbol_t *)a)->addr;
+	uintptr_t y = ((const elf_symbol_t *)b)->addr;
+	return (x > y) - (x < y);
+}
+
 void
 symbol_table_init(const Elf64_Shdr *sections, uint16_t entsize, uint16_t num)
 {
@@ -168,6 +177,10 @@ symbol_table_init(const Elf64_Shdr *sections, uint16_t entsize, uint16_t num)
 
 	kernel_assert(symname_idx == symname_len);
 	kernel_assert(symbol_idx == s_symbol_num);
+
+	// Sort by address so that lookups can bisect; the profiler makes
+	// a lot of them.
+	qsort(s_symbols, s_symbol_num, sizeof(elf_symbol_t), symbol_compare);
 }
 
 // INVARIANT: symbol_table_init is called before this.
@@ -177,17 +190,31 @@ symbol_resolve(size_t addr, size_t *rela)
 	if (s_symbol_num == 0 || s_symlen_max == 0 || s_symbols == NULL) {
 		goto error_condition;
 	}
-	for (int i = 0; i < s_symbol_num; i++) {
-		size_t start = s_symbols[i].addr;
-		size_t end = start + s_symbols[i].size;
-		if (addr < start || addr >= end) {
-			continue;
+	// Find the last symbol that starts at or below addr.
+	int lo = 0;
+	int hi = s_symbol_num;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (s_symbols[mid].addr <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
-
-		if (rela) {
-			*rela = addr - start;
+	}
+	if (lo > 0) {
+		const elf_symbol_t *sym = &s_symbols[lo - 1];
+		// Assembly routines often have no size; let them run up to
+		// the next symbol.
+		size_t end = sym->addr + sym->size;
+		if (sym->size == 0) {
+			end = lo < s_symbol_num ? s_symbols[lo].addr : sym->addr + 1;
+		}
+		if (addr < end) {
+			if (rela) {
+				*rela = addr - sym->addr;
+			}
+			return sym->name;
 		}
-		return s_symbols[i].name;
 	}
 
 	if (rela) {
@@ -1,10 +1,14 @@
 #include "syscall.h"
+#include "acct.h"
 #include "console.h"
+#include "dev/trace.h"
 #include "mmu.h"
 #include "msr.h"
 #include "proc.h"
 #include "spinlock.h"
 #include "trap.h"
+#include "vm.h"
+#include "vma.h"
 #include "x86.h"
 #include <defs.h>
 #include <errno.h>
@@ -12,14 +16,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define SYSCALL_ARG_FETCH(T)                                   \
-	int fetch##T(uintptr_t addr, T *ip)                          \
-	{                                                            \
-		struct proc *curproc = myproc();                           \
-		if (addr >= curproc->sz || addr + sizeof(T) > curproc->sz) \
-			return -EFAULT;                                          \
-		*ip = *(T *)(addr);                                        \
-		return 0;                                                  \
+#define SYSCALL_ARG_FETCH(T)                            \
+	int fetch##T(uintptr_t addr, T *ip)                   \
+	{                                                     \
+		return copy_from_user(ip, (void *)addr, sizeof(T)); \
 	}
 
 // User code makes a system call with INT T_SYSCALL.
@@ -43,12 +43,13 @@ ssize_t
 fetchstr(uintptr_t addr, char **pp)
 {
 	struct proc *curproc = myproc();
+	uintptr_t end = mm_region_end(curproc->mm, addr);
 
-	if (addr >= curproc->sz) {
+	if (end == 0) {
 		return -EFAULT;
 	}
 	*pp = (char *)addr;
-	char *ep = (char *)curproc->sz;
+	char *ep = (char *)end;
 	for (char *s = *pp; s < ep; s++) {
 		if (s != NULL && *s == 0) {
 			return s - *pp;
@@ -101,29 +102,43 @@ SYSCALL_ARG_N(uid_t);
 SYSCALL_ARG_N(gid_t);
 SYSCALL_ARG_N(clockid_t);
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+argptr1(int n, char **pp, int size, bool write)
 {
 	uintptr_t ptr;
 	struct proc *curproc = myproc();
 
 	PROPOGATE_ERR(arguintptr_t(n, &ptr));
 
-	if (size < 0 ||
-	    ((uintptr_t)ptr >= curproc->sz || (uintptr_t)ptr + size > curproc->sz)) {
+	// The buffer may be in the program image or in an mmap()ed region.
+	if (size < 0 || mm_user_range(curproc->mm, ptr, size, write) < 0) {
 		return -EFAULT;
 	}
 	*pp = (char *)ptr;
 	return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+	return argptr1(n, pp, size, false);
+}
+
+// Like argptr(), for a buffer the kernel writes to: it must be
+// writable too, since those writes have nowhere to go if they fault.
+int
+argptr_out(int n, char **pp, int size)
+{
+	return argptr1(n, pp, size, true);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Another thread, or a MAP_SHARED mapping of the same file, can
+// still change the string between this check and its use.)
 ssize_t
 argstr(int n, char **pp)
 {
@@ -195,6 +210,36 @@ extern size_t sys_setegid(void);
 extern size_t sys_getgroups(void);
 extern size_t sys_getsid(void);
 extern size_t sys_setsid(void);
+extern size_t sys_poll(void);
+extern size_t sys_ppoll(void);
+extern size_t sys_epoll_create1(void);
+extern size_t sys_epoll_ctl(void);
+extern size_t sys_epoll_wait(void);
+extern size_t sys_readv(void);
+extern size_t sys_preadv(void);
+extern size_t sys_pwritev(void);
+extern size_t sys_pread(void);
+extern size_t sys_pwrite(void);
+extern size_t sys_sendfile(void);
+extern size_t sys_splice(void);
+extern size_t sys_copy_file_range(void);
+extern size_t sys_clone(void);
+extern size_t sys_exit_thread(void);
+extern size_t sys_gettid(void);
+extern size_t sys_futex(void);
+extern size_t sys_arch_prctl(void);
+extern size_t sys_sched_yield(void);
+extern size_t sys_vfork(void);
+extern size_t sys_mprotect(void);
+extern size_t sys_msync(void);
+extern size_t sys_madvise(void);
+extern size_t sys_mount(void);
+extern size_t sys_umount(void);
+extern size_t sys_fdatasync(void);
+extern size_t sys_sync(void);
+extern size_t sys_ftruncate(void);
+extern size_t sys_fallocate(void);
+extern size_t sys_getrusage(void);
 
 static size_t
 unknown_syscall(void)
@@ -264,6 +309,36 @@ static size_t (*syscalls[])(void) = {
 	[SYS_setegid] = sys_setegid,
 	[SYS_getgroups] = sys_getgroups,
 	[SYS_setsid] = sys_setsid,
+	[SYS_poll] = sys_poll,
+	[SYS_ppoll] = sys_ppoll,
+	[SYS_epoll_create1] = sys_epoll_create1,
+	[SYS_epoll_ctl] = sys_epoll_ctl,
+	[SYS_epoll_wait] = sys_epoll_wait,
+	[SYS_readv] = sys_readv,
+	[SYS_preadv] = sys_preadv,
+	[SYS_pwritev] = sys_pwritev,
+	[SYS_pread] = sys_pread,
+	[SYS_pwrite] = sys_pwrite,
+	[SYS_sendfile] = sys_sendfile,
+	[SYS_splice] = sys_splice,
+	[SYS_copy_file_range] = sys_copy_file_range,
+	[SYS_clone] = sys_clone,
+	[SYS_exit_thread] = sys_exit_thread,
+	[SYS_gettid] = sys_gettid,
+	[SYS_futex] = sys_futex,
+	[SYS_arch_prctl] = sys_arch_prctl,
+	[SYS_sched_yield] = sys_sched_yield,
+	[SYS_vfork] = sys_vfork,
+	[SYS_mprotect] = sys_mprotect,
+	[SYS_msync] = sys_msync,
+	[SYS_madvise] = sys_madvise,
+	[SYS_mount] = sys_mount,
+	[SYS_umount] = sys_umount,
+	[SYS_fdatasync] = sys_fdatasync,
+	[SYS_sync] = sys_sync,
+	[SYS_ftruncate] = sys_ftruncate,
+	[SYS_fallocate] = sys_fallocate,
+	[SYS_getrusage] = sys_getrusage,
 	[SYS_getsid] = sys_getsid,
 };
 
@@ -395,6 +470,7 @@ void
 syswrap(struct trapframe *tf)
 {
 	struct proc *curproc = myproc();
+	acct_charge(true);
 	curproc->tf = tf;
 	if (curproc->killed) {
 		exit(0);
@@ -403,6 +479,7 @@ syswrap(struct trapframe *tf)
 	if (curproc->killed) {
 		exit(0);
 	}
+	acct_charge(false);
 }
 
 static void
@@ -424,6 +501,10 @@ syscall(struct proc *curproc)
 				cprintf(" errno %d", -(signed)curproc->tf->rax);
 			}
 			cprintf("\n");
+		} else if (trace_enabled(TRACE_SYSCALLS)) {
+			uint64_t start = rdtsc();
+			curproc->tf->rax = syscalls[num]();
+			trace_syscall(num, rdtsc() - start);
 		} else {
 			curproc->tf->rax = syscalls[num]();
 		}
@@ -4,6 +4,9 @@
 // user code, and calls into file.c and fs.c.
 //
 
+#include "dev/prof.h"
+#include "dev/trace.h"
+
 #include "console.h"
 #include "exec.h"
 #include "fb.h"
@@ -12,19 +15,24 @@
 #include "ioctl.h"
 #include "kalloc.h"
 #include "kernel_assert.h"
+#include "kernel_poll.h"
 #include "log.h"
 #include "macros.h"
 #include "memlayout.h"
 #include "mman.h"
 #include "mmu.h"
+#include "mount.h"
 #include "pci.h"
 #include "pipe.h"
 #include "proc.h"
 #include "syscall.h"
 #include "termios.h"
+#include "time_units.h"
 #include "trap.h"
 #include "vga.h"
 #include "vm.h"
+#include "vma.h"
+#include "x86.h"
 #include <bits/access_constants.h>
 #include <bits/fcntl_constants.h>
 #include <bits/seek_constants.h>
@@ -34,6 +42,8 @@
 #include <limits.h>
 #include <stdalign.h>
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdckdint.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -65,7 +75,7 @@ argfd(int n, int *pfd, struct file **pf)
 	if (fd >= OPEN_MAX) {
 		return -ENFILE;
 	}
-	if ((f = myproc()->ofile[fd]) == NULL) {
+	if ((f = myproc()->files->ofile[fd]) == NULL) {
 		return -EBADF;
 	}
 
@@ -119,7 +129,7 @@ sys_read(void)
 	// initialized after arguintptr_t() is run.
 	PROPOGATE_ERR(argfd(0, NULL, &f));
 	PROPOGATE_ERR(arguintptr_t(2, &n));
-	PROPOGATE_ERR(argptr(1, &p, n));
+	PROPOGATE_ERR(argptr_out(1, &p, n));
 	return vfs_read(f, p, n);
 }
 
@@ -139,26 +149,276 @@ sys_write(void)
 	return vfs_write(f, p, n);
 }
 
-size_t
-sys_writev(void)
+// Small iovec arrays are copied onto the stack instead of kmalloc()ed.
+#define UIO_FASTIOV 8
+
+// Copy in the iovec array at argument n, whose length is argument
+// n + 1, and check that every buffer lies in the process, and is
+// writable if out (the buffers are to be read into). The array is
+// copied so that the lengths cannot change after they are checked. If
+// *iovp does not end up pointing at fast, the caller must kfree() it.
+static int
+argiovec(int n, struct iovec fast[static UIO_FASTIOV], struct iovec **iovp,
+         int *iovcntp, bool out)
 {
-	struct iovec *iovecs;
+	struct proc *curproc = myproc();
+	struct iovec *uiov;
+	struct iovec *iov = fast;
 	int iovcnt;
-	int fd;
-	struct file *file;
-	ssize_t accumulated_bytes = 0;
-	PROPOGATE_ERR(argfd(0, &fd, &file));
-	PROPOGATE_ERR(argint(2, &iovcnt));
-	PROPOGATE_ERR(argptr(1, (void *)&iovecs, sizeof(*iovecs) * iovcnt));
+	size_t total = 0;
+
+	PROPOGATE_ERR(argint(n + 1, &iovcnt));
+	if (iovcnt < 0 || iovcnt > IOV_MAX) {
+		return -EINVAL;
+	}
+	PROPOGATE_ERR(argptr(n, (void *)&uiov, sizeof(*uiov) * iovcnt));
+	if (iovcnt > UIO_FASTIOV &&
+	    (iov = kmalloc(sizeof(*iov) * iovcnt)) == NULL) {
+		return -ENOMEM;
+	}
+	memcpy(iov, uiov, sizeof(*iov) * iovcnt);
 
 	for (int i = 0; i < iovcnt; i++) {
-		ssize_t ret = vfs_write(file, iovecs->iov_base, iovecs->iov_len);
-		if (ret < 0) {
-			return ret;
+		uintptr_t base = (uintptr_t)iov[i].iov_base;
+		if (iov[i].iov_len == 0) {
+			continue;
+		}
+		if (mm_user_range(curproc->mm, base, iov[i].iov_len, out) < 0) {
+			goto bad_fault;
+		}
+		if (ckd_add(&total, total, iov[i].iov_len) || total > SSIZE_MAX) {
+			goto bad_inval;
 		}
-		accumulated_bytes += ret;
 	}
-	return accumulated_bytes;
+	*iovp = iov;
+	*iovcntp = iovcnt;
+	return 0;
+
+bad_fault:
+	if (iov != fast) {
+		kfree(iov);
+	}
+	return -EFAULT;
+bad_inval:
+	if (iov != fast) {
+		kfree(iov);
+	}
+	return -EINVAL;
+}
+
+// Shared by readv, writev, preadv and pwritev. The positional
+// variants take the offset as argument 3.
+static ssize_t
+do_rwv(bool write, bool positional)
+{
+	struct iovec fast[UIO_FASTIOV];
+	struct iovec *iov;
+	int iovcnt;
+	struct file *file;
+	off_t off;
+	ssize_t ret;
+
+	PROPOGATE_ERR(argfd(0, NULL, &file));
+	if (positional) {
+		PROPOGATE_ERR(argoff_t(3, &off));
+		if (off < 0) {
+			return -EINVAL;
+		}
+	}
+	PROPOGATE_ERR(argiovec(1, fast, &iov, &iovcnt, !write));
+
+	if (write) {
+		ret = vfs_writev(file, iov, iovcnt, positional ? &off : NULL);
+	} else {
+		ret = vfs_readv(file, iov, iovcnt, positional ? &off : NULL);
+	}
+	if (iov != fast) {
+		kfree(iov);
+	}
+	return ret;
+}
+
+size_t
+sys_readv(void)
+{
+	return do_rwv(false, false);
+}
+
+size_t
+sys_writev(void)
+{
+	return do_rwv(true, false);
+}
+
+size_t
+sys_preadv(void)
+{
+	return do_rwv(false, true);
+}
+
+size_t
+sys_pwritev(void)
+{
+	return do_rwv(true, true);
+}
+
+size_t
+sys_pread(void)
+{
+	struct file *f;
+	uint64_t n;
+	char *p;
+	off_t off;
+
+	// Same ordering constraint as sys_read().
+	PROPOGATE_ERR(argfd(0, NULL, &f));
+	PROPOGATE_ERR(arguintptr_t(2, &n));
+	PROPOGATE_ERR(argptr_out(1, &p, n));
+	PROPOGATE_ERR(argoff_t(3, &off));
+	if (off < 0) {
+		return -EINVAL;
+	}
+	return vfs_readv(f, &(const struct iovec){ p, n }, 1, &off);
+}
+
+size_t
+sys_pwrite(void)
+{
+	struct file *f;
+	uint64_t n;
+	char *p;
+	off_t off;
+
+	// Same ordering constraint as sys_write().
+	PROPOGATE_ERR(argfd(0, NULL, &f));
+	PROPOGATE_ERR(arguintptr_t(2, &n));
+	PROPOGATE_ERR(argptr(1, &p, n));
+	PROPOGATE_ERR(argoff_t(3, &off));
+	if (off < 0) {
+		return -EINVAL;
+	}
+	return vfs_writev(f, &(const struct iovec){ p, n }, 1, &off);
+}
+
+// Fetch an optional off_t pointer argument; *pp is NULL if the
+// caller passed NULL.
+static int
+argoffp(int n, off_t **pp)
+{
+	uintptr_t ptr;
+
+	PROPOGATE_ERR(arguintptr_t(n, &ptr));
+	if (ptr == 0) {
+		*pp = NULL;
+		return 0;
+	}
+	return argptr_out(n, (char **)pp, sizeof(**pp));
+}
+
+// Common part of sendfile, splice and copy_file_range. Offsets are
+// read from and written back to user memory around the transfer.
+static ssize_t
+do_splice(struct file *in, off_t *uin_off, struct file *out, off_t *uout_off,
+          size_t len)
+{
+	off_t in_off;
+	off_t out_off;
+	ssize_t ret;
+
+	if (uin_off != NULL) {
+		if ((in_off = *uin_off) < 0) {
+			return -EINVAL;
+		}
+	}
+	if (uout_off != NULL) {
+		if ((out_off = *uout_off) < 0) {
+			return -EINVAL;
+		}
+	}
+	ret = vfs_splice(in, uin_off != NULL ? &in_off : NULL, out,
+	                 uout_off != NULL ? &out_off : NULL, len);
+	if (uin_off != NULL) {
+		*uin_off = in_off;
+	}
+	if (uout_off != NULL) {
+		*uout_off = out_off;
+	}
+	return ret;
+}
+
+size_t
+sys_sendfile(void)
+{
+	struct file *out;
+	struct file *in;
+	off_t *offset;
+	size_t count;
+
+	PROPOGATE_ERR(argfd(0, NULL, &out));
+	PROPOGATE_ERR(argfd(1, NULL, &in));
+	PROPOGATE_ERR(argoffp(2, &offset));
+	PROPOGATE_ERR(argsize_t(3, &count));
+	return do_splice(in, offset, out, NULL, count);
+}
+
+size_t
+sys_splice(void)
+{
+	struct file *in;
+	struct file *out;
+	off_t *in_off;
+	off_t *out_off;
+	size_t len;
+	unsigned int flags;
+
+	PROPOGATE_ERR(argfd(0, NULL, &in));
+	PROPOGATE_ERR(argoffp(1, &in_off));
+	PROPOGATE_ERR(argfd(2, NULL, &out));
+	PROPOGATE_ERR(argoffp(3, &out_off));
+	PROPOGATE_ERR(argsize_t(4, &len));
+	PROPOGATE_ERR(argunsigned_int(5, &flags));
+	// One end has to be a pipe, like on Linux. The flags are only
+	// hints there, so they are ignored.
+	if (in->type != FD_PIPE && in->type != FD_FIFO && out->type != FD_PIPE &&
+	    out->type != FD_FIFO) {
+		return -EINVAL;
+	}
+	return do_splice(in, in_off, out, out_off, len);
+}
+
+size_t
+sys_copy_file_range(void)
+{
+	struct file *in;
+	struct file *out;
+	off_t *in_off;
+	off_t *out_off;
+	size_t len;
+	unsigned int flags;
+
+	PROPOGATE_ERR(argfd(0, NULL, &in));
+	PROPOGATE_ERR(argoffp(1, &in_off));
+	PROPOGATE_ERR(argfd(2, NULL, &out));
+	PROPOGATE_ERR(argoffp(3, &out_off));
+	PROPOGATE_ERR(argsize_t(4, &len));
+	PROPOGATE_ERR(argunsigned_int(5, &flags));
+	if (flags != 0) {
+		return -EINVAL;
+	}
+	if (in->type != FD_INODE || out->type != FD_INODE ||
+	    !S_ISREG(in->ip->mode) || !S_ISREG(out->ip->mode)) {
+		return -EINVAL;
+	}
+	// Copying a file onto an overlapping range of itself would read
+	// back bytes it had just written.
+	if (in->ip == out->ip) {
+		off_t ioff = in_off != NULL ? *in_off : in->off;
+		off_t ooff = out_off != NULL ? *out_off : out->off;
+		if (ioff < ooff + (off_t)len && ooff < ioff + (off_t)len) {
+			return -EINVAL;
+		}
+	}
+	return do_splice(in, in_off, out, out_off, len);
 }
 
 size_t
@@ -168,7 +428,7 @@ sys_close(void)
 	struct file *f;
 	PROPOGATE_ERR(argfd(0, &fd, &f));
 
-	myproc()->ofile[fd] = NULL;
+	myproc()->files->ofile[fd] = NULL;
 	return vfs_close(f);
 }
 
@@ -178,7 +438,7 @@ sys_fstat(void)
 	struct file *f;
 	struct stat *st;
 	PROPOGATE_ERR(argfd(0, NULL, &f));
-	PROPOGATE_ERR(argptr(1, (void *)&st, sizeof(*st)));
+	PROPOGATE_ERR(argptr_out(1, (void *)&st, sizeof(*st)));
 
 	if (st == NULL) {
 		return -EFAULT;
@@ -196,7 +456,7 @@ sys_fstatat(void)
 	struct inode *ip = NULL;
 	PROPOGATE_ERR(argfd(0, &dirfd, NULL));
 	PROPOGATE_ERR(argstr(1, &path));
-	PROPOGATE_ERR(argptr(2, (char **)&st, sizeof(*st)));
+	PROPOGATE_ERR(argptr_out(2, (char **)&st, sizeof(*st)));
 	PROPOGATE_ERR(argint(3, &flags));
 
 	// Find the inode from the name.
@@ -255,9 +515,12 @@ sys_linkat(void)
 		retflag = -ENOENT;
 		goto bad;
 	}
+	if (dp->dev != ip->dev) {
+		inode_put(dp);
+		retflag = -EXDEV;
+		goto bad;
+	}
 	inode_lock(dp);
-	// TODO: When we get different filesystem support, we need to
-	// check for differing filesystems here and return EXDEV.
 	int ret;
 	if ((ret = dirlink(dp, name, ip->inum)) < 0) {
 		inode_unlockput(dp);
@@ -332,6 +595,11 @@ sys_unlinkat(void)
 		goto bad;
 	}
 	kernel_assert(ip != dp);
+	if (mount_is_covered(ip)) {
+		inode_put(ip);
+		error = -EBUSY;
+		goto bad;
+	}
 
 	inode_lock(ip);
 
@@ -436,72 +704,83 @@ sys_getdents(void)
 	size_t nbyte;
 	int flags;
 	PROPOGATE_ERR(argfd(0, NULL, &file));
-	PROPOGATE_ERR(argptr(1, (char **)&buf, sizeof(void *)));
 	PROPOGATE_ERR(argsize_t(2, &nbyte));
+	nbyte = min(nbyte, INT_MAX);
+	PROPOGATE_ERR(argptr_out(1, (char **)&buf, nbyte));
 	PROPOGATE_ERR(argint(3, &flags));
 
 	if (flags & ~(DT_FORCE_TYPE)) {
 		return -EINVAL;
 	}
 
+	// Directory entries are read a page at a time rather than one by
+	// one, which would lock and walk the inode for every entry.
+	struct dirent *chunk = (struct dirent *)kpage_alloc();
+	if (chunk == NULL) {
+		return -ENOMEM;
+	}
+	const size_t per_chunk = PGSIZE / sizeof(struct dirent);
 	size_t nread = 0;
-	size_t dir_size;
-
-	inode_lock(file->ip);
-	dir_size = file->ip->size;
-	inode_unlock(file->ip);
+	bool full = false;
 
-	// If we reach the end of the directory, exit.
-	while (file->off < dir_size) {
-		struct posix_dent *buf_loc = buf + nread;
-		struct dirent de;
-		PROPOGATE_ERR(vfs_read(file, (char *)&de, sizeof(struct dirent)));
-		// This directory entry was deleted, so skip over it.
-		if (de.d_ino == 0) {
-			continue;
+	while (!full) {
+		ssize_t r = vfs_read(file, (char *)chunk, per_chunk * sizeof(struct dirent));
+		if (r < 0) {
+			kpage_free((char *)chunk);
+			return r;
 		}
-		// Use offsetof to get the offset as sizeof will not be helpful here.
-		// The true size of the struct is this calculation, before we round it
-		// to the alignment.
-		size_t expected_size =
-			ROUND_UP(offsetof(struct posix_dent, d_name) + strlen(de.d_name) + 1,
-		           alignof(struct posix_dent));
-
-		// Also check for the case where the
-		// expected size is over the size
-		// of our buffer. In that case,
-		// seek the file back where it was
-		// and exit.
-		if (nread + expected_size >= nbyte) {
-			fileseek(file, -(off_t)sizeof(struct dirent), SEEK_CUR);
+		size_t count = r / sizeof(struct dirent);
+		if (count == 0) {
 			break;
 		}
+		for (size_t i = 0; i < count; i++) {
+			struct dirent *de = &chunk[i];
+			struct posix_dent *buf_loc = buf + nread;
+			// This directory entry was deleted, so skip over it.
+			if (de->d_ino == 0) {
+				continue;
+			}
+			size_t name_len = strlen(de->d_name);
+			// Use offsetof to get the offset as sizeof will not be helpful here.
+			// The true size of the struct is this calculation, before we round it
+			// to the alignment.
+			size_t expected_size =
+				ROUND_UP(offsetof(struct posix_dent, d_name) + name_len + 1,
+			           alignof(struct posix_dent));
+
+			// If this entry does not fit, seek the file back to it so that
+			// the next call starts there.
+			if (nread + expected_size >= nbyte) {
+				fileseek(file, -(off_t)((count - i) * sizeof(struct dirent)),
+				         SEEK_CUR);
+				full = true;
+				break;
+			}
 
-		buf_loc->d_ino = de.d_ino;
+			buf_loc->d_ino = de->d_ino;
+			memcpy(buf_loc->d_name, de->d_name, name_len + 1);
+
+			// POSIX.1-2024 recommends that this flag is implemented, so we do.
+			if (flags & DT_FORCE_TYPE) {
+				struct inode *temp_ip = inode_get(file->ip->dev, de->d_ino);
+				inode_lock(temp_ip);
+				buf_loc->d_type = stat_type_to_getdents_type(temp_ip->mode & S_IFMT);
+				inode_unlockput(temp_ip);
+			} else {
+				// When we get different filesystems, we might be able to get directory
+				// entry types without searching it from the inode number.
+				buf_loc->d_type = DT_UNKNOWN;
+			}
 
-		// Copy file name and truncate result if necessary.
-		// We use strlen() instead of sizeof() because posix_dent
-		// has a flexible array member for the file name.
-		strncpy(buf_loc->d_name, de.d_name, strlen(de.d_name));
-		buf_loc->d_name[strlen(de.d_name)] = '\0';
+			buf_loc->d_reclen = expected_size;
 
-		// POSIX.1-2024 recommends that this flag is implemented, so we do.
-		if (flags & DT_FORCE_TYPE) {
-			struct inode *temp_ip = inode_get(file->ip->dev, de.d_ino);
-			inode_lock(temp_ip);
-			buf_loc->d_type = stat_type_to_getdents_type(temp_ip->mode & S_IFMT);
-			inode_unlockput(temp_ip);
-		} else {
-			// When we get different filesystems, we might be able to get directory
-			// entry types without searching it from the inode number.
-			buf_loc->d_type = DT_UNKNOWN;
+			nread += buf_loc->d_reclen;
+		}
+		if ((size_t)r < per_chunk * sizeof(struct dirent)) {
+			break;
 		}
-
-		buf_loc->d_reclen = expected_size;
-
-		nread += buf_loc->d_reclen;
 	}
-
+	kpage_free((char *)chunk);
 	return nread;
 }
 
@@ -578,9 +857,9 @@ sys_chdir(void)
 		return -ENOTDIR;
 	}
 	inode_unlock(ip);
-	inode_put(curproc->cwd);
+	inode_put(curproc->files->cwd);
 	end_op();
-	curproc->cwd = ip;
+	curproc->files->cwd = ip;
 	return 0;
 }
 
@@ -593,7 +872,7 @@ sys_getcwd(void)
 	PROPOGATE_ERR(argsize_t(1, &size));
 
 	// Translate cwd from inode into path.
-	char *ret = inode_to_path(buf, size, myproc()->cwd);
+	char *ret = inode_to_path(buf, size, myproc()->files->cwd);
 	// If we are negative, propogate the errno.
 	if (ret == NULL) {
 		return -EINVAL;
@@ -658,7 +937,7 @@ sys_pipe2(void)
 	// Arrays don't decay like you'd expect them to
 	// when going into argptr. You must use a raw
 	// pointer type, even for arrays.
-	PROPOGATE_ERR(argptr(0, (char **)&fd, 2 * sizeof(fd[0])));
+	PROPOGATE_ERR(argptr_out(0, (char **)&fd, 2 * sizeof(fd[0])));
 	PROPOGATE_ERR(argint(1, &oflags));
 
 	if (oflags & ~(O_CLOEXEC | O_CLOFORK | O_NONBLOCK)) {
@@ -669,7 +948,7 @@ sys_pipe2(void)
 	fd0 = -1;
 	if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
 		if (fd0 >= 0) {
-			myproc()->ofile[fd0] = NULL;
+			myproc()->files->ofile[fd0] = NULL;
 		}
 		// Ignore the return value here so that
 		// we can get a more accurate errno.
@@ -684,6 +963,117 @@ sys_pipe2(void)
 	return 0;
 }
 
+size_t
+sys_poll(void)
+{
+	struct pollfd *fds;
+	unsigned long nfds;
+	int timeout;
+
+	PROPOGATE_ERR(argunsigned_long(1, &nfds));
+	if (nfds > OPEN_MAX) {
+		return -EINVAL;
+	}
+	PROPOGATE_ERR(argptr_out(0, (char **)&fds, nfds * sizeof(*fds)));
+	PROPOGATE_ERR(argint(2, &timeout));
+
+	return do_poll(fds, nfds, timeout);
+}
+
+size_t
+sys_ppoll(void)
+{
+	struct pollfd *fds;
+	unsigned long nfds;
+	uintptr_t tmo_addr;
+	struct timespec *tmo;
+	long timeout = -1;
+
+	PROPOGATE_ERR(argunsigned_long(1, &nfds));
+	if (nfds > OPEN_MAX) {
+		return -EINVAL;
+	}
+	PROPOGATE_ERR(argptr_out(0, (char **)&fds, nfds * sizeof(*fds)));
+	PROPOGATE_ERR(arguintptr_t(2, &tmo_addr));
+	// The signal mask (argument 3) is ignored, since signals
+	// cannot be blocked yet.
+
+	if (tmo_addr != 0) {
+		PROPOGATE_ERR(argptr(2, (char **)&tmo, sizeof(*tmo)));
+		if (tmo->tv_nsec < 0 || tmo->tv_nsec >= (long)NSEC_PER_SEC ||
+		    tmo->tv_sec > LONG_MAX / MSEC_PER_SEC - 1) {
+			return -EINVAL;
+		}
+		// Round up, so that we never return early.
+		timeout = sec_to_msec(tmo->tv_sec) +
+		          (tmo->tv_nsec + NSEC_PER_SEC / MSEC_PER_SEC - 1) /
+		            (NSEC_PER_SEC / MSEC_PER_SEC);
+	}
+
+	return do_poll(fds, nfds, timeout);
+}
+
+size_t
+sys_epoll_create1(void)
+{
+	int flags;
+	struct file *f;
+	int fd;
+
+	PROPOGATE_ERR(argint(0, &flags));
+	if (flags & ~EPOLL_CLOEXEC) {
+		return -EINVAL;
+	}
+	if ((f = epoll_create(flags & EPOLL_CLOEXEC ? O_CLOEXEC : 0)) == NULL) {
+		return -ENFILE;
+	}
+	if ((fd = fdalloc(f)) < 0) {
+		(void)vfs_close(f);
+	}
+	return fd;
+}
+
+size_t
+sys_epoll_ctl(void)
+{
+	struct file *epf;
+	int op;
+	int fd;
+	struct epoll_event *event = NULL;
+
+	PROPOGATE_ERR(argfd(0, NULL, &epf));
+	PROPOGATE_ERR(argint(1, &op));
+	PROPOGATE_ERR(argint(2, &fd));
+	if (epf->type != FD_EPOLL) {
+		return -EINVAL;
+	}
+	if (op != EPOLL_CTL_DEL) {
+		PROPOGATE_ERR(argptr(3, (char **)&event, sizeof(*event)));
+	}
+
+	return epoll_ctl(epf, op, fd, event);
+}
+
+size_t
+sys_epoll_wait(void)
+{
+	struct file *epf;
+	struct epoll_event *events;
+	int maxevents;
+	int timeout;
+
+	PROPOGATE_ERR(argfd(0, NULL, &epf));
+	PROPOGATE_ERR(argint(2, &maxevents));
+	if (epf->type != FD_EPOLL || maxevents <= 0 ||
+	    maxevents > INT_MAX / sizeof(*events)) {
+		return -EINVAL;
+	}
+	PROPOGATE_ERR(argptr_out(1, (char **)&events, maxevents * sizeof(*events)));
+	PROPOGATE_ERR(argint(3, &timeout));
+
+	return epoll_wait(epf, events, maxevents, timeout);
+}
+
 size_t
 sys_fchmodat(void)
 {
@@ -697,17 +1087,17 @@ sys_fchmodat(void)
 	PROPOGATE_ERR(argmode_t(2, &mode));
 	PROPOGATE_ERR(argint(3, &flags));
 
+	begin_op();
 	if ((ip = ((flags & AT_SYMLINK_NOFOLLOW) ? namei_with_fd : resolve_nameat)(
 				 fd, path)) == NULL) {
 		end_op();
 		return -EINVAL;
 	}
-	begin_op();
 	inode_lock(ip);
 	// capture the file type and change the permissions
 	ip->mode = (ip->mode & S_IFMT) | mode;
 	inode_update(ip);
-	inode_unlock(ip);
+	inode_unlockput(ip);
 	end_op();
 	return 0;
 }
@@ -717,8 +1107,8 @@ sys_fchmod(void)
 {
 	struct file *file;
 	mode_t mode;
-	PROPOGATE_ERR_WITH(argfd(0, NULL, &file), { end_op(); });
-	PROPOGATE_ERR_WITH(argmode_t(1, &mode), { end_op(); });
+	PROPOGATE_ERR(argfd(0, NULL, &file));
+	PROPOGATE_ERR(argmode_t(1, &mode));
 	if (file == NULL) {
 		return -ENOENT;
 	}
@@ -822,7 +1212,8 @@ sys_lseek(void)
 		return -ENOENT;
 	}
 
-	if (S_ISFIFO(file->ip->mode) || S_ISSOCK(file->ip->mode)) {
+	if (file->type != FD_INODE || S_ISFIFO(file->ip->mode) ||
+	    S_ISSOCK(file->ip->mode)) {
 		return -ESPIPE;
 	}
 
@@ -850,7 +1241,7 @@ sys_ioctl(void)
 	case PCIIOCGETCONF: {
 		struct pci_conf *pci_conf_p;
 
-		PROPOGATE_ERR(argptr(2, (char **)&pci_conf_p, sizeof(struct pci_conf *)));
+		PROPOGATE_ERR(argptr_out(2, (char **)&pci_conf_p, sizeof(struct pci_conf *)));
 
 		if (pci_conf_p == NULL) {
 			return -EFAULT;
@@ -869,7 +1260,7 @@ sys_ioctl(void)
 		}
 		struct fb_var_screeninfo *scr_info;
 		PROPOGATE_ERR(
-			argptr(2, (char **)&scr_info, sizeof(struct fb_var_screeninfo *)));
+			argptr_out(2, (char **)&scr_info, sizeof(struct fb_var_screeninfo *)));
 
 		if (scr_info == NULL) {
 			return -EFAULT;
@@ -886,7 +1277,7 @@ sys_ioctl(void)
 			return -EINVAL;
 		}
 		pid_t *pgrp;
-		PROPOGATE_ERR(argptr(2, (char **)&pgrp, sizeof(pid_t *)));
+		PROPOGATE_ERR(argptr_out(2, (char **)&pgrp, sizeof(pid_t *)));
 		if (pgrp == NULL) {
 			return -EFAULT;
 		}
@@ -901,7 +1292,7 @@ sys_ioctl(void)
 			return -EINVAL;
 		}
 		struct termios *termios;
-		PROPOGATE_ERR(argptr(2, (char **)&termios, sizeof(struct termios *)));
+		PROPOGATE_ERR(argptr_out(2, (char **)&termios, sizeof(struct termios *)));
 
 		if (termios == NULL) {
 			return -EFAULT;
@@ -948,7 +1339,7 @@ sys_ioctl(void)
 	}
 	case TIOCGSID: {
 		pid_t *user_sid;
-		PROPOGATE_ERR(argptr(2, (char **)&user_sid, sizeof(pid_t *)));
+		PROPOGATE_ERR(argptr_out(2, (char **)&user_sid, sizeof(pid_t *)));
 		// Situations for ENOTTY:
 		// "The calling process does not have a controlling terminal, or the file is
 		// not the controlling terminal."
@@ -970,7 +1361,7 @@ sys_ioctl(void)
 	}
 	case TIOCGWINSZ: {
 		struct winsize *ws;
-		PROPOGATE_ERR(argptr(2, (char **)&ws, sizeof(struct winsize *)));
+		PROPOGATE_ERR(argptr_out(2, (char **)&ws, sizeof(struct winsize *)));
 		if (file->ip->major != DEV_TTY) {
 			return -ENOTTY;
 		}
@@ -984,6 +1375,50 @@ sys_ioctl(void)
 	case TIOCSWINSZ: {
 		return -ENOSYS;
 	}
+	case PROFIOCSTART: {
+		if (file->ip->major != DEV_PROF) {
+			return -ENOTTY;
+		}
+		int interval;
+		PROPOGATE_ERR(argint(2, &interval));
+		return prof_start(interval);
+	}
+	case PROFIOCSTOP: {
+		if (file->ip->major != DEV_PROF) {
+			return -ENOTTY;
+		}
+		return prof_stop();
+	}
+	case PROFIOCKSYM: {
+		if (file->ip->major != DEV_PROF) {
+			return -ENOTTY;
+		}
+		struct prof_symbol *sym;
+		PROPOGATE_ERR(argptr_out(2, (char **)&sym, sizeof(*sym)));
+		return prof_ksym(sym);
+	}
+	case TRACEIOCSTART: {
+		if (file->ip->major != DEV_TRACE) {
+			return -ENOTTY;
+		}
+		int mask;
+		PROPOGATE_ERR(argint(2, &mask));
+		return trace_start(mask);
+	}
+	case TRACEIOCSTOP: {
+		if (file->ip->major != DEV_TRACE) {
+			return -ENOTTY;
+		}
+		return trace_stop();
+	}
+	case TRACEIOCINFO: {
+		if (file->ip->major != DEV_TRACE) {
+			return -ENOTTY;
+		}
+		struct trace_info *info;
+		PROPOGATE_ERR(argptr_out(2, (char **)&info, sizeof(*info)));
+		return trace_info(info);
+	}
 	default: {
 		return -EINVAL;
 	}
@@ -1082,173 +1517,264 @@ sys_fcntl(void)
 	// Not reached.
 }
 
-static int
-mmap_prot_to_perm(int prot)
-{
-	int ret = PTE_U;
-	if ((prot & PROT_READ) == PROT_READ) {
-		// No PTE flag for this
-	}
-	if ((prot & PROT_WRITE) == PROT_WRITE) {
-		ret |= PTE_W;
-	}
-	return ret;
-}
-
-#define MMAP_HAS_FLAG(x, flag) ((x & flag) == flag)
-
 size_t
 sys_mmap(void)
 {
-	void *user_virt_addr;
+	uintptr_t addr;
 	size_t length;
 	int prot, flags, fd;
 	struct file *file = NULL;
 	off_t offset;
-	PROPOGATE_ERR(argptr(0, (char **)&user_virt_addr, sizeof(void *)));
+	PROPOGATE_ERR(arguintptr_t(0, &addr));
 	PROPOGATE_ERR(argsize_t(1, &length));
 	PROPOGATE_ERR(argint(2, &prot));
 	PROPOGATE_ERR(argint(3, &flags));
+	PROPOGATE_ERR(argoff_t(5, &offset));
 
-	if (!MMAP_HAS_FLAG(flags, MAP_ANONYMOUS)) {
-		PROPOGATE_ERR(argfd(4, &fd, &file));
-	} else {
+	if (flags & MAP_ANONYMOUS) {
 		// We ignore whatever is in fd if we map anonymous.
-		(void)argfd(4, &fd, &file);
+		file = NULL;
+	} else {
+		PROPOGATE_ERR(argfd(4, &fd, &file));
 	}
-
-	PROPOGATE_ERR(argoff_t(5, &offset));
-
-	if (length == 0) {
+	// Exactly one of MAP_SHARED and MAP_PRIVATE, though anonymous
+	// memory has always done without either.
+	int sharing = flags & (MAP_SHARED | MAP_PRIVATE);
+	if (sharing == (MAP_SHARED | MAP_PRIVATE) ||
+	    (sharing == 0 && file != NULL)) {
 		return -EINVAL;
 	}
-	// We don't support MAP_PRIVATE for now.
-	if (!MMAP_HAS_FLAG(flags, MAP_SHARED) &&
-	    !MMAP_HAS_FLAG(flags, MAP_ANONYMOUS)) {
+	if (flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED)) {
 		return -EINVAL;
 	}
 
-	if (length % PGSIZE != 0 || (uintptr_t)user_virt_addr % PGSIZE != 0) {
-		return -EINVAL;
-	}
-	int perm = mmap_prot_to_perm(prot);
-	struct mmap_info info;
-	if (!MMAP_HAS_FLAG(flags, MAP_ANONYMOUS) && file != NULL &&
-	    S_ISCHR(file->ip->mode)) {
-		// "The file has been locked, or too much memory has been locked"
-		if (atomic_load(&file->ip->lock.locked)) {
-			return -EAGAIN;
-		}
-		if (file->ip->major < 0 || file->ip->major >= NDEV ||
-		    !devsw[file->ip->major].mmap) {
-			return -ENODEV;
-		}
-		info = devsw[file->ip->major].mmap(file->ip->minor, length,
-		                                   (uintptr_t)user_virt_addr, perm);
-		info.file = file;
-	} else {
-		info =
-			(struct mmap_info){ length, 0, (uintptr_t)user_virt_addr, NULL, perm };
-	}
-	struct proc *proc = myproc();
-	if (proc->mmap_count > NMMAP) {
-		return -ENOMEM;
-	}
+	struct mm *mm = myproc()->mm;
+	acquiresleep(&mm->lock);
+	ssize_t ret = mm_map(mm, addr, length, prot, flags, file, offset);
+	releasesleep(&mm->lock);
+	return ret;
+}
 
-	// Place it anywhere.
-	if (info.virt_addr == 0) {
-		// Next spot in the heap.
-		info.virt_addr = PGROUNDUP(proc->heap + proc->heapsz);
+size_t
+sys_munmap(void)
+{
+	uintptr_t addr;
+	size_t length;
 
-		uintptr_t user_phys_addr;
-		if (info.addr == 0) {
-			PROPOGATE_ERR(alloc_user_bytes(proc->pgdir, info.length, info.virt_addr,
-			                               &user_phys_addr));
-			info.addr = user_phys_addr;
-		} else {
-			PROPOGATE_ERR(mappages(proc->pgdir, (void *)info.virt_addr, info.length,
-			                       info.addr, info.perm));
-		}
+	PROPOGATE_ERR(arguintptr_t(0, &addr));
+	PROPOGATE_ERR(argsize_t(1, &length));
 
-		proc->heapsz += info.length;
-		proc->mmap_info[proc->mmap_count++] = info;
-		return (size_t)info.virt_addr;
-	} else {
-		if (mappages(proc->pgdir, user_virt_addr, info.length, info.addr,
-		             info.perm) < 0) {
-			// If we arrive here, odds are the physical address we were given is
-			// garbage.
-			void *ptr = kmalloc(info.length);
-			if (ptr == NULL) {
-				return -ENOMEM;
-			}
-			info.addr = V2P(ptr);
-			if (mappages(proc->pgdir, user_virt_addr, info.length, info.addr,
-			             info.perm) < 0) {
-				kfree(ptr);
-				return -ENOMEM;
-			}
-			proc->heapsz += info.length;
-			proc->mmap_info[proc->mmap_count++] = info;
-			return (size_t)ptr;
-		}
-		proc->heapsz += info.length;
-		proc->mmap_info[proc->mmap_count++] = info;
-		return (size_t)user_virt_addr;
-	}
+	struct mm *mm = myproc()->mm;
+	acquiresleep(&mm->lock);
+	int ret = mm_unmap(mm, addr, length);
+	releasesleep(&mm->lock);
+	return ret;
 }
 
 size_t
-sys_munmap(void)
+sys_mprotect(void)
 {
-	void *addr;
+	uintptr_t addr;
 	size_t length;
+	int prot;
+
+	PROPOGATE_ERR(arguintptr_t(0, &addr));
+	PROPOGATE_ERR(argsize_t(1, &length));
+	PROPOGATE_ERR(argint(2, &prot));
+
+	struct mm *mm = myproc()->mm;
+	acquiresleep(&mm->lock);
+	int ret = mm_protect(mm, addr, length, prot);
+	releasesleep(&mm->lock);
+	return ret;
+}
 
-	struct proc *proc = myproc();
+size_t
+sys_msync(void)
+{
+	uintptr_t addr;
+	size_t length;
+	int flags;
 
-	PROPOGATE_ERR(argptr(0, (char **)&addr, sizeof(void *)));
+	PROPOGATE_ERR(arguintptr_t(0, &addr));
 	PROPOGATE_ERR(argsize_t(1, &length));
+	PROPOGATE_ERR(argint(2, &flags));
 
-	if (length == 0) {
-		return -EINVAL;
+	struct mm *mm = myproc()->mm;
+	acquiresleep(&mm->lock);
+	int ret = mm_sync(mm, addr, length, flags);
+	releasesleep(&mm->lock);
+	return ret;
+}
+
+size_t
+sys_madvise(void)
+{
+	uintptr_t addr;
+	size_t length;
+	int advice;
+
+	PROPOGATE_ERR(arguintptr_t(0, &addr));
+	PROPOGATE_ERR(argsize_t(1, &length));
+	PROPOGATE_ERR(argint(2, &advice));
+
+	struct mm *mm = myproc()->mm;
+	acquiresleep(&mm->lock);
+	int ret = mm_advise(mm, addr, length, advice);
+	releasesleep(&mm->lock);
+	return ret;
+}
+
+// Mount a file system on the directory target. fstype is "tmpfs",
+// whose source is ignored, or "relixfs", whose source is a /dev/sd*
+// node: its minor number is the disk. flags and data are unused.
+size_t
+sys_mount(void)
+{
+	char *source, *target, *fstype;
+	dev_t dev;
+	struct inode *ip;
+
+	PROPOGATE_ERR(argstr(0, &source));
+	PROPOGATE_ERR(argstr(1, &target));
+	PROPOGATE_ERR(argstr(2, &fstype));
+	if (myproc()->cred.uid != 0) {
+		return -EPERM;
 	}
-	int j = -1;
-	for (int i = 0; i < NMMAP; i++) {
-		if ((proc->mmap_info[i].virt_addr == (uintptr_t)addr) &&
-		    ((proc->mmap_info[i].length == length) ||
-		     (proc->mmap_info[i].file &&
-		      S_ISCHR(proc->mmap_info[i].file->ip->mode)))) {
-			j = i;
+
+	begin_op();
+	if (strcmp(fstype, "tmpfs") == 0) {
+		dev = TMPFSDEV;
+	} else if (strcmp(fstype, "relixfs") == 0) {
+		if ((ip = resolve_name(source)) == NULL) {
+			end_op();
+			return -ENOENT;
 		}
+		inode_lock_shared(ip);
+		bool isdisk = S_ISCHR(ip->mode) && ip->major == DEV_SD && ip->minor >= 0 &&
+		              ip->minor < NDISK;
+		dev = ip->minor;
+		inode_unlockput(ip);
+		if (!isdisk) {
+			end_op();
+			return -ENOTBLK;
+		}
+	} else {
+		end_op();
+		return -ENODEV;
 	}
-	if (j == -1) {
-		return -EINVAL;
+
+	if ((ip = resolve_name(target)) == NULL) {
+		end_op();
+		return -ENOENT;
 	}
-	for (int i = 0; i < PGROUNDUP(proc->mmap_info[j].length); i += PGSIZE) {
-		unmap_user_page(proc->pgdir, (char *)proc->mmap_info[j].virt_addr);
+	int ret = mount_fs(dev, ip);
+	if (ret < 0) {
+		inode_put(ip);
+	}
+	end_op();
+	return ret;
+}
+
+// Unmount the file system mounted on target.
+size_t
+sys_umount(void)
+{
+	char *target;
+	struct inode *ip;
+
+	PROPOGATE_ERR(argstr(0, &target));
+	if (myproc()->cred.uid != 0) {
+		return -EPERM;
 	}
-	if (addr != NULL && V2P(addr) < KERNBASE) {
-		kfree(addr);
+
+	begin_op();
+	if ((ip = resolve_name(target)) == NULL) {
+		end_op();
+		return -ENOENT;
 	}
-	return 0;
+	int ret = umount_fs(ip);
+	end_op();
+	return ret;
 }
 
-/* Unimplemented */
 size_t
 sys_fsync(void)
 {
-	int fd;
 	struct file *file;
-	PROPOGATE_ERR(argfd(0, &fd, &file));
+	PROPOGATE_ERR(argfd(0, NULL, &file));
 
-	if (fd == 0) {
+	if (file->type != FD_INODE) {
+		return -EINVAL;
+	}
+	return inode_sync(file->ip, false);
+}
+
+size_t
+sys_fdatasync(void)
+{
+	struct file *file;
+	PROPOGATE_ERR(argfd(0, NULL, &file));
+
+	if (file->type != FD_INODE) {
 		return -EINVAL;
-	} else if (fd == 1 || fd == 2) {
-		return 0;
 	}
+	return inode_sync(file->ip, true);
+}
+
+size_t
+sys_sync(void)
+{
+	log_sync();
 	return 0;
 }
 
+size_t
+sys_ftruncate(void)
+{
+	struct file *file;
+	off_t length;
+	PROPOGATE_ERR(argfd(0, NULL, &file));
+	PROPOGATE_ERR(argoff_t(1, &length));
+
+	if (!file->writable) {
+		return -EBADF;
+	}
+	if (file->type != FD_INODE || !S_ISREG(file->ip->mode)) {
+		return -EINVAL;
+	}
+	return inode_truncate(file->ip, length);
+}
+
+size_t
+sys_fallocate(void)
+{
+	struct file *file;
+	int mode;
+	off_t off, len;
+	PROPOGATE_ERR(argfd(0, NULL, &file));
+	PROPOGATE_ERR(argint(1, &mode));
+	PROPOGATE_ERR(argoff_t(2, &off));
+	PROPOGATE_ERR(argoff_t(3, &len));
+
+	if (!file->writable) {
+		return -EBADF;
+	}
+	if (file->type != FD_INODE || !S_ISREG(file->ip->mode)) {
+		return -ENODEV;
+	}
+	switch (mode) {
+	case 0:
+		return inode_fallocate(file->ip, off, len, false);
+	case FALLOC_FL_KEEP_SIZE:
+		return inode_fallocate(file->ip, off, len, true);
+	case FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE:
+		return inode_punch(file->ip, off, len);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
 size_t
 sys_umask(void)
 {
@@ -1313,6 +1839,12 @@ sys_renameat(void)
 		end_op();
 		return -ENOENT;
 	}
+	if (dp->dev != new_dp->dev) {
+		inode_put(dp);
+		inode_put(new_dp);
+		end_op();
+		return -EXDEV;
+	}
 
 	inode_lock(dp);
 	// This starts at "2 * sizeof(de)" in order to skip "." and "..".
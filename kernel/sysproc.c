@@ -4,8 +4,12 @@
 #include "dev/lapic.h"
 
 #include "console.h"
+#include "futex.h"
 #include "kernel_ld_syms.h"
 #include "kernel_signal.h"
+#include "log.h"
+#include "memlayout.h"
+#include "msr.h"
 #include "proc.h"
 #include "syscall.h"
 #include "time_units.h"
@@ -15,9 +19,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <sched.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/futex.h>
+#include <sys/prctl.h>
 #include <sys/reboot.h>
+#include <sys/resource.h>
 #include <sys/times.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
@@ -29,6 +37,14 @@ sys_fork(void)
 	return fork();
 }
 
+// Like fork(), but the child borrows our address space instead of
+// copying it, and we sleep until it execs or exits.
+size_t
+sys_vfork(void)
+{
+	return clone(CLONE_VM | CLONE_VFORK, 0, NULL, NULL, 0);
+}
+
 size_t
 sys__exit(void)
 {
@@ -39,6 +55,120 @@ sys__exit(void)
 	return 0; // not reached
 }
 
+// Exit only the calling thread.
+size_t
+sys_exit_thread(void)
+{
+	int status;
+	PROPOGATE_ERR(argint(0, &status));
+
+	thread_exit(status);
+	return 0; // not reached
+}
+
+size_t
+sys_clone(void)
+{
+	unsigned long flags;
+	uintptr_t stack;
+	pid_t *parent_tid = NULL;
+	pid_t *child_tid = NULL;
+	uintptr_t tls;
+
+	PROPOGATE_ERR(argunsigned_long(0, &flags));
+	PROPOGATE_ERR(arguintptr_t(1, &stack));
+	PROPOGATE_ERR(arguintptr_t(4, &tls));
+	if (flags & CLONE_PARENT_SETTID) {
+		PROPOGATE_ERR(argptr_out(2, (char **)&parent_tid, sizeof(*parent_tid)));
+	}
+	if (flags & (CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID)) {
+		PROPOGATE_ERR(argptr_out(3, (char **)&child_tid, sizeof(*child_tid)));
+	}
+	if (stack >= KERNBASE || tls >= KERNBASE) {
+		return -EINVAL;
+	}
+	return clone(flags, stack, parent_tid, child_tid, tls);
+}
+
+size_t
+sys_gettid(void)
+{
+	return myproc()->pid;
+}
+
+size_t
+sys_futex(void)
+{
+	uintptr_t uaddr;
+	int op;
+	unsigned int val;
+	uintptr_t tmo_addr;
+	struct timespec *tmo;
+	long timeout = -1;
+
+	PROPOGATE_ERR(arguintptr_t(0, &uaddr));
+	PROPOGATE_ERR(argint(1, &op));
+	PROPOGATE_ERR(argunsigned_int(2, &val));
+	PROPOGATE_ERR(arguintptr_t(3, &tmo_addr));
+
+	// Every futex is private to its address space.
+	switch (op & ~FUTEX_PRIVATE_FLAG) {
+	case FUTEX_WAIT:
+		if (tmo_addr != 0) {
+			PROPOGATE_ERR(argptr(3, (char **)&tmo, sizeof(*tmo)));
+			if (tmo->tv_nsec < 0 || tmo->tv_nsec >= (long)NSEC_PER_SEC ||
+			    tmo->tv_sec > LONG_MAX / MSEC_PER_SEC - 1) {
+				return -EINVAL;
+			}
+			// Round up, so that we never return early.
+			timeout = sec_to_msec(tmo->tv_sec) +
+			          (tmo->tv_nsec + NSEC_PER_SEC / MSEC_PER_SEC - 1) /
+			            (NSEC_PER_SEC / MSEC_PER_SEC);
+		}
+		return futex_wait((uint32_t *)uaddr, val, timeout);
+	case FUTEX_WAKE:
+		return futex_wake((uint32_t *)uaddr, (int)val);
+	default:
+		return -ENOSYS;
+	}
+}
+
+size_t
+sys_arch_prctl(void)
+{
+	int code;
+	uintptr_t addr;
+	uintptr_t *out;
+
+	PROPOGATE_ERR(argint(0, &code));
+	PROPOGATE_ERR(arguintptr_t(1, &addr));
+
+	switch (code) {
+	case ARCH_SET_FS:
+		if (addr >= KERNBASE) {
+			return -EPERM;
+		}
+		myproc()->fs_base = addr;
+		pushcli();
+		wrmsr(MSR_FS_BASE, addr);
+		popcli();
+		return 0;
+	case ARCH_GET_FS:
+		PROPOGATE_ERR(argptr_out(1, (char **)&out, sizeof(*out)));
+		*out = myproc()->fs_base;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+size_t
+sys_sched_yield(void)
+{
+	yield();
+	return 0;
+}
+
 size_t
 sys_waitpid(void)
 {
@@ -46,7 +176,7 @@ sys_waitpid(void)
 	int *status;
 	int options;
 	PROPOGATE_ERR(argpid_t(0, &pid));
-	PROPOGATE_ERR(argptr(1, (char **)&status, sizeof(*status)));
+	PROPOGATE_ERR(argptr_out(1, (char **)&status, sizeof(*status)));
 	PROPOGATE_ERR(argint(2, &options));
 
 	if (options != 0 && options != WNOHANG && options != WCONTINUED &&
@@ -74,15 +204,15 @@ sys_kill(void)
 size_t
 sys_getpid(void)
 {
-	return myproc()->pid;
+	return myproc()->tgid;
 }
 
 size_t
 sys_getppid(void)
 {
-	struct proc *proc = myproc();
+	struct proc *proc = myproc()->group_leader;
 	if (proc != NULL && proc->parent != NULL) {
-		return proc->parent->pid;
+		return proc->parent->tgid;
 	} else {
 		// If parent has been killed, use init (PID 1).
 		return 1;
@@ -97,7 +227,7 @@ sys_sbrk(void)
 
 	PROPOGATE_ERR(argintptr_t(0, &n));
 
-	addr = myproc()->sz;
+	addr = myproc()->mm->sz;
 	PROPOGATE_ERR(growproc(n));
 	return addr;
 }
@@ -149,7 +279,7 @@ sys_clock_nanosleep(void)
 	PROPOGATE_ERR(argclockid_t(0, &clockid));
 	PROPOGATE_ERR(argint(1, &flags));
 	PROPOGATE_ERR(argptr(2, (char **)&duration, sizeof(*duration)));
-	PROPOGATE_ERR(argptr(3, (char **)&rem, sizeof(*rem)));
+	PROPOGATE_ERR(argptr_out(3, (char **)&rem, sizeof(*rem)));
 
 	if (duration == NULL && (uintptr_t)duration >= (uintptr_t)__kernel_begin) {
 		return -EFAULT;
@@ -191,7 +321,7 @@ sys_clock_gettime(void)
 	clockid_t clockid;
 	struct timespec *tp;
 	PROPOGATE_ERR(argclockid_t(0, &clockid));
-	PROPOGATE_ERR(argptr(1, (char **)&tp, sizeof(*tp)));
+	PROPOGATE_ERR(argptr_out(1, (char **)&tp, sizeof(*tp)));
 
 	if (tp == NULL || (uintptr_t)tp >= (uintptr_t)__kernel_begin) {
 		return -EFAULT;
@@ -222,6 +352,8 @@ sys_reboot(void)
 	int cmd;
 	PROPOGATE_ERR(argint(0, &cmd));
 
+	// Nothing the log is holding back should be lost.
+	log_sync();
 	switch (cmd) {
 	case RB_POWER_OFF:
 		kill(1, SIGKILL);
@@ -465,13 +597,54 @@ sys_sigaction(void)
 	return -ENOSYS;
 }
 
+// Clock ticks are milliseconds, as everywhere else.
 size_t
 sys_times(void)
 {
 	struct tms *tms;
-	PROPOGATE_ERR(argptr(0, (char **)&tms, sizeof(*tms)));
+	struct proc_usage self, children;
+	PROPOGATE_ERR(argptr_out(0, (char **)&tms, sizeof(*tms)));
 
-	return -ENOSYS;
+	struct proc *curproc = myproc();
+	PROPOGATE_ERR(proc_getrusage(curproc, RUSAGE_SELF, &self));
+	PROPOGATE_ERR(proc_getrusage(curproc, RUSAGE_CHILDREN, &children));
+	tms->tms_utime = self.utime / (NSEC_PER_SEC / MSEC_PER_SEC);
+	tms->tms_stime = self.stime / (NSEC_PER_SEC / MSEC_PER_SEC);
+	tms->tms_cutime = children.utime / (NSEC_PER_SEC / MSEC_PER_SEC);
+	tms->tms_cstime = children.stime / (NSEC_PER_SEC / MSEC_PER_SEC);
+	return ticks;
+}
+
+static struct timeval
+nsec_to_timeval(uint64_t ns)
+{
+	struct timeval tv = {
+		.tv_sec = ns / NSEC_PER_SEC,
+		.tv_usec = nsec_to_usec(ns % NSEC_PER_SEC),
+	};
+	return tv;
+}
+
+size_t
+sys_getrusage(void)
+{
+	int who;
+	struct rusage *ru;
+	struct proc_usage u;
+	PROPOGATE_ERR(argint(0, &who));
+	PROPOGATE_ERR(argptr_out(1, (char **)&ru, sizeof(*ru)));
+
+	PROPOGATE_ERR(proc_getrusage(myproc(), who, &u));
+	memset(ru, 0, sizeof(*ru));
+	ru->ru_utime = nsec_to_timeval(u.utime);
+	ru->ru_stime = nsec_to_timeval(u.stime);
+	ru->ru_minflt = u.minflt;
+	ru->ru_majflt = u.majflt;
+	ru->ru_inblock = u.inblock;
+	ru->ru_oublock = u.oublock;
+	ru->ru_nvcsw = u.nvcsw;
+	ru->ru_nivcsw = u.nivcsw;
+	return 0;
 }
 
 #ifdef __x86_64__
@@ -501,7 +674,7 @@ size_t
 sys_uname(void)
 {
 	struct utsname *utsname;
-	PROPOGATE_ERR(argptr(0, (char **)&utsname, sizeof(*utsname)));
+	PROPOGATE_ERR(argptr_out(0, (char **)&utsname, sizeof(*utsname)));
 	if (utsname == NULL) {
 		return -EFAULT;
 	}
@@ -540,7 +713,7 @@ sys_getgroups(void)
 	} else if (!(1 <= gidsetsize && gidsetsize <= NGROUPS_MAX + 1)) {
 		return -EINVAL;
 	}
-	PROPOGATE_ERR(argptr(2, (char **)&grouplist, sizeof(gid_t) * gidsetsize));
+	PROPOGATE_ERR(argptr_out(2, (char **)&grouplist, sizeof(gid_t) * gidsetsize));
 	struct proc *curproc = myproc();
 	for (; ngroups < gidsetsize; ngroups++) {
 		// -1 happens to be our indication for an invalid group. We
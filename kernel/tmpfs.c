@@ -0,0 +1,178 @@
+// tmpfs: a file system that lives only in the page cache.
+//
+// An inode on TMPFSDEV has no disk blocks. Its data is the pages in
+// ip->pcache, and what would be its on-disk inode is an entry in
+// tmpfs.nodes, which also keeps the pages while the inode is out of
+// the inode cache. Nothing goes through the buffer cache or the log,
+// and all of it is gone when it is unmounted.
+//
+// fs.c calls in here wherever it would otherwise go to the disk, and
+// mount.c to mount and unmount it. There is only the one tmpfs, so
+// it can be mounted in one place at a time.
+
+#include "console.h"
+#include "fs.h"
+#include "kernel_assert.h"
+#include "param.h"
+#include "spinlock.h"
+#include "tmpfs.h"
+
+#include "dev/lapic.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define NTMPFSNODE 1024 // maximum number of files on the tmpfs
+
+// What the disk would keep of an inode.
+struct tmpfs_node {
+	uint64_t ctime;
+	uint64_t atime;
+	uint64_t mtime;
+	uint64_t size;
+	mode_t mode; // 0 if the node is free.
+	uint16_t gid;
+	uint16_t uid;
+	short major;
+	short minor;
+	short nlink;
+	// The data, while no inode in the cache holds it.
+	char ***pcache;
+};
+
+static struct {
+	struct spinlock lock;
+	// Indexed by inode number. 0 is never used.
+	struct tmpfs_node nodes[NTMPFSNODE];
+} tmpfs;
+
+void
+tmpfs_init(void)
+{
+	initlock(&tmpfs.lock, "tmpfs");
+	lockstat_register(&tmpfs.lock);
+}
+
+// Make an empty tmpfs, with just the root directory. Returns -EBUSY
+// if it is already mounted.
+int
+tmpfs_mount(void)
+{
+	acquire(&tmpfs.lock);
+	struct tmpfs_node *root = &tmpfs.nodes[ROOTINO];
+	if (root->mode != 0) {
+		release(&tmpfs.lock);
+		return -EBUSY;
+	}
+	root->mode = S_IFDIR | S_ISVTX | S_IRWXU | S_IRWXG | S_IRWXO;
+	root->nlink = 1;
+	root->uid = DEFAULT_UID;
+	root->gid = DEFAULT_GID;
+	root->ctime = root->atime = root->mtime = rtc_now();
+	release(&tmpfs.lock);
+
+	// Directory entries are written through the inode cache.
+	struct inode *ip = inode_get(TMPFSDEV, ROOTINO);
+	inode_lock(ip);
+	if (dirlink(ip, ".", ROOTINO) < 0 || dirlink(ip, "..", ROOTINO) < 0) {
+		panic("tmpfs_mount: dots");
+	}
+	inode_unlockput(ip);
+	return 0;
+}
+
+// Throw every file away. Nothing may be using any of them, so all
+// of the pages are back with their nodes.
+void
+tmpfs_unmount(void)
+{
+	acquire(&tmpfs.lock);
+	for (ino_t inum = ROOTINO; inum < NTMPFSNODE; inum++) {
+		struct tmpfs_node *node = &tmpfs.nodes[inum];
+
+		pcache_destroy(node->pcache);
+		memset(node, 0, sizeof(*node));
+	}
+	release(&tmpfs.lock);
+}
+
+// Allocate a node with mode mode. Returns an unlocked but allocated
+// and referenced inode, or NULL if every node is taken.
+struct inode *
+tmpfs_alloc(mode_t mode)
+{
+	acquire(&tmpfs.lock);
+	for (ino_t inum = ROOTINO + 1; inum < NTMPFSNODE; inum++) {
+		struct tmpfs_node *node = &tmpfs.nodes[inum];
+
+		if (node->mode == 0) {
+			memset(node, 0, sizeof(*node));
+			node->mode = mode;
+			node->gid = DEFAULT_GID;
+			node->uid = DEFAULT_UID;
+			node->ctime = node->atime = node->mtime = rtc_now();
+			release(&tmpfs.lock);
+			return inode_get(TMPFSDEV, inum);
+		}
+	}
+	release(&tmpfs.lock);
+	return NULL;
+}
+
+// Fill in ip from its node, taking over its pages.
+void
+tmpfs_load(struct inode *ip) __must_hold(&ip->lock)
+{
+	acquire(&tmpfs.lock);
+	struct tmpfs_node *node = &tmpfs.nodes[ip->inum];
+	ip->major = node->major;
+	ip->minor = node->minor;
+	ip->nlink = node->nlink;
+	ip->size = node->size;
+	ip->mode = node->mode;
+	ip->uid = node->uid;
+	ip->gid = node->gid;
+	ip->atime = node->atime;
+	ip->ctime = node->ctime;
+	ip->mtime = node->mtime;
+	memset(ip->addrs, 0, sizeof(ip->addrs));
+	ip->pcache = node->pcache;
+	node->pcache = NULL;
+	release(&tmpfs.lock);
+}
+
+// The inode_update() of the tmpfs. A mode of 0 frees the node.
+void
+tmpfs_update(struct inode *ip) __must_hold(&ip->lock)
+{
+	acquire(&tmpfs.lock);
+	struct tmpfs_node *node = &tmpfs.nodes[ip->inum];
+	node->major = ip->major;
+	node->minor = ip->minor;
+	node->nlink = ip->nlink;
+	node->size = ip->size;
+	node->mode = ip->mode;
+	node->uid = ip->uid;
+	node->gid = ip->gid;
+	node->mtime = rtc_now();
+	node->atime = rtc_now();
+	node->ctime = ip->ctime;
+	release(&tmpfs.lock);
+}
+
+// The last reference to ip is going away: give its pages back to
+// the node to keep.
+void
+tmpfs_release(struct inode *ip)
+{
+	if (!ip->valid) {
+		return;
+	}
+	acquire(&tmpfs.lock);
+	kernel_assert(tmpfs.nodes[ip->inum].pcache == NULL);
+	tmpfs.nodes[ip->inum].pcache = ip->pcache;
+	ip->pcache = NULL;
+	release(&tmpfs.lock);
+}
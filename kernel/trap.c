@@ -1,8 +1,11 @@
 #include "dev/hpet.h"
 #include "dev/kbd.h"
 #include "dev/lapic.h"
+#include "dev/prof.h"
 #include "dev/ps2mouse.h"
+#include "dev/trace.h"
 
+#include "acct.h"
 #include "console.h"
 #include "ide.h"
 #include "kalloc.h"
@@ -15,9 +18,12 @@
 #include "trap.h"
 #include "traps.h"
 #include "uart.h"
+#include "vm.h"
+#include "vma.h"
 #include "x86.h"
 
 #include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
@@ -87,14 +93,23 @@ regdump(struct trapframe *tf)
 void
 trap(struct trapframe *tf)
 {
+	uintptr_t fixup;
+	bool from_user = (tf->cs & 3) == DPL_USER;
+
+	// Up to now it was running user code.
+	if (from_user) {
+		acct_charge(true);
+	}
+
 	switch (tf->trapno) {
 	case T_IRQ0 + IRQ_TIMER:
 		if (my_cpu_id() == 0) {
 			acquire(&tickslock);
 			ticks++;
-			wakeup(&ticks);
+			wakeup_timer(&ticks, ticks);
 			release(&tickslock);
 		}
+		prof_tick(tf);
 		lapiceoi();
 		break;
 	case T_IRQ0 + IRQ_IDE:
@@ -124,6 +139,10 @@ trap(struct trapframe *tf)
 	case T_IRQ0 + IRQ_SATA:
 		panic("SATA IRQ should not be reached (currently)");
 		break;
+	case T_IRQ0 + IRQ_TLB:
+		tlb_shootdown_intr();
+		lapiceoi();
+		break;
 	case T_IRQ0 + IRQ_PS2_MOUSE:
 		ps2mouseintr();
 		lapiceoi();
@@ -152,6 +171,10 @@ trap(struct trapframe *tf)
 		}
 		break;
 	case T_GPFLT:
+		if ((tf->cs & 3) == 0 && (fixup = exception_fixup(tf->rip)) != 0) {
+			tf->rip = fixup;
+			break;
+		}
 		uart_printf("General protection fault\n");
 		if ((tf->cs & 3) == DPL_USER) {
 			kill(myproc()->pid, SIGSEGV);
@@ -176,20 +199,20 @@ trap(struct trapframe *tf)
 	// TODO handle pagefaults in a way that allows copy-on-write
 	case T_PGFLT: {
 		uintptr_t addr = rcr2();
-		uart_printf("Page fault at %#lx, ip=%#lx\n", rcr2(), tf->rip);
-		uintptr_t pml4 = PML4X(addr);
-		uintptr_t pdpt = PDPTX(addr);
-		uintptr_t pde = PDX(addr);
-		uintptr_t pte = PTX(addr);
-		uintptr_t idx = addr & 0b111111111111;
-		decipher_page_fault_error_code(tf->err);
-		uart_printf("This is at [%ld][%ld][%ld][%ld][%ld]\n", pml4, pdpt, pde, pte,
-		            idx);
 		// Skip over this if we are in early boot and have no processes.
 		if (myproc() == NULL) {
 			goto out;
 		}
-		uintptr_t *pde_ = &myproc()->pgdir[PDX(addr)];
+		tracepoint(TRACE_PAGE_FAULT, addr, tf->err);
+		uint64_t inblock = myproc()->usage.inblock;
+		// A file mapping that is not in yet, or a private page that
+		// has to be copied before it is written.
+		if (addr < USER_ADDR_LIMIT &&
+		    mm_fault(myproc()->mm, addr, tf->err & PAGE_FAULT_WRITE) == 0) {
+			acct_fault(myproc(), inblock);
+			break;
+		}
+		uintptr_t *pde_ = &myproc()->mm->pgdir[PDX(addr)];
 		// We can only attempt CoW if the page tables are
 		// not severely messed up. If they are NULL, we just
 		// do the normal process killing.
@@ -210,11 +233,21 @@ trap(struct trapframe *tf)
 				}
 				*pg |= V2P(mem) | PTE_P;
 				*pg &= ~PTE_COW;
-				lcr3(V2P(myproc()->pgdir));
+				lcr3(V2P(myproc()->mm->pgdir));
+				acct_fault(myproc(), inblock);
 				break;
 			}
 		}
 out:
+		// copy_to_user() and friends hit a bad user address.
+		if ((tf->cs & 3) == 0 && (fixup = exception_fixup(tf->rip)) != 0) {
+			tf->rip = fixup;
+			break;
+		}
+		uart_printf("Page fault at %#lx, ip=%#lx\n", addr, tf->rip);
+		decipher_page_fault_error_code(tf->err);
+		uart_printf("This is at [%ld][%ld][%ld][%ld][%ld]\n", PML4X(addr),
+		            PDPTX(addr), PDX(addr), PTX(addr), addr & 0b111111111111);
 		regdump(tf);
 		if ((tf->cs & DPL_USER) == 0) {
 			panic("trap");
@@ -278,4 +311,8 @@ out:
 	if (myproc() && myproc()->killed && (tf->cs & 3) == DPL_USER) {
 		exit(0);
 	}
+
+	if (from_user) {
+		acct_charge(false);
+	}
 }
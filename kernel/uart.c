@@ -1,24 +1,60 @@
 // Intel 8250 serial port (UART).
+//
+// Output goes through a ring that the transmit-holding-register-empty
+// interrupt drains into the 16550's FIFO, so writers only wait for the
+// line when the ring is full. Until uartinit3() and after a panic,
+// characters are sent one at a time by polling instead.
 
 #include "dev/lapic.h"
 
 #include "console.h"
 #include "ioapic.h"
+#include "spinlock.h"
 #include "traps.h"
 #include "uart.h"
 #include "x86.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #define COM1 0x3f8
 
+// Registers, as offsets from COM1.
+#define UART_DATA 0
+#define UART_IER 1 // Interrupt enable
+#define UART_FCR 2 // FIFO control (write)
+#define UART_LSR 5 // Line status
+
+#define IER_RX 0x01 // Received data available
+#define IER_TX 0x02 // Transmit holding register empty
+#define LSR_RX_READY 0x01
+#define LSR_TX_EMPTY 0x20
+
+// Bytes the transmit FIFO takes once it reports empty.
+#define UART_FIFO_SIZE 16
+#define UART_TX_SIZE 4096
+
 static int uart; // is there a uart?
 
+static struct {
+	struct spinlock lock;
+	char buf[UART_TX_SIZE];
+	size_t head; // Bytes queued.
+	size_t tail; // Bytes handed to the UART.
+	bool irq; // Is the transmit interrupt on?
+} tx;
+
+// Whether output goes through the ring. Off until uartinit3(),
+// and again once panicking.
+static bool buffered;
+
 void
 uartinit1(void)
 {
 	char *p;
 
-	// Turn off the FIFO
-	outb(COM1 + 2, 0);
+	// Turn on the FIFOs and clear them.
+	outb(COM1 + UART_FCR, 0x07);
 
 	// 9600 baud, 8 data bits, 1 stop bit, parity off.
 	outb(COM1 + 3, 0x80); // Unlock divisor
@@ -26,10 +62,10 @@ uartinit1(void)
 	outb(COM1 + 1, 0);
 	outb(COM1 + 3, 0x03); // Lock divisor, 8 data bits.
 	outb(COM1 + 4, 0);
-	outb(COM1 + 1, 0x01); // Enable receive interrupts.
+	outb(COM1 + UART_IER, IER_RX); // Enable receive interrupts.
 
 	// If status is 0xFF, no serial port.
-	if (inb(COM1 + 5) == 0xFF) {
+	if (inb(COM1 + UART_LSR) == 0xFF) {
 		return;
 	}
 	uart = 1;
@@ -50,16 +86,107 @@ uartinit2(void)
 	ioapicenable(IRQ_COM1, 0);
 }
 
+// Once locks work: send output through the ring.
+void
+uartinit3(void)
+{
+	initlock(&tx.lock, "uart");
+	buffered = uart;
+}
+
+static void
+uart_putc_polled(int c)
+{
+	for (int i = 0; i < 128 && !(inb(COM1 + UART_LSR) & LSR_TX_EMPTY); i++) {
+		microdelay(10);
+	}
+	outb(COM1 + UART_DATA, c);
+}
+
+// Fill the FIFO from the ring if the UART has room, and keep the
+// interrupt on for as long as there is more. Caller holds tx.lock.
+static void
+uart_tx_fill(void)
+{
+	if (inb(COM1 + UART_LSR) & LSR_TX_EMPTY) {
+		for (int i = 0; i < UART_FIFO_SIZE && tx.tail != tx.head; i++) {
+			outb(COM1 + UART_DATA, tx.buf[tx.tail++ % UART_TX_SIZE]);
+		}
+	}
+	bool more = tx.tail != tx.head;
+	if (more != tx.irq) {
+		tx.irq = more;
+		outb(COM1 + UART_IER, IER_RX | (more ? IER_TX : 0));
+	}
+}
+
+// Queue n bytes. Only a full ring makes this wait, and then only as
+// long as the line takes to make room.
+static void
+uart_tx_queue(const char *buf, size_t n)
+{
+	acquire(&tx.lock);
+	while (n > 0) {
+		if (tx.head - tx.tail == UART_TX_SIZE) {
+			// This CPU may have interrupts off, or be the one that
+			// would take the interrupt, so make the room here.
+			while (!(inb(COM1 + UART_LSR) & LSR_TX_EMPTY)) {
+				microdelay(10);
+			}
+			uart_tx_fill();
+			continue;
+		}
+		tx.buf[tx.head++ % UART_TX_SIZE] = *buf++;
+		n--;
+	}
+	uart_tx_fill();
+	release(&tx.lock);
+}
+
 void
 uartputc(int c)
 {
+	char ch = c;
+
 	if (!uart) {
 		return;
 	}
-	for (int i = 0; i < 128 && !(inb(COM1 + 5) & 0x20); i++) {
-		microdelay(10);
+	if (!buffered) {
+		uart_putc_polled(c);
+		return;
+	}
+	uart_tx_queue(&ch, 1);
+}
+
+void
+uartwrite(const char *buf, size_t n)
+{
+	if (!uart) {
+		return;
+	}
+	if (!buffered) {
+		for (size_t i = 0; i < n; i++) {
+			uart_putc_polled(buf[i]);
+		}
+		return;
+	}
+	uart_tx_queue(buf, n);
+}
+
+// Go back to polling so that a panic's last words get out. What was
+// still queued goes first. The lock is not taken: it may be held by a
+// CPU that will never let go.
+void
+uart_panic(void)
+{
+	if (!buffered) {
+		return;
+	}
+	buffered = false;
+	outb(COM1 + UART_IER, IER_RX);
+	while (tx.tail != tx.head) {
+		uart_putc_polled(tx.buf[tx.tail++ % UART_TX_SIZE]);
 	}
-	outb(COM1 + 0, c);
 }
 
 static int
@@ -68,14 +195,19 @@ uartgetc(void)
 	if (!uart) {
 		return -1;
 	}
-	if (!(inb(COM1 + 5) & 0x01)) {
+	if (!(inb(COM1 + UART_LSR) & LSR_RX_READY)) {
 		return -1;
 	}
-	return inb(COM1 + 0);
+	return inb(COM1 + UART_DATA);
 }
 
 void
 uartintr(void)
 {
+	if (buffered) {
+		acquire(&tx.lock);
+		uart_tx_fill();
+		release(&tx.lock);
+	}
 	consoleintr(uartgetc);
 }
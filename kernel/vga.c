@@ -39,6 +39,26 @@ struct CursorPosition {
 
 static struct DamageTracking damage_tracking_data = { 0 };
 static struct CursorPosition cursor_position = { 0, 0 };
+// Where the cursor block is on the screen, if it is.
+static struct CursorPosition cursor_drawn = { 0, 0 };
+static bool cursor_visible = false;
+// While nonzero, the cursor is not drawn until vga_end_batch().
+static int batch_depth = 0;
+
+// For each (foreground, background) pair in use, the pixels for every
+// possible row of a glyph, worked out once. Drawing a row of a glyph
+// is then a lookup and four 64-bit stores.
+#define GLYPH_CACHE_PAIRS 4
+struct GlyphRows {
+	uint32_t fg;
+	uint32_t bg;
+	bool valid;
+	uint64_t pixels[256][FONT_WIDTH / 2];
+};
+
+static struct GlyphRows glyph_cache[GLYPH_CACHE_PAIRS];
+static uint32_t glyph_cache_last = 0;
+static uint32_t glyph_cache_next = 0;
 
 /*
  * This init function needs these 3 parameters
@@ -95,12 +115,60 @@ x_y_to_fb_char_index(uint32_t x, uint32_t y, uint8_t font_width)
 	return (y * SCREEN_WIDTH) + (x * font_width);
 }
 
+static const struct GlyphRows *
+glyph_rows_for(uint32_t foreground, uint32_t background)
+{
+	struct GlyphRows *g = &glyph_cache[glyph_cache_last];
+	if (g->valid && g->fg == foreground && g->bg == background) {
+		return g;
+	}
+	for (uint32_t i = 0; i < GLYPH_CACHE_PAIRS; i++) {
+		g = &glyph_cache[i];
+		if (g->valid && g->fg == foreground && g->bg == background) {
+			glyph_cache_last = i;
+			return g;
+		}
+	}
+	// Replace the pairs in turn.
+	glyph_cache_last = glyph_cache_next++ % GLYPH_CACHE_PAIRS;
+	g = &glyph_cache[glyph_cache_last];
+	for (uint32_t bits = 0; bits < 256; bits++) {
+		for (uint32_t j = 0; j < FONT_WIDTH; j += 2) {
+			// Bit j is pixel j, and the lower address holds the
+			// lower half.
+			uint64_t lo = (bits >> j) & 1 ? foreground : background;
+			uint64_t hi = (bits >> (j + 1)) & 1 ? foreground : background;
+			g->pixels[bits][j / 2] = lo | hi << 32;
+		}
+	}
+	g->fg = foreground;
+	g->bg = background;
+	g->valid = true;
+	return g;
+}
+
 static void
 render_font_glyph(uint8_t character, uint32_t x, uint32_t y, uint8_t font_width,
                   uint8_t font_height,
                   const uint8_t font[static 256][font_height],
                   uint32_t foreground, uint32_t background)
 {
+	if (font_width == FONT_WIDTH && fb_common.framebuffer_bpp == 32 &&
+	    x + font_width <= fb_common.framebuffer_width &&
+	    y + font_height <= fb_common.framebuffer_height) {
+		const struct GlyphRows *g = glyph_rows_for(foreground, background);
+		char *row = (char *)fb + fb_common.framebuffer_pitch * y + x * 4;
+		for (uint8_t i = 0; i < font_height; i++) {
+			const uint64_t *src = g->pixels[font[character][i]];
+			uint64_t *dst = (uint64_t *)row;
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = src[3];
+			row += fb_common.framebuffer_pitch;
+		}
+		return;
+	}
 	for (uint8_t i = 0; i < font_height; i++) {
 		for (uint8_t j = 0; j < font_width; j++) {
 			const uint32_t adjusted_x = x + j;
@@ -200,24 +268,72 @@ vga_write_tab(uint32_t fb_width, uint8_t font_width)
 	fb_char_index += TAB_WIDTH * font_width;
 }
 
+static bool
+cell_on_screen(struct CursorPosition pos)
+{
+	return pos.x < SCREEN_WIDTH / FONT_WIDTH && pos.y < SCREEN_HEIGHT / FONT_HEIGHT;
+}
+
+// Put back what the cursor block was covering.
 static void
-move_cursor(struct CursorPosition *position, uint32_t from_x, uint32_t from_y,
-            uint32_t to_x, uint32_t to_y)
+hide_cursor(void)
 {
 	struct font_data_8x16 font_data = { FONT_WIDTH, FONT_HEIGHT, &font_termplus };
-	// Erase the previous cursor.
-	render_font_glyph(' ', to_x * font_data.width, to_y * font_data.height,
-	                  font_data.width, font_data.height, *font_data.font,
-	                  damage_tracking_data.bg[position->x][position->y],
-	                  damage_tracking_data.fg[position->x][position->y]);
-	// Create a new cursor at (to_x, to_y).
-	render_font_glyph(damage_tracking_data.data[from_x][from_y],
-	                  from_x * font_data.width, from_y * font_data.height,
+	uint32_t x = cursor_drawn.x;
+	uint32_t y = cursor_drawn.y;
+
+	if (!cursor_visible) {
+		return;
+	}
+	cursor_visible = false;
+	render_font_glyph(damage_tracking_data.data[x][y], x * font_data.width,
+	                  y * font_data.height, font_data.width, font_data.height,
+	                  *font_data.font, damage_tracking_data.fg[x][y],
+	                  damage_tracking_data.bg[x][y]);
+}
+
+static void
+show_cursor(void)
+{
+	struct font_data_8x16 font_data = { FONT_WIDTH, FONT_HEIGHT, &font_termplus };
+	uint32_t x = cursor_position.x;
+	uint32_t y = cursor_position.y;
+
+	if (batch_depth > 0) {
+		return;
+	}
+	hide_cursor();
+	if (!cell_on_screen(cursor_position)) {
+		return;
+	}
+	// A block in the cell's foreground color.
+	render_font_glyph(' ', x * font_data.width, y * font_data.height,
 	                  font_data.width, font_data.height, *font_data.font,
-	                  damage_tracking_data.fg[from_x][from_y],
-	                  damage_tracking_data.bg[from_x][from_y]);
-	// Update our internal position of the cursor.
+	                  damage_tracking_data.bg[x][y], damage_tracking_data.fg[x][y]);
+	cursor_drawn = cursor_position;
+	cursor_visible = true;
+}
+
+static void
+move_cursor(uint32_t to_x, uint32_t to_y)
+{
 	cursor_position = (struct CursorPosition){ to_x, to_y };
+	show_cursor();
+}
+
+// Draw the cursor once, at the end, instead of after every character.
+void
+vga_begin_batch(void)
+{
+	batch_depth++;
+}
+
+void
+vga_end_batch(void)
+{
+	if (--batch_depth == 0) {
+		show_cursor();
+	}
 }
 
 static void
@@ -233,50 +349,45 @@ vga_backspace(struct font_data_8x16 *font_data, struct CursorPosition *position,
 
 	uint32_t x = fb_char_index_to_char_x_coord(fb_char_index, font_data->width);
 	uint32_t y = fb_char_index_to_char_y_coord(fb_char_index);
-	move_cursor(position, x, y, x - 1, y);
+	move_cursor(x - 1, y);
 
 	fb_char_index -= font_data->width;
 }
-// This scrolling algorithm is *way* more complex than it should've been.
-// The good news is that when using damage tracking for every char,
-// the speedup is around 2x.
+// Move everything up a line of text by copying the pixels, rather
+// than drawing each cell again.
 static void
 vga_scroll(uint32_t fb_width, uint32_t fb_height, uint8_t font_width,
            uint8_t font_height, const uint8_t (*font)[])
 {
-	uint32_t fb_in_bytes = fb_height * fb_width;
-
-	// Initiate scroll.
-	for (uint32_t i = (fb_width * font_height); i < fb_in_bytes;
-	     i += font_width) {
-		uint32_t x = fb_char_index_to_char_x_coord(i, font_width);
-		uint32_t y = fb_char_index_to_char_y_coord(i / font_height);
-		// We "have" to scroll on these chars.
-		if (!(damage_tracking_data.data[x][y] ==
-		        damage_tracking_data.data[x][y - 1] &&
-		      damage_tracking_data.fg[x][y] == damage_tracking_data.fg[x][y - 1] &&
-		      damage_tracking_data.bg[x][y] == damage_tracking_data.bg[x][y - 1])) {
-			render_font_glyph(damage_tracking_data.data[x][y], x * font_width,
-			                  (y - 1) * font_height, font_width, font_height, font,
-			                  damage_tracking_data.fg[x][y],
-			                  damage_tracking_data.bg[x][y]);
-			damage_tracking_data.data[x][y - 1] = damage_tracking_data.data[x][y];
-			damage_tracking_data.fg[x][y - 1] = damage_tracking_data.fg[x][y];
-			damage_tracking_data.bg[x][y - 1] = damage_tracking_data.bg[x][y];
-		}
-	}
 	const uint32_t height = screen_height_in_chars(font_height);
 	const uint32_t width = screen_width_in_chars(font_width);
+	const size_t pitch = fb_common.framebuffer_pitch;
+	const size_t line = fb_width * (fb_common.framebuffer_bpp / 8);
+	const size_t scanlines = (height - 1) * font_height;
+	char *pixels = fb;
+
+	// The cursor block would go up with everything else.
+	hide_cursor();
+	if (pitch == line) {
+		memmove(pixels, pixels + font_height * pitch, scanlines * pitch);
+	} else {
+		for (size_t i = 0; i < scanlines; i++) {
+			memmove(pixels + i * pitch, pixels + (i + font_height) * pitch, line);
+		}
+	}
+	for (uint32_t x = 0; x < width; x++) {
+		memmove(&damage_tracking_data.data[x][0],
+		        &damage_tracking_data.data[x][1],
+		        (height - 1) * sizeof(damage_tracking_data.data[x][0]));
+		memmove(&damage_tracking_data.fg[x][0], &damage_tracking_data.fg[x][1],
+		        (height - 1) * sizeof(damage_tracking_data.fg[x][0]));
+		memmove(&damage_tracking_data.bg[x][0], &damage_tracking_data.bg[x][1],
+		        (height - 1) * sizeof(damage_tracking_data.bg[x][0]));
+	}
 
 	// Clear the last row.
-	for (int i = 0; i < width; i++) {
-		damage_tracking_data.data[i][height - 1] = ' ';
-		damage_tracking_data.fg[i][height - 1] = VGA_COLOR_WHITE;
-		damage_tracking_data.bg[i][height - 1] = VGA_COLOR_BLACK;
-
-		clear_cells(i, height - 1, 1, 1, font_width, font_height, VGA_COLOR_WHITE,
-		            VGA_COLOR_BLACK, font);
-	}
+	clear_cells(0, height - 1, width, 1, font_width, font_height,
+	            VGA_COLOR_WHITE, VGA_COLOR_BLACK, font);
 	cursor_position = (struct CursorPosition){ 0, height - 1 };
 
 	vga_write_carriage_return(fb_width, font_width);
@@ -295,16 +406,18 @@ clear_cells(uint32_t x, uint32_t y, uint32_t x_len, uint32_t y_len,
 {
 	const uint32_t height = screen_height_in_chars(font_height);
 	const uint32_t width = screen_width_in_chars(font_width);
-	if (x > width || y > height) {
+	if (x >= width || y >= height) {
 		return;
 	}
+	x_len = min(x_len, width - x);
+	y_len = min(y_len, height - y);
 	for (uint32_t i = 0; i < x_len; i++) {
 		for (uint32_t j = 0; j < y_len; j++) {
 			render_font_glyph(' ', (i + x) * font_width, (j + y) * font_height,
 			                  font_width, font_height, font, foreground, background);
-			damage_tracking_data.data[i][j] = ' ';
-			damage_tracking_data.fg[i][j] = foreground;
-			damage_tracking_data.bg[i][j] = background;
+			damage_tracking_data.data[i + x][j + y] = ' ';
+			damage_tracking_data.fg[i + x][j + y] = foreground;
+			damage_tracking_data.bg[i + x][j + y] = background;
 		}
 	}
 }
@@ -397,8 +510,9 @@ ansi_erase_from_cursor_to_end_of_line(void)
 // Consistent with the define found in console.c.
 #define BACKSPACE 0x100
 
+// Put c on the screen only.
 void
-vga_write_char(int c, uint32_t foreground, uint32_t background)
+vga_draw_char(int c, uint32_t foreground, uint32_t background)
 {
 	struct font_data_8x16 font_data = { FONT_WIDTH, FONT_HEIGHT, &font_termplus };
 	// Past last line.
@@ -410,54 +524,63 @@ vga_write_char(int c, uint32_t foreground, uint32_t background)
 	     c == '\n')) {
 		vga_scroll(SCREEN_WIDTH, SCREEN_HEIGHT, font_data.width, font_data.height,
 		           font_termplus);
-	} else {
-		switch (c) {
-		case '\n': {
-			// move_cursor requires the old x and y values.
-			uint32_t old_x =
-				fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
-			uint32_t old_y = fb_char_index_to_char_y_coord(fb_char_index);
-
-			vga_write_newline(SCREEN_WIDTH, font_data.width);
-
-			uint32_t x =
-				fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
-			uint32_t y = fb_char_index_to_char_y_coord(fb_char_index);
-			move_cursor(&cursor_position, old_x, old_y, x, y);
-			break;
+		// Anything but a newline still goes at the start of the new line.
+		if (c == '\n') {
+			show_cursor();
+			return;
 		}
-		case '\r':
-			vga_write_carriage_return(SCREEN_WIDTH, font_data.width);
-			break;
-		case '\t':
-			// TODO: handle backspace on a tab character.
-			vga_write_tab(SCREEN_WIDTH, font_data.width);
-			break;
-		case '\b':
-		case BACKSPACE:
-			vga_backspace(&font_data, &cursor_position, foreground, background);
-			break;
-		default:;
-			uint32_t x =
-				fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
-			uint32_t y = fb_char_index_to_char_y_coord(fb_char_index);
-			render_font_glyph(c, x * font_data.width, y * font_data.height,
-			                  font_data.width, font_data.height, *font_data.font,
-			                  foreground, background);
-			damage_tracking_data.data[x][y] = (char)c;
-			damage_tracking_data.fg[x][y] = foreground;
-			damage_tracking_data.bg[x][y] = background;
-			// We need to update the char index.
-			fb_char_index += font_data.width;
-			// There is the edge case that we are at the last char on the screen.
-			// In that case, we need to draw the cursor on the next line.
-			uint32_t to_x =
-				fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
-			uint32_t to_y = fb_char_index_to_char_y_coord(fb_char_index);
-			move_cursor(&cursor_position, x, y, to_x, to_y);
-			break;
+	}
+	switch (c) {
+	case '\n': {
+		vga_write_newline(SCREEN_WIDTH, font_data.width);
+
+		uint32_t x =
+			fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
+		uint32_t y = fb_char_index_to_char_y_coord(fb_char_index);
+		move_cursor(x, y);
+		break;
+	}
+	case '\r':
+		vga_write_carriage_return(SCREEN_WIDTH, font_data.width);
+		break;
+	case '\t':
+		// TODO: handle backspace on a tab character.
+		vga_write_tab(SCREEN_WIDTH, font_data.width);
+		break;
+	case '\b':
+	case BACKSPACE:
+		vga_backspace(&font_data, &cursor_position, foreground, background);
+		break;
+	default:;
+		uint32_t x =
+			fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
+		uint32_t y = fb_char_index_to_char_y_coord(fb_char_index);
+		render_font_glyph(c, x * font_data.width, y * font_data.height,
+		                  font_data.width, font_data.height, *font_data.font,
+		                  foreground, background);
+		damage_tracking_data.data[x][y] = (char)c;
+		damage_tracking_data.fg[x][y] = foreground;
+		damage_tracking_data.bg[x][y] = background;
+		if (cursor_drawn.x == x && cursor_drawn.y == y) {
+			cursor_visible = false;
 		}
+		// We need to update the char index.
+		fb_char_index += font_data.width;
+		// There is the edge case that we are at the last char on the screen.
+		// In that case, we need to draw the cursor on the next line.
+		uint32_t to_x =
+			fb_char_index_to_char_x_coord(fb_char_index, font_data.width);
+		uint32_t to_y = fb_char_index_to_char_y_coord(fb_char_index);
+		move_cursor(to_x, to_y);
+		break;
 	}
+}
+
+// Put c on the screen and mirror it to the serial port.
+void
+vga_write_char(int c, uint32_t foreground, uint32_t background)
+{
+	vga_draw_char(c, foreground, background);
 	if (c == BACKSPACE) {
 		uartputc('\b');
 		uartputc(' ');
@@ -26,15 +26,18 @@
 #include "vm.h"
 #include "boot/multiboot2.h"
 #include "console.h"
+#include "dev/lapic.h"
 #include "errno.h"
 #include "fs.h"
 #include "kalloc.h"
+#include "kernel_assert.h"
 #include "kernel_ld_syms.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "msr.h"
 #include "param.h"
 #include "proc.h"
+#include "traps.h"
 #include "vga.h"
 #include "x86.h"
 #include <stdint.h>
@@ -62,7 +65,7 @@ static struct kmap {
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(uintptr_t *pgdir, const void *va, bool alloc)
 {
 	uintptr_t *pde;
@@ -220,12 +223,15 @@ alloc_user_bytes(uintptr_t *pgdir, const size_t size, const uintptr_t virt_addr,
 
 	const size_t newsize = PGROUNDUP(size);
 	for (size_t i = 0; i < newsize; i += PGSIZE) {
-		char *mem = kmalloc(PGSIZE);
+		// Whole pages, since deallocuvm() gives them back with kpage_free().
+		char *mem = kpage_alloc();
 		if (mem == NULL) {
 			uart_printf("alloc_user_bytes: out of memory\n");
-			/* dealloc_user_bytes ... */
+			deallocuvm(pgdir, PGROUNDUP(virt_addr) + i, PGROUNDUP(virt_addr));
 			return -ENOMEM;
 		}
+		// Anonymous memory starts out zeroed.
+		memset(mem, 0, PGSIZE);
 		if (i == 0 && phys_addr != NULL) {
 			*phys_addr = V2P(mem);
 		}
@@ -233,8 +239,8 @@ alloc_user_bytes(uintptr_t *pgdir, const size_t size, const uintptr_t virt_addr,
 
 		if (mappages(pgdir, (char *)proper_virt_addr, PGSIZE, V2P(mem),
 		             PTE_W | PTE_U) < 0) {
-			/* dealloc_user_bytes ... */
-			kfree(mem);
+			kpage_free(mem);
+			deallocuvm(pgdir, PGROUNDUP(virt_addr) + i, PGROUNDUP(virt_addr));
 			return -ENOMEM;
 		}
 	}
@@ -282,8 +288,9 @@ deallocuvm(uintptr_t *pgdir, uintptr_t oldsz, uintptr_t newsz)
 	for (; a < oldsz; a += PGSIZE) {
 		pte = walkpgdir(pgdir, (char *)a, 0);
 		if (!pte) {
-			// a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-			a += (uintptr_t)(NPTENTRIES - 1) * PGSIZE;
+			// Skip to the last page covered by the missing page table.
+			a = (a & ~((uintptr_t)NPTENTRIES * PGSIZE - 1)) +
+			    (uintptr_t)(NPTENTRIES - 1) * PGSIZE;
 		} else if ((*pte & PTE_P) != 0) {
 			pa = PTE_ADDR(*pte);
 			if (pa == 0) {
@@ -292,8 +299,8 @@ deallocuvm(uintptr_t *pgdir, uintptr_t oldsz, uintptr_t newsz)
 			// Temporary hack.
 			// The only set of memory above the physical address of KERNBASE
 			// is a device's mmio. Since those aren't allocated, just ignore
-			// them.
-			if ((uintptr_t)P2V(pa) > KERNBASE) {
+			// them. Page cache pages belong to their inode.
+			if ((uintptr_t)P2V(pa) > KERNBASE && !(*pte & PTE_PCACHE)) {
 				char *v = p2v(pa);
 				kpage_free(v);
 			}
@@ -431,6 +438,52 @@ uva2ka(uintptr_t *pgdir, char *uva)
 	return (char *)p2v(PTE_ADDR(*pte));
 }
 
+// Where __ex_table says to go if the kernel faults at rip while
+// touching user memory, or 0 if rip is not one of those places.
+uintptr_t
+exception_fixup(uintptr_t rip)
+{
+	struct {
+		uintptr_t insn;
+		uintptr_t fixup;
+	} *start = (void *)__start_ex_table, *stop = (void *)__stop_ex_table;
+
+	for (; start < stop; start++) {
+		if (start->insn == rip) {
+			return start->fixup;
+		}
+	}
+	return 0;
+}
+
+static bool
+user_range_ok(const void *uaddr, size_t n)
+{
+	return n <= USER_ADDR_LIMIT &&
+	       (uintptr_t)uaddr <= USER_ADDR_LIMIT - n;
+}
+
+// Copy n bytes to user address udst in the current address space.
+// Unmapped pages make this return -EFAULT instead of panicking.
+int
+copy_to_user(void *udst, const void *src, size_t n)
+{
+	if (!user_range_ok(udst, n) || __copy_user(udst, src, n) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+// Copy n bytes from user address usrc in the current address space.
+int
+copy_from_user(void *dst, const void *usrc, size_t n)
+{
+	if (!user_range_ok(usrc, n) || __copy_user(dst, usrc, n) != 0) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
@@ -440,6 +493,10 @@ copyout(uintptr_t *pgdir, uintptr_t va, void *p, size_t len)
 	char *buf, *pa0;
 	uintptr_t n, va0;
 
+	// No need to walk the page table if it is the one we are using.
+	if (myproc() != NULL && pgdir == myproc()->mm->pgdir) {
+		return copy_to_user((void *)va, p, len);
+	}
 	buf = (char *)p;
 	while (len > 0) {
 		va0 = (uint32_t)PGROUNDDOWN(va);
@@ -557,6 +614,11 @@ seginit(void)
 
 	ltr(SEG_TSS << 3);
 	syscall_init(c);
+
+	// Make the kernel honour read-only user pages as well, so that its
+	// writes to a private file mapping copy the page like the user's
+	// do.
+	write_cr0(read_cr0() | CR0_WP);
 }
 
 // The core relix code only knows about two levels of page tables,
@@ -643,14 +705,71 @@ switchuvm(struct proc *p)
 	struct taskstate64 *tss;
 
 	pushcli();
-	if (p->pgdir == NULL) {
+	if (p->mm->pgdir == NULL) {
 		panic("switchuvm: no pgdir");
 	}
 	tss = mycpu()->tss;
 	tss_set_rsp(tss, 0, (uintptr_t)myproc()->kstack + KSTACKSIZE);
 	// Set for when we swapgs in syscalls.
 	mycpu()->kernel_stack = tss->rsp0;
-	pml4 = (void *)PTE_ADDR(p->pgdir[511]);
+	pml4 = (void *)PTE_ADDR(p->mm->pgdir[511]);
 	lcr3(v2p(pml4));
+	// Thread-local storage. The kernel does not use %fs itself.
+	wrmsr(MSR_FS_BASE, p->fs_base);
+	popcli();
+}
+
+// Make every other CPU running a thread of mm forget what its TLB
+// holds of mm's pages, and wait until they all have. The caller has
+// changed mm's page table and flushed its own TLB; once this returns,
+// the pages it took out can be freed and the dirty bits it cleared
+// are set again by the next write. scheduler() sets c->proc before
+// it loads a page table and clears it after it leaves one, so a CPU
+// that is not sent to has nothing of mm's left to flush.
+//
+// Interrupts must be on, so that CPUs doing this to each other at
+// once both get through.
+void
+tlb_shootdown(struct mm *mm)
+{
+	uint64_t sent[NCPU / 64] = { 0 };
+
+	kernel_assert(readrflags() & FL_IF);
+	// Order the caller's PTE stores before the loads of c->proc.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	pushcli();
+	for (int i = 0; i < ncpu; i++) {
+		struct cpu *c = &cpus[i];
+		struct proc *p = __atomic_load_n(&c->proc, __ATOMIC_SEQ_CST);
+		if (c == mycpu() || p == NULL || p->mm != mm) {
+			continue;
+		}
+		__atomic_add_fetch(&c->tlb_req, 1, __ATOMIC_SEQ_CST);
+		lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+		sent[i / 64] |= 1ULL << (i % 64);
+	}
 	popcli();
+	for (int i = 0; i < ncpu; i++) {
+		if (!(sent[i / 64] & (1ULL << (i % 64)))) {
+			continue;
+		}
+		// Ours, or one made after it.
+		uint64_t want = __atomic_load_n(&cpus[i].tlb_req, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&cpus[i].tlb_done, __ATOMIC_SEQ_CST) < want) {
+			__asm__ __volatile__("pause" ::: "memory");
+		}
+	}
+}
+
+// The IPI from tlb_shootdown(). Reloading %cr3 flushes every user
+// page, which is cheaper than being told which ones. It answers every
+// request made before it read tlb_req.
+void
+tlb_shootdown_intr(void)
+{
+	struct cpu *c = mycpu();
+	uint64_t req = __atomic_load_n(&c->tlb_req, __ATOMIC_SEQ_CST);
+
+	lcr3(rcr3());
+	__atomic_store_n(&c->tlb_done, req, __ATOMIC_SEQ_CST);
 }
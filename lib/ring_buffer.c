@@ -1,6 +1,7 @@
 #include "ring_buffer.h"
 #include "stdbool.h"
 #include <stddef.h>
+#include <string.h>
 
 struct ring_buf *
 ring_buffer_create(size_t nbytes, void *(*allocator)(size_t))
@@ -76,3 +77,61 @@ ring_buffer_is_full(struct ring_buf *rb)
 	}
 	return (rb && rb->nwrite + 1) % rb->size == rb->nread;
 }
+
+void
+spsc_ring_init(struct spsc_ring *r, void *data, size_t elem_size,
+               size_t capacity)
+{
+	atomic_store_explicit(&r->head, 0, memory_order_relaxed);
+	atomic_store_explicit(&r->tail, 0, memory_order_relaxed);
+	r->capacity = capacity;
+	r->elem_size = elem_size;
+	r->data = data;
+}
+
+bool
+spsc_ring_push(struct spsc_ring *r, const void *elem)
+{
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head - tail == r->capacity) {
+		return false;
+	}
+	memcpy(r->data + (head & (r->capacity - 1)) * r->elem_size, elem,
+	       r->elem_size);
+	// Publish the element before the new head.
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	return true;
+}
+
+bool
+spsc_ring_pop(struct spsc_ring *r, void *elem)
+{
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	if (head == tail) {
+		return false;
+	}
+	memcpy(elem, r->data + (tail & (r->capacity - 1)) * r->elem_size,
+	       r->elem_size);
+	// Hand the slot back only once it has been copied out.
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+bool
+spsc_ring_is_empty(struct spsc_ring *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_acquire) ==
+	       atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+void
+spsc_ring_clear(struct spsc_ring *r)
+{
+	atomic_store_explicit(&r->tail,
+	                      atomic_load_explicit(&r->head, memory_order_acquire),
+	                      memory_order_release);
+}
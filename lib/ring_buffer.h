@@ -1,4 +1,5 @@
 #pragma once
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -21,3 +22,25 @@ int ring_buffer_pop(struct ring_buf *rb, char *data, size_t n);
 void ring_buffer_destroy(struct ring_buf *rb, void (*deallocator)(void *));
 bool ring_buffer_is_empty(struct ring_buf *rb);
 bool ring_buffer_is_full(struct ring_buf *rb);
+
+// A fixed-size ring of fixed-size elements for one producer and one
+// consumer. They need no lock between them: only the producer moves
+// head, and only the consumer moves tail. The caller provides the
+// storage, so pushing never allocates. capacity must be a power of two.
+struct spsc_ring {
+	_Atomic size_t head; // Elements pushed.
+	_Atomic size_t tail; // Elements popped.
+	size_t capacity;
+	size_t elem_size;
+	char *data;
+};
+
+void spsc_ring_init(struct spsc_ring *r, void *data, size_t elem_size,
+                    size_t capacity);
+// Returns false if the ring is full.
+bool spsc_ring_push(struct spsc_ring *r, const void *elem);
+// Returns false if the ring is empty.
+bool spsc_ring_pop(struct spsc_ring *r, void *elem);
+bool spsc_ring_is_empty(struct spsc_ring *r);
+// Drop everything pushed so far. Consumer side.
+void spsc_ring_clear(struct spsc_ring *r);
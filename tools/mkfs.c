@@ -152,6 +152,8 @@ makedirs(void)
 	binino = make_dir(rootino, "bin");
 	etcino = make_dir(rootino, "etc");
 	slashroot_ino = make_dir(rootino, "root");
+	// The kernel mounts a tmpfs here.
+	make_dir(rootino, "tmp");
 }
 
 int
@@ -388,7 +390,8 @@ iappend(uint32_t inum, void *xp, ssize_t n)
 	while (n > 0) {
 		// Block number needed.
 		fbn = off / BSIZE;
-		assert(fbn < MAXFILE);
+		// The files here never need the triply indirect block.
+		assert(fbn < NDIRECT + NINDIRECT + NINDIRECT * NINDIRECT);
 		if (fbn < NDIRECT) {
 			if (xlong(din.addrs[fbn]) == 0) {
 				din.addrs[fbn] = xlong(freeblock++);
@@ -15,10 +15,12 @@ cleanup(void)
 }
 
 void __init_stdio(void);
+void __libc_init_string(void);
 
 static void
 startup(void)
 {
+	__libc_init_string();
 	__init_stdio();
 }
 
@@ -51,3 +51,24 @@ fcntl(int fd, int cmd, ...)
 	}
 	return __syscall_ret(__syscall3(SYS_fcntl, fd, cmd, (long)arg));
 }
+
+ssize_t
+splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len,
+       unsigned int flags)
+{
+	return __syscall_ret(__syscall6(SYS_splice, fd_in, (long)off_in, fd_out,
+	                                (long)off_out, len, flags));
+}
+
+int
+fallocate(int fd, int mode, off_t offset, off_t len)
+{
+	return __syscall_ret(__syscall4(SYS_fallocate, fd, mode, offset, len));
+}
+
+// Returns the error rather than setting errno.
+int
+posix_fallocate(int fd, off_t offset, off_t len)
+{
+	return -(int)__syscall4(SYS_fallocate, fd, 0, offset, len);
+}
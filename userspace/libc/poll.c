@@ -0,0 +1,21 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <poll.h>
+#include <sys/syscall.h>
+
+int
+poll(struct pollfd fds[], nfds_t nfds, int timeout)
+{
+	return __syscall_ret(__syscall3(SYS_poll, (long)fds, nfds, timeout));
+}
+
+int
+ppoll(struct pollfd fds[], nfds_t nfds, const struct timespec *restrict tmo,
+      const sigset_t *restrict sigmask)
+{
+	return __syscall_ret(
+		__syscall4(SYS_ppoll, (long)fds, nfds, (long)tmo, (long)sigmask));
+}
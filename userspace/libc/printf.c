@@ -3,11 +3,16 @@
  * Copyright (c) 2025 Connor-GH. All Rights Reserved.
  */
 #include "printf.h"
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/types.h>
+
+// Everything here works on the caller's sink and stack, so any number
+// of threads can format at once.
 
 enum {
 	FLAG_PADZERO = 1 << 0,
@@ -15,359 +20,604 @@ enum {
 	FLAG_LJUST = 1 << 2,
 	FLAG_BLANK = 1 << 3,
 	FLAG_SIGN = 1 << 4,
-	FLAG_LONG = 1 << 5,
-	FLAG_PRECISION = 1 << 6,
+	FLAG_PRECISION = 1 << 5,
 };
 #define IS_SET(x, flag) (bool)((x & flag) == flag)
 
-static int print_string(void (*put_function)(FILE *fp, char c, char *buf),
-                        char *s, int flags, FILE *fp, char *restrict buf,
-                        int str_pad, size_t print_n_chars);
+enum length {
+	LEN_INT,
+	LEN_CHAR,
+	LEN_SHORT,
+	LEN_LONG,
+	LEN_LLONG,
+	LEN_SIZE,
+	LEN_MAX,
+	LEN_PTRDIFF,
+	LEN_LDOUBLE,
+};
+
+// 64 binary digits is the longest integer we print.
+#define INT_BUF_SIZE 64
+// Precision past this is cut off. Doubles carry 17 significant digits,
+// so anything further is zeros anyway.
+#define MAX_FLOAT_PRECISION 64
+#define MAX_FLOAT_DIGITS 17
+// Up to 309 integer digits, the point, and the fraction.
+#define FLOAT_BUF_SIZE (320 + MAX_FLOAT_PRECISION)
 
-#define PRINTF_INT_BUF_SIZE 4096
+// Two digits per division instead of one.
+static const char digit_pairs[200] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+static const uint64_t powers_of_10[MAX_FLOAT_DIGITS + 1] = {
+	1ULL,
+	10ULL,
+	100ULL,
+	1000ULL,
+	10000ULL,
+	100000ULL,
+	1000000ULL,
+	10000000ULL,
+	100000000ULL,
+	1000000000ULL,
+	10000000000ULL,
+	100000000000ULL,
+	1000000000000ULL,
+	10000000000000ULL,
+	100000000000000ULL,
+	1000000000000000ULL,
+	10000000000000000ULL,
+	100000000000000000ULL,
+};
 
-// IMPORTANT: MAYBE_APPEND modifies 'i' in the current scope.
-#define MAYBE_APPEND(buf, data)  \
-	if (i < PRINTF_INT_BUF_SIZE) { \
-		(buf)[i++] = data;           \
+// The sink is full. Ask for more room, or give up on storing anything.
+static bool
+sink_drain(struct printf_sink *sink)
+{
+	if (sink->drain == NULL || !sink->drain(sink)) {
+		sink->drain = NULL;
+		sink->room = 0;
+		return false;
 	}
+	return sink->room != 0;
+}
 
-// We store the string in a buffer backwards and then print that buffer
-// backwards, thus printing it forwards.
-//
-// Example:
-// printf("%#04d", 32);
-// buf = "2300"
-// prints as "0032"
-static int
-printint(void (*put_function)(FILE *, char, char *), char *put_func_buf,
-         FILE *fp, int64_t xx, int base, bool sgn, int flags, int padding)
+// Copy into the sink. Most pieces are a few characters, where calling
+// memcpy() or memset() costs more than the copy itself.
+static inline void
+sink_copy(char *dst, const char *s, size_t n)
 {
-	static const char digits[] = "0123456789abcdef";
-	char buf[PRINTF_INT_BUF_SIZE];
-	int i = 0;
-	int ret = 0;
-	bool neg = false;
-	uint64_t x;
-
-	if (sgn && xx < 0) {
-		neg = true;
-		x = -xx;
+	if (n < 16) {
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = s[i];
+		}
 	} else {
-		x = xx;
+		memcpy(dst, s, n);
 	}
+}
 
-	int numlen = 1;
-	uint64_t x_copy = x;
-
-	while ((x_copy /= base) != 0) {
-		numlen++;
+static inline void
+sink_set(char *dst, char c, size_t n)
+{
+	if (n < 16) {
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = c;
+		}
+	} else {
+		memset(dst, c, n);
 	}
-	x_copy = x;
+}
 
-	// If we need to set special padding for
-	// alternative form, we do it here.
-	if (IS_SET(flags, FLAG_ALTFORM)) {
-		if (base == 16 || base == 2) {
-			// Remove 2 padding in place for "0x" or "0b".
-			padding -= 2;
-		} else if (base == 8) {
-			// printf says that for octal, you
-			// increase the precision "if and only if necessary" to
-			// force the first digit to be a zero.
-			// zero is a special case, as 0o0 == "0" from printf.
-			if (x_copy != 0 && padding < numlen) {
-				padding++;
-			}
+// The piece does not fit; hand it over in chunks.
+static void
+sink_write_slow(struct printf_sink *sink, const char *s, size_t n)
+{
+	while (n > 0) {
+		if (sink->room == 0 && !sink_drain(sink)) {
+			return;
 		}
+		size_t chunk = n < sink->room ? n : sink->room;
+		sink_copy(sink->pos, s, chunk);
+		sink->pos += chunk;
+		sink->room -= chunk;
+		s += chunk;
+		n -= chunk;
 	}
+}
 
-	if (IS_SET(flags, FLAG_LJUST) && !IS_SET(flags, FLAG_PRECISION)) {
-		while (i < padding - numlen) {
-			MAYBE_APPEND(buf, ' ');
+static void
+sink_fill_slow(struct printf_sink *sink, char c, size_t n)
+{
+	while (n > 0) {
+		if (sink->room == 0 && !sink_drain(sink)) {
+			return;
 		}
+		size_t chunk = n < sink->room ? n : sink->room;
+		sink_set(sink->pos, c, chunk);
+		sink->pos += chunk;
+		sink->room -= chunk;
+		n -= chunk;
 	}
+}
+
+static inline void
+sink_write(struct printf_sink *sink, const char *s, size_t n)
+{
+	sink->count += n;
+	if (n <= sink->room) {
+		sink_copy(sink->pos, s, n);
+		sink->pos += n;
+		sink->room -= n;
+	} else {
+		sink_write_slow(sink, s, n);
+	}
+}
+
+static inline void
+sink_fill(struct printf_sink *sink, char c, size_t n)
+{
+	sink->count += n;
+	if (n <= sink->room) {
+		sink_set(sink->pos, c, n);
+		sink->pos += n;
+		sink->room -= n;
+	} else {
+		sink_fill_slow(sink, c, n);
+	}
+}
+
+// Write x in decimal so that it ends just before end. Returns the first
+// digit.
+static char *
+format_decimal(char *end, uint64_t x)
+{
+	while (x >= 100) {
+		const char *pair = &digit_pairs[(x % 100) * 2];
+		x /= 100;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+	if (x >= 10) {
+		*--end = digit_pairs[x * 2 + 1];
+		*--end = digit_pairs[x * 2];
+	} else {
+		*--end = '0' + x;
+	}
+	return end;
+}
+
+// Same, for bases 2, 8 and 16.
+static char *
+format_power_of_2(char *end, uint64_t x, int shift, bool upper)
+{
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	const unsigned mask = (1U << shift) - 1;
 
 	do {
-		MAYBE_APPEND(buf, digits[x % base]);
-	} while ((x /= base) != 0);
+		*--end = digits[x & mask];
+		x >>= shift;
+	} while (x != 0);
+	return end;
+}
 
-	// pad for zeroes (and blanks)
-	if (IS_SET(flags, FLAG_PADZERO)) {
-		while (i < padding) {
-			MAYBE_APPEND(buf, '0');
-		}
+// Write one field: prefix (sign or "0x"), zeros, then body, padded out
+// to width with spaces, or with zeros after the prefix for FLAG_PADZERO.
+static void
+emit_field(struct printf_sink *sink, int flags, size_t width,
+           const char *prefix, size_t prefix_len, size_t zeros,
+           const char *body, size_t body_len)
+{
+	size_t len = prefix_len + zeros + body_len;
+	size_t pad = width > len ? width - len : 0;
+
+	if (IS_SET(flags, FLAG_LJUST)) {
+		sink_write(sink, prefix, prefix_len);
+		sink_fill(sink, '0', zeros);
+		sink_write(sink, body, body_len);
+		sink_fill(sink, ' ', pad);
+	} else if (IS_SET(flags, FLAG_PADZERO)) {
+		sink_write(sink, prefix, prefix_len);
+		sink_fill(sink, '0', zeros + pad);
+		sink_write(sink, body, body_len);
+	} else {
+		sink_fill(sink, ' ', pad);
+		sink_write(sink, prefix, prefix_len);
+		sink_fill(sink, '0', zeros);
+		sink_write(sink, body, body_len);
 	}
-	if (IS_SET(flags, FLAG_ALTFORM)) {
-		if (x_copy != 0 || (x_copy == 0 && (IS_SET(flags, FLAG_PRECISION) ||
-		                                    IS_SET(flags, FLAG_PADZERO)))) {
-			if (base == 16) {
-				MAYBE_APPEND(buf, 'x');
-			} else if (base == 2) {
-				MAYBE_APPEND(buf, 'b');
-			}
-			MAYBE_APPEND(buf, '0');
+}
+
+static void
+format_int(struct printf_sink *sink, int flags, size_t width, size_t precision,
+           uint64_t x, bool neg, char conv)
+{
+	char buf[INT_BUF_SIZE];
+	char *end = buf + sizeof(buf);
+	char *digits;
+	char prefix[2];
+	size_t prefix_len = 0;
+
+	switch (conv) {
+	case 'x':
+	case 'X':
+	case 'p':
+		digits = format_power_of_2(end, x, 4, conv == 'X');
+		break;
+	case 'o':
+		digits = format_power_of_2(end, x, 3, false);
+		break;
+	case 'b':
+		digits = format_power_of_2(end, x, 1, false);
+		break;
+	default:
+		digits = format_decimal(end, x);
+		break;
+	}
+	size_t len = end - digits;
+
+	// An explicit precision turns off zero padding, and "%.0d" of zero
+	// prints nothing at all.
+	if (IS_SET(flags, FLAG_PRECISION)) {
+		flags &= ~FLAG_PADZERO;
+		if (precision == 0 && x == 0) {
+			len = 0;
 		}
 	}
-	// append negative/positive sign
+	size_t zeros = precision > len ? precision - len : 0;
+
 	if (neg) {
-		MAYBE_APPEND(buf, '-');
+		prefix[prefix_len++] = '-';
 	} else if (IS_SET(flags, FLAG_SIGN)) {
-		MAYBE_APPEND(buf, '+');
+		prefix[prefix_len++] = '+';
+	} else if (IS_SET(flags, FLAG_BLANK)) {
+		prefix[prefix_len++] = ' ';
 	}
-	if (IS_SET(flags, FLAG_BLANK)) {
-		while (i < padding) {
-			MAYBE_APPEND(buf, ' ');
-		}
-	} else if (IS_SET(flags, FLAG_PRECISION)) {
-		while (i < padding) {
-			MAYBE_APPEND(buf, '0');
+	if (IS_SET(flags, FLAG_ALTFORM)) {
+		// Unlike other libcs, an explicitly padded zero keeps its "0x".
+		bool show_zero = IS_SET(flags, FLAG_PRECISION) || IS_SET(flags, FLAG_PADZERO);
+		if (conv == 'p' || ((x != 0 || show_zero) &&
+		                    (conv == 'x' || conv == 'X' || conv == 'b'))) {
+			prefix[prefix_len++] = '0';
+			prefix[prefix_len++] = conv == 'p' ? 'x' : conv;
+		} else if (conv == 'o' && zeros == 0 && (len == 0 || digits[0] != '0')) {
+			// Octal only gets as many zeros as it takes to start with one.
+			zeros = 1;
 		}
 	}
+	emit_field(sink, flags, width, prefix, prefix_len, zeros, digits, len);
+}
+
+// %f. Exact for the usual cases; very large numbers and long
+// precisions are rounded to what a double actually holds.
+static void
+format_double(struct printf_sink *sink, int flags, size_t width,
+              size_t precision, double num, bool upper)
+{
+	char buf[FLOAT_BUF_SIZE];
+	char *end = buf + sizeof(buf);
+	char *p = end;
+	char sign = '\0';
+
+	if (__builtin_signbit(num)) {
+		sign = '-';
+		num = -num;
+	} else if (IS_SET(flags, FLAG_SIGN)) {
+		sign = '+';
+	} else if (IS_SET(flags, FLAG_BLANK)) {
+		sign = ' ';
+	}
 
-	if (!IS_SET(flags, FLAG_LJUST) && !IS_SET(flags, FLAG_PADZERO) &&
-	    padding != 0) {
-		while (i < padding) {
-			MAYBE_APPEND(buf, ' ');
-		}
+	if (__builtin_isnan(num) || __builtin_isinf(num)) {
+		const char *s = __builtin_isnan(num) ? (upper ? "NAN" : "nan")
+		                                     : (upper ? "INF" : "inf");
+		emit_field(sink, flags & ~FLAG_PADZERO, width, &sign, sign != '\0', 0, s,
+		           3);
+		return;
+	}
+
+	if (!IS_SET(flags, FLAG_PRECISION)) {
+		precision = 6;
+	} else if (precision > MAX_FLOAT_PRECISION) {
+		precision = MAX_FLOAT_PRECISION;
+	}
+
+	// Keep the integer part within a uint64_t, and make up the
+	// difference with zeros.
+	size_t int_zeros = 0;
+	while (num >= 1e19) {
+		num /= 10;
+		int_zeros++;
 	}
+	uint64_t int_part = (uint64_t)num;
+	double fraction = int_zeros == 0 ? num - (double)int_part : 0;
 
-	ret = i;
+	size_t frac_digits =
+		precision < MAX_FLOAT_DIGITS ? precision : MAX_FLOAT_DIGITS;
+	uint64_t scale = powers_of_10[frac_digits];
+	double scaled = fraction * (double)scale;
+	uint64_t frac_part = (uint64_t)scaled;
+	double rest = scaled - (double)frac_part;
+	// Round half to even, like the exact conversion would.
+	bool odd = frac_digits != 0 ? (frac_part & 1) : (int_part & 1);
+	if (rest > 0.5 || (rest == 0.5 && odd)) {
+		frac_part++;
+	}
+	// 0.9999999 rounds up into the integer part.
+	if (frac_part >= scale) {
+		frac_part -= scale;
+		int_part++;
+	}
 
-	while (--i >= 0) {
-		put_function(fp, buf[i], put_func_buf);
+	for (size_t i = frac_digits; i < precision; i++) {
+		*--p = '0';
+	}
+	if (frac_digits != 0) {
+		char *stop = p - frac_digits;
+		p = format_decimal(p, frac_part);
+		while (p > stop) {
+			*--p = '0';
+		}
 	}
-	return ret;
+	if (precision != 0 || IS_SET(flags, FLAG_ALTFORM)) {
+		*--p = '.';
+	}
+	for (size_t i = 0; i < int_zeros; i++) {
+		*--p = '0';
+	}
+	p = format_decimal(p, int_part);
+
+	emit_field(sink, flags, width, &sign, sign != '\0', 0, p, end - p);
 }
 
 static uint64_t
-pow_10(int n)
+fetch_unsigned(va_list *ap, enum length length)
 {
-	uint64_t result = 1;
-	for (int i = 0; i < n; i++) {
-		result *= 10;
+	switch (length) {
+	case LEN_CHAR:
+		return (unsigned char)va_arg(*ap, unsigned int);
+	case LEN_SHORT:
+		return (unsigned short)va_arg(*ap, unsigned int);
+	case LEN_LONG:
+		return va_arg(*ap, unsigned long);
+	case LEN_LLONG:
+		return va_arg(*ap, unsigned long long);
+	case LEN_SIZE:
+		return va_arg(*ap, size_t);
+	case LEN_MAX:
+		return va_arg(*ap, uintmax_t);
+	case LEN_PTRDIFF:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, unsigned int);
 	}
-	return result;
 }
 
-static int
-print_string(void (*put_function)(FILE *fp, char c, char *buf), char *s,
-             int flags, FILE *fp, char *restrict buf, int str_pad,
-             size_t print_n_chars)
+static int64_t
+fetch_signed(va_list *ap, enum length length)
 {
-	if (s == NULL) {
-		s = "(null)";
+	switch (length) {
+	case LEN_CHAR:
+		return (signed char)va_arg(*ap, int);
+	case LEN_SHORT:
+		return (short)va_arg(*ap, int);
+	case LEN_LONG:
+		return va_arg(*ap, long);
+	case LEN_LLONG:
+		return va_arg(*ap, long long);
+	case LEN_SIZE:
+		return va_arg(*ap, ssize_t);
+	case LEN_MAX:
+		return va_arg(*ap, intmax_t);
+	case LEN_PTRDIFF:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, int);
 	}
-	int len;
-	int written = 0;
-	if (strcmp(s, "") == 0) {
-		len = 0;
-	} else {
-		len = (int)strnlen(s, print_n_chars);
-	}
-	while (len != 0 && *s != 0) {
-		put_function(fp, *s, buf);
-		written++;
-		s++;
-	}
-	if (IS_SET(flags, FLAG_LJUST) && len < str_pad) {
-		for (int i = 0; i < str_pad - len; i++) {
-			put_function(fp, ' ', buf);
-			written++;
-		}
-	}
-	return written;
 }
 
-static int
-print_double(void (*put_function)(FILE *fp, char c, char *buf), double num,
-             int flags, FILE *fp, char *restrict buf, int str_pad, int base)
+// Read a decimal field width or precision, saturating rather than
+// overflowing.
+static size_t
+parse_number(const char **fmt)
 {
-	int written = 0;
-	/* Print the num before the decimal point. */
-	written =
-		printint(put_function, buf, fp, (uint64_t)num, base, true, flags, 0);
-	put_function(fp, '.', buf);
-	written++;
-
-	double fraction = (num - (uint64_t)num);
-	fraction *= pow_10(str_pad);
-	uint64_t fraction_as_integer = (uint64_t)(fraction + 0.5);
-	written += printint(put_function, buf, fp, fraction_as_integer, base, false,
-	                    FLAG_PADZERO, str_pad);
-	return written;
+	size_t n = 0;
+	while (**fmt >= '0' && **fmt <= '9') {
+		if (n < INT_MAX / 10) {
+			n = n * 10 + (**fmt - '0');
+		}
+		(*fmt)++;
+	}
+	return n;
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
+// Understands the C99 flags, width, precision and length modifiers with
+// %d %i %u %o %x %X %b %p %s %c %f %F %%. %g and %G are printed like %f.
 int
-__libc_vprintf_template(void (*put_function)(FILE *fp, char c, char *buf),
-                        size_t (*ansi_func)(const char *), FILE *fp,
-                        char *restrict buf, const char *fmt, va_list argp,
-                        size_t print_n_chars)
+__libc_vformat(struct printf_sink *sink, const char *fmt,
+               va_list argp)
 {
-	char *s;
-	int c = 0, i = 0, state = 0;
-	int flags = 0;
-	int str_pad = 0;
-	size_t count = 0;
-
-	for (; fmt[i]; i++) {
-		// 'floor' character down to bottom 255 chars
-		c = fmt[i] & 0xff;
-		if (state == 0) {
-			if (c == '%') {
-				state = '%';
-			} else {
-				put_function(fp, c, buf);
-				count++;
-			}
-		} else if (state == '%') {
-			switch (c) {
-			case '.': {
-				if (str_pad == 0) {
-					flags |= FLAG_PRECISION;
-					goto skip_state_reset;
-				} else {
-					goto numerical_padding;
-				}
-			}
-			case '0': {
-				if (str_pad == 0) {
-					flags |= FLAG_PADZERO;
-					goto skip_state_reset;
-				} else {
-					goto numerical_padding;
-				}
-			}
-			case '1' ... '9':
-numerical_padding:
-				str_pad = str_pad * 10 + (c - '0');
-				goto skip_state_reset;
-				break;
-			case '*':
-				str_pad = va_arg(argp, int);
-				goto skip_state_reset;
-				break;
-			case '#':
-				flags |= FLAG_ALTFORM;
-				goto skip_state_reset;
-				break;
+	va_list ap;
+	va_copy(ap, argp);
+
+	for (;;) {
+		// Everything up to the next '%' goes out in one piece.
+		const char *run = fmt;
+		while (*fmt != '\0' && *fmt != '%') {
+			fmt++;
+		}
+		if (fmt != run) {
+			sink_write(sink, run, fmt - run);
+		}
+		if (*fmt == '\0') {
+			break;
+		}
+
+		const char *spec = fmt++;
+		int flags = 0;
+		size_t width = 0;
+		size_t precision = 0;
+		enum length length = LEN_INT;
+
+		for (bool more = true; more; fmt++) {
+			switch (*fmt) {
 			case '-':
 				flags |= FLAG_LJUST;
-				if (IS_SET(flags, FLAG_PADZERO)) {
-					flags ^= FLAG_PADZERO;
-				}
-				if (fmt[i + 1] && (fmt[i + 1] - '0' >= 0)) {
-					str_pad = fmt[++i] - '0';
-				}
-				goto skip_state_reset;
 				break;
-			case ' ':
-				flags |= FLAG_BLANK;
-				goto skip_state_reset;
+			case '0':
+				flags |= FLAG_PADZERO;
 				break;
 			case '+':
 				flags |= FLAG_SIGN;
-				goto skip_state_reset;
-			case 'z':
-			case 'l':
-				flags |= FLAG_LONG;
-				goto skip_state_reset;
-			case 'i':
-			case 'd': {
-				if (IS_SET(flags, FLAG_LONG)) {
-					long ld = va_arg(argp, long);
-					count +=
-						printint(put_function, buf, fp, ld, 10, true, flags, str_pad);
-
-				} else {
-					int d = va_arg(argp, int);
-					count += printint(put_function, buf, fp, d, 10, true, flags, str_pad);
-				}
 				break;
-			}
-			case 'b': {
-				if (IS_SET(flags, FLAG_LONG)) {
-					unsigned long lb = va_arg(argp, unsigned long);
-					count +=
-						printint(put_function, buf, fp, lb, 2, false, flags, str_pad);
-				} else {
-					unsigned int b = va_arg(argp, unsigned int);
-					count += printint(put_function, buf, fp, b, 2, false, flags, str_pad);
-				}
+			case ' ':
+				flags |= FLAG_BLANK;
 				break;
-			}
-			case 'g':
-			case 'f': {
-				double d = va_arg(argp, double);
-				count += print_double(put_function, d, flags, fp, buf,
-				                      str_pad > 0 ? str_pad : 6,
-				                      IS_SET(flags, FLAG_ALTFORM) ? 16 : 10);
+			case '#':
+				flags |= FLAG_ALTFORM;
 				break;
-			}
-			case 'u': {
-				if (IS_SET(flags, FLAG_LONG)) {
-					unsigned long lu = va_arg(argp, unsigned long);
-					count +=
-						printint(put_function, buf, fp, lu, 10, false, flags, str_pad);
-				} else {
-					unsigned int u = va_arg(argp, unsigned int);
-					count +=
-						printint(put_function, buf, fp, u, 10, false, flags, str_pad);
-				}
+			default:
+				more = false;
+				fmt--;
 				break;
 			}
-			case 'x': {
-				if (IS_SET(flags, FLAG_LONG)) {
-					unsigned long lx = va_arg(argp, unsigned long);
-					count +=
-						printint(put_function, buf, fp, lx, 16, false, flags, str_pad);
+		}
+
+		if (*fmt == '*') {
+			int w = va_arg(ap, int);
+			if (w < 0) {
+				flags |= FLAG_LJUST;
+				w = -w;
+			}
+			width = (size_t)w;
+			fmt++;
+		} else {
+			width = parse_number(&fmt);
+		}
+
+		if (*fmt == '.') {
+			fmt++;
+			flags |= FLAG_PRECISION;
+			if (*fmt == '*') {
+				int prec = va_arg(ap, int);
+				// A negative precision is taken as if it were missing.
+				if (prec < 0) {
+					flags &= ~FLAG_PRECISION;
 				} else {
-					unsigned int x = va_arg(argp, unsigned int);
-					count +=
-						printint(put_function, buf, fp, x, 16, false, flags, str_pad);
+					precision = (size_t)prec;
 				}
-				break;
-			}
-			case 'p': {
-				flags |= FLAG_ALTFORM;
-				uintptr_t x = (uintptr_t)va_arg(argp, void *);
-				count += printint(put_function, buf, fp, x, 16, false, flags, str_pad);
-				break;
-			}
-			case 'o': {
-				int x = va_arg(argp, int);
-				count += printint(put_function, buf, fp, x, 8, false, flags, str_pad);
-				break;
+				fmt++;
+			} else {
+				precision = parse_number(&fmt);
 			}
-			case 's': {
-				s = va_arg(argp, char *);
-				count +=
-					print_string(put_function, s, flags, fp, buf, str_pad, print_n_chars);
-				break;
+		}
+
+		switch (*fmt) {
+		case 'h':
+			fmt++;
+			length = LEN_SHORT;
+			if (*fmt == 'h') {
+				fmt++;
+				length = LEN_CHAR;
 			}
-			case 'c': {
-				int c_ = va_arg(argp, int);
-				put_function(fp, c_, buf);
-				count++;
-				break;
+			break;
+		case 'l':
+			fmt++;
+			length = LEN_LONG;
+			if (*fmt == 'l') {
+				fmt++;
+				length = LEN_LLONG;
 			}
-			case '%':
-				put_function(fp, c, buf);
-				count++;
-				break;
-			// Unknown % sequence.  Print it to draw attention.
-			default:
-				put_function(fp, '%', buf);
-				put_function(fp, c, buf);
-				count++;
-				break;
+			break;
+		case 'z':
+			fmt++;
+			length = LEN_SIZE;
+			break;
+		case 'j':
+			fmt++;
+			length = LEN_MAX;
+			break;
+		case 't':
+			fmt++;
+			length = LEN_PTRDIFF;
+			break;
+		case 'L':
+			fmt++;
+			length = LEN_LDOUBLE;
+			break;
+		}
+
+		if (IS_SET(flags, FLAG_LJUST)) {
+			flags &= ~FLAG_PADZERO;
+		}
+
+		switch (*fmt) {
+		case 'd':
+		case 'i': {
+			int64_t d = fetch_signed(&ap, length);
+			format_int(sink, flags, width, precision,
+			           d < 0 ? -(uint64_t)d : (uint64_t)d, d < 0, 'd');
+			break;
+		}
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+		case 'b':
+			format_int(sink, flags & ~(FLAG_SIGN | FLAG_BLANK), width, precision,
+			           fetch_unsigned(&ap, length), false, *fmt);
+			break;
+		case 'p':
+			format_int(sink, (flags & ~(FLAG_SIGN | FLAG_BLANK)) | FLAG_ALTFORM,
+			           width, precision, (uintptr_t)va_arg(ap, void *), false, 'p');
+			break;
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G': {
+			double d = length == LEN_LDOUBLE ? (double)va_arg(ap, long double)
+			                                 : va_arg(ap, double);
+			format_double(sink, flags, width, precision, d,
+			              *fmt == 'F' || *fmt == 'G');
+			break;
+		}
+		case 's': {
+			const char *s = va_arg(ap, const char *);
+			if (s == NULL) {
+				s = "(null)";
 			}
-			str_pad = 0;
-			state = 0;
-			flags = 0;
-skip_state_reset:; // state = '%' if set
+			size_t len =
+				IS_SET(flags, FLAG_PRECISION) ? strnlen(s, precision) : strlen(s);
+			emit_field(sink, flags & FLAG_LJUST, width, NULL, 0, 0, s, len);
+			break;
+		}
+		case 'c': {
+			char c = (char)va_arg(ap, int);
+			emit_field(sink, flags & FLAG_LJUST, width, NULL, 0, 0, &c, 1);
+			break;
+		}
+		case '%':
+			sink_write(sink, "%", 1);
+			break;
+		case '\0':
+			// A '%' at the very end. Print what there is and stop.
+			sink_write(sink, spec, fmt - spec);
+			va_end(ap);
+			return sink->count > INT_MAX ? -1 : (int)sink->count;
+		// Unknown % sequence.  Print it to draw attention.
+		default:
+			sink_write(sink, spec, fmt - spec + 1);
+			break;
 		}
+		fmt++;
 	}
-	return count;
+	va_end(ap);
+	return sink->count > INT_MAX ? -1 : (int)sink->count;
 }
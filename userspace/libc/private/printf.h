@@ -1,7 +1,23 @@
 #pragma once
-// We just need FILE for its struct impl.
-#include <stdio.h>
-int __libc_vprintf_template(void (*put_function)(FILE *fp, char c, char *buf),
-                            size_t (*ansi_func)(const char *), FILE *fp,
-                            char *restrict buf, const char *fmt, va_list argp,
-                            size_t print_n_chars);
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Where formatted output goes. The formatter copies straight into
+// [pos, pos + room) and calls drain() once that is full. drain() either
+// makes more room and returns true, or returns false and everything
+// after that is only counted. A NULL drain() behaves like one that
+// always returns false, which is what snprintf() wants.
+struct printf_sink {
+	char *pos;
+	size_t room;
+	// Characters produced so far, whether or not they were stored.
+	size_t count;
+	bool (*drain)(struct printf_sink *sink);
+	void *ctx;
+};
+
+// Format into sink. Returns the length of the full output, or -1 if it
+// does not fit in an int.
+int __libc_vformat(struct printf_sink *sink, const char *fmt,
+                   va_list argp);
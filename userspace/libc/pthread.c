@@ -0,0 +1,276 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/futex.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_STACK_SIZE (64 * 1024)
+
+// Each thread's %fs base points at its descriptor, so that
+// pthread_self() is a single load.
+struct __pthread {
+	struct __pthread *self;
+	void *(*start_routine)(void *);
+	void *arg;
+	void *result;
+	// Set by the kernel before the thread runs, and cleared (with a
+	// futex wake) when it exits.
+	pid_t tid;
+	int errno_value;
+};
+
+static struct __pthread main_thread = { .self = &main_thread };
+// %fs is only set up once the first thread is created.
+static bool threads_started = false;
+
+pthread_t
+pthread_self(void)
+{
+	struct __pthread *self;
+
+	if (!threads_started) {
+		return &main_thread;
+	}
+	__asm__("mov %%fs:0, %0" : "=r"(self));
+	return self;
+}
+
+int *
+__errno_location(void)
+{
+	return &pthread_self()->errno_value;
+}
+
+int
+pthread_equal(pthread_t t1, pthread_t t2)
+{
+	return t1 == t2;
+}
+
+static inline int
+futex_wait(uint32_t *addr, uint32_t val)
+{
+	return __syscall4(SYS_futex, (long)addr, FUTEX_WAIT_PRIVATE, val, 0);
+}
+
+static inline int
+futex_wake(uint32_t *addr, int n)
+{
+	return __syscall4(SYS_futex, (long)addr, FUTEX_WAKE_PRIVATE, n, 0);
+}
+
+int
+pthread_attr_init(pthread_attr_t *attr)
+{
+	attr->stacksize = DEFAULT_STACK_SIZE;
+	return 0;
+}
+
+int
+pthread_attr_destroy(pthread_attr_t *attr)
+{
+	return 0;
+}
+
+int
+pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize)
+{
+	if (stacksize < PTHREAD_STACK_MIN) {
+		return EINVAL;
+	}
+	attr->stacksize = stacksize;
+	return 0;
+}
+
+int
+pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *stacksize)
+{
+	*stacksize = attr->stacksize;
+	return 0;
+}
+
+static int
+pthread_start(void *arg)
+{
+	struct __pthread *self = arg;
+	self->result = self->start_routine(self->arg);
+	return 0;
+}
+
+int
+pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+               void *(*start_routine)(void *), void *arg)
+{
+	size_t stacksize = attr != NULL ? attr->stacksize : DEFAULT_STACK_SIZE;
+	struct __pthread *t;
+
+	if (!threads_started) {
+		if (arch_prctl(ARCH_SET_FS, (unsigned long)&main_thread) < 0) {
+			return errno;
+		}
+		threads_started = true;
+	}
+
+	// The descriptor sits at the bottom of the block, and the stack
+	// grows down towards it from the top.
+	if ((t = malloc(sizeof(*t) + stacksize)) == NULL) {
+		return EAGAIN;
+	}
+	t->self = t;
+	t->start_routine = start_routine;
+	t->arg = arg;
+	t->result = NULL;
+	t->tid = 0;
+	t->errno_value = 0;
+
+	int flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND |
+	            CLONE_THREAD | CLONE_SETTLS | CLONE_PARENT_SETTID |
+	            CLONE_CHILD_CLEARTID;
+	if (clone(pthread_start, (char *)(t + 1) + stacksize, flags, t, &t->tid,
+	          (unsigned long)t, &t->tid) < 0) {
+		int err = errno;
+		free(t);
+		return err;
+	}
+	*thread = t;
+	return 0;
+}
+
+int
+pthread_join(pthread_t thread, void **retval)
+{
+	pid_t tid;
+
+	if (thread == pthread_self()) {
+		return EDEADLK;
+	}
+	// The kernel zeroes tid once the thread is gone for good.
+	while ((tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE)) != 0) {
+		futex_wait((uint32_t *)&thread->tid, tid);
+	}
+	if (retval != NULL) {
+		*retval = thread->result;
+	}
+	if (thread != &main_thread) {
+		free(thread);
+	}
+	return 0;
+}
+
+void
+pthread_exit(void *retval)
+{
+	pthread_self()->result = retval;
+	__syscall1(SYS_exit_thread, 0);
+	__builtin_unreachable();
+}
+
+int
+pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+	mutex->state = 0;
+	return 0;
+}
+
+int
+pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+	return 0;
+}
+
+// The three-state mutex from Drepper's "Futexes Are Tricky": unlocking
+// only makes a syscall if someone might be waiting.
+int
+pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	uint32_t c = 0;
+
+	if (__atomic_compare_exchange_n(&mutex->state, &c, 1, false,
+	                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	if (c != 2) {
+		c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+	}
+	while (c != 0) {
+		futex_wait(&mutex->state, 2);
+		c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+	}
+	return 0;
+}
+
+int
+pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	uint32_t c = 0;
+
+	if (__atomic_compare_exchange_n(&mutex->state, &c, 1, false,
+	                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	return EBUSY;
+}
+
+int
+pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	if (__atomic_fetch_sub(&mutex->state, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n(&mutex->state, 0, __ATOMIC_RELEASE);
+		futex_wake(&mutex->state, 1);
+	}
+	return 0;
+}
+
+int
+pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+	cond->seq = 0;
+	return 0;
+}
+
+int
+pthread_cond_destroy(pthread_cond_t *cond)
+{
+	return 0;
+}
+
+int
+pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(mutex);
+	// If anyone signals after we sampled seq, this returns right away.
+	futex_wait(&cond->seq, seq);
+	// Take the lock as contended, since others may have been woken too.
+	while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+		futex_wait(&mutex->state, 2);
+	}
+	return 0;
+}
+
+int
+pthread_cond_signal(pthread_cond_t *cond)
+{
+	__atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&cond->seq, 1);
+	return 0;
+}
+
+int
+pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	__atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&cond->seq, INT_MAX);
+	return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <sched.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+long __clone(int (*fn)(void *), void *stack, unsigned long flags, void *arg,
+             pid_t *parent_tid, unsigned long tls, pid_t *child_tid);
+
+// clone(fn, stack, flags, arg, [parent_tid, [tls, [child_tid]]])
+// The child calls fn(arg) on stack and exits with its return value.
+int
+clone(int (*fn)(void *), void *stack, int flags, void *arg, ...)
+{
+	va_list ap;
+	pid_t *parent_tid = NULL;
+	unsigned long tls = 0;
+	pid_t *child_tid = NULL;
+
+	if (fn == NULL || stack == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	va_start(ap, arg);
+	if (flags & (CLONE_PARENT_SETTID | CLONE_SETTLS | CLONE_CHILD_SETTID |
+	             CLONE_CHILD_CLEARTID)) {
+		parent_tid = va_arg(ap, pid_t *);
+		tls = va_arg(ap, unsigned long);
+		child_tid = va_arg(ap, pid_t *);
+	}
+	va_end(ap);
+	return __syscall_ret(
+		__clone(fn, stack, flags, arg, parent_tid, tls, child_tid));
+}
+
+int
+sched_yield(void)
+{
+	return __syscall_ret(__syscall0(SYS_sched_yield));
+}
@@ -0,0 +1,356 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+enum { SPAWN_OPEN, SPAWN_CLOSE, SPAWN_DUP2 };
+
+struct __spawn_action {
+	int type;
+	int fd;
+	int newfd; // SPAWN_DUP2
+	int oflag; // SPAWN_OPEN
+	mode_t mode;
+	char *path;
+};
+
+int
+posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions)
+{
+	file_actions->__count = 0;
+	file_actions->__capacity = 0;
+	file_actions->__actions = NULL;
+	return 0;
+}
+
+int
+posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions)
+{
+	for (int i = 0; i < file_actions->__count; i++) {
+		free(file_actions->__actions[i].path);
+	}
+	free(file_actions->__actions);
+	return posix_spawn_file_actions_init(file_actions);
+}
+
+static struct __spawn_action *
+add_action(posix_spawn_file_actions_t *file_actions, int type, int fd)
+{
+	if (fd < 0 || fd >= OPEN_MAX) {
+		errno = EBADF;
+		return NULL;
+	}
+	if (file_actions->__count == file_actions->__capacity) {
+		int capacity = file_actions->__capacity ? file_actions->__capacity * 2 : 4;
+		struct __spawn_action *actions = realloc(
+			file_actions->__actions, capacity * sizeof(struct __spawn_action));
+		if (actions == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		file_actions->__actions = actions;
+		file_actions->__capacity = capacity;
+	}
+	struct __spawn_action *action =
+		&file_actions->__actions[file_actions->__count++];
+	memset(action, 0, sizeof(*action));
+	action->type = type;
+	action->fd = fd;
+	return action;
+}
+
+int
+posix_spawn_file_actions_addopen(
+	posix_spawn_file_actions_t *restrict file_actions, int fildes,
+	const char *restrict path, int oflag, mode_t mode)
+{
+	char *copy = strdup(path);
+	if (copy == NULL) {
+		return ENOMEM;
+	}
+	struct __spawn_action *action =
+		add_action(file_actions, SPAWN_OPEN, fildes);
+	if (action == NULL) {
+		free(copy);
+		return errno;
+	}
+	action->path = copy;
+	action->oflag = oflag;
+	action->mode = mode;
+	return 0;
+}
+
+int
+posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions,
+                                  int fildes)
+{
+	return add_action(file_actions, SPAWN_CLOSE, fildes) == NULL ? errno : 0;
+}
+
+int
+posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions,
+                                 int fildes, int newfildes)
+{
+	if (newfildes < 0 || newfildes >= OPEN_MAX) {
+		return EBADF;
+	}
+	struct __spawn_action *action =
+		add_action(file_actions, SPAWN_DUP2, fildes);
+	if (action == NULL) {
+		return errno;
+	}
+	action->newfd = newfildes;
+	return 0;
+}
+
+int
+posix_spawnattr_init(posix_spawnattr_t *attr)
+{
+	memset(attr, 0, sizeof(*attr));
+	return 0;
+}
+
+int
+posix_spawnattr_destroy(posix_spawnattr_t *attr)
+{
+	(void)attr;
+	return 0;
+}
+
+int
+posix_spawnattr_getflags(const posix_spawnattr_t *restrict attr,
+                         short *restrict flags)
+{
+	*flags = attr->__flags;
+	return 0;
+}
+
+int
+posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags)
+{
+	// There is no scheduler policy to set.
+	if (flags & ~(POSIX_SPAWN_RESETIDS | POSIX_SPAWN_SETPGROUP |
+	              POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK)) {
+		return EINVAL;
+	}
+	attr->__flags = flags;
+	return 0;
+}
+
+int
+posix_spawnattr_getpgroup(const posix_spawnattr_t *restrict attr,
+                          pid_t *restrict pgroup)
+{
+	*pgroup = attr->__pgroup;
+	return 0;
+}
+
+int
+posix_spawnattr_setpgroup(posix_spawnattr_t *attr, pid_t pgroup)
+{
+	attr->__pgroup = pgroup;
+	return 0;
+}
+
+int
+posix_spawnattr_getsigdefault(const posix_spawnattr_t *restrict attr,
+                              sigset_t *restrict sigdefault)
+{
+	*sigdefault = attr->__sigdefault;
+	return 0;
+}
+
+int
+posix_spawnattr_setsigdefault(posix_spawnattr_t *restrict attr,
+                              const sigset_t *restrict sigdefault)
+{
+	attr->__sigdefault = *sigdefault;
+	return 0;
+}
+
+int
+posix_spawnattr_getsigmask(const posix_spawnattr_t *restrict attr,
+                           sigset_t *restrict sigmask)
+{
+	*sigmask = attr->__sigmask;
+	return 0;
+}
+
+int
+posix_spawnattr_setsigmask(posix_spawnattr_t *restrict attr,
+                           const sigset_t *restrict sigmask)
+{
+	attr->__sigmask = *sigmask;
+	return 0;
+}
+
+static int
+apply_actions(const posix_spawn_file_actions_t *file_actions)
+{
+	for (int i = 0; i < file_actions->__count; i++) {
+		const struct __spawn_action *action = &file_actions->__actions[i];
+		switch (action->type) {
+		case SPAWN_OPEN: {
+			int fd = open(action->path, action->oflag, action->mode);
+			if (fd < 0) {
+				return -1;
+			}
+			if (fd != action->fd) {
+				int ret = dup2(fd, action->fd);
+				close(fd);
+				if (ret < 0) {
+					return -1;
+				}
+			}
+			break;
+		}
+		case SPAWN_CLOSE:
+			// Closing something that is not open is not an error.
+			close(action->fd);
+			break;
+		case SPAWN_DUP2:
+			if (dup2(action->fd, action->newfd) < 0) {
+				return -1;
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+static int
+apply_attr(const posix_spawnattr_t *attr)
+{
+	if (attr->__flags & POSIX_SPAWN_SETSIGDEF) {
+		for (int sig = 1; sig < NSIG; sig++) {
+			if (sigismember(&attr->__sigdefault, sig) == 1) {
+				signal(sig, SIG_DFL);
+			}
+		}
+	}
+	if ((attr->__flags & POSIX_SPAWN_SETSIGMASK) &&
+	    sigprocmask(SIG_SETMASK, &attr->__sigmask, NULL) < 0) {
+		return -1;
+	}
+	if ((attr->__flags & POSIX_SPAWN_SETPGROUP) &&
+	    setpgid(0, attr->__pgroup) < 0) {
+		return -1;
+	}
+	if ((attr->__flags & POSIX_SPAWN_RESETIDS) &&
+	    (setegid(getgid()) < 0 || seteuid(getuid()) < 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+// Try each directory in PATH, like execvp(), but without strtok():
+// we are running on our parent's memory.
+static void
+exec_search(const char *file, char *const argv[], char *const envp[])
+{
+	char buf[PATH_MAX];
+	const char *path = getenv("PATH");
+	size_t len = strlen(file);
+	bool denied = false;
+
+	if (path == NULL) {
+		path = "/bin";
+	}
+	for (const char *p = path;; p++) {
+		const char *end = p;
+		while (*end != '\0' && *end != ':') {
+			end++;
+		}
+		size_t dirlen = end - p;
+		if (dirlen + len + 2 <= sizeof(buf)) {
+			memcpy(buf, p, dirlen);
+			buf[dirlen] = '/';
+			memcpy(buf + dirlen + 1, file, len + 1);
+			execve(buf, argv, envp);
+			if (errno == EACCES) {
+				denied = true;
+			} else if (errno != ENOENT && errno != ENOTDIR) {
+				return;
+			}
+		}
+		if (*end == '\0') {
+			break;
+		}
+		p = end;
+	}
+	if (denied) {
+		errno = EACCES;
+	}
+}
+
+static int
+spawn(pid_t *restrict pid, const char *restrict path, bool search,
+      const posix_spawn_file_actions_t *file_actions,
+      const posix_spawnattr_t *restrict attrp, char *const argv[],
+      char *const envp[])
+{
+	// The child shares our memory until it execs, so it can hand its
+	// errno back through here. It also shares errno itself.
+	volatile int err = 0;
+	int saved_errno = errno;
+
+	if (envp == NULL) {
+		envp = environ;
+	}
+	pid_t child = vfork();
+	if (child < 0) {
+		return errno;
+	}
+	if (child == 0) {
+		if ((file_actions == NULL || apply_actions(file_actions) == 0) &&
+		    (attrp == NULL || apply_attr(attrp) == 0)) {
+			if (search && strchr(path, '/') == NULL) {
+				exec_search(path, argv, envp);
+			} else {
+				execve(path, argv, envp);
+			}
+		}
+		err = errno;
+		_exit(127);
+	}
+	// vfork() only returns here once the child has exec'd or exited.
+	errno = saved_errno;
+	if (err != 0) {
+		waitpid(child, NULL, 0);
+		return err;
+	}
+	if (pid != NULL) {
+		*pid = child;
+	}
+	return 0;
+}
+
+int
+posix_spawn(pid_t *restrict pid, const char *restrict path,
+            const posix_spawn_file_actions_t *file_actions,
+            const posix_spawnattr_t *restrict attrp, char *const argv[restrict],
+            char *const envp[restrict])
+{
+	return spawn(pid, path, false, file_actions, attrp, argv, envp);
+}
+
+int
+posix_spawnp(pid_t *restrict pid, const char *restrict file,
+             const posix_spawn_file_actions_t *file_actions,
+             const posix_spawnattr_t *restrict attrp, char *const argv[restrict],
+             char *const envp[restrict])
+{
+	return spawn(pid, file, true, file_actions, attrp, argv, envp);
+}
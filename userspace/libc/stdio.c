@@ -10,6 +10,7 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdckdint.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -24,14 +25,12 @@ FILE *stdin;
 FILE *stdout;
 FILE *stderr;
 
-int errno;
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
 
 static FILE *open_files[FOPEN_MAX];
 static size_t open_files_index = 0;
 
-static size_t global_idx = 0;
-static size_t global_idx_fgetc = 0;
-
 void
 __init_stdio(void)
 {
@@ -43,7 +42,9 @@ __init_stdio(void)
 		raise(SIGSEGV);
 	}
 	setvbuf(file_stdin, NULL, _IOLBF, 0);
-	setvbuf(file_stdout, NULL, _IOLBF, 0);
+	// Output to a file or pipe is not for a person to watch, so it can
+	// wait until the buffer fills.
+	setvbuf(file_stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, 0);
 	/* stderr is unbuffered by default. */
 	setvbuf(file_stderr, NULL, _IONBF, 0);
 	open_files[0] = file_stdin;
@@ -71,6 +72,7 @@ rename(const char *oldpath, const char *newpath)
 	                                (long)AT_FDCWD, (long)newpath));
 }
 
+// Write out everything in the buffer.
 static int
 flush(FILE *stream)
 {
@@ -79,12 +81,88 @@ flush(FILE *stream)
 		return -1;
 	}
 
-	// write(stream->fd, stream->write_buffer, stream->write_buffer_index);
-	writev(stream->fd,
-	       &(const struct iovec){ stream->write_buffer,
-	                              stream->write_buffer_index },
-	       1);
-	stream->write_buffer_index = 0;
+	size_t done = 0;
+	while (done < stream->write_index) {
+		ssize_t n = write(stream->fd, stream->buffer + done,
+		                  stream->write_index - done);
+		if (n <= 0) {
+			// Drop what is left rather than letting it pile up.
+			stream->error = true;
+			stream->write_index = 0;
+			return EOF;
+		}
+		done += n;
+	}
+	stream->write_index = 0;
+	return 0;
+}
+
+// Throw away anything read ahead, and move the descriptor back to
+// where the caller thinks the stream is. That fails on pipes and
+// terminals, where the data is gone anyway.
+static void
+drop_read_buffer(FILE *stream)
+{
+	if (stream->read_pos != stream->read_end) {
+		(void)lseek(stream->fd, -(off_t)(stream->read_end - stream->read_pos),
+		            SEEK_CUR);
+	}
+	stream->read_pos = stream->read_end = 0;
+}
+
+// Allocate the buffer if setvbuf() did not give us one.
+static int
+ensure_buffer(FILE *stream)
+{
+	if (__likely(stream->buffer != NULL)) {
+		return 0;
+	}
+	if ((stream->buffer = malloc(stream->buffer_size)) == NULL) {
+		stream->error = true;
+		return EOF;
+	}
+	stream->own_buffer = true;
+	return 0;
+}
+
+// Get ready to put data in the buffer.
+static inline int
+begin_write(FILE *stream)
+{
+	if (__unlikely(stream->read_end != 0)) {
+		drop_read_buffer(stream);
+	}
+	return ensure_buffer(stream);
+}
+
+// Refill the buffer from the descriptor. Only called when it is empty.
+static int
+fill(FILE *stream)
+{
+	if (stream->write_index != 0 && flush(stream) == EOF) {
+		return EOF;
+	}
+	if (ensure_buffer(stream) == EOF) {
+		return EOF;
+	}
+	// Someone waiting on interactive input should see the prompt.
+	if (stream->buffer_mode != _IOFBF && stdout != NULL && stream != stdout &&
+	    stdout->write_index != 0) {
+		(void)flush(stdout);
+	}
+	size_t want = stream->buffer_mode == _IONBF ? 1 : stream->buffer_size;
+	ssize_t n = read(stream->fd, stream->buffer, want);
+	stream->read_pos = 0;
+	if (n <= 0) {
+		if (n == 0) {
+			stream->eof = true;
+		} else {
+			stream->error = true;
+		}
+		stream->read_end = 0;
+		return EOF;
+	}
+	stream->read_end = n;
 	return 0;
 }
 
@@ -92,10 +170,15 @@ int
 fflush(FILE *stream)
 {
 	if (__unlikely(stream == NULL)) {
+		int ret = 0;
 		for (size_t i = 0; i < open_files_index; i++) {
-			(void)flush(open_files[i]);
+			if (open_files[i] != NULL && flush(open_files[i]) == EOF) {
+				ret = EOF;
+			}
 		}
+		return ret;
 	}
+	drop_read_buffer(stream);
 	return flush(stream);
 }
 
@@ -172,7 +255,8 @@ freopen(const char *restrict pathname, const char *restrict mode,
 		stream->flags = flags;
 	}
 	stream->fd = open(pathname, flags, stream->mode);
-	stream->write_buffer_index = 0;
+	stream->write_index = 0;
+	stream->read_pos = stream->read_end = 0;
 	return stream;
 }
 
@@ -203,28 +287,24 @@ fdopen(int fd, const char *restrict mode)
 	fp->fd = fd;
 	fp->eof = false;
 	fp->error = false;
-	fp->write_buffer = malloc(BUFSIZ);
-	if (__unlikely(fp->write_buffer == NULL)) {
-		free(fp);
-		return NULL;
-	}
-	fp->write_buffer_size = BUFSIZ;
-	fp->write_buffer_index = 0;
-	fp->stdio_flush = true;
-	fp->previous_char = EOF;
+	fp->buffer = NULL;
+	fp->buffer_size = BUFSIZ;
+	fp->own_buffer = false;
+	fp->write_index = 0;
+	fp->read_pos = fp->read_end = 0;
+	fp->stdio_flush = false;
 	fp->buffer_mode = _IOFBF;
-	if (open_files_index < OPEN_MAX) {
+	if (open_files_index < FOPEN_MAX) {
 		fp->static_table_index = open_files_index;
 		open_files[open_files_index++] = fp;
 	} else {
-		for (size_t i = 0; i < OPEN_MAX; i++) {
+		for (size_t i = 0; i < FOPEN_MAX; i++) {
 			if (open_files[i] == NULL) {
 				fp->static_table_index = i;
 				open_files[i] = fp;
 				return fp;
 			}
 		}
-		free(fp->write_buffer);
 		free(fp);
 		return NULL;
 	}
@@ -235,15 +315,19 @@ int
 fclose(FILE *stream)
 {
 	fflush(stream);
-	if (stream->write_buffer != NULL) {
-		free(stream->write_buffer);
+	if (stream->own_buffer) {
+		free(stream->buffer);
 	}
+	stream->buffer = NULL;
 	if (close(stream->fd) < 0) {
 		stream->error = true;
 		return EOF;
 	}
 	open_files[stream->static_table_index] = NULL;
-	open_files_index--;
+	// Only give back the slot if nothing after it is in use.
+	if (stream->static_table_index + 1 == open_files_index) {
+		open_files_index--;
+	}
 	free(stream);
 
 	return 0;
@@ -254,21 +338,35 @@ ferror(FILE *stream)
 	return stream->error;
 }
 
+// Push c back in front of the unread data, so the next read returns it.
 int
 ungetc(int c, FILE *stream)
 {
-	return stream->previous_char;
+	if (c == EOF || (stream->write_index != 0 && flush(stream) == EOF) ||
+	    ensure_buffer(stream) == EOF) {
+		return EOF;
+	}
+	if (stream->read_pos == 0) {
+		// Nothing has been read out of the buffer yet; make room.
+		if (stream->read_end == stream->buffer_size) {
+			return EOF;
+		}
+		memmove(stream->buffer + 1, stream->buffer, stream->read_end);
+		stream->read_pos++;
+		stream->read_end++;
+	}
+	stream->buffer[--stream->read_pos] = (char)c;
+	stream->eof = false;
+	return (unsigned char)c;
 }
 
 int
 fgetc(FILE *stream)
 {
-	int c;
-	if (read(fileno(stream), &c, 1) != 1) {
+	if (stream->read_pos == stream->read_end && fill(stream) == EOF) {
 		return EOF;
 	}
-	stream->previous_char = c;
-	return c;
+	return (unsigned char)stream->buffer[stream->read_pos++];
 }
 
 int
@@ -283,74 +381,111 @@ getchar(void)
 	return getc(stdin);
 }
 
-static void
-static_fgetc(FILE *stream, char c, char *buf)
+// Copy from the buffer up to and including the first delim, or up to
+// limit bytes. Returns how many bytes were copied and sets *found if
+// that ended with delim.
+static size_t
+take_until(FILE *stream, char *dst, size_t limit, int delim, bool *found)
 {
-	if (global_idx_fgetc < BUFSIZ - 1) {
-		buf[global_idx_fgetc++] = getc(stream);
-	} else {
-		buf[global_idx_fgetc++] = '\0';
+	const char *start = stream->buffer + stream->read_pos;
+	size_t n = min(limit, stream->read_end - stream->read_pos);
+	const char *hit = memchr(start, delim, n);
+
+	*found = hit != NULL;
+	if (hit != NULL) {
+		n = hit - start + 1;
 	}
+	memcpy(dst, start, n);
+	stream->read_pos += n;
+	return n;
 }
 
 char *
 fgets(char *buf, int max, FILE *restrict stream)
 {
-	int i;
-	char c;
+	size_t i = 0;
+	bool found = false;
 
-	for (i = 0; i + 1 < max;) {
-		c = getc(stream);
-		if (c == EOF) {
-			stream->eof = true;
-			return NULL;
-		}
-		buf[i++] = c;
-		if (c == '\n' || c == '\r') {
+	if (max <= 0) {
+		return NULL;
+	}
+	while (i + 1 < (size_t)max && !found) {
+		if (stream->read_pos == stream->read_end && fill(stream) == EOF) {
 			break;
 		}
+		i += take_until(stream, buf + i, max - 1 - i, '\n', &found);
+	}
+	if (i == 0 && max > 1) {
+		return NULL;
 	}
 	buf[i] = '\0';
 	return buf;
 }
 
-/* We don't care about what's passed in buf */
-// This is where the buffered IO happens.
-__NONNULL(1)
-static void
-fd_putc(FILE *fp, char c, char *__attribute__((unused)) buf)
-
+// Read up to and including delim into *lineptr, growing it with
+// realloc() as needed. Returns the length, or -1 at end of file.
+ssize_t
+getdelim(char **restrict lineptr, size_t *restrict n, int delim,
+         FILE *restrict stream)
 {
-	fp->write_buffer[fp->write_buffer_index++] = c;
-	if (((fp->buffer_mode == _IOFBF &&
-	      fp->write_buffer_index >= fp->write_buffer_size - 1) ||
-	     (fp->buffer_mode == _IONBF) ||
-	     (fp->buffer_mode == _IOLBF && c == '\n'))) {
-		flush(fp);
+	size_t len = 0;
+	bool found = false;
+
+	if (*lineptr == NULL) {
+		*n = 0;
+	}
+	while (!found) {
+		if (stream->read_pos == stream->read_end && fill(stream) == EOF) {
+			break;
+		}
+		// Room for everything buffered, plus the terminator.
+		size_t need = len + (stream->read_end - stream->read_pos) + 1;
+		if (need > *n) {
+			size_t size = max(need, max(*n * 2, (size_t)128));
+			char *p = realloc(*lineptr, size);
+			if (p == NULL) {
+				stream->error = true;
+				errno = ENOMEM;
+				return -1;
+			}
+			*lineptr = p;
+			*n = size;
+		}
+		len += take_until(stream, *lineptr + len, SIZE_MAX, delim, &found);
+	}
+	if (len == 0) {
+		return -1;
 	}
+	(*lineptr)[len] = '\0';
+	return len;
 }
 
-__NONNULL(3)
-static void
-string_putc(__attribute__((unused)) FILE *fp, char c, char *buf)
+ssize_t
+getline(char **restrict lineptr, size_t *restrict n, FILE *restrict stream)
 {
-	buf[global_idx] = c;
-	global_idx++;
+	return getdelim(lineptr, n, '\n', stream);
 }
 
+// This is where the buffered IO happens.
+__NONNULL(1)
 static void
-null_string_putc(__attribute__((unused)) FILE *fp,
-                 __attribute__((unused)) char c,
-                 __attribute__((unused)) char *buf)
+fd_putc(FILE *fp, char c)
 {
-	global_idx++;
+	if (__unlikely(begin_write(fp) == EOF)) {
+		return;
+	}
+	fp->buffer[fp->write_index++] = c;
+	if (fp->write_index == fp->buffer_size || fp->buffer_mode == _IONBF ||
+	    (fp->buffer_mode == _IOLBF && c == '\n')) {
+		flush(fp);
+	}
 }
 
 int
 fputc(int c, FILE *stream)
 {
-	fd_putc(stream, c, NULL);
-	return c;
+	fd_putc(stream, c);
+	return stream->error ? EOF : (unsigned char)c;
 }
 
 int
@@ -365,13 +500,43 @@ putchar(int c)
 	return putc(c, stdout);
 }
 
+// The formatter has filled the buffer; write it out and start over.
+static bool
+file_drain(struct printf_sink *sink)
+{
+	FILE *stream = sink->ctx;
+
+	stream->write_index = stream->buffer_size;
+	if (flush(stream) == EOF) {
+		return false;
+	}
+	sink->pos = stream->buffer;
+	sink->room = stream->buffer_size;
+	return true;
+}
+
+// Output is formatted straight into the stream's buffer.
 int
 vfprintf(FILE *restrict stream, const char *restrict fmt, va_list argp)
 {
-	int ret =
-		__libc_vprintf_template(fd_putc, NULL, stream, NULL, fmt, argp, SIZE_MAX);
-	if (stream->stdio_flush) {
-		flush(stream);
+	if (__unlikely(begin_write(stream) == EOF)) {
+		return -1;
+	}
+	struct printf_sink sink = {
+		.pos = stream->buffer + stream->write_index,
+		.room = stream->buffer_size - stream->write_index,
+		.drain = file_drain,
+		.ctx = stream,
+	};
+	int ret = __libc_vformat(&sink, fmt, argp);
+	if (sink.drain == NULL) {
+		// A write failed and the rest was thrown away.
+		stream->write_index = 0;
+		return -1;
+	}
+	stream->write_index = sink.pos - stream->buffer;
+	if (stream->stdio_flush && flush(stream) == EOF) {
+		return -1;
 	}
 	return ret;
 }
@@ -379,26 +544,27 @@ vfprintf(FILE *restrict stream, const char *restrict fmt, va_list argp)
 int
 vsnprintf(char *restrict str, size_t n, const char *restrict fmt, va_list argp)
 {
-	global_idx = 0;
-	int idx =
-		__libc_vprintf_template(str == NULL ? null_string_putc : string_putc, NULL,
-	                          NULL, str, fmt, argp, n);
-	if (str != NULL) {
-		str[idx] = '\0';
+	// Leave room for the terminator; what does not fit is only counted.
+	struct printf_sink sink = {
+		.pos = str,
+		.room = (str == NULL || n == 0) ? 0 : n - 1,
+	};
+	int ret = __libc_vformat(&sink, fmt, argp);
+	if (str != NULL && n != 0) {
+		*sink.pos = '\0';
 	}
-	return idx;
+	return ret;
 }
+
 int
 vsprintf(char *restrict str, const char *restrict fmt, va_list argp)
 {
-	global_idx = 0;
-	int ret =
-		__libc_vprintf_template(string_putc, NULL, NULL, str, fmt, argp, SIZE_MAX);
-	if (str != NULL) {
-		str[ret] = '\0';
-	}
+	struct printf_sink sink = { .pos = str, .room = SIZE_MAX };
+	int ret = __libc_vformat(&sink, fmt, argp);
+	*sink.pos = '\0';
 	return ret;
 }
+
 int
 snprintf(char *restrict str, size_t n, const char *restrict fmt, ...)
 {
@@ -418,43 +584,18 @@ sprintf(char *restrict str, const char *restrict fmt, ...)
 	va_start(listp, fmt);
 	ret = vsprintf(str, fmt, listp);
 	va_end(listp);
-	if (str != NULL) {
-		str[ret] = '\0';
-	}
-	return ret;
-}
-
-int
-vfscanf(FILE *restrict stream, const char *restrict fmt, va_list argp)
-{
-	static char static_buffer[BUFSIZ];
-	global_idx_fgetc = 0;
-	return __libc_vprintf_template(static_fgetc, NULL, stream, static_buffer, fmt,
-	                               argp, -1);
-}
-
-int
-fscanf(FILE *restrict stream, const char *restrict fmt, ...)
-{
-	int ret;
-	va_list listp;
-	va_start(listp, fmt);
-	ret = vfscanf(stream, fmt, listp);
-	va_end(listp);
 	return ret;
 }
 
 /* This is only a temporary incomplete implementation. */
-int
-sscanf(const char *restrict str, const char *restrict fmt, ...)
+static int
+scan_string(const char *restrict str, const char *restrict fmt, va_list listp)
 {
 	int state = 0;
 	int count = 0;
 	size_t i = 0;
 	size_t j = 0;
 	size_t format_size = 0;
-	va_list listp;
-	va_start(listp, fmt);
 
 	while (str[i] != '\0' && fmt[j] != '\0') {
 		if (fmt[j] == '%') {
@@ -491,10 +632,44 @@ sscanf(const char *restrict str, const char *restrict fmt, ...)
 skip_str_forward:
 		j++;
 	}
-	va_end(listp);
 	return count;
 }
 
+int
+sscanf(const char *restrict str, const char *restrict fmt, ...)
+{
+	int ret;
+	va_list listp;
+	va_start(listp, fmt);
+	ret = scan_string(str, fmt, listp);
+	va_end(listp);
+	return ret;
+}
+
+// Scan one line of input. The line is read into a buffer of each
+// call's own, so nothing is shared between calls or threads.
+int
+vfscanf(FILE *restrict stream, const char *restrict fmt, va_list argp)
+{
+	char line[BUFSIZ];
+
+	if (fgets(line, sizeof(line), stream) == NULL) {
+		return EOF;
+	}
+	return scan_string(line, fmt, argp);
+}
+
+int
+fscanf(FILE *restrict stream, const char *restrict fmt, ...)
+{
+	int ret;
+	va_list listp;
+	va_start(listp, fmt);
+	ret = vfscanf(stream, fmt, listp);
+	va_end(listp);
+	return ret;
+}
+
 __attribute__((format(printf, 2, 3))) int
 fprintf(FILE *restrict stream, const char *restrict fmt, ...)
 {
@@ -506,19 +681,49 @@ fprintf(FILE *restrict stream, const char *restrict fmt, ...)
 	return ret;
 }
 
+// dprintf() formats into a buffer on the stack and writes it out when
+// full, so it neither allocates nor touches the caller's fd otherwise.
+struct fd_sink {
+	int fd;
+	char buf[256];
+};
+
+static bool
+fd_drain(struct printf_sink *sink)
+{
+	struct fd_sink *fs = sink->ctx;
+	size_t len = sink->pos - fs->buf;
+
+	for (size_t done = 0; done < len;) {
+		ssize_t n = write(fs->fd, fs->buf + done, len - done);
+		if (n <= 0) {
+			return false;
+		}
+		done += n;
+	}
+	sink->pos = fs->buf;
+	sink->room = sizeof(fs->buf);
+	return true;
+}
+
 int
 dprintf(int fd, const char *restrict fmt, ...)
 {
-	FILE *fp = fdopen(fd, "w");
-	if (fp == NULL) {
-		return -1;
-	}
+	struct fd_sink fs = { .fd = fd };
+	struct printf_sink sink = {
+		.pos = fs.buf,
+		.room = sizeof(fs.buf),
+		.drain = fd_drain,
+		.ctx = &fs,
+	};
 	int ret;
 	va_list listp;
 	va_start(listp, fmt);
-	ret = vfprintf(fp, fmt, listp);
+	ret = __libc_vformat(&sink, fmt, listp);
 	va_end(listp);
-	fclose(fp);
+	if (sink.drain == NULL || !fd_drain(&sink)) {
+		return -1;
+	}
 	return ret;
 }
 
@@ -542,28 +747,41 @@ printf(const char *restrict fmt, ...)
 int
 fputs(const char *restrict s, FILE *restrict stream)
 {
-	return fprintf(stream, "%s\n", s);
+	size_t len = strlen(s);
+	return fwrite(s, 1, len, stream) == len ? 0 : EOF;
 }
 
 int
 puts(const char *restrict s)
 {
-	return fputs(s, stdout);
+	if (fputs(s, stdout) == EOF || fputc('\n', stdout) == EOF) {
+		return EOF;
+	}
+	return 0;
 }
 
+// Use buf, or if that is NULL a buffer of n bytes we allocate, from
+// now on. n == 0 keeps the current size.
 int
 setvbuf(FILE *restrict stream, char *restrict buf, int modes, size_t n)
 {
-	if (__likely(buf != NULL)) {
-		fflush(stream);
-		stream->write_buffer = buf;
-		stream->write_buffer_size = n;
-	}
-	if (__unlikely(!(modes == _IOFBF || modes == _IOLBF || modes == _IONBF))) {
+	if (__unlikely(!(modes == _IOFBF || modes == _IOLBF || modes == _IONBF)) ||
+	    (buf != NULL && n == 0)) {
 		errno = EINVAL;
 		return -1;
 	}
+	if (buf != NULL || (n != 0 && n != stream->buffer_size)) {
+		fflush(stream);
+		if (stream->own_buffer) {
+			free(stream->buffer);
+		}
+		stream->buffer = buf;
+		stream->buffer_size = n;
+		stream->own_buffer = false;
+	}
 	stream->buffer_mode = modes;
+	// Only fully buffered streams may hold printf() output past the call.
+	stream->stdio_flush = modes != _IOFBF;
 	return 0;
 }
 
@@ -611,36 +829,100 @@ remove(const char *pathname)
 	return -1;
 }
 
+// Small writes are gathered in the buffer. Anything at least as big as
+// the buffer goes straight to write() once the buffer is flushed.
 size_t
 fwrite(const void *ptr, size_t size, size_t nmemb, FILE *restrict stream)
 {
-	size_t count = size * nmemb;
-	int fd = fileno(stream);
-	ssize_t ret = write(fd, ptr, count);
-	if (ret < 0) {
-		stream->error = true;
+	size_t count;
+
+	if (size == 0 || nmemb == 0 || ckd_mul(&count, size, nmemb)) {
+		return 0;
+	}
+	if (begin_write(stream) == EOF) {
 		return 0;
 	}
-	return ret / size;
+	if (count < stream->buffer_size && stream->buffer_mode != _IONBF) {
+		if (count > stream->buffer_size - stream->write_index &&
+		    flush(stream) == EOF) {
+			return 0;
+		}
+		memcpy(stream->buffer + stream->write_index, ptr, count);
+		stream->write_index += count;
+		if (stream->buffer_mode == _IOLBF && memchr(ptr, '\n', count) != NULL &&
+		    flush(stream) == EOF) {
+			return 0;
+		}
+		return nmemb;
+	}
+
+	if (flush(stream) == EOF) {
+		return 0;
+	}
+	size_t done = 0;
+	while (done < count) {
+		ssize_t n = write(stream->fd, (const char *)ptr + done, count - done);
+		if (n <= 0) {
+			stream->error = true;
+			break;
+		}
+		done += n;
+	}
+	return done / size;
 }
 
+// Serve what we can from the buffer. The rest is read straight into
+// ptr if it would not fit in the buffer anyway, and through the buffer
+// otherwise.
 size_t
 fread(void *ptr, size_t size, size_t nmemb, FILE *restrict stream)
 {
-	size_t count = size * nmemb;
-	int fd = fileno(stream);
-	ssize_t ret = read(fd, ptr, count);
-	if (ret < 0) {
-		stream->error = true;
+	size_t count;
+	char *dst = ptr;
+	size_t done = 0;
+
+	if (size == 0 || nmemb == 0 || ckd_mul(&count, size, nmemb)) {
 		return 0;
 	}
-	return ret / size;
+	while (done < count) {
+		size_t avail = stream->read_end - stream->read_pos;
+		if (avail != 0) {
+			size_t n = min(avail, count - done);
+			memcpy(dst + done, stream->buffer + stream->read_pos, n);
+			stream->read_pos += n;
+			done += n;
+			continue;
+		}
+		if (count - done >= stream->buffer_size) {
+			if (stream->write_index != 0 && flush(stream) == EOF) {
+				break;
+			}
+			ssize_t n = read(stream->fd, dst + done, count - done);
+			if (n <= 0) {
+				if (n == 0) {
+					stream->eof = true;
+				} else {
+					stream->error = true;
+				}
+				break;
+			}
+			done += n;
+		} else if (fill(stream) == EOF) {
+			break;
+		}
+	}
+	return done / size;
 }
 
 long
 ftell(FILE *stream)
 {
-	return lseek(stream->fd, 0L, SEEK_CUR);
+	off_t pos = lseek(stream->fd, 0L, SEEK_CUR);
+	if (pos < 0) {
+		return -1;
+	}
+	return pos - (off_t)(stream->read_end - stream->read_pos) +
+	       (off_t)stream->write_index;
 }
 
 void
@@ -653,8 +935,17 @@ rewind(FILE *stream)
 int
 fseek(FILE *stream, long offset, int whence)
 {
+	if (flush(stream) == EOF) {
+		return -1;
+	}
+	// SEEK_CUR is relative to where the caller is, not to how far
+	// ahead we have read.
+	if (whence == SEEK_CUR) {
+		offset -= stream->read_end - stream->read_pos;
+	}
+	stream->read_pos = stream->read_end = 0;
 	clearerr(stream);
-	return lseek(stream->fd, offset, whence);
+	return lseek(stream->fd, offset, whence) < 0 ? -1 : 0;
 }
 
 char *
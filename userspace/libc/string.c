@@ -99,16 +99,6 @@ strcasecmp(const char *p, const char *q)
 	return (uint8_t)*p - (uint8_t)*q;
 }
 
-size_t
-strlen(const char *s)
-{
-	size_t n;
-
-	for (n = 0; s[n]; n++)
-		;
-	return n;
-}
-
 size_t
 strnlen(const char *s, size_t size)
 {
@@ -128,17 +118,6 @@ strchr(const char *s, int c)
 	return memchr(s, c, strlen(s) + 1);
 }
 
-void *
-memchr(const void *s, int c, size_t n)
-{
-	for (size_t i = 0; i < n; i++) {
-		if (((const char *)s)[i] == c) {
-			return (void *)s + i;
-		}
-	}
-	return NULL;
-}
-
 void *
 memrchr(const void *s, int c, size_t n)
 {
@@ -235,35 +214,6 @@ strtok(char *restrict str, const char *restrict delim)
 	return strtok_r(str, delim, &__strtok_token);
 }
 
-void *
-memset(void *dst, int c, size_t n)
-{
-	for (size_t i = 0; i < n; i++) {
-		((char *)dst)[i] = c;
-	}
-	return dst;
-}
-
-int
-memcmp(const void *v1, const void *v2, size_t n)
-{
-	const uint8_t *dst, *s2;
-	if (__unlikely(n == 0)) {
-		return 0;
-	}
-
-	dst = v1;
-	s2 = v2;
-	while (n-- > 0) {
-		if (*dst != *s2) {
-			return *dst - *s2;
-		}
-		dst++, s2++;
-	}
-
-	return 0;
-}
-
 // Based on code from https://libc11.org/string/memmove.html (public domain)
 void *
 memmove(void *dst, const void *src, size_t n)
@@ -302,15 +252,6 @@ mempcpy(void *dst, const void *src, size_t n)
 	return memcpy(dst, src, n) + n;
 }
 
-void *
-memcpy(void *dst, const void *src, size_t n)
-{
-	for (size_t i = 0; i < n; i++) {
-		((char *)dst)[i] = ((char *)src)[i];
-	}
-	return dst;
-}
-
 char *
 stpcpy(char *restrict dst, const char *restrict src)
 {
@@ -0,0 +1,432 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+// memcpy(), memset(), memcmp(), strlen() and memchr() using SSE2 and
+// AVX2. Userspace is built for plain x86-64, so each version asks the
+// compiler for its instruction set, and __libc_init_string() points
+// the public functions at the best one the CPU and kernel support.
+//
+// strlen() and memchr() read whole aligned blocks, which may go past
+// the end of the string but never into the next page.
+#include <__intrinsics.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+typedef char v16 __attribute__((vector_size(16)));
+typedef char v16u __attribute__((vector_size(16), aligned(1), may_alias));
+typedef char v32 __attribute__((vector_size(32)));
+typedef char v32u __attribute__((vector_size(32), aligned(1), may_alias));
+typedef uint64_t u64u __attribute__((aligned(1), may_alias));
+typedef uint32_t u32u __attribute__((aligned(1), may_alias));
+typedef uint16_t u16u __attribute__((aligned(1), may_alias));
+
+// Bit i is set if byte i of a and b are equal.
+static inline SSE2 uint32_t
+eq_mask16(v16 a, v16 b)
+{
+	return (uint32_t)__builtin_ia32_pmovmskb128((v16)(a == b));
+}
+
+static inline AVX2 uint32_t
+eq_mask32(v32 a, v32 b)
+{
+	return (uint32_t)__builtin_ia32_pmovmskb256((v32)(a == b));
+}
+
+// Copy fewer than 16 bytes with at most two overlapping moves, so
+// there is no loop for the compiler to turn back into a memcpy() call.
+static inline void
+copy_small(char *d, const char *s, size_t n)
+{
+	if (n >= 8) {
+		uint64_t a = *(const u64u *)s, b = *(const u64u *)(s + n - 8);
+		*(u64u *)d = a;
+		*(u64u *)(d + n - 8) = b;
+	} else if (n >= 4) {
+		uint32_t a = *(const u32u *)s, b = *(const u32u *)(s + n - 4);
+		*(u32u *)d = a;
+		*(u32u *)(d + n - 4) = b;
+	} else if (n >= 2) {
+		uint16_t a = *(const u16u *)s, b = *(const u16u *)(s + n - 2);
+		*(u16u *)d = a;
+		*(u16u *)(d + n - 2) = b;
+	} else if (n == 1) {
+		*d = *s;
+	}
+}
+
+static inline void
+set_small(char *d, uint8_t c, size_t n)
+{
+	uint64_t v = c * 0x0101010101010101ULL;
+	if (n >= 8) {
+		*(u64u *)d = v;
+		*(u64u *)(d + n - 8) = v;
+	} else if (n >= 4) {
+		*(u32u *)d = (uint32_t)v;
+		*(u32u *)(d + n - 4) = (uint32_t)v;
+	} else if (n >= 2) {
+		*(u16u *)d = (uint16_t)v;
+		*(u16u *)(d + n - 2) = (uint16_t)v;
+	} else if (n == 1) {
+		*d = c;
+	}
+}
+
+// 16 to 32 bytes: the first and last 16, which may overlap.
+static inline SSE2 void
+copy_16_32(char *d, const char *s, size_t n)
+{
+	v16 a = *(const v16u *)s, b = *(const v16u *)(s + n - 16);
+	*(v16u *)d = a;
+	*(v16u *)(d + n - 16) = b;
+}
+
+static SSE2 void *
+memcpy_sse2(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+	const char *s = src;
+
+	if (n < 16) {
+		copy_small(d, s, n);
+		return dst;
+	}
+	if (n <= 32) {
+		copy_16_32(d, s, n);
+		return dst;
+	}
+	// Load both ends first, then fill in the middle with aligned
+	// stores. The ends cover whatever the loop leaves over.
+	v16 head = *(const v16u *)s;
+	v16 tail = *(const v16u *)(s + n - 16);
+	size_t i = 16 - ((uintptr_t)d & 15);
+	for (; i + 64 < n - 16; i += 64) {
+		v16 a = *(const v16u *)(s + i), b = *(const v16u *)(s + i + 16);
+		v16 c = *(const v16u *)(s + i + 32), e = *(const v16u *)(s + i + 48);
+		*(v16 *)(d + i) = a;
+		*(v16 *)(d + i + 16) = b;
+		*(v16 *)(d + i + 32) = c;
+		*(v16 *)(d + i + 48) = e;
+	}
+	for (; i < n - 16; i += 16) {
+		*(v16 *)(d + i) = *(const v16u *)(s + i);
+	}
+	*(v16u *)d = head;
+	*(v16u *)(d + n - 16) = tail;
+	return dst;
+}
+
+static AVX2 void *
+memcpy_avx2(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+	const char *s = src;
+
+	if (n < 16) {
+		copy_small(d, s, n);
+		return dst;
+	}
+	if (n <= 32) {
+		copy_16_32(d, s, n);
+		return dst;
+	}
+	if (n <= 64) {
+		v32 a = *(const v32u *)s, b = *(const v32u *)(s + n - 32);
+		*(v32u *)d = a;
+		*(v32u *)(d + n - 32) = b;
+		return dst;
+	}
+	v32 head = *(const v32u *)s;
+	v32 tail = *(const v32u *)(s + n - 32);
+	size_t i = 32 - ((uintptr_t)d & 31);
+	for (; i + 128 < n - 32; i += 128) {
+		v32 a = *(const v32u *)(s + i), b = *(const v32u *)(s + i + 32);
+		v32 c = *(const v32u *)(s + i + 64), e = *(const v32u *)(s + i + 96);
+		*(v32 *)(d + i) = a;
+		*(v32 *)(d + i + 32) = b;
+		*(v32 *)(d + i + 64) = c;
+		*(v32 *)(d + i + 96) = e;
+	}
+	for (; i < n - 32; i += 32) {
+		*(v32 *)(d + i) = *(const v32u *)(s + i);
+	}
+	*(v32u *)d = head;
+	*(v32u *)(d + n - 32) = tail;
+	return dst;
+}
+
+static SSE2 void *
+memset_sse2(void *dst, int c, size_t n)
+{
+	char *d = dst;
+
+	if (n < 16) {
+		set_small(d, (uint8_t)c, n);
+		return dst;
+	}
+	v16 v = (v16){} + (char)c;
+	*(v16u *)d = v;
+	*(v16u *)(d + n - 16) = v;
+	for (size_t i = 16 - ((uintptr_t)d & 15); i < n - 16; i += 16) {
+		*(v16 *)(d + i) = v;
+	}
+	return dst;
+}
+
+static AVX2 void *
+memset_avx2(void *dst, int c, size_t n)
+{
+	char *d = dst;
+
+	if (n < 32) {
+		return memset_sse2(dst, c, n);
+	}
+	v32 v = (v32){} + (char)c;
+	*(v32u *)d = v;
+	*(v32u *)(d + n - 32) = v;
+	size_t i = 32 - ((uintptr_t)d & 31);
+	for (; i + 64 < n - 32; i += 64) {
+		*(v32 *)(d + i) = v;
+		*(v32 *)(d + i + 32) = v;
+	}
+	for (; i < n - 32; i += 32) {
+		*(v32 *)(d + i) = v;
+	}
+	return dst;
+}
+
+static inline int
+byte_diff(const char *a, const char *b, uint32_t i)
+{
+	return (uint8_t)a[i] - (uint8_t)b[i];
+}
+
+static SSE2 int
+memcmp_sse2(const void *v1, const void *v2, size_t n)
+{
+	const char *a = v1, *b = v2;
+
+	if (n < 16) {
+		for (size_t i = 0; i < n; i++) {
+			if (a[i] != b[i]) {
+				return byte_diff(a, b, i);
+			}
+		}
+		return 0;
+	}
+	// The last block may overlap the one before it, which is fine
+	// because those bytes already compared equal.
+	for (size_t i = 0;; i += 16) {
+		if (i > n - 16) {
+			i = n - 16;
+		}
+		uint32_t m = eq_mask16(*(const v16u *)(a + i), *(const v16u *)(b + i));
+		if (m != 0xffff) {
+			return byte_diff(a + i, b + i, __builtin_ctz(~m));
+		}
+		if (i == n - 16) {
+			return 0;
+		}
+	}
+}
+
+static AVX2 int
+memcmp_avx2(const void *v1, const void *v2, size_t n)
+{
+	const char *a = v1, *b = v2;
+
+	if (n < 32) {
+		return memcmp_sse2(v1, v2, n);
+	}
+	for (size_t i = 0;; i += 32) {
+		if (i > n - 32) {
+			i = n - 32;
+		}
+		uint32_t m = eq_mask32(*(const v32u *)(a + i), *(const v32u *)(b + i));
+		if (m != 0xffffffff) {
+			return byte_diff(a + i, b + i, __builtin_ctz(~m));
+		}
+		if (i == n - 32) {
+			return 0;
+		}
+	}
+}
+
+static SSE2 size_t
+strlen_sse2(const char *s)
+{
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+	uint32_t m = eq_mask16(*(const v16 *)p, (v16){}) >> (s - p);
+
+	if (m != 0) {
+		return __builtin_ctz(m);
+	}
+	for (;;) {
+		p += 16;
+		if ((m = eq_mask16(*(const v16 *)p, (v16){})) != 0) {
+			return p + __builtin_ctz(m) - s;
+		}
+	}
+}
+
+static AVX2 size_t
+strlen_avx2(const char *s)
+{
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+	uint32_t m = eq_mask32(*(const v32 *)p, (v32){}) >> (s - p);
+
+	if (m != 0) {
+		return __builtin_ctz(m);
+	}
+	for (;;) {
+		p += 32;
+		if ((m = eq_mask32(*(const v32 *)p, (v32){})) != 0) {
+			return p + __builtin_ctz(m) - s;
+		}
+	}
+}
+
+// n counts down instead of computing an end pointer, since callers may
+// pass SIZE_MAX to mean "until you find it".
+static SSE2 void *
+memchr_sse2(const void *src, int c, size_t n)
+{
+	const char *s = src;
+	v16 v = (v16){} + (char)c;
+
+	if (n == 0) {
+		return NULL;
+	}
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+	size_t off = s - p;
+	uint32_t m = eq_mask16(*(const v16 *)p, v) >> off;
+	if (m != 0) {
+		return __builtin_ctz(m) < n ? (void *)(s + __builtin_ctz(m)) : NULL;
+	}
+	if (n <= 16 - off) {
+		return NULL;
+	}
+	n -= 16 - off;
+	for (;;) {
+		p += 16;
+		if ((m = eq_mask16(*(const v16 *)p, v)) != 0) {
+			return __builtin_ctz(m) < n ? (void *)(p + __builtin_ctz(m)) : NULL;
+		}
+		if (n <= 16) {
+			return NULL;
+		}
+		n -= 16;
+	}
+}
+
+static AVX2 void *
+memchr_avx2(const void *src, int c, size_t n)
+{
+	const char *s = src;
+	v32 v = (v32){} + (char)c;
+
+	if (n == 0) {
+		return NULL;
+	}
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+	size_t off = s - p;
+	uint32_t m = eq_mask32(*(const v32 *)p, v) >> off;
+	if (m != 0) {
+		return __builtin_ctz(m) < n ? (void *)(s + __builtin_ctz(m)) : NULL;
+	}
+	if (n <= 32 - off) {
+		return NULL;
+	}
+	n -= 32 - off;
+	for (;;) {
+		p += 32;
+		if ((m = eq_mask32(*(const v32 *)p, v)) != 0) {
+			return __builtin_ctz(m) < n ? (void *)(p + __builtin_ctz(m)) : NULL;
+		}
+		if (n <= 32) {
+			return NULL;
+		}
+		n -= 32;
+	}
+}
+
+// Every x86-64 CPU has SSE2, so that is what we use until
+// __libc_init_string() has had a look.
+static void *(*memcpy_impl)(void *, const void *, size_t) = memcpy_sse2;
+static void *(*memset_impl)(void *, int, size_t) = memset_sse2;
+static int (*memcmp_impl)(const void *, const void *, size_t) = memcmp_sse2;
+static size_t (*strlen_impl)(const char *) = strlen_sse2;
+static void *(*memchr_impl)(const void *, int, size_t) = memchr_sse2;
+
+// AVX2 needs the CPU to have it, and the kernel to save the YMM
+// registers across context switches, which it says by setting XCR0.
+static bool
+have_avx2(void)
+{
+	uint32_t a, b, c, d;
+
+	cpuid(0, 0, &a, &b, &c, &d);
+	if (a < 7) {
+		return false;
+	}
+	cpuid(1, 0, &a, &b, &c, &d);
+	// OSXSAVE and AVX.
+	if ((c & (1 << 27)) == 0 || (c & (1 << 28)) == 0) {
+		return false;
+	}
+	// SSE and AVX state enabled.
+	if ((xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	cpuid(7, 0, &a, &b, &c, &d);
+	return (b & (1 << 5)) != 0;
+}
+
+void
+__libc_init_string(void)
+{
+	if (have_avx2()) {
+		memcpy_impl = memcpy_avx2;
+		memset_impl = memset_avx2;
+		memcmp_impl = memcmp_avx2;
+		strlen_impl = strlen_avx2;
+		memchr_impl = memchr_avx2;
+	}
+}
+
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	return memcpy_impl(dst, src, n);
+}
+
+void *
+memset(void *dst, int c, size_t n)
+{
+	return memset_impl(dst, c, n);
+}
+
+int
+memcmp(const void *v1, const void *v2, size_t n)
+{
+	return memcmp_impl(v1, v2, n);
+}
+
+size_t
+strlen(const char *s)
+{
+	return strlen_impl(s);
+}
+
+void *
+memchr(const void *s, int c, size_t n)
+{
+	return memchr_impl(s, c, n);
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+int
+epoll_create(int size)
+{
+	// The size hint is obsolete, but still has to be positive.
+	if (size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return epoll_create1(0);
+}
+
+int
+epoll_create1(int flags)
+{
+	return __syscall_ret(__syscall1(SYS_epoll_create1, flags));
+}
+
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	return __syscall_ret(__syscall4(SYS_epoll_ctl, epfd, op, fd, (long)event));
+}
+
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	return __syscall_ret(
+		__syscall4(SYS_epoll_wait, epfd, (long)events, maxevents, timeout));
+}
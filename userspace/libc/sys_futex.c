@@ -0,0 +1,16 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <stdint.h>
+#include <sys/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+int
+futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+	return __syscall_ret(__syscall4(SYS_futex, (long)uaddr, op, val,
+	                                (long)timeout));
+}
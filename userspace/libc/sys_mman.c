@@ -3,6 +3,7 @@
  * Copyright (c) 2025 Connor-GH. All Rights Reserved.
  */
 #include "libc_syscalls.h"
+#include <errno.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
 
@@ -18,3 +19,35 @@ munmap(void *addr, size_t length)
 {
 	return __syscall_ret(__syscall2(SYS_munmap, (long)addr, length));
 }
+
+int
+mprotect(void *addr, size_t length, int prot)
+{
+	return __syscall_ret(__syscall3(SYS_mprotect, (long)addr, length, prot));
+}
+
+int
+msync(void *addr, size_t length, int flags)
+{
+	return __syscall_ret(__syscall3(SYS_msync, (long)addr, length, flags));
+}
+
+int
+madvise(void *addr, size_t length, int advice)
+{
+	return __syscall_ret(__syscall3(SYS_madvise, (long)addr, length, advice));
+}
+
+int
+posix_madvise(void *addr, size_t length, int advice)
+{
+	// POSIX_MADV_DONTNEED may not throw away data, and MADV_DONTNEED
+	// does, so leave the pages be.
+	if (advice == POSIX_MADV_DONTNEED) {
+		return 0;
+	}
+	if (madvise(addr, length, advice) < 0) {
+		return errno;
+	}
+	return 0;
+}
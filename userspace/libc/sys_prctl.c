@@ -0,0 +1,13 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+int
+arch_prctl(int code, unsigned long addr)
+{
+	return __syscall_ret(__syscall2(SYS_arch_prctl, code, addr));
+}
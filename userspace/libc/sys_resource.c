@@ -0,0 +1,13 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+int
+getrusage(int who, struct rusage *usage)
+{
+	return __syscall_ret(__syscall2(SYS_getrusage, who, (long)usage));
+}
@@ -0,0 +1,15 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Connor-GH. All Rights Reserved.
+ */
+#include "libc_syscalls.h"
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+ssize_t
+sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	return __syscall_ret(
+		__syscall4(SYS_sendfile, out_fd, in_fd, (long)offset, count));
+}
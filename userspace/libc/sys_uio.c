@@ -7,8 +7,28 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 
+ssize_t
+readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	return __syscall_ret(__syscall3(SYS_readv, fd, (long)iov, iovcnt));
+}
+
 ssize_t
 writev(int fd, const struct iovec *iov, int iovcnt)
 {
 	return __syscall_ret(__syscall3(SYS_writev, fd, (long)iov, iovcnt));
 }
+
+ssize_t
+preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	return __syscall_ret(
+		__syscall4(SYS_preadv, fd, (long)iov, iovcnt, (long)offset));
+}
+
+ssize_t
+pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	return __syscall_ret(
+		__syscall4(SYS_pwritev, fd, (long)iov, iovcnt, (long)offset));
+}
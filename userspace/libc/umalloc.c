@@ -1,85 +1,241 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdckdint.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/param.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// A segregated size-class allocator.
+//
+// Every block starts with a 16-byte header. Requests up to
+// MMAP_THRESHOLD are rounded up to one of NCLASSES size classes, and
+// each class keeps a LIFO list of its free blocks, so both malloc() and
+// free() are O(1): pop a block off the list, or carve a new one from
+// the current arena. Arenas are mmap()ed chunks (or sbrk()ed ones, if
+// mmap() fails) that only ever get carved up, never given back.
+//
+// Anything bigger than MMAP_THRESHOLD gets its own mapping, which
+// free() unmaps again.
+//
+// Set MALLOC_STATS in the environment to get malloc_stats() at exit.
+
+#define ALIGNMENT 16
+#define MMAP_THRESHOLD (128 * 1024)
+// Arenas start small, so that small programs stay small, and double
+// in size up to ARENA_MAX.
+#define ARENA_MIN (64 * 1024)
+#define ARENA_MAX (1024 * 1024)
+
+// 16..128 in steps of 16, then four classes per power of two up to
+// MMAP_THRESHOLD.
+#define NCLASSES 48
+
+// Values of header.cls that are not size classes.
+#define CLASS_MMAP 0xffff // Has its own mapping.
+#define CLASS_LARGE 0xfffe // Too big for a class, but mmap() failed.
+#define CLASS_ALIGNED 0xfffd // Points into another block; see aligned_alloc().
+
+#define HEADER_MAGIC 0x6d616c6cU // "mall"
+#define FREED_MAGIC 0x66726565U // "free"
 
 struct header {
-	struct header *ptr;
+	uint32_t magic;
+	uint32_t cls;
+	// Usable bytes after the header. For CLASS_ALIGNED, how far this
+	// header is past the start of the block it points into.
 	size_t size;
-} __attribute__((aligned(8)));
+} __attribute__((aligned(ALIGNMENT)));
 
-typedef struct header Header;
+// A free block keeps the next pointer in its first usable bytes.
+struct free_block {
+	struct free_block *next;
+};
 
-static Header base = { NULL, 0 };
-static Header *freep = NULL;
+#define ptr_to_header(ptr) (((struct header *)(ptr)) - 1)
+#define header_to_ptr(hdr) ((void *)((hdr) + 1))
+#define round_up(x, to) (((x) + (to) - 1) & ~((size_t)(to) - 1))
 
-#define ptr_to_header(ptr) (((Header *)ptr) - 1)
-#define header_to_ptr(hdr) ((void *)(hdr + 1))
+static pthread_mutex_t malloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized = false;
 
-// Undefined behavior:
-// - the pointer we are handed is not from {re,m}alloc.
-// - the pointer is from {re,m}alloc, but has been free()'d
-void
-free(void *ap)
+static struct free_block *free_lists[NCLASSES];
+// Freed CLASS_LARGE blocks. Only used when the process is out of
+// mappings, so a first-fit walk is fine.
+static struct free_block *large_list = NULL;
+
+static char *arena_cur = NULL;
+static char *arena_end = NULL;
+static size_t arena_next_size = ARENA_MIN;
+
+static struct malloc_counts {
+	size_t allocs[NCLASSES];
+	size_t frees[NCLASSES];
+	size_t mmap_allocs;
+	size_t mmap_frees;
+	size_t mmap_bytes; // Currently mapped for big blocks.
+	size_t large_allocs; // CLASS_LARGE fallbacks.
+	size_t arena_mmap_bytes;
+	size_t arena_sbrk_bytes;
+	size_t realloc_in_place;
+	size_t realloc_copied;
+} stats;
+
+static unsigned int
+size_to_class(size_t n)
 {
-	Header *bp, *p;
+	if (n <= 128) {
+		return n == 0 ? 0 : (n - 1) / 16;
+	}
+	// For n in (2^k, 2^(k+1)], the classes are 2^(k-2) apart.
+	unsigned int k = 63 - __builtin_clzl(n - 1);
+	size_t step = (size_t)1 << (k - 2);
+	return 8 + (k - 7) * 4 + (n - 1 - ((size_t)1 << k)) / step;
+}
 
-	// C spec: "If ptr is a null pointer, no action occurs".
-	if (ap == NULL) {
+static size_t
+class_to_size(unsigned int c)
+{
+	if (c < 8) {
+		return (c + 1) * 16;
+	}
+	unsigned int k = 7 + (c - 8) / 4;
+	return ((size_t)1 << k) + ((c - 8) % 4 + 1) * ((size_t)1 << (k - 2));
+}
+
+static void
+guard_check(const struct header *h, const char *func)
+{
+#ifdef __RELIX_MEMORY_GUARDS__
+	if (h->magic == HEADER_MAGIC) {
 		return;
 	}
+	fprintf(stderr, "%s(): %s %p\n", func,
+	        h->magic == FREED_MAGIC ? "double free of" : "invalid pointer",
+	        header_to_ptr(h));
+	abort();
+#endif
+}
 
-	bp = (Header *)ap - 1;
-	for (p = freep; !(bp > p && bp < p->ptr); p = p->ptr) {
-		if (p >= p->ptr && (bp > p || bp < p->ptr)) {
-			break;
+static void
+push_free(unsigned int c, struct header *h)
+{
+	struct free_block *b = header_to_ptr(h);
+	h->magic = FREED_MAGIC;
+	b->next = free_lists[c];
+	free_lists[c] = b;
+}
+
+// Get a fresh arena of at least need bytes. malloc_lock must be held.
+static bool
+arena_grow(size_t need)
+{
+	// Hand out what is left of the old arena before leaving it behind.
+	while (arena_end - arena_cur >= (ptrdiff_t)(sizeof(struct header) + 16)) {
+		size_t room = arena_end - arena_cur - sizeof(struct header);
+		unsigned int c = room > MMAP_THRESHOLD ? NCLASSES - 1 : size_to_class(room);
+		if (class_to_size(c) > room) {
+			c--;
 		}
+		struct header *h = (struct header *)arena_cur;
+		h->cls = c;
+		h->size = class_to_size(c);
+		arena_cur += sizeof(struct header) + h->size;
+		push_free(c, h);
 	}
 
-	if (bp + bp->size == p->ptr) {
-		bp->size += p->ptr->size;
-		bp->ptr = p->ptr->ptr;
+	size_t len = round_up(need > arena_next_size ? need : arena_next_size,
+	                      PAGE_SIZE);
+	char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+	if (p != MMAP_FAILED) {
+		stats.arena_mmap_bytes += len;
 	} else {
-		bp->ptr = p->ptr;
+		// Out of mappings, probably. The break is not necessarily aligned.
+		if ((p = sbrk(len + ALIGNMENT)) == (char *)-1) {
+			return false;
+		}
+		p = (char *)round_up((uintptr_t)p, ALIGNMENT);
+		stats.arena_sbrk_bytes += len;
 	}
-	if (p + p->size == bp) {
-		p->size += bp->size;
-		p->ptr = bp->ptr;
-	} else {
-		p->ptr = bp;
+	if (arena_next_size < ARENA_MAX) {
+		arena_next_size *= 2;
 	}
-	freep = p;
+	arena_cur = p;
+	arena_end = p + len;
+	return true;
 }
 
-#define MORECORE_THRESHOLD 4096
-// "nu" is "number of units".
-//
-static Header *
-allocate_units(size_t nu)
+// Carve a block with size usable bytes off the arena.
+// malloc_lock must be held.
+static struct header *
+arena_carve(size_t size)
+{
+	size_t total = sizeof(struct header) + size;
+	if (arena_end - arena_cur < (ptrdiff_t)total && !arena_grow(total)) {
+		return NULL;
+	}
+	struct header *h = (struct header *)arena_cur;
+	arena_cur += total;
+	h->size = size;
+	return h;
+}
+
+static void
+malloc_init(void)
+{
+	initialized = true;
+	if (getenv("MALLOC_STATS") != NULL) {
+		atexit(malloc_stats);
+	}
+}
+
+static void *
+large_alloc(size_t nbytes)
 {
-	char *p;
-	Header *hp;
+	struct header *h;
+	size_t len;
 
-	if (nu < MORECORE_THRESHOLD) {
-		nu = MORECORE_THRESHOLD;
+	if (ckd_add(&len, nbytes, sizeof(struct header) + PAGE_SIZE - 1)) {
+		return NULL;
+	}
+	len &= ~((size_t)PAGE_SIZE - 1);
+	h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+	if (h != MMAP_FAILED) {
+		h->magic = HEADER_MAGIC;
+		h->cls = CLASS_MMAP;
+		h->size = len - sizeof(struct header);
+		pthread_mutex_lock(&malloc_lock);
+		stats.mmap_allocs++;
+		stats.mmap_bytes += len;
+		pthread_mutex_unlock(&malloc_lock);
+		return header_to_ptr(h);
 	}
-	// TODO this will be uncommented when the full
-	// sbrk->mmap migration is complete.
-	// p = mmap(NULL, nu * sizeof(Header), PROT_READ | PROT_WRITE, MAP_ANONYMOUS,
-	// -1, 0);
-	p = sbrk(nu * sizeof(Header));
-	if (p == (char *)-1) {
+
+	// Fall back to the arenas, reusing an old block if one fits.
+	pthread_mutex_lock(&malloc_lock);
+	h = NULL;
+	for (struct free_block **bp = &large_list; *bp != NULL;
+	     bp = &(*bp)->next) {
+		if (ptr_to_header(*bp)->size >= nbytes) {
+			h = ptr_to_header(*bp);
+			*bp = (*bp)->next;
+			break;
+		}
+	}
+	if (h == NULL && (h = arena_carve(round_up(nbytes, ALIGNMENT))) == NULL) {
+		pthread_mutex_unlock(&malloc_lock);
 		return NULL;
 	}
-	hp = (Header *)p;
-	hp->size = nu;
-	free((void *)(hp + 1));
-	return freep;
+	h->magic = HEADER_MAGIC;
+	h->cls = CLASS_LARGE;
+	stats.large_allocs++;
+	pthread_mutex_unlock(&malloc_lock);
+	return header_to_ptr(h);
 }
 
 // Undefined behavior:
@@ -87,41 +243,86 @@ allocate_units(size_t nu)
 __attribute__((malloc)) void *
 malloc(size_t nbytes)
 {
-	Header *p, *prevp;
-	size_t nunits;
 	if (nbytes == 0) {
 		return NULL;
 	}
-	nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
-	// There is no free list yet, so we need to make one.
-	if ((prevp = freep) == NULL) {
-		base.ptr = freep = prevp = &base;
-		base.size = 0;
-	}
-	for (p = prevp->ptr;; prevp = p, p = p->ptr) {
-		// This pointer size (p->size) is big enough.
-		if (p->size >= nunits) {
-			// The rare case where it is exactly big enough.
-			if (p->size == nunits) {
-				prevp->ptr = p->ptr;
-			} else {
-				// Use the end part of p for nunits storage.
-				// memory: [| ... ... ... ]
-				//          ^~~ p pointer
-				// 				 [ ... ... | ]
-				//    p += p->size ~~^
-				p->size -= nunits;
-				p += p->size;
-				p->size = nunits;
-			}
-			freep = prevp;
-			return (void *)(p + 1);
-		}
-		if (p == freep) {
-			if ((p = allocate_units(nunits)) == NULL) {
-				return NULL;
-			}
-		}
+	if (!initialized) {
+		malloc_init();
+	}
+	if (nbytes > MMAP_THRESHOLD) {
+		return large_alloc(nbytes);
+	}
+
+	unsigned int c = size_to_class(nbytes);
+	struct header *h;
+
+	pthread_mutex_lock(&malloc_lock);
+	if (free_lists[c] != NULL) {
+		h = ptr_to_header(free_lists[c]);
+		free_lists[c] = free_lists[c]->next;
+	} else if ((h = arena_carve(class_to_size(c))) == NULL) {
+		pthread_mutex_unlock(&malloc_lock);
+		return NULL;
+	}
+	h->magic = HEADER_MAGIC;
+	h->cls = c;
+	stats.allocs[c]++;
+	pthread_mutex_unlock(&malloc_lock);
+	return header_to_ptr(h);
+}
+
+// How many bytes of the block at ptr can be used.
+static size_t
+usable_size(void *ptr)
+{
+	struct header *h = ptr_to_header(ptr);
+	if (h->cls == CLASS_ALIGNED) {
+		return usable_size((char *)ptr - h->size) - h->size;
+	}
+	return h->size;
+}
+
+// Undefined behavior:
+// - the pointer we are handed is not from {re,m}alloc.
+// - the pointer is from {re,m}alloc, but has been free()'d
+void
+free(void *ap)
+{
+	// C spec: "If ptr is a null pointer, no action occurs".
+	if (ap == NULL) {
+		return;
+	}
+
+	struct header *h = ptr_to_header(ap);
+	guard_check(h, "free");
+	switch (h->cls) {
+	case CLASS_ALIGNED:
+		h->magic = FREED_MAGIC;
+		free((char *)ap - h->size);
+		return;
+	case CLASS_MMAP: {
+		size_t len = h->size + sizeof(struct header);
+		h->magic = FREED_MAGIC;
+		munmap(h, len);
+		pthread_mutex_lock(&malloc_lock);
+		stats.mmap_frees++;
+		stats.mmap_bytes -= len;
+		pthread_mutex_unlock(&malloc_lock);
+		return;
+	}
+	case CLASS_LARGE:
+		pthread_mutex_lock(&malloc_lock);
+		h->magic = FREED_MAGIC;
+		((struct free_block *)ap)->next = large_list;
+		large_list = ap;
+		pthread_mutex_unlock(&malloc_lock);
+		return;
+	default:
+		pthread_mutex_lock(&malloc_lock);
+		stats.frees[h->cls]++;
+		push_free(h->cls, h);
+		pthread_mutex_unlock(&malloc_lock);
+		return;
 	}
 }
 
@@ -138,12 +339,33 @@ realloc(void *ptr, size_t size)
 		return malloc(size);
 	}
 
-	Header *old_ptr_hdr = ptr_to_header(ptr);
-
-	size_t old_size = old_ptr_hdr->size * sizeof(Header);
+	struct header *h = ptr_to_header(ptr);
+	guard_check(h, "realloc");
+	size_t old_size = usable_size(ptr);
 	if (old_size >= size) {
 		return ptr;
 	}
+
+	// If this was the last block carved off the arena, it can grow into
+	// the rest of the arena by moving up a few classes.
+	if (h->cls < NCLASSES && size <= MMAP_THRESHOLD) {
+		unsigned int c = size_to_class(size);
+		size_t extra = class_to_size(c) - h->size;
+		pthread_mutex_lock(&malloc_lock);
+		if ((char *)ptr + h->size == arena_cur &&
+		    arena_end - arena_cur >= (ptrdiff_t)extra) {
+			arena_cur += extra;
+			stats.frees[h->cls]++;
+			stats.allocs[c]++;
+			stats.realloc_in_place++;
+			h->cls = c;
+			h->size = class_to_size(c);
+			pthread_mutex_unlock(&malloc_lock);
+			return ptr;
+		}
+		pthread_mutex_unlock(&malloc_lock);
+	}
+
 	void *new_ptr = malloc(size);
 
 	// C spec:
@@ -157,6 +379,9 @@ realloc(void *ptr, size_t size)
 	}
 	memcpy(new_ptr, ptr, old_size);
 	free(ptr);
+	pthread_mutex_lock(&malloc_lock);
+	stats.realloc_copied++;
+	pthread_mutex_unlock(&malloc_lock);
 	return new_ptr;
 }
 
@@ -180,3 +405,89 @@ calloc(size_t nmemb, size_t sz)
 	memset(ptr, 0, res);
 	return ptr;
 }
+
+// Every block is already ALIGNMENT-aligned. For more than that,
+// allocate enough to find an aligned spot inside a bigger block, and
+// put a CLASS_ALIGNED header in front of it that leads back to the
+// start of the block.
+__attribute__((malloc)) void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	size_t total;
+
+	// C spec: the alignment has to be valid, which for us means a power
+	// of two.
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (alignment <= ALIGNMENT) {
+		return malloc(size);
+	}
+	if (ckd_add(&total, size, alignment)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	char *raw = malloc(total);
+	if (raw == NULL) {
+		return NULL;
+	}
+	// raw is only ALIGNMENT-aligned, so this always leaves room for a
+	// header between raw and p.
+	char *p = (char *)round_up((uintptr_t)raw + 1, alignment);
+	struct header *h = ptr_to_header(p);
+	h->magic = HEADER_MAGIC;
+	h->cls = CLASS_ALIGNED;
+	h->size = p - raw;
+	return p;
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	if (alignment % sizeof(void *) != 0 ||
+	    (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	if (size == 0) {
+		*memptr = NULL;
+		return 0;
+	}
+	void *p = aligned_alloc(alignment, size);
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	*memptr = p;
+	return 0;
+}
+
+// Print what the allocator has been up to on stderr. The counts are
+// copied out first, since stderr may malloc() its buffer and
+// malloc_lock is not recursive.
+void
+malloc_stats(void)
+{
+	struct malloc_counts st;
+
+	pthread_mutex_lock(&malloc_lock);
+	st = stats;
+	pthread_mutex_unlock(&malloc_lock);
+
+	fprintf(stderr, "%8s %10s %10s %10s\n", "class", "allocs", "frees", "in use");
+	for (unsigned int c = 0; c < NCLASSES; c++) {
+		if (st.allocs[c] == 0) {
+			continue;
+		}
+		fprintf(stderr, "%8zu %10zu %10zu %10zu\n", class_to_size(c),
+		        st.allocs[c], st.frees[c], st.allocs[c] - st.frees[c]);
+	}
+	fprintf(stderr, "mmap: %zu allocs, %zu frees, %zu bytes mapped\n",
+	        st.mmap_allocs, st.mmap_frees, st.mmap_bytes);
+	if (st.large_allocs != 0) {
+		fprintf(stderr, "large blocks from arenas: %zu\n", st.large_allocs);
+	}
+	fprintf(stderr, "arenas: %zu bytes from mmap, %zu bytes from sbrk\n",
+	        st.arena_mmap_bytes, st.arena_sbrk_bytes);
+	fprintf(stderr, "realloc: %zu in place, %zu copied\n", st.realloc_in_place,
+	        st.realloc_copied);
+}
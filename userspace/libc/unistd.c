@@ -69,6 +69,34 @@ write(int fd, const void *buf, size_t count)
 	return __syscall_ret(__syscall3(SYS_write, fd, (long)buf, count));
 }
 
+ssize_t
+pread(int fd, void *buf, size_t count, off_t offset)
+{
+	if (fd < 0) {
+		return __syscall_ret(-EBADF);
+	}
+	return __syscall_ret(
+		__syscall4(SYS_pread, fd, (long)buf, count, (long)offset));
+}
+
+ssize_t
+pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	if (fd < 0) {
+		return __syscall_ret(-EBADF);
+	}
+	return __syscall_ret(
+		__syscall4(SYS_pwrite, fd, (long)buf, count, (long)offset));
+}
+
+ssize_t
+copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                size_t len, unsigned int flags)
+{
+	return __syscall_ret(__syscall6(SYS_copy_file_range, fd_in, (long)off_in,
+	                                fd_out, (long)off_out, len, flags));
+}
+
 int
 close(int fd)
 {
@@ -216,6 +244,12 @@ getpid(void)
 	return __syscall_ret(__syscall0(SYS_getpid));
 }
 
+pid_t
+gettid(void)
+{
+	return __syscall_ret(__syscall0(SYS_gettid));
+}
+
 pid_t
 getppid(void)
 {
@@ -313,6 +347,38 @@ fsync(int fd)
 	return __syscall_ret(__syscall1(SYS_fsync, fd));
 }
 
+int
+fdatasync(int fd)
+{
+	return __syscall_ret(__syscall1(SYS_fdatasync, fd));
+}
+
+void
+sync(void)
+{
+	(void)__syscall0(SYS_sync);
+}
+
+int
+ftruncate(int fd, off_t length)
+{
+	return __syscall_ret(__syscall2(SYS_ftruncate, fd, length));
+}
+
+int
+truncate(const char *path, off_t length)
+{
+	int fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	int ret = ftruncate(fd, length);
+	int saved = errno;
+	close(fd);
+	errno = saved;
+	return ret;
+}
+
 char *
 getcwd(char *buf, size_t n)
 {
@@ -345,17 +411,11 @@ getcwd(char *buf, size_t n)
 	}
 }
 
-// Without this code,
-// dash will fail to run commands.
-// It uses vfork instead of fork, but we don't have vfork.
-// As a temporary fix, just use fork.
-__deprecated("Removed in POSIX.1-2008; use fork()") pid_t vfork(void)
+// vfork.S hands us the raw result of the syscall.
+long
+__vfork_ret(unsigned long r)
 {
-	return fork();
-#if 0
-	errno = ENOSYS;
-	return -1;
-#endif
+	return __syscall_ret(r);
 }
 
 clock_t
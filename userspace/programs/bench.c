@@ -0,0 +1,150 @@
+// Time the basic utilities on generated input, so that regressions
+// show up as numbers. Usage: bench [megabytes]
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+
+#define TEXT "/bench.txt"
+#define COPY "/bench.out"
+#define DIR "/bench.dir"
+#define NFILES 256
+
+static const char *const words[] = {
+	"the", "kernel", "maps", "a", "page", "for", "each", "process",
+	"and", "then", "returns", "to", "user", "space", "with", "interrupts",
+};
+
+// Run argv with stdout sent to out, and return how long it took.
+static time_t
+run(char *const argv[], const char *out)
+{
+	time_t before = uptime();
+	int pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror(out);
+			_exit(127);
+		}
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	if (WIFSIGNALED(status) || WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "bench: %s failed\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	return uptime() - before;
+}
+
+static size_t
+make_text(size_t total)
+{
+	FILE *fp = fopen(TEXT, "w");
+	size_t written = 0;
+	unsigned seed = 1;
+
+	if (fp == NULL) {
+		perror(TEXT);
+		exit(EXIT_FAILURE);
+	}
+	while (written < total) {
+		int n = 0;
+		char line[128];
+		int count = 4 + seed % 9;
+		for (int i = 0; i < count; i++) {
+			seed = seed * 1103515245 + 12345;
+			n += snprintf(line + n, sizeof(line) - n, "%s%s", i ? " " : "",
+			              words[(seed >> 16) % 16]);
+		}
+		line[n++] = '\n';
+		fwrite(line, 1, n, fp);
+		written += n;
+	}
+	fclose(fp);
+	return written;
+}
+
+static void
+make_dir(void)
+{
+	char path[64];
+
+	mkdir(DIR, 0755);
+	for (int i = 0; i < NFILES; i++) {
+		snprintf(path, sizeof(path), DIR "/file%03d", i);
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	}
+}
+
+static void
+remove_dir(void)
+{
+	char path[64];
+
+	for (int i = 0; i < NFILES; i++) {
+		snprintf(path, sizeof(path), DIR "/file%03d", i);
+		unlink(path);
+	}
+	rmdir(DIR);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 8) << 20;
+
+	if (total == 0) {
+		fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	size_t bytes = make_text(total);
+	printf("%zu bytes of text\n", bytes);
+
+	bench_report("wc", bytes, run((char *[]){ "wc", TEXT, NULL }, "/dev/null"));
+	bench_report("cat > /dev/null", bytes,
+	             run((char *[]){ "cat", TEXT, NULL }, "/dev/null"));
+	bench_report("cat > file", bytes,
+	             run((char *[]){ "cat", TEXT, NULL }, COPY));
+	bench_report(
+		"cat | wc", bytes,
+		run((char *[]){ "sh", "-c", "cat " TEXT " | wc", NULL }, "/dev/null"));
+	bench_report(
+		"grep -c", bytes,
+		run((char *[]){ "grep", "-c", "page for", TEXT, NULL }, "/dev/null"));
+	bench_report(
+		"grep -v", bytes,
+		run((char *[]){ "grep", "-v", "kernel", TEXT, NULL }, "/dev/null"));
+
+	make_dir();
+	time_t ms = run((char *[]){ "ls", DIR, NULL }, "/dev/null");
+	printf("%-24s %6ldms %6d files\n", "ls", ms, NFILES);
+	ms = run((char *[]){ "ls", "-l", DIR, NULL }, "/dev/null");
+	printf("%-24s %6ldms %6d files\n", "ls -l", ms, NFILES);
+	remove_dir();
+
+	unlink(TEXT);
+	unlink(COPY);
+	return 0;
+}
@@ -0,0 +1,19 @@
+// What the *bench programs share.
+#pragma once
+#include <stdio.h>
+#include <sys/types.h>
+
+// KiB per second through bytes in ms, taking a run too quick to time
+// as 1ms.
+static inline unsigned long
+bench_kibps(size_t bytes, time_t ms)
+{
+	return (unsigned long)(bytes / 1024 * 1000 / (ms == 0 ? 1 : ms));
+}
+
+// Print how long what took and how fast it went through bytes.
+static inline void
+bench_report(const char *what, size_t bytes, time_t ms)
+{
+	printf("%-24s %6ldms %8lu KiB/s\n", what, ms, bench_kibps(bytes, ms));
+}
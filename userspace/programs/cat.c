@@ -3,18 +3,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 
+// Past this size, reads and writes cost about the same per byte.
+#define CAT_BUFSIZE (128 * 1024)
+// sendfile() loops in the kernel, so ask for a lot at once.
+#define SENDFILE_CHUNK (16 * 1024 * 1024)
+
+static char buf[CAT_BUFSIZE];
+
 void
 cat(int fd)
 {
-	char buf[512];
-	int n;
+	ssize_t n;
+
+	// Let the kernel move the data if it can.
+	while ((n = sendfile(STDOUT_FILENO, fd, NULL, SENDFILE_CHUNK)) > 0) {
+	}
+	if (n == 0) {
+		return;
+	}
+	if (errno != EINVAL) {
+		perror("cat");
+		exit(1);
+	}
 
 	while ((n = read(fd, buf, sizeof(buf))) > 0) {
-		if (write(1, buf, n) != n) {
-			perror("cat");
-			exit(1);
+		for (ssize_t done = 0, w; done < n; done += w) {
+			if ((w = write(STDOUT_FILENO, buf + done, n - done)) <= 0) {
+				perror("cat");
+				exit(1);
+			}
 		}
 	}
 	if (n < 0) {
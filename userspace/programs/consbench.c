@@ -0,0 +1,81 @@
+// Time writing text to the console and to the serial port, in
+// 80-column lines that keep the screen scrolling.
+// Usage: consbench [kilobytes]
+// The console mirrors what it shows to the serial port, so run this
+// with serial enabled to see what that costs.
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+
+#define LINE 80
+
+static void
+report(const char *what, size_t bytes, time_t ms)
+{
+	printf("%-24s %6ldms %8lu KiB/s %8lu lines/s\n", what, ms,
+	       bench_kibps(bytes, ms),
+	       (unsigned long)(bytes / LINE * 1000 / (ms == 0 ? 1 : ms)));
+}
+
+// Write total bytes of lines to fd, bufsize bytes at a time.
+static time_t
+spew(int fd, size_t total, size_t bufsize)
+{
+	char *buf = malloc(bufsize);
+
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < bufsize; i++) {
+		buf[i] = i % LINE == LINE - 1 ? '\n' : 'a' + i % 26;
+	}
+	time_t before = uptime();
+	for (size_t done = 0; done < total; done += bufsize) {
+		if (write(fd, buf, bufsize) < 0) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+	}
+	time_t ms = uptime() - before;
+	free(buf);
+	return ms;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 64) << 10;
+
+	if (total == 0) {
+		fprintf(stderr, "usage: %s [kilobytes]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	// Everything is printed at the end, so that it does not scroll
+	// away.
+	time_t console_line = spew(STDOUT_FILENO, total, LINE);
+	time_t console_bulk = spew(STDOUT_FILENO, total, LINE * 64);
+	time_t serial_line = 0, serial_bulk = 0;
+	int fd = open("/dev/ttyS0", O_WRONLY);
+	if (fd >= 0) {
+		serial_line = spew(fd, total, LINE);
+		serial_bulk = spew(fd, total, LINE * 64);
+		close(fd);
+	}
+
+	printf("%zu bytes\n", total);
+	report("console 80B writes", total, console_line);
+	report("console 5KB writes", total, console_bulk);
+	if (fd >= 0) {
+		report("ttyS0 80B writes", total, serial_line);
+		report("ttyS0 5KB writes", total, serial_bulk);
+	} else {
+		printf("no /dev/ttyS0\n");
+	}
+	return 0;
+}
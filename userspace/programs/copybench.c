@@ -0,0 +1,111 @@
+// Compare copying through a user buffer with sendfile() and
+// copy_file_range(). Usage: copybench [megabytes]
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+
+#define SRC "/copybench.src"
+#define DST "/copybench.dst"
+
+static size_t total;
+
+static int
+open_or_die(const char *path, int flags)
+{
+	int fd = open(path, flags, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void
+bench_rw(const char *what, int out_flags, const char *out_path, size_t bufsize)
+{
+	char *buf = malloc(bufsize);
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int in = open_or_die(SRC, O_RDONLY);
+	int out = open_or_die(out_path, out_flags);
+	time_t before = uptime();
+	ssize_t n;
+	while ((n = read(in, buf, bufsize)) > 0) {
+		if (write(out, buf, n) != n) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+	}
+	bench_report(what, total, uptime() - before);
+	close(in);
+	close(out);
+	free(buf);
+}
+
+static void
+bench_sendfile(const char *what, int out_flags, const char *out_path)
+{
+	int in = open_or_die(SRC, O_RDONLY);
+	int out = open_or_die(out_path, out_flags);
+	time_t before = uptime();
+	while (sendfile(out, in, NULL, 1 << 20) > 0) {
+	}
+	bench_report(what, total, uptime() - before);
+	close(in);
+	close(out);
+}
+
+static void
+bench_copy_file_range(void)
+{
+	int in = open_or_die(SRC, O_RDONLY);
+	int out = open_or_die(DST, O_WRONLY | O_CREAT | O_TRUNC);
+	time_t before = uptime();
+	while (copy_file_range(in, NULL, out, NULL, 1 << 20, 0) > 0) {
+	}
+	bench_report("copy_file_range", total, uptime() - before);
+	close(in);
+	close(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+	if (megabytes == 0) {
+		fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	total = megabytes << 20;
+
+	char block[4096];
+	memset(block, 'x', sizeof(block));
+	int fd = open_or_die(SRC, O_WRONLY | O_CREAT | O_TRUNC);
+	for (size_t i = 0; i < total; i += sizeof(block)) {
+		if (write(fd, block, sizeof(block)) != sizeof(block)) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+
+	printf("copying %zu MB\n", megabytes);
+	bench_rw("read/write 512B, file", O_WRONLY | O_CREAT | O_TRUNC, DST, 512);
+	bench_rw("read/write 4K, file", O_WRONLY | O_CREAT | O_TRUNC, DST, 4096);
+	bench_copy_file_range();
+	bench_sendfile("sendfile, file", O_WRONLY | O_CREAT | O_TRUNC, DST);
+	bench_rw("read/write 4K, null", O_WRONLY, "/dev/null", 4096);
+	bench_sendfile("sendfile, null", O_WRONLY, "/dev/null");
+
+	unlink(SRC);
+	unlink(DST);
+	return 0;
+}
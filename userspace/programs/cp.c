@@ -0,0 +1,63 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+copy_slow(int in, int out)
+{
+	char buf[4096];
+	ssize_t n;
+
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			perror("cp: write");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (n < 0) {
+		perror("cp: read");
+		exit(EXIT_FAILURE);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s [source] [dest]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	int in = open(argv[1], O_RDONLY);
+	if (in < 0) {
+		perror(argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	struct stat st;
+	if (fstat(in, &st) < 0) {
+		perror("cp: fstat");
+		exit(EXIT_FAILURE);
+	}
+	int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+	if (out < 0) {
+		perror(argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	ssize_t n;
+	while ((n = copy_file_range(in, NULL, out, NULL, 1 << 20, 0)) > 0) {
+	}
+	if (n < 0) {
+		// Not a regular file, e.g. a device: copy it by hand.
+		if (errno != EINVAL) {
+			perror("cp");
+			exit(EXIT_FAILURE);
+		}
+		copy_slow(in, out);
+	}
+	close(in);
+	close(out);
+	return 0;
+}
@@ -0,0 +1,96 @@
+// Time a write-ahead-log style workload: append records to a file,
+// making each batch durable before the next, as a database would.
+// Usage: fsyncbench [records] [bytes per record] [records per sync]
+// Runs once with no syncing, once with fdatasync() and once with
+// fsync() after every batch, then once with sync().
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILENAME "fsyncbench.log"
+
+enum { NONE, FDATASYNC, FSYNC, SYNC };
+
+static const char *const names[] = {
+	[NONE] = "no sync",
+	[FDATASYNC] = "fdatasync",
+	[FSYNC] = "fsync",
+	[SYNC] = "sync",
+};
+
+static time_t
+run(int how, int nrecords, const char *rec, size_t size, int batch)
+{
+	int fd = open(FILENAME, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+	if (fd < 0) {
+		perror(FILENAME);
+		exit(EXIT_FAILURE);
+	}
+	time_t before = uptime();
+	for (int i = 0; i < nrecords; i++) {
+		if (write(fd, rec, size) != (ssize_t)size) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+		if ((i + 1) % batch != 0 && i + 1 != nrecords) {
+			continue;
+		}
+		int ret = 0;
+		switch (how) {
+		case FDATASYNC:
+			ret = fdatasync(fd);
+			break;
+		case FSYNC:
+			ret = fsync(fd);
+			break;
+		case SYNC:
+			sync();
+			break;
+		}
+		if (ret < 0) {
+			perror(names[how]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	time_t ms = uptime() - before;
+	close(fd);
+	unlink(FILENAME);
+	return ms;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nrecords = argc > 1 ? atoi(argv[1]) : 200;
+	size_t size = argc > 2 ? atoi(argv[2]) : 128;
+	int batch = argc > 3 ? atoi(argv[3]) : 1;
+
+	if (nrecords <= 0 || size == 0 || batch <= 0) {
+		fprintf(stderr, "usage: %s [records] [bytes per record] [records per sync]\n",
+		        argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	char *rec = malloc(size);
+	if (rec == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(rec, 'r', size);
+	rec[size - 1] = '\n';
+
+	printf("%d records of %zu bytes, synced every %d\n", nrecords, size, batch);
+	for (int how = NONE; how <= SYNC; how++) {
+		time_t ms = run(how, nrecords, rec, size, batch);
+		if (ms == 0) {
+			ms = 1;
+		}
+		printf("%-10s %6ldms %8ld records/s\n", names[how], ms,
+		       nrecords * 1000L / ms);
+	}
+	free(rec);
+	return 0;
+}
@@ -1,116 +1,1180 @@
-// Simple grep.  Only supports ^ . * $ operators.
+// grep: print lines that match a regular expression.
+//
+// usage: grep [-cvieF] pattern [file ...]
+//
+// Patterns are POSIX basic regular expressions, or extended ones with
+// -E. They are parsed into a tree, compiled to an NFA, and run as a DFA
+// that is built lazily, a state at a time, as the input asks for it.
+// When every match has to contain some fixed string, we look for that
+// first with memchr() or Boyer-Moore-Horspool, and only run the DFA on
+// the lines where it turns up.
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-char buf[1024];
-int match(char *, char *);
+static bool opt_count;
+static bool opt_invert;
+static bool opt_icase;
+static bool opt_fixed;
+static bool opt_extended;
+static bool show_names;
+// Whether any line has been selected, for the exit status.
+static bool selected;
 
-void
-grep(char *pattern, int fd)
+static __attribute__((noreturn)) void
+die(const char *msg)
 {
-	int n, m;
-	char *p, *q;
+	fprintf(stderr, "grep: %s\n", msg);
+	exit(2);
+}
+
+static void *
+xmalloc(size_t n)
+{
+	void *p = malloc(n);
+	if (p == NULL) {
+		die("out of memory");
+	}
+	return p;
+}
+
+static void *
+xrealloc(void *p, size_t n)
+{
+	p = realloc(p, n);
+	if (p == NULL) {
+		die("out of memory");
+	}
+	return p;
+}
+
+// Sets of bytes.
 
-	m = 0;
-	while ((n = read(fd, buf + m, sizeof(buf) - m - 1)) > 0) {
-		m += n;
-		buf[m] = '\0';
-		p = buf;
-		while ((q = strchr(p, '\n')) != 0) {
-			*q = 0;
-			if (match(pattern, p)) {
-				*q = '\n';
-				write(1, p, q + 1 - p);
+struct charset {
+	uint64_t bits[4];
+};
+
+static inline void
+set_add(struct charset *s, unsigned char c)
+{
+	s->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline bool
+set_has(const struct charset *s, unsigned char c)
+{
+	return (s->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static void
+set_add_range(struct charset *s, unsigned char lo, unsigned char hi)
+{
+	for (unsigned c = lo; c <= hi; c++) {
+		set_add(s, c);
+	}
+}
+
+// With -i, a letter stands for both of its cases.
+static void
+set_fold(struct charset *s)
+{
+	for (unsigned c = 'a'; c <= 'z'; c++) {
+		if (set_has(s, c) || set_has(s, toupper(c))) {
+			set_add(s, c);
+			set_add(s, toupper(c));
+		}
+	}
+}
+
+// Nothing matches a newline: it only ever ends a line.
+static void
+set_invert(struct charset *s)
+{
+	for (int i = 0; i < 4; i++) {
+		s->bits[i] = ~s->bits[i];
+	}
+	s->bits['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+}
+
+// If the set is a single character (in either case with -i), return
+// it, lowercased with -i. Otherwise return -1.
+static int
+set_literal(const struct charset *s)
+{
+	int found = -1;
+	int count = 0;
+	for (unsigned c = 0; c < 256; c++) {
+		if (set_has(s, c)) {
+			if (++count > 2) {
+				return -1;
+			}
+			if (found < 0) {
+				found = c;
 			}
-			p = q + 1;
 		}
-		if (p == buf) {
-			m = 0;
+	}
+	if (count == 1) {
+		return opt_icase && isalpha(found) ? -1 : found;
+	}
+	// Two members: only a letter and its other case under -i.
+	if (count == 2 && opt_icase && isupper(found) &&
+	    set_has(s, tolower(found))) {
+		return tolower(found);
+	}
+	return -1;
+}
+
+// Parse tree.
+
+enum node_type {
+	N_SET,
+	N_EMPTY,
+	N_BOL,
+	N_EOL,
+	N_CAT,
+	N_ALT,
+	N_REPEAT,
+};
+
+struct node {
+	enum node_type type;
+	int left, right;
+	// For N_REPEAT. max < 0 means no limit.
+	int min, max;
+	struct charset set;
+};
+
+#define MAX_REPEAT 255
+
+static struct node *nodes;
+static int nnodes, nodes_cap;
+
+static int
+new_node(enum node_type type, int left, int right)
+{
+	if (nnodes == nodes_cap) {
+		nodes_cap = nodes_cap ? nodes_cap * 2 : 64;
+		nodes = xrealloc(nodes, nodes_cap * sizeof(*nodes));
+	}
+	memset(&nodes[nnodes], 0, sizeof(*nodes));
+	nodes[nnodes].type = type;
+	nodes[nnodes].left = left;
+	nodes[nnodes].right = right;
+	return nnodes++;
+}
+
+static int
+new_set(const struct charset *set)
+{
+	int n = new_node(N_SET, -1, -1);
+	nodes[n].set = *set;
+	if (opt_icase) {
+		set_fold(&nodes[n].set);
+	}
+	return n;
+}
+
+static const char *re;
+
+// In a BRE, ( ) { } | + ? are operators only after a backslash. In an
+// ERE it is the other way around.
+static bool
+at_op(char op)
+{
+	if (op == '*') {
+		return *re == '*';
+	}
+	if (opt_extended) {
+		return *re == op;
+	}
+	return re[0] == '\\' && re[1] == op;
+}
+
+static void
+eat_op(char op)
+{
+	re += (op == '*' || opt_extended) ? 1 : 2;
+}
+
+static bool
+at_cat_end(void)
+{
+	return *re == '\0' || at_op('|') || at_op(')');
+}
+
+static int parse_alt(void);
+
+static const struct {
+	const char *name;
+	int (*is)(int);
+} classes[] = {
+	{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+	{ "upper", isupper }, { "lower", islower }, { "space", isspace },
+	{ "blank", isblank }, { "punct", ispunct }, { "print", isprint },
+	{ "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit },
+};
+
+static void
+add_class(struct charset *s, int (*is)(int))
+{
+	for (unsigned c = 0; c < 128; c++) {
+		if (is(c)) {
+			set_add(s, c);
 		}
-		if (m > 0) {
-			m -= p - buf;
-			memmove(buf, p, m);
+	}
+}
+
+// A bracket expression; re points just past the '['.
+static int
+parse_bracket(void)
+{
+	struct charset set = { 0 };
+	bool negate = false;
+
+	if (*re == '^') {
+		negate = true;
+		re++;
+	}
+	// A ']' straight away is a member, not the end.
+	bool first = true;
+	while (first || *re != ']') {
+		if (*re == '\0') {
+			die("unmatched [");
 		}
+		first = false;
+		if (re[0] == '[' && re[1] == ':') {
+			const char *end = strstr(re + 2, ":]");
+			if (end == NULL) {
+				die("unmatched [:");
+			}
+			size_t len = end - (re + 2);
+			size_t i;
+			for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+				if (strlen(classes[i].name) == len &&
+				    strncmp(classes[i].name, re + 2, len) == 0) {
+					break;
+				}
+			}
+			if (i == sizeof(classes) / sizeof(classes[0])) {
+				die("unknown character class");
+			}
+			add_class(&set, classes[i].is);
+			re = end + 2;
+			continue;
+		}
+		unsigned char lo = *re++;
+		if (re[0] == '-' && re[1] != ']' && re[1] != '\0') {
+			unsigned char hi = re[1];
+			if (hi < lo) {
+				die("invalid range");
+			}
+			set_add_range(&set, lo, hi);
+			re += 2;
+		} else {
+			set_add(&set, lo);
+		}
+	}
+	re++;
+	if (opt_icase) {
+		set_fold(&set);
 	}
+	if (negate) {
+		set_invert(&set);
+	}
+	return new_set(&set);
 }
 
-int
-main(int argc, char *argv[])
+static int
+parse_atom(bool first)
 {
-	char *pattern;
+	struct charset set = { 0 };
+
+	if (at_op('(')) {
+		eat_op('(');
+		int n = parse_alt();
+		if (!at_op(')')) {
+			die("unmatched (");
+		}
+		eat_op(')');
+		return n;
+	}
+	switch (*re) {
+	case '[':
+		re++;
+		return parse_bracket();
+	case '.':
+		re++;
+		set_invert(&set);
+		return new_set(&set);
+	case '^':
+		// In a BRE, only a leading ^ is an anchor.
+		if (opt_extended || first) {
+			re++;
+			return new_node(N_BOL, -1, -1);
+		}
+		break;
+	case '$':
+		// Likewise, only a trailing $ is.
+		re++;
+		if (opt_extended || at_cat_end()) {
+			return new_node(N_EOL, -1, -1);
+		}
+		re--;
+		break;
+	case '\\':
+		if (re[1] == '\0') {
+			die("trailing backslash");
+		}
+		re++;
+		switch (*re) {
+		case 'w':
+		case 'W':
+			add_class(&set, isalnum);
+			set_add(&set, '_');
+			break;
+		case 's':
+		case 'S':
+			add_class(&set, isspace);
+			break;
+		case 'd':
+		case 'D':
+			add_class(&set, isdigit);
+			break;
+		case '1' ... '9':
+			// The DFA has no memory of what a group matched.
+			die("back-references are not supported");
+		default:
+			set_add(&set, *re);
+			re++;
+			return new_set(&set);
+		}
+		if (isupper((unsigned char)*re)) {
+			set_invert(&set);
+		}
+		re++;
+		return new_set(&set);
+	}
+	set_add(&set, *re++);
+	return new_set(&set);
+}
 
-	if (argc <= 1) {
-		fprintf(stderr, "usage: grep pattern [file ...]\n");
-		return 1;
+// Read a decimal count for {m,n}.
+static int
+parse_count(void)
+{
+	int n = 0;
+	if (!isdigit((unsigned char)*re)) {
+		die("invalid repetition count");
+	}
+	while (isdigit((unsigned char)*re)) {
+		n = n * 10 + (*re++ - '0');
+		if (n > MAX_REPEAT) {
+			die("repetition count too large");
+		}
 	}
-	pattern = argv[1];
+	return n;
+}
 
-	if (argc <= 2) {
-		grep(pattern, 0);
-		return 0;
+static int
+parse_repeat(bool first)
+{
+	// A leading * is an ordinary character.
+	if (*re == '*' && first) {
+		struct charset set = { 0 };
+		set_add(&set, *re++);
+		return new_set(&set);
 	}
+	int n = parse_atom(first);
 
-	for (int fd, i = 2; i < argc; i++) {
-		if ((fd = open(argv[i], 0)) < 0) {
-			perror("grep: cannot open file");
-			return 2;
+	for (;;) {
+		int min, max;
+		if (at_op('*')) {
+			eat_op('*');
+			min = 0;
+			max = -1;
+		} else if (at_op('+')) {
+			eat_op('+');
+			min = 1;
+			max = -1;
+		} else if (at_op('?')) {
+			eat_op('?');
+			min = 0;
+			max = 1;
+		} else if (at_op('{') &&
+		           isdigit((unsigned char)re[opt_extended ? 1 : 2])) {
+			eat_op('{');
+			min = max = parse_count();
+			if (*re == ',') {
+				re++;
+				max = isdigit((unsigned char)*re) ? parse_count() : -1;
+			}
+			if (!at_op('}')) {
+				die("unmatched {");
+			}
+			eat_op('}');
+			if (max >= 0 && max < min) {
+				die("invalid repetition count");
+			}
+		} else {
+			return n;
 		}
-		grep(pattern, fd);
-		close(fd);
+		int r = new_node(N_REPEAT, n, -1);
+		nodes[r].min = min;
+		nodes[r].max = max;
+		n = r;
 	}
-	return 0;
 }
 
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
+static int
+parse_cat(void)
+{
+	if (at_cat_end()) {
+		return new_node(N_EMPTY, -1, -1);
+	}
+	int n = parse_repeat(true);
+	while (!at_cat_end()) {
+		n = new_node(N_CAT, n, parse_repeat(false));
+	}
+	return n;
+}
 
-int matchhere(char *, char *);
-int matchstar(int, char *, char *);
+static int
+parse_alt(void)
+{
+	int n = parse_cat();
+	while (at_op('|')) {
+		eat_op('|');
+		n = new_node(N_ALT, n, parse_cat());
+	}
+	return n;
+}
 
-int
-match(char *re, char *text)
+// The longest string that every match must contain.
+
+#define MAX_LITERAL 255
+
+struct literal {
+	size_t len;
+	char s[MAX_LITERAL];
+};
+
+static void
+find_literal_run(int n, struct literal *cur, struct literal *best)
+{
+	int c;
+
+	switch (nodes[n].type) {
+	case N_CAT:
+		find_literal_run(nodes[n].left, cur, best);
+		find_literal_run(nodes[n].right, cur, best);
+		return;
+	case N_SET:
+		if ((c = set_literal(&nodes[n].set)) < 0) {
+			break;
+		}
+		// Once full, cur stays a (shorter) required prefix.
+		if (cur->len < MAX_LITERAL) {
+			cur->s[cur->len++] = c;
+		}
+		if (cur->len > best->len) {
+			*best = *cur;
+		}
+		return;
+	case N_REPEAT:
+		// Something inside has to appear at least once, but it does not
+		// join up with what is around it.
+		if (nodes[n].min > 0) {
+			struct literal inner = { 0 };
+			find_literal_run(nodes[n].left, &inner, best);
+		}
+		break;
+	default:
+		break;
+	}
+	cur->len = 0;
+}
+
+// Whether the pattern is nothing but literal characters.
+static bool
+is_plain_literal(int n)
+{
+	switch (nodes[n].type) {
+	case N_CAT:
+		return is_plain_literal(nodes[n].left) && is_plain_literal(nodes[n].right);
+	case N_SET:
+		return set_literal(&nodes[n].set) >= 0;
+	default:
+		return false;
+	}
+}
+
+// NFA.
+
+enum nfa_op {
+	OP_SET,
+	OP_SPLIT,
+	OP_BOL,
+	OP_EOL,
+	OP_MATCH,
+};
+
+struct nfa_state {
+	enum nfa_op op;
+	int out, out1;
+	// For OP_SET: an index into nodes, whose set we borrow.
+	int node;
+};
+
+#define MAX_NFA_STATES 20000
+
+static struct nfa_state *nfa;
+static int nfa_len, nfa_cap;
+static int nfa_start;
+
+static int
+new_state(enum nfa_op op, int out, int out1)
 {
-	if (re[0] == '^') {
-		return matchhere(re + 1, text);
+	if (nfa_len == MAX_NFA_STATES) {
+		die("pattern too large");
+	}
+	if (nfa_len == nfa_cap) {
+		nfa_cap = nfa_cap ? nfa_cap * 2 : 64;
+		nfa = xrealloc(nfa, nfa_cap * sizeof(*nfa));
 	}
-	do { // must look at empty string
-		if (matchhere(re, text)) {
-			return 1;
+	nfa[nfa_len] = (struct nfa_state){ op, out, out1, -1 };
+	return nfa_len++;
+}
+
+// Compile n so that it continues at next. Returns the entry state.
+// Counted repeats get a fresh copy of their body for each repetition.
+static int
+compile(int n, int next)
+{
+	struct node *node = &nodes[n];
+	int s;
+
+	switch (node->type) {
+	case N_SET:
+		s = new_state(OP_SET, next, -1);
+		nfa[s].node = n;
+		return s;
+	case N_EMPTY:
+		return next;
+	case N_BOL:
+		return new_state(OP_BOL, next, -1);
+	case N_EOL:
+		return new_state(OP_EOL, next, -1);
+	case N_CAT:
+		return compile(node->left, compile(node->right, next));
+	case N_ALT: {
+		int left = compile(node->left, next);
+		return new_state(OP_SPLIT, left, compile(node->right, next));
+	}
+	case N_REPEAT: {
+		int entry = next;
+		int min = node->min;
+		int max = node->max;
+		if (max < 0) {
+			// loop: try the body, or move on.
+			int loop = new_state(OP_SPLIT, -1, next);
+			nfa[loop].out = compile(node->left, loop);
+			entry = loop;
+		} else {
+			// Each optional copy may stop short of the next.
+			for (int i = min; i < max; i++) {
+				entry = new_state(OP_SPLIT, compile(node->left, entry), next);
+			}
 		}
-	} while (*text++ != '\0');
-	return 0;
+		for (int i = 0; i < min; i++) {
+			entry = compile(node->left, entry);
+		}
+		return entry;
+	}
+	}
+	return next;
 }
 
-// matchhere: search for re at beginning of text
-int
-matchhere(char *re, char *text)
+// Lazily built DFA. Each state is the set of NFA states (only the ones
+// that consume input or match) that we could be in. Bytes that every
+// set treats alike share a class, which keeps the transition table
+// small.
+
+#define MAX_DFA_STATES 2048
+#define DFA_HASH_SIZE (MAX_DFA_STATES * 2)
+
+struct dfa_state {
+	int *set;
+	int len;
+	// Built at the start of a line, where ^ holds.
+	bool bol;
+	// A match has been seen, whatever comes next.
+	bool accept;
+	// Matches if the line ends here.
+	bool accept_eol;
+	// Only a newline can get us anywhere.
+	bool dead;
+	uint32_t hash;
+};
+
+static struct dfa_state dstates[MAX_DFA_STATES];
+static int ndstates;
+static int hash_table[DFA_HASH_SIZE];
+static int *transitions;
+static int dfa_start;
+// Counts flushes of the states above.
+static unsigned dfa_epoch;
+
+static uint8_t byte_class[256];
+static int nclasses;
+
+// Scratch space for building sets.
+static uint32_t *mark;
+static uint32_t generation;
+static int *stack;
+static int *scratch;
+
+static void
+build_byte_classes(void)
+{
+	int remap[256][2];
+
+	memset(byte_class, 0, sizeof(byte_class));
+	nclasses = 1;
+	for (int s = 0; s < nfa_len; s++) {
+		if (nfa[s].op != OP_SET) {
+			continue;
+		}
+		const struct charset *set = &nodes[nfa[s].node].set;
+		int count = 0;
+		memset(remap, -1, sizeof(remap));
+		for (unsigned c = 0; c < 256; c++) {
+			int *to = &remap[byte_class[c]][set_has(set, c)];
+			if (*to < 0) {
+				*to = count++;
+			}
+			byte_class[c] = *to;
+		}
+		nclasses = count;
+	}
+}
+
+// Walk from the states on the stack without consuming input, marking
+// what we reach. bol lets us past ^, eol past $. Returns whether we got
+// to a match.
+static bool
+closure(int depth, bool bol, bool eol)
+{
+	bool matched = false;
+
+	while (depth > 0) {
+		int s = stack[--depth];
+		if (s < 0 || mark[s] == generation) {
+			continue;
+		}
+		mark[s] = generation;
+		switch (nfa[s].op) {
+		case OP_SPLIT:
+			stack[depth++] = nfa[s].out;
+			stack[depth++] = nfa[s].out1;
+			break;
+		case OP_BOL:
+			if (bol) {
+				stack[depth++] = nfa[s].out;
+			}
+			break;
+		case OP_EOL:
+			if (eol) {
+				stack[depth++] = nfa[s].out;
+			}
+			break;
+		case OP_MATCH:
+			matched = true;
+			break;
+		case OP_SET:
+			break;
+		}
+	}
+	return matched;
+}
+
+// Collect the marked states that go into a DFA state, in order.
+static int
+collect(void)
+{
+	int len = 0;
+	for (int s = 0; s < nfa_len; s++) {
+		if (mark[s] == generation &&
+		    (nfa[s].op == OP_SET || nfa[s].op == OP_EOL || nfa[s].op == OP_MATCH)) {
+			scratch[len++] = s;
+		}
+	}
+	return len;
+}
+
+static uint32_t
+hash_set(const int *set, int len, bool bol)
+{
+	uint32_t h = 2166136261U ^ bol;
+	for (int i = 0; i < len; i++) {
+		h = (h ^ (uint32_t)set[i]) * 16777619U;
+	}
+	return h;
+}
+
+static void
+dfa_flush(void)
+{
+	for (int i = 0; i < ndstates; i++) {
+		free(dstates[i].set);
+	}
+	ndstates = 0;
+	dfa_epoch++;
+	memset(hash_table, -1, sizeof(hash_table));
+}
+
+static int dfa_add(int len, bool bol);
+
+// Find or make the DFA state for scratch[0..len).
+static int
+dfa_lookup(int len, bool bol)
+{
+	uint32_t h = hash_set(scratch, len, bol);
+	uint32_t i = h & (DFA_HASH_SIZE - 1);
+
+	for (; hash_table[i] >= 0; i = (i + 1) & (DFA_HASH_SIZE - 1)) {
+		struct dfa_state *d = &dstates[hash_table[i]];
+		if (d->hash == h && d->len == len && d->bol == bol &&
+		    memcmp(d->set, scratch, len * sizeof(int)) == 0) {
+			return hash_table[i];
+		}
+	}
+	return dfa_add(len, bol);
+}
+
+static int
+dfa_add(int len, bool bol)
+{
+	if (ndstates == MAX_DFA_STATES) {
+		// Start over rather than grow without limit. The set we were
+		// about to add is still in scratch.
+		int *set = xmalloc((len + 1) * sizeof(int));
+		memcpy(set, scratch, len * sizeof(int));
+		dfa_flush();
+		generation++;
+		stack[0] = nfa_start;
+		closure(1, true, false);
+		dfa_start = dfa_add(collect(), true);
+		memcpy(scratch, set, len * sizeof(int));
+		free(set);
+		if (bol) {
+			return dfa_start;
+		}
+	}
+
+	int id = ndstates++;
+	struct dfa_state *d = &dstates[id];
+	d->set = xmalloc((len + 1) * sizeof(int));
+	memcpy(d->set, scratch, len * sizeof(int));
+	d->len = len;
+	d->bol = bol;
+	d->hash = hash_set(scratch, len, bol);
+	d->accept = false;
+	d->dead = true;
+	for (int i = 0; i < len; i++) {
+		if (nfa[scratch[i]].op == OP_MATCH) {
+			d->accept = true;
+		}
+		if (nfa[scratch[i]].op == OP_SET) {
+			d->dead = false;
+		}
+	}
+	// Does getting past any $ here lead to a match?
+	generation++;
+	int depth = 0;
+	for (int i = 0; i < len; i++) {
+		if (nfa[d->set[i]].op == OP_EOL) {
+			stack[depth++] = nfa[d->set[i]].out;
+		}
+	}
+	d->accept_eol = d->accept || closure(depth, bol, true);
+	if (d->accept_eol) {
+		d->dead = false;
+	}
+	for (int i = 0; i < nclasses; i++) {
+		transitions[id * nclasses + i] = -1;
+	}
+
+	uint32_t slot = d->hash & (DFA_HASH_SIZE - 1);
+	while (hash_table[slot] >= 0) {
+		slot = (slot + 1) & (DFA_HASH_SIZE - 1);
+	}
+	hash_table[slot] = id;
+	return id;
+}
+
+// Work out, and remember, where state from goes on byte c.
+static int
+dfa_step(int from, unsigned char c)
+{
+	struct dfa_state *d = &dstates[from];
+	int depth = 0;
+
+	generation++;
+	for (int i = 0; i < d->len; i++) {
+		int s = d->set[i];
+		if (nfa[s].op == OP_SET && set_has(&nodes[nfa[s].node].set, c)) {
+			stack[depth++] = nfa[s].out;
+		}
+	}
+	// A match may also begin at the next character.
+	stack[depth++] = nfa_start;
+	closure(depth, false, false);
+
+	unsigned epoch = dfa_epoch;
+	int to = dfa_lookup(collect(), false);
+	// Unless that flushed the cache, and took from with it, remember it.
+	if (epoch == dfa_epoch) {
+		transitions[from * nclasses + byte_class[c]] = to;
+	}
+	return to;
+}
+
+static int root;
+
+static void
+compile_pattern(const char *pattern)
+{
+	re = pattern;
+	root = parse_alt();
+	if (*re != '\0') {
+		die("unmatched )");
+	}
+
+	nfa_start = compile(root, new_state(OP_MATCH, -1, -1));
+	build_byte_classes();
+
+	mark = xmalloc(nfa_len * sizeof(*mark));
+	memset(mark, 0, nfa_len * sizeof(*mark));
+	// SPLITs push two states each, so the walk can need twice as many.
+	stack = xmalloc((2 * nfa_len + 1) * sizeof(*stack));
+	scratch = xmalloc((nfa_len + 1) * sizeof(*scratch));
+	transitions = xmalloc((size_t)MAX_DFA_STATES * nclasses * sizeof(int));
+	memset(hash_table, -1, sizeof(hash_table));
+
+	generation++;
+	stack[0] = nfa_start;
+	closure(1, true, false);
+	dfa_start = dfa_add(collect(), true);
+}
+
+// Find the first line in [p, end) that matches, where end follows a
+// newline. Returns its start and sets *line_end to its newline, or
+// returns NULL.
+static const char *
+dfa_find(const char *p, const char *end, const char **line_end)
+{
+	const char *line = p;
+	int s = dfa_start;
+
+	while (p < end) {
+		unsigned char c = *p;
+		if (c == '\n') {
+			if (dstates[s].accept_eol) {
+				*line_end = p;
+				return line;
+			}
+			line = ++p;
+			s = dfa_start;
+			continue;
+		}
+		if (dstates[s].accept) {
+			*line_end = memchr(p, '\n', end - p);
+			return line;
+		}
+		if (dstates[s].dead) {
+			p = memchr(p, '\n', end - p);
+			continue;
+		}
+		int next = transitions[s * nclasses + byte_class[c]];
+		s = next >= 0 ? next : dfa_step(s, c);
+		p++;
+	}
+	return NULL;
+}
+
+// Literal search.
+
+static struct literal literal;
+// The literal is the whole pattern, so finding it is a match.
+static bool literal_is_pattern;
+static unsigned char fold[256];
+static size_t skip[256];
+
+static void
+prepare_literal(void)
+{
+	for (unsigned c = 0; c < 256; c++) {
+		fold[c] = opt_icase ? tolower(c) : c;
+		skip[c] = literal.len;
+	}
+	for (size_t i = 0; i + 1 < literal.len; i++) {
+		unsigned char c = literal.s[i];
+		skip[c] = literal.len - 1 - i;
+		if (opt_icase) {
+			skip[toupper(c)] = literal.len - 1 - i;
+		}
+	}
+}
+
+// Boyer-Moore-Horspool: compare the last character of the window, and
+// on a mismatch slide by as much as that character allows.
+static const char *
+find_literal(const char *p, const char *end)
+{
+	const size_t m = literal.len;
+
+	if (m == 1 && !opt_icase) {
+		return memchr(p, literal.s[0], end - p);
+	}
+	if ((size_t)(end - p) < m) {
+		return NULL;
+	}
+	const unsigned char *s = (const unsigned char *)p;
+	const unsigned char *last = (const unsigned char *)end - m;
+	const unsigned char *lit = (const unsigned char *)literal.s;
+	const unsigned char last_c = lit[m - 1];
+
+	while (s <= last) {
+		unsigned char c = s[m - 1];
+		if (fold[c] == last_c) {
+			size_t i = 0;
+			while (i < m - 1 && fold[s[i]] == lit[i]) {
+				i++;
+			}
+			if (i == m - 1) {
+				return (const char *)s;
+			}
+		}
+		s += skip[c];
+	}
+	return NULL;
+}
+
+static const char *
+next_match(const char *p, const char *end, const char **line_end)
+{
+	if (literal.len == 0) {
+		if (literal_is_pattern) {
+			// An empty -F pattern matches every line.
+			*line_end = memchr(p, '\n', end - p);
+			return p;
+		}
+		return dfa_find(p, end, line_end);
+	}
+	while (p < end) {
+		const char *hit = find_literal(p, end);
+		if (hit == NULL) {
+			return NULL;
+		}
+		const char *nl = memrchr(p, '\n', hit - p);
+		const char *line = nl != NULL ? nl + 1 : p;
+		const char *le = memchr(hit, '\n', end - hit);
+		if (literal_is_pattern || dfa_find(line, le + 1, line_end) != NULL) {
+			*line_end = le;
+			return line;
+		}
+		p = le + 1;
+	}
+	return NULL;
+}
+
+// Output.
+
+static const char *cur_name;
+static long cur_count;
+
+// Select the whole lines in [p, end).
+static void
+select_lines(const char *p, const char *end)
+{
+	if (p == end) {
+		return;
+	}
+	selected = true;
+	if (opt_count) {
+		for (; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+			cur_count++;
+		}
+		return;
+	}
+	if (!show_names) {
+		fwrite(p, 1, end - p, stdout);
+		return;
+	}
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		fputs(cur_name, stdout);
+		fputc(':', stdout);
+		fwrite(p, 1, nl + 1 - p, stdout);
+		p = nl + 1;
+	}
+}
+
+// [p, end) is whole lines.
+static void
+search(const char *p, const char *end)
+{
+	while (p < end) {
+		const char *line_end;
+		const char *line = next_match(p, end, &line_end);
+		if (opt_invert) {
+			select_lines(p, line != NULL ? line : end);
+		}
+		if (line == NULL) {
+			return;
+		}
+		if (!opt_invert) {
+			select_lines(line, line_end + 1);
+		}
+		p = line_end + 1;
+	}
+}
+
+static char *buf;
+static size_t buf_cap = 64 * 1024;
+
+static bool
+grep(int fd, const char *name)
 {
-	if (re[0] == '\0') {
-		return 1;
+	size_t len = 0;
+	ssize_t n;
+
+	cur_name = name;
+	cur_count = 0;
+	for (;;) {
+		if (len == buf_cap) {
+			// One line fills the buffer.
+			buf_cap *= 2;
+			buf = xrealloc(buf, buf_cap);
+		}
+		if ((n = read(fd, buf + len, buf_cap - len)) <= 0) {
+			break;
+		}
+		len += n;
+		// Search every complete line, and keep the last partial one.
+		char *nl = memrchr(buf + len - n, '\n', n);
+		if (nl == NULL) {
+			continue;
+		}
+		size_t done = nl + 1 - buf;
+		search(buf, buf + done);
+		memmove(buf, buf + done, len - done);
+		len -= done;
 	}
-	if (re[1] == '*') {
-		return matchstar(re[0], re + 2, text);
+	if (n < 0) {
+		fprintf(stderr, "grep: %s: %s\n", name, strerror(errno));
+		return false;
 	}
-	if (re[0] == '$' && re[1] == '\0') {
-		return *text == '\0';
+	// A last line without a newline still counts.
+	if (len > 0) {
+		if (len == buf_cap) {
+			buf = xrealloc(buf, ++buf_cap);
+		}
+		buf[len++] = '\n';
+		search(buf, buf + len);
 	}
-	if (*text != '\0' && (re[0] == '.' || re[0] == *text)) {
-		return matchhere(re + 1, text + 1);
+	if (opt_count) {
+		if (show_names) {
+			printf("%s:%ld\n", name, cur_count);
+		} else {
+			printf("%ld\n", cur_count);
+		}
 	}
-	return 0;
+	return true;
 }
 
-// matchstar: search for c*re at beginning of text
 int
-matchstar(int c, char *re, char *text)
+main(int argc, char *argv[])
 {
-	do { // a * matches zero or more instances
-		if (matchhere(re, text)) {
-			return 1;
+	int c;
+
+	while ((c = getopt(argc, argv, "cviEF")) != -1) {
+		switch (c) {
+		case 'c':
+			opt_count = true;
+			break;
+		case 'v':
+			opt_invert = true;
+			break;
+		case 'i':
+			opt_icase = true;
+			break;
+		case 'E':
+			opt_extended = true;
+			break;
+		case 'F':
+			opt_fixed = true;
+			break;
+		default:
+			fprintf(stderr, "usage: grep [-cviEF] pattern [file ...]\n");
+			return 2;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1) {
+		fprintf(stderr, "usage: grep [-cviEF] pattern [file ...]\n");
+		return 2;
+	}
+
+	const char *pattern = argv[0];
+	if (opt_fixed) {
+		if (strlen(pattern) > MAX_LITERAL) {
+			die("pattern too long");
+		}
+		literal.len = strlen(pattern);
+		for (size_t i = 0; i < literal.len; i++) {
+			literal.s[i] = opt_icase ? tolower((unsigned char)pattern[i]) : pattern[i];
 		}
-	} while (*text != '\0' && (*text++ == c || c == '.'));
-	return 0;
+		literal_is_pattern = true;
+	} else {
+		compile_pattern(pattern);
+		struct literal cur = { 0 };
+		find_literal_run(root, &cur, &literal);
+		literal_is_pattern = literal.len > 0 && literal.len < MAX_LITERAL &&
+		                     is_plain_literal(root);
+	}
+	prepare_literal();
+	buf = xmalloc(buf_cap);
+
+	int status = 0;
+	if (argc == 1) {
+		grep(STDIN_FILENO, "(standard input)");
+	} else {
+		show_names = argc > 2;
+		for (int i = 1; i < argc; i++) {
+			int fd = open(argv[i], O_RDONLY);
+			if (fd < 0) {
+				fprintf(stderr, "grep: %s: %s\n", argv[i], strerror(errno));
+				status = 2;
+				continue;
+			}
+			if (!grep(fd, argv[i])) {
+				status = 2;
+			}
+			close(fd);
+		}
+	}
+	fflush(stdout);
+	if (status != 0) {
+		return status;
+	}
+	return selected ? 0 : 1;
 }
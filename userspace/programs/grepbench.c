@@ -0,0 +1,189 @@
+// Time grep on a generated log file, next to the matcher it used to
+// have where that supports the pattern. Usage: grepbench [lines]
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PATH "/grepbench.tmp"
+
+// The old matcher, from Kernighan & Pike: ^ . * $ only.
+static int matchhere(const char *, const char *);
+
+static int
+matchstar(int c, const char *re, const char *text)
+{
+	do {
+		if (matchhere(re, text)) {
+			return 1;
+		}
+	} while (*text != '\0' && (*text++ == c || c == '.'));
+	return 0;
+}
+
+static int
+matchhere(const char *re, const char *text)
+{
+	if (re[0] == '\0') {
+		return 1;
+	}
+	if (re[1] == '*') {
+		return matchstar(re[0], re + 2, text);
+	}
+	if (re[0] == '$' && re[1] == '\0') {
+		return *text == '\0';
+	}
+	if (*text != '\0' && (re[0] == '.' || re[0] == *text)) {
+		return matchhere(re + 1, text + 1);
+	}
+	return 0;
+}
+
+static int
+match(const char *re, const char *text)
+{
+	if (re[0] == '^') {
+		return matchhere(re + 1, text);
+	}
+	do {
+		if (matchhere(re, text)) {
+			return 1;
+		}
+	} while (*text++ != '\0');
+	return 0;
+}
+
+// Count matching lines the way the old grep read them.
+static long
+old_grep(const char *pattern)
+{
+	static char buf[1024];
+	int fd = open(PATH, O_RDONLY);
+	long count = 0;
+	int n, m = 0;
+
+	while ((n = read(fd, buf + m, sizeof(buf) - m - 1)) > 0) {
+		m += n;
+		buf[m] = '\0';
+		char *p = buf, *q;
+		while ((q = strchr(p, '\n')) != NULL) {
+			*q = '\0';
+			count += match(pattern, p);
+			p = q + 1;
+		}
+		if (p == buf) {
+			m = 0;
+		}
+		if (m > 0) {
+			m -= p - buf;
+			memmove(buf, p, m);
+		}
+	}
+	close(fd);
+	return count;
+}
+
+// Run grep with stdout thrown away.
+static int
+run_grep(char *const argv[])
+{
+	int pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	return status;
+}
+
+static const char *const sources[] = { "kernel", "sched", "vfs", "net", "tty" };
+static const char *const events[] = {
+	"opened file", "page fault handled", "timer tick", "wrote block",
+	"process exited", "signal delivered", "mapped region",
+};
+
+static const struct {
+	const char *flags;
+	const char *pattern;
+	// Whether the old matcher understands it.
+	int old;
+} tests[] = {
+	{ "", "panic", 1 },
+	{ "", "page fault", 1 },
+	{ "-i", "PANIC", 0 },
+	{ "-F", "[sched]", 0 },
+	{ "", "^.*pid 12.*exited$", 1 },
+	{ "-E", "pid [0-9]+: (wrote|mapped)", 0 },
+	{ "-c", "timer", 1 },
+	{ "-v -c", "kernel", 1 },
+};
+
+int
+main(int argc, char **argv)
+{
+	long lines = argc > 1 ? atol(argv[1]) : 100000;
+
+	if (lines <= 0) {
+		fprintf(stderr, "usage: %s [lines]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	FILE *fp = fopen(PATH, "w");
+	if (fp == NULL) {
+		perror(PATH);
+		exit(EXIT_FAILURE);
+	}
+	for (long i = 0; i < lines; i++) {
+		fprintf(fp, "%8ld.%03ld [%s] pid %ld: %s\n", i / 1000, i % 1000,
+		        sources[i % 5], (i * 7919) % 4096, events[(i / 3) % 7]);
+		if (i % 9973 == 0) {
+			fprintf(fp, "%8ld.%03ld [kernel] panic: not really\n", i / 1000,
+			        i % 1000);
+		}
+	}
+	fclose(fp);
+
+	printf("%ld lines, times in ms\n", lines);
+	printf("%-8s %-28s %8s %8s\n", "flags", "pattern", "old", "new");
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		char flags[16];
+		char *args[8];
+		int n = 0;
+
+		args[n++] = "grep";
+		strncpy(flags, tests[i].flags, sizeof(flags) - 1);
+		flags[sizeof(flags) - 1] = '\0';
+		for (char *f = strtok(flags, " "); f != NULL; f = strtok(NULL, " ")) {
+			args[n++] = f;
+		}
+		args[n++] = (char *)tests[i].pattern;
+		args[n++] = PATH;
+		args[n] = NULL;
+
+		char old[16] = "-";
+		if (tests[i].old) {
+			time_t before = uptime();
+			old_grep(tests[i].pattern);
+			snprintf(old, sizeof(old), "%ld", uptime() - before);
+		}
+		time_t before = uptime();
+		run_grep(args);
+		printf("%-8s %-28s %8s %8ld\n", tests[i].flags, tests[i].pattern, old,
+		       uptime() - before);
+	}
+	unlink(PATH);
+	return 0;
+}
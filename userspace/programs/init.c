@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
@@ -93,7 +94,30 @@ main(void)
 	make_file_device("/dev/null", makedev(2, 1), O_RDWR);
 	make_file_device("/dev/kbd0", makedev(4, 0), O_RDONLY | O_NONBLOCK);
 	make_file_device("/dev/mouse0", makedev(7, 0), O_RDONLY | O_NONBLOCK);
+	// The minor number is the disk, as mount(2) wants it.
 	make_file_device("/dev/sda", makedev(5, 0), O_RDWR);
+	make_file_device_quiet("/dev/sdb", makedev(5, 1), O_RDWR);
+	make_file_device_quiet("/dev/sdc", makedev(5, 2), O_RDWR);
+	make_file_device_quiet("/dev/sdd", makedev(5, 3), O_RDWR);
+	make_file_device("/dev/lockstat", makedev(8, 0), O_RDWR);
+	make_file_device("/dev/prof", makedev(9, 0), O_RDWR);
+	make_file_device("/dev/trace", makedev(10, 0), O_RDWR);
+	make_file_device("/dev/sysstat", makedev(10, 1), O_RDONLY);
+	make_file_device("/dev/procstat", makedev(11, 0), O_RDONLY);
+	make_file_device("/dev/cpustat", makedev(11, 1), O_RDONLY);
+
+	if (mount("tmpfs", "/tmp", "tmpfs", 0, NULL) < 0) {
+		perror("mount /tmp");
+	}
+
+	// The file system logs hold on to what has not been synced for
+	// a while; put it on disk every so often, as update(8) did.
+	if (fork() == 0) {
+		for (;;) {
+			sleep(30);
+			sync();
+		}
+	}
 
 	// Don't exit, we want a decently stable init.
 	if (signal(SIGINT, noop) == SIG_ERR) {
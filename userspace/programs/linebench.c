@@ -0,0 +1,153 @@
+// Count the lines of a file in different ways, to compare unbuffered
+// reads with stdio. Usage: linebench [lines]
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *path = "/linebench.tmp";
+
+static FILE *
+open_or_die(void)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	return fp;
+}
+
+// What fgetc() used to do: one read() per byte.
+static long
+count_read1(void)
+{
+	int fd = open(path, O_RDONLY);
+	long lines = 0;
+	char c;
+
+	if (fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	while (read(fd, &c, 1) == 1) {
+		lines += c == '\n';
+	}
+	close(fd);
+	return lines;
+}
+
+static long
+count_fgetc(void)
+{
+	FILE *fp = open_or_die();
+	long lines = 0;
+	int c;
+
+	while ((c = fgetc(fp)) != EOF) {
+		lines += c == '\n';
+	}
+	fclose(fp);
+	return lines;
+}
+
+static long
+count_fgets(void)
+{
+	FILE *fp = open_or_die();
+	long lines = 0;
+	char buf[256];
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		lines += strchr(buf, '\n') != NULL;
+	}
+	fclose(fp);
+	return lines;
+}
+
+static long
+count_getline(void)
+{
+	FILE *fp = open_or_die();
+	long lines = 0;
+	char *line = NULL;
+	size_t cap = 0;
+
+	while (getline(&line, &cap, fp) > 0) {
+		lines++;
+	}
+	free(line);
+	fclose(fp);
+	return lines;
+}
+
+static long
+count_fread(void)
+{
+	FILE *fp = open_or_die();
+	long lines = 0;
+	static char buf[65536];
+	size_t n;
+
+	while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+		for (char *p = buf; (p = memchr(p, '\n', buf + n - p)) != NULL; p++) {
+			lines++;
+		}
+	}
+	fclose(fp);
+	return lines;
+}
+
+static const struct {
+	const char *name;
+	long (*count)(void);
+} methods[] = {
+	{ "read(1)", count_read1 }, { "fgetc", count_fgetc },
+	{ "fgets", count_fgets },   { "getline", count_getline },
+	{ "fread", count_fread },
+};
+
+int
+main(int argc, char **argv)
+{
+	long lines = argc > 1 ? atol(argv[1]) : 20000;
+
+	if (lines <= 0) {
+		fprintf(stderr, "usage: %s [lines]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	time_t before = uptime();
+	for (long i = 0; i < lines; i++) {
+		char buf[128];
+		int n = snprintf(buf, sizeof(buf), "line %ld: %.*s\n", i, (int)(i % 64),
+		                 "the quick brown fox jumps over the lazy dog, again and again");
+		if (fwrite(buf, 1, n, fp) != (size_t)n) {
+			perror("fwrite");
+			exit(EXIT_FAILURE);
+		}
+	}
+	fclose(fp);
+	printf("%-8s %6ldms\n", "fwrite", uptime() - before);
+
+	for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+		before = uptime();
+		long n = methods[i].count();
+		time_t elapsed = uptime() - before;
+		if (n != lines) {
+			fprintf(stderr, "%s counted %ld lines, expected %ld\n", methods[i].name,
+			        n, lines);
+			exit(EXIT_FAILURE);
+		}
+		printf("%-8s %6ldms\n", methods[i].name, elapsed);
+	}
+	unlink(path);
+	return 0;
+}
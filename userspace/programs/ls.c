@@ -72,8 +72,6 @@ fmtname(char *path, int fmt_flag)
 	char *p;
 	char *indicator = "";
 	bool skip_fmt = false;
-	// zero out the buffer.
-	memset(buf, '\0', sizeof(buf));
 
 	// Find first character after last slash.
 	for (p = path + strlen(path); p >= path && *p != '/'; p--)
@@ -84,7 +82,7 @@ fmtname(char *path, int fmt_flag)
 	if (strlen(p) >= PATH_MAX) {
 		return p;
 	}
-	memmove(buf, p, strlen(p));
+	memmove(buf, p, strlen(p) + 1);
 	switch (fmt_flag) {
 	default:
 	case FMT_FILE:
@@ -99,7 +97,7 @@ fmtname(char *path, int fmt_flag)
 		char readlink_buf[PATH_MAX] = {};
 		char sprintf_buf[PATH_MAX + sizeof(readlink_buf) + 4 + 2] = {};
 		if (!Lflag) {
-			if (readlink(buf, readlink_buf, PATH_MAX) < 0) {
+			if (readlink(path, readlink_buf, PATH_MAX) < 0) {
 				fprintf(stderr, "readlink `%s'", buf);
 				perror("readlink");
 				exit(1);
@@ -163,6 +161,28 @@ mode_to_perm(mode_t mode, char ret[static 11])
 	ret[10] = '\0';
 	return ret;
 }
+// getpwuid() reads /etc/passwd every time, and a directory's entries
+// nearly always share an owner.
+static const char *
+owner_name(uid_t uid)
+{
+	static char name[LOGIN_NAME_MAX + 1];
+	static uid_t cached_uid;
+	static bool cached = false;
+
+	if (!cached || uid != cached_uid) {
+		struct passwd *passwd = getpwuid(uid);
+		if (passwd == NULL) {
+			perror("getpwuid");
+			exit(EXIT_FAILURE);
+		}
+		strncpy(name, passwd->pw_name, sizeof(name) - 1);
+		cached_uid = uid;
+		cached = true;
+	}
+	return name;
+}
+
 static void
 ls_format(char *buf, struct stat st)
 {
@@ -193,14 +213,10 @@ ls_format(char *buf, struct stat st)
 		}
 		char ret[11];
 		fprintf(stdout, "%s ", mode_to_perm(st.st_mode, ret));
-		struct passwd *passwd = getpwuid(st.st_uid);
-		if (passwd == NULL) {
-			perror("getpwuid");
-			exit(EXIT_FAILURE);
-		}
+		const char *owner = owner_name(st.st_uid);
 		fprintf(stdout, "%u ", st.st_nlink);
 		// TODO: add getgrgid (/etc/group) and use it here.
-		fprintf(stdout, "%s %s ", passwd->pw_name, passwd->pw_name);
+		fprintf(stdout, "%s %s ", owner, owner);
 		if (!S_ISBLK(st.st_mode) && !S_ISCHR(st.st_mode)) {
 			if (hflag) {
 				fprintf(stdout, "%s ", to_human_bytes(st.st_size, human_bytes_buf));
@@ -220,14 +236,83 @@ ls_format(char *buf, struct stat st)
 	}
 }
 
+// What we know about an entry when only its type is needed.
+static mode_t
+dirent_type_to_mode(unsigned char type)
+{
+	switch (type) {
+	case DT_DIR:
+		return S_IFDIR;
+	case DT_LNK:
+		return S_IFLNK;
+	case DT_FIFO:
+		return S_IFIFO;
+	case DT_CHR:
+		return S_IFCHR;
+	case DT_BLK:
+		return S_IFBLK;
+	default:
+		return S_IFREG;
+	}
+}
+
+// Entries are read in large batches straight from posix_getdents().
+// Without -l, -p or -L only their types matter, and the kernel fills
+// those in as it goes, so nothing is stat'ed; otherwise each entry is
+// stat'ed relative to the directory rather than by its full path.
+static void
+list_dir(int fd, const char *path)
+{
+	static char dents[32 * 1024];
+	char buf[PATH_MAX];
+	bool need_stat = lflag || pflag || Lflag;
+	ssize_t nread;
+
+	if (strlen(path) + 2 > sizeof(buf)) {
+		fprintf(stderr, "ls: path too long\n");
+		return;
+	}
+	strcpy(buf, path);
+	char *p = buf + strlen(buf);
+	*p++ = '/';
+
+	while ((nread = posix_getdents(fd, dents, sizeof(dents),
+	                               need_stat ? 0 : DT_FORCE_TYPE)) > 0) {
+		for (ssize_t bpos = 0; bpos < nread;) {
+			struct posix_dent *d = (struct posix_dent *)(dents + bpos);
+			struct stat st;
+
+			bpos += d->d_reclen;
+			if (d->d_ino == 0) {
+				continue;
+			}
+			if (p + strlen(d->d_name) >= buf + sizeof(buf)) {
+				fprintf(stderr, "ls: path too long\n");
+				continue;
+			}
+			strcpy(p, d->d_name);
+			if (!need_stat) {
+				st = (struct stat){ .st_mode = dirent_type_to_mode(d->d_type) };
+			} else if (fstatat(fd, d->d_name, &st, Lflag ? 0 : AT_SYMLINK_NOFOLLOW) <
+			           0) {
+				fprintf(stderr, "ls: cannot stat %s\n", buf);
+				perror("stat");
+				continue;
+			}
+			ls_format(buf, st);
+		}
+	}
+	if (nread < 0) {
+		perror("posix_getdents");
+	}
+}
+
 // this ls(1) tries to follow __minimal__ POSIX stuff.
 static void
 ls(char *path)
 {
 	int fd;
-	struct dirent *de;
 	struct stat st;
-	char buf[PATH_MAX] = {};
 
 	if ((fd = open(path, O_RDONLY | O_NONBLOCK)) < 0) {
 		fprintf(stderr, "ls: cannot open %s\n", path);
@@ -243,33 +328,9 @@ ls(char *path)
 	}
 
 	switch (st.st_mode & S_IFMT) {
-	case S_IFDIR: {
-		if (strlen(path) + 1 > sizeof buf) {
-			fprintf(stderr, "ls: path too long\n");
-			break;
-		}
-		strcpy(buf, path);
-		char *p = buf + strlen(buf);
-		*p++ = '/';
-		DIR *dir = fdopendir(fd);
-		if (dir == NULL) {
-			perror("fdopendir");
-			exit(EXIT_FAILURE);
-		}
-		while ((de = readdir(dir)) != NULL) {
-			if (de->d_ino == 0) {
-				continue;
-			}
-			strcpy(p, de->d_name);
-			if ((Lflag ? stat : lstat)(buf, &st) < 0) {
-				fprintf(stderr, "ls: cannot stat %s\n", buf);
-				perror("stat");
-				continue;
-			}
-			ls_format(buf, st);
-		}
-		closedir(dir);
-	} break;
+	case S_IFDIR:
+		list_dir(fd, path);
+		break;
 	default:
 		ls_format(path, st);
 		break;
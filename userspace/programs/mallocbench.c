@@ -0,0 +1,206 @@
+// Compare malloc() against the K&R first-fit allocator libc used to
+// have, which is kept here as the baseline.
+// Usage: mallocbench [rounds]
+// Run it with MALLOC_STATS set to see what malloc() did.
+#include <ext.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LIVE 1000
+
+struct kr_header {
+	struct kr_header *ptr;
+	size_t size;
+} __attribute__((aligned(8)));
+
+static struct kr_header kr_base;
+static struct kr_header *kr_freep = NULL;
+
+static void
+kr_free(void *ap)
+{
+	struct kr_header *bp = (struct kr_header *)ap - 1, *p;
+
+	for (p = kr_freep; !(bp > p && bp < p->ptr); p = p->ptr) {
+		if (p >= p->ptr && (bp > p || bp < p->ptr)) {
+			break;
+		}
+	}
+	if (bp + bp->size == p->ptr) {
+		bp->size += p->ptr->size;
+		bp->ptr = p->ptr->ptr;
+	} else {
+		bp->ptr = p->ptr;
+	}
+	if (p + p->size == bp) {
+		p->size += bp->size;
+		p->ptr = bp->ptr;
+	} else {
+		p->ptr = bp;
+	}
+	kr_freep = p;
+}
+
+static void *
+kr_malloc(size_t nbytes)
+{
+	struct kr_header *p, *prevp;
+	size_t nunits = (nbytes + sizeof(*p) - 1) / sizeof(*p) + 1;
+
+	if ((prevp = kr_freep) == NULL) {
+		kr_base.ptr = kr_freep = prevp = &kr_base;
+		kr_base.size = 0;
+	}
+	for (p = prevp->ptr;; prevp = p, p = p->ptr) {
+		if (p->size >= nunits) {
+			if (p->size == nunits) {
+				prevp->ptr = p->ptr;
+			} else {
+				p->size -= nunits;
+				p += p->size;
+				p->size = nunits;
+			}
+			kr_freep = prevp;
+			return p + 1;
+		}
+		if (p == kr_freep) {
+			size_t nu = nunits < 4096 ? 4096 : nunits;
+			char *cp = sbrk(nu * sizeof(*p));
+			if (cp == (char *)-1) {
+				return NULL;
+			}
+			p = (struct kr_header *)cp;
+			p->size = nu;
+			kr_free(p + 1);
+			p = kr_freep;
+		}
+	}
+}
+
+static void *
+kr_realloc(void *ptr, size_t size)
+{
+	size_t old_size = ((struct kr_header *)ptr - 1)->size * sizeof(struct kr_header);
+	if (old_size >= size) {
+		return ptr;
+	}
+	void *new_ptr = kr_malloc(size);
+	if (new_ptr != NULL) {
+		memcpy(new_ptr, ptr, old_size);
+		kr_free(ptr);
+	}
+	return new_ptr;
+}
+
+struct allocator {
+	const char *name;
+	void *(*alloc)(size_t);
+	void (*release)(void *);
+	void *(*resize)(void *, size_t);
+};
+
+static const struct allocator allocators[] = {
+	{ "K&R", kr_malloc, kr_free, kr_realloc },
+	{ "malloc", malloc, free, realloc },
+};
+
+static void *
+check(void *p)
+{
+	if (p == NULL) {
+		fprintf(stderr, "mallocbench: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+// Allocate and immediately free one small block.
+static void
+bench_pairs(const struct allocator *a, int rounds)
+{
+	for (int i = 0; i < rounds * 100; i++) {
+		a->release(check(a->alloc(32)));
+	}
+}
+
+// Keep LIVE blocks of random sizes around and keep replacing them,
+// which fragments a first-fit list.
+static void
+bench_random(const struct allocator *a, int rounds)
+{
+	static void *live[LIVE];
+	unsigned int seed = 1;
+
+	for (int i = 0; i < LIVE; i++) {
+		live[i] = check(a->alloc(16 + i % 500));
+	}
+	for (int i = 0; i < rounds * 100; i++) {
+		seed = seed * 1103515245 + 12345;
+		int slot = (seed >> 16) % LIVE;
+		a->release(live[slot]);
+		live[slot] = check(a->alloc(16 + (seed >> 8) % 500));
+	}
+	for (int i = 0; i < LIVE; i++) {
+		a->release(live[i]);
+	}
+}
+
+// Grow a string a few bytes at a time, the way a shell reads a line.
+static void
+bench_realloc(const struct allocator *a, int rounds)
+{
+	for (int r = 0; r < rounds / 10; r++) {
+		char *buf = check(a->alloc(16));
+		for (size_t len = 32; len <= 16384; len += 32) {
+			buf = check(a->resize(buf, len));
+			buf[len - 1] = 'x';
+		}
+		a->release(buf);
+	}
+}
+
+// Big buffers: the new allocator maps and unmaps each one.
+static void
+bench_large(const struct allocator *a, int rounds)
+{
+	for (int i = 0; i < rounds / 10; i++) {
+		char *p = check(a->alloc(256 * 1024));
+		p[0] = p[256 * 1024 - 1] = 1;
+		a->release(p);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*run)(const struct allocator *, int);
+} benches[] = {
+	{ "alloc/free pairs", bench_pairs },
+	{ "random sizes", bench_random },
+	{ "realloc growth", bench_realloc },
+	{ "256K blocks", bench_large },
+};
+
+int
+main(int argc, char **argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 1000;
+
+	if (rounds < 10) {
+		fprintf(stderr, "usage: %s [rounds (at least 10)]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	printf("%18s %10s %10s\n", "", allocators[0].name, allocators[1].name);
+	for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		time_t elapsed[2];
+		for (int i = 0; i < 2; i++) {
+			time_t before = uptime();
+			benches[b].run(&allocators[i], rounds);
+			elapsed[i] = uptime() - before;
+		}
+		printf("%18s %8ldms %8ldms\n", benches[b].name, elapsed[0], elapsed[1]);
+	}
+	return 0;
+}
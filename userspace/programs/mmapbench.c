@@ -0,0 +1,160 @@
+// Time reading a file with read() at several buffer sizes against
+// mapping it, and writing one through a shared mapping.
+// Usage: mmapbench [megabytes]
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+
+#define FILE_NAME "/mmapbench.dat"
+
+static volatile unsigned long sink;
+
+static int
+open_file(int flags)
+{
+	int fd = open(FILE_NAME, flags, 0644);
+	if (fd < 0) {
+		perror(FILE_NAME);
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void
+make_file(size_t total)
+{
+	static char buf[64 * 1024];
+	int fd = open_file(O_WRONLY | O_CREAT | O_TRUNC);
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (char)(i * 31 + 7);
+	}
+	for (size_t done = 0; done < total; done += sizeof(buf)) {
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+}
+
+// Touch one word in every cache line, so that both ways do the same
+// work on the data once they have it.
+static unsigned long
+sum(const unsigned char *p, size_t n)
+{
+	unsigned long s = 0;
+	for (size_t i = 0; i < n; i += 64) {
+		s += p[i];
+	}
+	return s;
+}
+
+static time_t
+read_scan(size_t bufsize)
+{
+	char *buf = malloc(bufsize);
+	int fd = open_file(O_RDONLY);
+	unsigned long s = 0;
+	ssize_t n;
+
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	time_t before = uptime();
+	while ((n = read(fd, buf, bufsize)) > 0) {
+		s += sum((unsigned char *)buf, n);
+	}
+	time_t ms = uptime() - before;
+	sink = s;
+	close(fd);
+	free(buf);
+	return ms;
+}
+
+static time_t
+map_scan(size_t total, int advice)
+{
+	int fd = open_file(O_RDONLY);
+	time_t before = uptime();
+	unsigned char *p = mmap(NULL, total, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	if (advice >= 0 && madvise(p, total, advice) < 0) {
+		perror("madvise");
+		exit(EXIT_FAILURE);
+	}
+	sink = sum(p, total);
+	munmap(p, total);
+	time_t ms = uptime() - before;
+	close(fd);
+	return ms;
+}
+
+static time_t
+map_write(size_t total)
+{
+	int fd = open_file(O_RDWR);
+	time_t before = uptime();
+	unsigned char *p =
+		mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < total; i += 64) {
+		p[i]++;
+	}
+	if (msync(p, total, MS_SYNC) < 0) {
+		perror("msync");
+		exit(EXIT_FAILURE);
+	}
+	munmap(p, total);
+	time_t ms = uptime() - before;
+	close(fd);
+	return ms;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 16) << 20;
+
+	if (total == 0) {
+		fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	make_file(total);
+	printf("%zu bytes\n", total);
+
+	static const size_t sizes[] = { 512, 4096, 65536, 1 << 20 };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		char what[32];
+		snprintf(what, sizeof(what), "read %zuB", sizes[i]);
+		bench_report(what, total, read_scan(sizes[i]));
+	}
+	// The first mapping reads the file into the page cache; the ones
+	// after that find it there as long as the file stays open.
+	int keep = open_file(O_RDONLY);
+	bench_report("mmap (cold)", total, map_scan(total, -1));
+	bench_report("mmap", total, map_scan(total, -1));
+	bench_report("mmap MADV_SEQUENTIAL", total, map_scan(total, MADV_SEQUENTIAL));
+	bench_report("mmap MADV_RANDOM", total, map_scan(total, MADV_RANDOM));
+	bench_report("mmap MADV_WILLNEED", total, map_scan(total, MADV_WILLNEED));
+	bench_report("mmap shared + msync", total, map_write(total));
+	close(keep);
+
+	unlink(FILE_NAME);
+	return 0;
+}
@@ -0,0 +1,37 @@
+// Mount a file system.
+// Usage: mount [-t relixfs|tmpfs] source directory
+// A relixfs source is a disk's /dev/sd* node; a tmpfs one is only a
+// name.
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+int
+main(int argc, char **argv)
+{
+	const char *type = "relixfs";
+	int c;
+
+	while ((c = getopt(argc, argv, "t:")) != -1) {
+		switch (c) {
+		case 't':
+			type = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 2) {
+		goto usage;
+	}
+	if (mount(argv[optind], argv[optind + 1], type, 0, NULL) < 0) {
+		perror("mount");
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-t relixfs|tmpfs] source directory\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
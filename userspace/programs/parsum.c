@@ -0,0 +1,85 @@
+// Sum a large array with 1, 2, ... N threads to see how well the
+// threads spread across CPUs. Usage: parsum [max threads] [MiB]
+#include <ext.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 16
+
+struct part {
+	const uint64_t *start;
+	size_t count;
+	uint64_t sum;
+};
+
+static void *
+sum_part(void *arg)
+{
+	struct part *p = arg;
+	uint64_t sum = 0;
+	for (size_t i = 0; i < p->count; i++) {
+		sum += p->start[i];
+	}
+	p->sum = sum;
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : 4;
+	size_t mib = argc > 2 ? atoi(argv[2]) : 16;
+
+	if (max_threads < 1 || max_threads > MAX_THREADS || mib == 0) {
+		fprintf(stderr, "usage: %s [max threads (1-%d)] [MiB]\n", argv[0],
+		        MAX_THREADS);
+		exit(EXIT_FAILURE);
+	}
+	size_t n = mib * 1024 * 1024 / sizeof(uint64_t);
+	uint64_t *data = malloc(n * sizeof(*data));
+	if (data == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < n; i++) {
+		data[i] = i;
+	}
+	uint64_t expected = (uint64_t)n * (n - 1) / 2;
+
+	pthread_t threads[MAX_THREADS];
+	struct part parts[MAX_THREADS];
+	time_t base = 0;
+	for (int nt = 1; nt <= max_threads; nt++) {
+		time_t before = uptime();
+		for (int i = 0; i < nt; i++) {
+			parts[i].start = data + n / nt * i;
+			parts[i].count = i == nt - 1 ? n - n / nt * i : n / nt;
+			if (pthread_create(&threads[i], NULL, sum_part, &parts[i]) != 0) {
+				fprintf(stderr, "pthread_create failed\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		uint64_t sum = 0;
+		for (int i = 0; i < nt; i++) {
+			pthread_join(threads[i], NULL);
+			sum += parts[i].sum;
+		}
+		time_t elapsed = uptime() - before;
+		if (sum != expected) {
+			fprintf(stderr, "%d threads: wrong sum\n", nt);
+			exit(EXIT_FAILURE);
+		}
+		if (nt == 1) {
+			base = elapsed;
+		}
+		printf("%2d threads: %ldms", nt, elapsed);
+		if (elapsed != 0) {
+			printf(" (%ld.%02ldx)", base / elapsed, base * 100 / elapsed % 100);
+		}
+		printf("\n");
+	}
+	free(data);
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include "kernel/include/dev/ps2mouse.h"
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,7 +20,13 @@ main(void)
 	bool right = false;
 	bool middle = false;
 
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
 	while (1) {
+		if (poll(&pfd, 1, -1) < 0) {
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
 		if (read(fd, mouse_data, 3) < 0) {
 			continue;
 		}
@@ -0,0 +1,136 @@
+// Compare poll() and epoll_wait() when only a few of many descriptors
+// are active. Usage: pollbench [pipes] [rounds]
+// By default it opens as many pipes as a process has descriptors for,
+// about 2000.
+#include <ext.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define ACTIVE 4
+
+static int (*pipes)[2];
+static int npipes;
+
+static void
+kick(int round)
+{
+	for (int i = 0; i < ACTIVE; i++) {
+		int p = (round * 7 + i * (npipes / ACTIVE)) % npipes;
+		if (write(pipes[p][1], "x", 1) != 1) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void
+drain(int fd)
+{
+	char c;
+	if (read(fd, &c, 1) != 1) {
+		perror("read");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static time_t
+bench_poll(int rounds)
+{
+	struct pollfd *fds = calloc(npipes, sizeof(*fds));
+	if (fds == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < npipes; i++) {
+		fds[i].fd = pipes[i][0];
+		fds[i].events = POLLIN;
+	}
+
+	time_t before = uptime();
+	for (int r = 0; r < rounds; r++) {
+		kick(r);
+		int n = poll(fds, npipes, -1);
+		if (n < 0) {
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < npipes && n > 0; i++) {
+			if (fds[i].revents & POLLIN) {
+				drain(fds[i].fd);
+				n--;
+			}
+		}
+	}
+	time_t elapsed = uptime() - before;
+	free(fds);
+	return elapsed;
+}
+
+static time_t
+bench_epoll(int rounds)
+{
+	struct epoll_event events[ACTIVE];
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < npipes; i++) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.fd = pipes[i][0] };
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[i][0], &ev) < 0) {
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	time_t before = uptime();
+	for (int r = 0; r < rounds; r++) {
+		kick(r);
+		int n = epoll_wait(epfd, events, ACTIVE, -1);
+		if (n < 0) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < n; i++) {
+			drain(events[i].data.fd);
+		}
+	}
+	time_t elapsed = uptime() - before;
+	close(epfd);
+	return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+	// Each pipe takes two descriptors; leave room for stdio and epoll.
+	npipes = argc > 1 ? atoi(argv[1]) : (OPEN_MAX - 8) / 2;
+	int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+
+	if (npipes < ACTIVE || npipes > (OPEN_MAX - 8) / 2 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [pipes (%d-%d)] [rounds]\n", argv[0], ACTIVE,
+		        (OPEN_MAX - 8) / 2);
+		exit(EXIT_FAILURE);
+	}
+	if ((pipes = calloc(npipes, sizeof(*pipes))) == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < npipes; i++) {
+		if (pipe(pipes[i]) < 0) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	time_t p = bench_poll(rounds);
+	time_t e = bench_epoll(rounds);
+	printf("%d pipes, %d active, %d rounds\n", npipes, ACTIVE, rounds);
+	printf("poll:       %ldms\n", p);
+	printf("epoll_wait: %ldms\n", e);
+	return 0;
+}
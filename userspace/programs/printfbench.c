@@ -0,0 +1,219 @@
+// Compare snprintf() and fprintf() with the old formatter, which handed
+// every character to a callback. Usage: printfbench [iterations]
+#include <ext.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The old engine, cut down to what the tests below use.
+struct old_out {
+	char *buf;
+	size_t idx;
+};
+
+static void
+old_putc(struct old_out *out, char c)
+{
+	out->buf[out->idx++] = c;
+}
+
+// libc called its put function through a pointer from another file, so
+// keep the compiler from inlining it here.
+static void (*volatile old_put)(struct old_out *, char) = old_putc;
+
+static __attribute__((noinline)) int
+old_printint(void (*put)(struct old_out *, char), struct old_out *out,
+             int64_t xx, int base, int sgn, int padzero, int padding)
+{
+	static const char digits[] = "0123456789abcdef";
+	char buf[4096];
+	int i = 0;
+	int neg = 0;
+	uint64_t x;
+
+	if (sgn && xx < 0) {
+		neg = 1;
+		x = -xx;
+	} else {
+		x = xx;
+	}
+	do {
+		buf[i++] = digits[x % base];
+	} while ((x /= base) != 0);
+	if (padzero) {
+		while (i < padding) {
+			buf[i++] = '0';
+		}
+	}
+	if (neg) {
+		buf[i++] = '-';
+	}
+	while (i < padding) {
+		buf[i++] = ' ';
+	}
+	int ret = i;
+	while (--i >= 0) {
+		put(out, buf[i]);
+	}
+	return ret;
+}
+
+static int
+old_vsprintf(char *str, const char *fmt, va_list argp)
+{
+	struct old_out out = { str, 0 };
+	void (*put)(struct old_out *, char) = old_put;
+	int state = 0, padzero = 0, pad = 0, lng = 0;
+
+	for (size_t i = 0; fmt[i]; i++) {
+		char c = fmt[i];
+		if (state == 0) {
+			if (c == '%') {
+				state = '%';
+			} else {
+				put(&out, c);
+			}
+			continue;
+		}
+		switch (c) {
+		case '0':
+			if (pad == 0) {
+				padzero = 1;
+				continue;
+			}
+			// fallthrough
+		case '1' ... '9':
+			pad = pad * 10 + (c - '0');
+			continue;
+		case 'l':
+			lng = 1;
+			continue;
+		case 'd':
+			old_printint(put, &out, lng ? va_arg(argp, long) : va_arg(argp, int),
+			             10, 1, padzero, pad);
+			break;
+		case 'u':
+			old_printint(put, &out,
+			             lng ? va_arg(argp, unsigned long) : va_arg(argp, unsigned),
+			             10, 0, padzero, pad);
+			break;
+		case 'x':
+			old_printint(put, &out,
+			             lng ? va_arg(argp, unsigned long) : va_arg(argp, unsigned),
+			             16, 0, padzero, pad);
+			break;
+		case 's':
+			for (const char *s = va_arg(argp, const char *); *s; s++) {
+				put(&out, *s);
+			}
+			break;
+		default:
+			put(&out, c);
+			break;
+		}
+		state = pad = padzero = lng = 0;
+	}
+	out.buf[out.idx] = '\0';
+	return out.idx;
+}
+
+static int
+old_sprintf(char *str, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int ret = old_vsprintf(str, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+static volatile size_t sink;
+
+enum test { LITERAL, INTS, MIXED, NTESTS };
+static const char *test_names[NTESTS] = { "literal", "ints", "mixed" };
+
+static void
+run_one(enum test t, int old, long i, char *buf)
+{
+	switch (t) {
+	case LITERAL:
+		sink += old ? old_sprintf(buf, "a fairly long line of text with no "
+		                                "conversions in it at all\n")
+		            : snprintf(buf, 128, "a fairly long line of text with no "
+		                                 "conversions in it at all\n");
+		break;
+	case INTS:
+		sink += old ? old_sprintf(buf, "%d %u %lx %08d\n", (int)i, (unsigned)i * 7,
+		                          (unsigned long)i << 20, (int)-i)
+		            : snprintf(buf, 128, "%d %u %lx %08d\n", (int)i,
+		                       (unsigned)i * 7, (unsigned long)i << 20, (int)-i);
+		break;
+	case MIXED:
+		sink += old ? old_sprintf(buf, "[%5d] %s: %s (%ld bytes)\n", (int)(i % 4096),
+		                          "kernel", "some message here", i * 512L)
+		            : snprintf(buf, 128, "[%5d] %s: %s (%ld bytes)\n",
+		                       (int)(i % 4096), "kernel", "some message here",
+		                       i * 512L);
+		break;
+	case NTESTS:
+		break;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 200000;
+	char buf[128];
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	// Make sure the two agree before timing them.
+	char want[128];
+	old_sprintf(want, "[%5d] %s: %s (%ld bytes)\n", 42, "kernel", "msg", 99L);
+	snprintf(buf, sizeof(buf), "[%5d] %s: %s (%ld bytes)\n", 42, "kernel", "msg",
+	         99L);
+	if (strcmp(want, buf) != 0) {
+		fprintf(stderr, "output differs: '%s' vs '%s'\n", want, buf);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%ld calls per test, times in ms\n", iterations);
+	printf("%-10s %8s %8s\n", "test", "old", "new");
+	for (enum test t = 0; t < NTESTS; t++) {
+		time_t before = uptime();
+		for (long i = 0; i < iterations; i++) {
+			run_one(t, 1, i, buf);
+		}
+		time_t slow = uptime() - before;
+		before = uptime();
+		for (long i = 0; i < iterations; i++) {
+			run_one(t, 0, i, buf);
+		}
+		printf("%-10s %8ld %8ld\n", test_names[t], slow, uptime() - before);
+	}
+
+	// The same lines through a FILE, which used to go a character at a
+	// time into the stream buffer.
+	const char *path = "/printfbench.tmp";
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	time_t before = uptime();
+	for (long i = 0; i < iterations; i++) {
+		fprintf(fp, "[%5d] %s: %s (%ld bytes)\n", (int)(i % 4096), "kernel",
+		        "some message here", i * 512L);
+	}
+	fclose(fp);
+	printf("%-10s %8s %8ld\n", "fprintf", "-", uptime() - before);
+	unlink(path);
+	return 0;
+}
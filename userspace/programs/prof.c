@@ -0,0 +1,473 @@
+// Profile a command with /dev/prof and print where its time went.
+// Usage: prof [-ag] [-i ticks] [-n lines] command [args...]
+//   -a  count every process, not just the command
+//   -g  add callers and callees to the report
+//   -i  take a sample every this many timer ticks (default 1)
+//   -n  how many functions to list (default 20)
+#include <elf.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prof.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Kernel addresses are all up here.
+#define KERNEL_MIN 0xffff800000000000UL
+
+struct symbol {
+	uint64_t addr;
+	uint64_t size;
+	char *name;
+};
+
+struct func {
+	uint64_t start;
+	char *name;
+	bool kernel;
+	long self;
+	long total;
+	long stamp; // The last sample that counted towards total.
+};
+
+struct pc {
+	uint64_t pc;
+	int func;
+};
+
+struct edge {
+	int caller;
+	int callee;
+};
+
+static struct symbol *usyms;
+static size_t nusyms;
+
+static struct prof_sample *samples;
+static size_t nsamples, samples_cap;
+
+static struct func *funcs;
+static size_t nfuncs, funcs_cap;
+
+static void *
+xrealloc(void *p, size_t size)
+{
+	if ((p = realloc(p, size)) == NULL) {
+		perror("prof");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static int
+compare_symbols(const void *a, const void *b)
+{
+	uint64_t x = ((const struct symbol *)a)->addr;
+	uint64_t y = ((const struct symbol *)b)->addr;
+	return (x > y) - (x < y);
+}
+
+// Read the function symbols out of the executable at path.
+static void
+load_user_symbols(const char *path)
+{
+	Elf64_Ehdr eh;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return;
+	}
+	if (read(fd, &eh, sizeof(eh)) != sizeof(eh) ||
+	    memcmp(eh.e_ident, ELFMAG, 4) != 0 ||
+	    eh.e_shentsize != sizeof(Elf64_Shdr)) {
+		close(fd);
+		return;
+	}
+	Elf64_Shdr *sh = xrealloc(NULL, eh.e_shnum * sizeof(*sh));
+	if (pread(fd, sh, eh.e_shnum * sizeof(*sh), eh.e_shoff) !=
+	    (ssize_t)(eh.e_shnum * sizeof(*sh))) {
+		goto out;
+	}
+	for (size_t i = 0; i < eh.e_shnum; i++) {
+		if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh.e_shnum) {
+			continue;
+		}
+		Elf64_Shdr *strsh = &sh[sh[i].sh_link];
+		Elf64_Sym *syms = xrealloc(NULL, sh[i].sh_size);
+		char *strtab = xrealloc(NULL, strsh->sh_size + 1);
+		if (pread(fd, syms, sh[i].sh_size, sh[i].sh_offset) ==
+		      (ssize_t)sh[i].sh_size &&
+		    pread(fd, strtab, strsh->sh_size, strsh->sh_offset) ==
+		      (ssize_t)strsh->sh_size) {
+			strtab[strsh->sh_size] = '\0';
+			size_t n = sh[i].sh_size / sizeof(Elf64_Sym);
+			usyms = xrealloc(usyms, (nusyms + n) * sizeof(*usyms));
+			for (size_t j = 0; j < n; j++) {
+				if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC ||
+				    syms[j].st_value == 0 || syms[j].st_name >= strsh->sh_size) {
+					continue;
+				}
+				usyms[nusyms++] = (struct symbol){ syms[j].st_value, syms[j].st_size,
+					                                 strdup(&strtab[syms[j].st_name]) };
+			}
+		}
+		free(syms);
+		free(strtab);
+	}
+	qsort(usyms, nusyms, sizeof(*usyms), compare_symbols);
+out:
+	free(sh);
+	close(fd);
+}
+
+static const struct symbol *
+find_user_symbol(uint64_t pc)
+{
+	size_t lo = 0, hi = nusyms;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (usyms[mid].addr <= pc) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	const struct symbol *s = &usyms[lo - 1];
+	uint64_t end = s->size != 0 ? s->addr + s->size
+	                            : (lo < nusyms ? usyms[lo].addr : s->addr + 1);
+	return pc < end ? s : NULL;
+}
+
+static int
+add_func(uint64_t start, const char *name, bool kernel)
+{
+	for (size_t i = 0; i < nfuncs; i++) {
+		if (funcs[i].start == start && funcs[i].kernel == kernel &&
+		    strcmp(funcs[i].name, name) == 0) {
+			return i;
+		}
+	}
+	if (nfuncs == funcs_cap) {
+		funcs_cap = funcs_cap ? funcs_cap * 2 : 64;
+		funcs = xrealloc(funcs, funcs_cap * sizeof(*funcs));
+	}
+	funcs[nfuncs] = (struct func){ .start = start,
+		                             .name = strdup(name),
+		                             .kernel = kernel,
+		                             .stamp = -1 };
+	return nfuncs++;
+}
+
+// Work out which function pc is in. Addresses nobody has a symbol
+// for are lumped together by where they were.
+static int
+resolve(int fd, uint64_t pc)
+{
+	if (pc >= KERNEL_MIN) {
+		struct prof_symbol ks = { .addr = pc };
+		if (ioctl(fd, PROFIOCKSYM, &ks) == 0) {
+			return add_func(pc - ks.offset, ks.name, true);
+		}
+		return add_func(0, "[kernel]", true);
+	}
+	const struct symbol *s = find_user_symbol(pc);
+	if (s != NULL) {
+		return add_func(s->addr, s->name, false);
+	}
+	return add_func(0, "[unknown]", false);
+}
+
+static int
+compare_pcs(const void *a, const void *b)
+{
+	uint64_t x = ((const struct pc *)a)->pc;
+	uint64_t y = ((const struct pc *)b)->pc;
+	return (x > y) - (x < y);
+}
+
+static int
+compare_self(const void *a, const void *b)
+{
+	const struct func *x = a, *y = b;
+	return (y->self > x->self) - (y->self < x->self);
+}
+
+static int
+compare_total(const void *a, const void *b)
+{
+	const struct func *x = *(struct func *const *)a;
+	const struct func *y = *(struct func *const *)b;
+	return (y->total > x->total) - (y->total < x->total);
+}
+
+static int
+compare_edges(const void *a, const void *b)
+{
+	const struct edge *x = a, *y = b;
+	if (x->caller != y->caller) {
+		return x->caller - y->caller;
+	}
+	return x->callee - y->callee;
+}
+
+static void
+drain(int fd)
+{
+	ssize_t n;
+
+	for (;;) {
+		if (samples_cap - nsamples < 64) {
+			samples_cap = samples_cap ? samples_cap * 2 : 1024;
+			samples = xrealloc(samples, samples_cap * sizeof(*samples));
+		}
+		n = read(fd, samples + nsamples,
+		         (samples_cap - nsamples) * sizeof(*samples));
+		if (n <= 0) {
+			break;
+		}
+		nsamples += n / sizeof(*samples);
+	}
+}
+
+// List who calls f (by = 0) or whom f calls (by = 1), busiest first.
+static void
+print_links(const struct edge *edges, const long *counts, size_t nedges,
+            int f, int by, long total)
+{
+	enum { MAX_LINKS = 5 };
+	size_t best[MAX_LINKS];
+	size_t nbest = 0;
+
+	for (size_t i = 0; i < nedges; i++) {
+		if ((by == 0 ? edges[i].callee : edges[i].caller) != f) {
+			continue;
+		}
+		// Insertion into a short sorted list.
+		size_t j = nbest < MAX_LINKS ? nbest++ : MAX_LINKS;
+		while (j > 0 && counts[best[j - 1]] < counts[i]) {
+			if (j < MAX_LINKS) {
+				best[j] = best[j - 1];
+			}
+			j--;
+		}
+		if (j < MAX_LINKS) {
+			best[j] = i;
+		}
+	}
+	for (size_t i = 0; i < nbest; i++) {
+		const struct edge *e = &edges[best[i]];
+		const struct func *other = &funcs[by == 0 ? e->caller : e->callee];
+		printf("        %s %5.1f%%  %s%s\n", by == 0 ? "<-" : "->",
+		       100.0 * counts[best[i]] / total, other->name,
+		       other->kernel ? " [k]" : "");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	bool all = false, graph = false;
+	int interval = 1, lines = 20;
+	int c;
+
+	while ((c = getopt(argc, argv, "agi:n:")) != -1) {
+		switch (c) {
+		case 'a':
+			all = true;
+			break;
+		case 'g':
+			graph = true;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'n':
+			lines = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc || interval <= 0 || lines <= 0) {
+		goto usage;
+	}
+
+	int fd = open("/dev/prof", O_RDONLY);
+	if (fd < 0) {
+		perror("/dev/prof");
+		exit(EXIT_FAILURE);
+	}
+	drain(fd);
+	nsamples = 0;
+	if (ioctl(fd, PROFIOCSTART, interval) < 0) {
+		perror("PROFIOCSTART");
+		exit(EXIT_FAILURE);
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		close(fd);
+		execvp(argv[optind], argv + optind);
+		perror(argv[optind]);
+		_exit(127);
+	}
+	// Keep the buffers from filling up while it runs.
+	const struct timespec pause = { 0, 20 * 1000 * 1000 };
+	int status;
+	while (waitpid(pid, &status, WNOHANG) == 0) {
+		drain(fd);
+		nanosleep(&pause, NULL);
+	}
+	int dropped = ioctl(fd, PROFIOCSTOP);
+	drain(fd);
+
+	// Find the program the way execvp() did, for its symbols.
+	const char *prog = argv[optind];
+	char path[256];
+	if (strchr(prog, '/') != NULL) {
+		load_user_symbols(prog);
+	} else {
+		const char *dirs = getenv("PATH") != NULL ? getenv("PATH") : "/bin";
+		for (const char *p = dirs; nusyms == 0 && *p != '\0';) {
+			size_t len = strcspn(p, ":");
+			snprintf(path, sizeof(path), "%.*s/%s", (int)len, p, prog);
+			load_user_symbols(path);
+			p += len + (p[len] == ':');
+		}
+	}
+
+	// Keep the samples we want, with return addresses pulled back into
+	// the call instruction so that they land in the caller.
+	size_t kept = 0, kernel = 0;
+	size_t npcs = 0;
+	for (size_t i = 0; i < nsamples; i++) {
+		struct prof_sample *s = &samples[i];
+		if (!all && s->pid != pid) {
+			continue;
+		}
+		for (size_t d = 1; d < s->depth; d++) {
+			s->pcs[d]--;
+		}
+		kernel += !s->user;
+		npcs += s->depth;
+		samples[kept++] = *s;
+	}
+	nsamples = kept;
+	if (nsamples == 0) {
+		printf("no samples (%d lost)\n", dropped);
+		return 0;
+	}
+
+	// Look each distinct address up once.
+	struct pc *pcs = xrealloc(NULL, npcs * sizeof(*pcs));
+	size_t n = 0;
+	for (size_t i = 0; i < nsamples; i++) {
+		for (size_t d = 0; d < samples[i].depth; d++) {
+			pcs[n++] = (struct pc){ samples[i].pcs[d], -1 };
+		}
+	}
+	qsort(pcs, n, sizeof(*pcs), compare_pcs);
+	npcs = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (npcs == 0 || pcs[npcs - 1].pc != pcs[i].pc) {
+			pcs[npcs++] = pcs[i];
+		}
+	}
+	for (size_t i = 0; i < npcs; i++) {
+		pcs[i].func = resolve(fd, pcs[i].pc);
+	}
+
+	struct edge *edges = xrealloc(NULL, nsamples * PROF_DEPTH * sizeof(*edges));
+	size_t nedges = 0;
+	int other = add_func(0, "[other user]", false);
+	for (size_t i = 0; i < nsamples; i++) {
+		struct prof_sample *s = &samples[i];
+		int prev = -1;
+		for (size_t d = 0; d < s->depth; d++) {
+			struct pc key = { s->pcs[d], 0 };
+			struct pc *found =
+				bsearch(&key, pcs, npcs, sizeof(*pcs), compare_pcs);
+			int f = found->func;
+			// Other processes' user addresses mean nothing to the
+			// command's symbols.
+			if (s->pid != pid && s->pcs[d] < KERNEL_MIN) {
+				f = other;
+			}
+			if (d == 0) {
+				funcs[f].self++;
+			}
+			if (funcs[f].stamp != (long)i) {
+				funcs[f].stamp = i;
+				funcs[f].total++;
+			}
+			if (prev >= 0 && prev != f) {
+				edges[nedges++] = (struct edge){ f, prev };
+			}
+			prev = f;
+		}
+	}
+
+	printf("%zu samples, %zu in the kernel, %d lost\n", nsamples, kernel,
+	       dropped);
+	// Sorting funcs would scramble the indices in edges, so sort
+	// pointers for the call graph and copy for the flat profile.
+	struct func **bytotal = xrealloc(NULL, nfuncs * sizeof(*bytotal));
+	for (size_t i = 0; i < nfuncs; i++) {
+		bytotal[i] = &funcs[i];
+	}
+	qsort(bytotal, nfuncs, sizeof(*bytotal), compare_total);
+
+	if (graph) {
+		// Count each caller/callee pair.
+		qsort(edges, nedges, sizeof(*edges), compare_edges);
+		long *counts = xrealloc(NULL, (nedges + 1) * sizeof(*counts));
+		size_t m = 0;
+		for (size_t i = 0; i < nedges; i++) {
+			if (m > 0 && compare_edges(&edges[m - 1], &edges[i]) == 0) {
+				counts[m - 1]++;
+			} else {
+				edges[m] = edges[i];
+				counts[m++] = 1;
+			}
+		}
+		printf("\n  total    self  function\n");
+		for (size_t i = 0; i < nfuncs && i < (size_t)lines; i++) {
+			const struct func *f = bytotal[i];
+			int fi = f - funcs;
+			printf("%6.1f%% %6.1f%%  %s%s\n", 100.0 * f->total / nsamples,
+			       100.0 * f->self / nsamples, f->name, f->kernel ? " [k]" : "");
+			print_links(edges, counts, m, fi, 0, nsamples);
+			print_links(edges, counts, m, fi, 1, nsamples);
+		}
+		free(counts);
+	}
+
+	struct func *flat = xrealloc(NULL, nfuncs * sizeof(*flat));
+	memcpy(flat, funcs, nfuncs * sizeof(*flat));
+	qsort(flat, nfuncs, sizeof(*flat), compare_self);
+	printf("\n   self   total  function\n");
+	for (size_t i = 0; i < nfuncs && i < (size_t)lines && flat[i].self > 0;
+	     i++) {
+		printf("%6.1f%% %6.1f%%  %s%s\n", 100.0 * flat[i].self / nsamples,
+		       100.0 * flat[i].total / nsamples, flat[i].name,
+		       flat[i].kernel ? " [k]" : "");
+	}
+	return WIFSIGNALED(status) ? EXIT_FAILURE : WEXITSTATUS(status);
+
+usage:
+	fprintf(stderr, "usage: %s [-ag] [-i ticks] [-n lines] command [args...]\n",
+	        argv[0]);
+	return EXIT_FAILURE;
+}
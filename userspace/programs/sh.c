@@ -5,11 +5,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <setjmp.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
@@ -66,7 +69,349 @@ int fork1(void); // Fork but panics on failure.
 void __attribute__((noreturn)) panic(char *);
 struct cmd *parsecmd(char *);
 
-static char pwd[PATH_MAX] = "/";
+// Where a syntax error sends the parser back to.
+static jmp_buf parse_error;
+
+static void __attribute__((noreturn))
+syntax(char *s)
+{
+	fprintf(stderr, "%s\n", s);
+	longjmp(parse_error, 1);
+}
+
+// Commands found in PATH, so that running one again costs a single
+// exec rather than one failed exec per directory in front of it.
+#define HASH_SIZE 64
+
+struct hashent {
+	char *name;
+	char *path;
+	struct hashent *next;
+};
+
+static struct hashent *path_hash[HASH_SIZE];
+
+static unsigned
+hash_name(const char *name)
+{
+	unsigned h = 5381;
+	while (*name != '\0') {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h % HASH_SIZE;
+}
+
+static void
+hash_forget(const char *name)
+{
+	for (struct hashent **pp = &path_hash[hash_name(name)]; *pp != NULL;
+	     pp = &(*pp)->next) {
+		struct hashent *e = *pp;
+		if (strcmp(e->name, name) == 0) {
+			*pp = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+			return;
+		}
+	}
+}
+
+static void
+hash_clear(void)
+{
+	for (int i = 0; i < HASH_SIZE; i++) {
+		while (path_hash[i] != NULL) {
+			hash_forget(path_hash[i]->name);
+		}
+	}
+}
+
+// Return the file to run for name, or NULL if PATH has no such
+// program.
+static const char *
+find_command(const char *name)
+{
+	static char buf[PATH_MAX];
+
+	if (strchr(name, '/') != NULL) {
+		return name;
+	}
+	unsigned h = hash_name(name);
+	for (struct hashent *e = path_hash[h]; e != NULL; e = e->next) {
+		if (strcmp(e->name, name) == 0) {
+			return e->path;
+		}
+	}
+
+	const char *path = getenv("PATH");
+	if (path == NULL) {
+		path = "/bin";
+	}
+	for (const char *p = path;; p++) {
+		const char *end = p;
+		while (*end != '\0' && *end != ':') {
+			end++;
+		}
+		int n = snprintf(buf, sizeof(buf), "%.*s/%s", (int)(end - p), p, name);
+		if (n < sizeof(buf) && access(buf, X_OK) == 0) {
+			struct hashent *e = malloc(sizeof(*e));
+			if (e == NULL) {
+				return buf;
+			}
+			e->name = strdup(name);
+			e->path = strdup(buf);
+			if (e->name == NULL || e->path == NULL) {
+				free(e->name);
+				free(e->path);
+				free(e);
+				return buf;
+			}
+			e->next = path_hash[h];
+			path_hash[h] = e;
+			return e->path;
+		}
+		if (*end == '\0') {
+			return NULL;
+		}
+		p = end;
+	}
+}
+
+// Builtins. They run in the shell itself when they can, and return
+// an exit status.
+static int
+builtin_cd(int argc, char **argv)
+{
+	char *dir = argv[1];
+
+	if (argc < 2) {
+		dir = getenv("HOME");
+		if (dir == NULL) {
+			fprintf(stderr, "$HOME is not set. It is needed for `cd'"
+			                " without arguments.\n");
+			return 1;
+		}
+	}
+	if (chdir(dir) < 0) {
+		fprintf(stderr, "cannot cd %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static int
+builtin_echo(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		fputs(argv[i], stdout);
+		if (i + 1 < argc) {
+			putchar(' ');
+		}
+	}
+	putchar('\n');
+	return 0;
+}
+
+static int
+builtin_exit(int argc, char **argv)
+{
+	fflush(stdout);
+	exit(argc > 1 ? atoi(argv[1]) : 0);
+}
+
+static int
+builtin_false(int argc, char **argv)
+{
+	return 1;
+}
+
+static int
+builtin_hash(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+		hash_clear();
+		return 0;
+	}
+	for (int i = 0; i < HASH_SIZE; i++) {
+		for (struct hashent *e = path_hash[i]; e != NULL; e = e->next) {
+			printf("%s\t%s\n", e->name, e->path);
+		}
+	}
+	return 0;
+}
+
+static int
+builtin_pwd(int argc, char **argv)
+{
+	char buf[PATH_MAX];
+
+	if (getcwd(buf, sizeof(buf)) == NULL) {
+		perror("pwd");
+		return 1;
+	}
+	puts(buf);
+	return 0;
+}
+
+static int
+builtin_true(int argc, char **argv)
+{
+	return 0;
+}
+
+static bool
+test_integers(const char *a, const char *b, long *x, long *y)
+{
+	char *end;
+
+	*x = strtol(a, &end, 10);
+	if (*a == '\0' || *end != '\0') {
+		return false;
+	}
+	*y = strtol(b, &end, 10);
+	return *b != '\0' && *end == '\0';
+}
+
+// Evaluate a test(1) expression of at most four arguments, the way
+// POSIX decides by how many there are. Returns 0 for true, 1 for
+// false and 2 for a malformed expression.
+static int
+test_expr(int argc, char **argv)
+{
+	struct stat st;
+	long x, y;
+
+	switch (argc) {
+	case 0:
+		return 1;
+	case 1:
+		return argv[0][0] == '\0';
+	case 2:
+		if (strcmp(argv[0], "!") == 0) {
+			return !test_expr(1, argv + 1);
+		}
+		if (argv[0][0] != '-' || argv[0][1] == '\0' || argv[0][2] != '\0') {
+			return 2;
+		}
+		switch (argv[0][1]) {
+		case 'n':
+			return argv[1][0] == '\0';
+		case 'z':
+			return argv[1][0] != '\0';
+		case 'e':
+			return stat(argv[1], &st) < 0;
+		case 'f':
+			return stat(argv[1], &st) < 0 || !S_ISREG(st.st_mode);
+		case 'd':
+			return stat(argv[1], &st) < 0 || !S_ISDIR(st.st_mode);
+		case 's':
+			return stat(argv[1], &st) < 0 || st.st_size == 0;
+		case 'h':
+		case 'L':
+			return lstat(argv[1], &st) < 0 || !S_ISLNK(st.st_mode);
+		case 'r':
+			return access(argv[1], R_OK) < 0;
+		case 'w':
+			return access(argv[1], W_OK) < 0;
+		case 'x':
+			return access(argv[1], X_OK) < 0;
+		default:
+			return 2;
+		}
+	case 3:
+		if (strcmp(argv[1], "=") == 0) {
+			return strcmp(argv[0], argv[2]) != 0;
+		}
+		if (strcmp(argv[1], "!=") == 0) {
+			return strcmp(argv[0], argv[2]) == 0;
+		}
+		if (strcmp(argv[0], "!") == 0) {
+			int ret = test_expr(2, argv + 1);
+			return ret == 2 ? 2 : !ret;
+		}
+		if (!test_integers(argv[0], argv[2], &x, &y)) {
+			return 2;
+		}
+		if (strcmp(argv[1], "-eq") == 0) {
+			return !(x == y);
+		}
+		if (strcmp(argv[1], "-ne") == 0) {
+			return !(x != y);
+		}
+		if (strcmp(argv[1], "-lt") == 0) {
+			return !(x < y);
+		}
+		if (strcmp(argv[1], "-le") == 0) {
+			return !(x <= y);
+		}
+		if (strcmp(argv[1], "-gt") == 0) {
+			return !(x > y);
+		}
+		if (strcmp(argv[1], "-ge") == 0) {
+			return !(x >= y);
+		}
+		return 2;
+	case 4:
+		if (strcmp(argv[0], "!") == 0) {
+			int ret = test_expr(3, argv + 1);
+			return ret == 2 ? 2 : !ret;
+		}
+		return 2;
+	default:
+		return 2;
+	}
+}
+
+static int
+builtin_test(int argc, char **argv)
+{
+	if (strcmp(argv[0], "[") == 0) {
+		if (strcmp(argv[argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing ]\n");
+			return 2;
+		}
+		argc--;
+	}
+	int ret = test_expr(argc - 1, argv + 1);
+	if (ret == 2) {
+		fprintf(stderr, "%s: bad expression\n", argv[0]);
+	}
+	return ret;
+}
+
+static const struct builtin {
+	const char *name;
+	int (*fn)(int argc, char **argv);
+} builtins[] = {
+	{ "[", builtin_test },     { "cd", builtin_cd },       { "echo", builtin_echo },
+	{ "exit", builtin_exit },  { "false", builtin_false }, { "hash", builtin_hash },
+	{ "pwd", builtin_pwd },    { "test", builtin_test },   { "true", builtin_true },
+};
+
+static const struct builtin *
+find_builtin(const char *name)
+{
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+		if (strcmp(builtins[i].name, name) == 0) {
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
+
+static int
+run_builtin(const struct builtin *b, char **argv)
+{
+	int argc = 0;
+	while (argv[argc] != NULL) {
+		argc++;
+	}
+	int ret = b->fn(argc, argv);
+	fflush(stdout);
+	return ret;
+}
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
@@ -90,9 +435,17 @@ runcmd(struct cmd *cmd)
 		if (ecmd->argv[0] == NULL) {
 			exit(1);
 		}
+		const struct builtin *b = find_builtin(ecmd->argv[0]);
+		if (b != NULL) {
+			exit(run_builtin(b, ecmd->argv));
+		}
 
-		execvp(ecmd->argv[0], ecmd->argv);
-		fprintf(stderr, "exec %s failed: %s\n", ecmd->argv[0], strerror(errno));
+		const char *path = find_command(ecmd->argv[0]);
+		if (path != NULL) {
+			execve(path, ecmd->argv, environ);
+		}
+		fprintf(stderr, "exec %s failed: %s\n", ecmd->argv[0],
+		        strerror(path == NULL ? ENOENT : errno));
 		exit(-1);
 		break;
 
@@ -153,6 +506,193 @@ runcmd(struct cmd *cmd)
 	exit(0);
 }
 
+// If cmd is a program from PATH run with nothing but redirections
+// around it, return its execcmd and queue the redirections in fa.
+static struct execcmd *
+simple_command(struct cmd *cmd, posix_spawn_file_actions_t *fa)
+{
+	// Redirections nest outermost first, the order runcmd() opens them.
+	while (cmd->type == REDIR) {
+		struct redircmd *rcmd = (struct redircmd *)cmd;
+		if (posix_spawn_file_actions_addopen(fa, rcmd->fd, rcmd->file,
+		                                     rcmd->flags, 0777) != 0) {
+			return NULL;
+		}
+		cmd = rcmd->cmd;
+	}
+	if (cmd->type != EXEC) {
+		return NULL;
+	}
+	struct execcmd *ecmd = (struct execcmd *)cmd;
+	if (ecmd->argv[0] == NULL || find_builtin(ecmd->argv[0]) != NULL) {
+		return NULL;
+	}
+	return ecmd;
+}
+
+// Start cmd with in and out, if not -1, as its stdin and stdout, and
+// with extra closed. Simple commands are spawned without copying the
+// shell; anything else gets a forked shell to run it. Returns the pid,
+// or -1 if the command could not be started.
+static pid_t
+start(struct cmd *cmd, int in, int out, int extra)
+{
+	posix_spawn_file_actions_t fa;
+	struct execcmd *ecmd;
+	pid_t pid = -1;
+
+	if (cmd == NULL) {
+		return -1;
+	}
+	posix_spawn_file_actions_init(&fa);
+	if (in >= 0) {
+		posix_spawn_file_actions_adddup2(&fa, in, 0);
+		posix_spawn_file_actions_addclose(&fa, in);
+	}
+	if (out >= 0) {
+		posix_spawn_file_actions_adddup2(&fa, out, 1);
+		posix_spawn_file_actions_addclose(&fa, out);
+	}
+	if (extra >= 0) {
+		posix_spawn_file_actions_addclose(&fa, extra);
+	}
+	fflush(stdout);
+	if ((ecmd = simple_command(cmd, &fa)) != NULL) {
+		const char *path = find_command(ecmd->argv[0]);
+		int err = ENOENT;
+		if (path != NULL) {
+			err = posix_spawn(&pid, path, &fa, NULL, ecmd->argv, environ);
+			if (err == ENOENT && path != ecmd->argv[0]) {
+				// The program moved since we found it.
+				hash_forget(ecmd->argv[0]);
+				path = find_command(ecmd->argv[0]);
+				if (path != NULL) {
+					err = posix_spawn(&pid, path, &fa, NULL, ecmd->argv, environ);
+				}
+			}
+		}
+		if (err != 0) {
+			fprintf(stderr, "exec %s failed: %s\n", ecmd->argv[0], strerror(err));
+			pid = -1;
+		}
+	} else {
+		pid = fork1();
+		if (pid == 0) {
+			if (in >= 0) {
+				dup2(in, 0);
+				close(in);
+			}
+			if (out >= 0) {
+				dup2(out, 1);
+				close(out);
+			}
+			if (extra >= 0) {
+				close(extra);
+			}
+			runcmd(cmd);
+		}
+	}
+	posix_spawn_file_actions_destroy(&fa);
+	return pid;
+}
+
+// Status for a command that never ran, as waitpid() would report it.
+#define FAILED_STATUS (255 << 8)
+
+static int
+wait_for(pid_t pid)
+{
+	int status;
+
+	if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+		return FAILED_STATUS;
+	}
+	return status;
+}
+
+// Run cmd from the shell itself, and return its status the way
+// waitpid() reports it. *pidp is the process that status came from,
+// or 0 if a builtin ran in the shell.
+static int
+run(struct cmd *cmd, pid_t *pidp)
+{
+	struct execcmd *ecmd;
+	struct listcmd *lcmd;
+	const struct builtin *b;
+	pid_t pid;
+	int status;
+
+	*pidp = 0;
+	if (cmd == NULL) {
+		return 1 << 8;
+	}
+	switch (cmd->type) {
+	case EXEC:
+		ecmd = (struct execcmd *)cmd;
+		if (ecmd->argv[0] == NULL) {
+			return 0;
+		}
+		if ((b = find_builtin(ecmd->argv[0])) != NULL) {
+			return (run_builtin(b, ecmd->argv) & 0xff) << 8;
+		}
+		// fallthrough
+	case REDIR:
+		pid = start(cmd, -1, -1, -1);
+		*pidp = pid > 0 ? pid : 0;
+		return wait_for(pid);
+
+	case PIPE: {
+		// Start every stage from here, each reading the pipe the one
+		// before it writes.
+		pid_t pids[MAXARG];
+		int n = 0;
+		int in = -1;
+		while (cmd->type == PIPE) {
+			struct pipecmd *pcmd = (struct pipecmd *)cmd;
+			int p[2];
+			if (pipe(p) < 0) {
+				perror("pipe");
+				break;
+			}
+			pid = start(pcmd->left, in, p[1], p[0]);
+			close(p[1]);
+			if (in >= 0) {
+				close(in);
+			}
+			in = p[0];
+			if (pid > 0 && n < MAXARG - 1) {
+				pids[n++] = pid;
+			}
+			cmd = pcmd->right;
+		}
+		pid = start(cmd, in, -1, -1);
+		*pidp = pid > 0 ? pid : 0;
+		if (in >= 0) {
+			close(in);
+		}
+		status = wait_for(pid);
+		for (int i = 0; i < n; i++) {
+			wait_for(pids[i]);
+		}
+		return status;
+	}
+
+	case LIST:
+		lcmd = (struct listcmd *)cmd;
+		run(lcmd->left, pidp);
+		return run(lcmd->right, pidp);
+
+	case BACK:
+		// runcmd() leaves the command to init, which reaps it.
+		pid = start(cmd, -1, -1, -1);
+		*pidp = pid > 0 ? pid : 0;
+		return wait_for(pid);
+
+	default:
+		panic("run");
+	}
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -172,7 +712,7 @@ main(int argc, char *argv[])
 	int fd;
 	int c;
 	bool iflag = false;
-	bool cflag = false;
+	pid_t pid;
 
 	// Ensure that three file descriptors are open.
 	while ((fd = open("console", O_RDWR)) >= 0) {
@@ -196,13 +736,8 @@ main(int argc, char *argv[])
 			}
 			argsbuf[ARG_MAX - 1] = '\0';
 
-			int status;
-			int pid = fork1();
-			if (pid == 0) {
-				runcmd(parsecmd(argsbuf));
-			}
-			pid = waitpid(pid, &status, 0);
 			// We return whatever status is returned from the program we ran.
+			int status = run(parsecmd(argsbuf), &pid);
 			exit(WEXITSTATUS(status));
 		default:
 			break;
@@ -233,45 +768,17 @@ main(int argc, char *argv[])
 		}
 	}
 
-	// TODO make more general builtin parser.
 	// Read and run input commands.
 	while (getcmd(buf, sizeof(buf)) >= 0) {
-		if (buf[0] == 'c' && buf[1] == 'd' && isspace(buf[2])) {
-			// Chdir must be called by the parent, not the child.
-			buf[strlen(buf) - 1] = 0; // chop \n
-			if (strlen(buf) >= 3) {
-				if (chdir(buf + 3) < 0) {
-					fprintf(stderr, "cannot cd %s: %s\n", buf + 3, strerror(errno));
-				} else {
-					strcpy(pwd, buf);
-				}
-				continue;
-			} else {
-				char *home = getenv("HOME");
-				if (home == NULL) {
-					fprintf(stderr, "$HOME is not set. It is needed for `cd'"
-					                " without arguments.\n");
-					exit(1);
-				}
-				// `cd' with no arguments.`
-				if (chdir(home) < 0) {
-					fprintf(stderr, "cannot cd %s: %s\n", buf + 3, strerror(errno));
-				} else {
-					strcpy(pwd, buf);
-				}
-				continue;
-			}
-		}
-		int status;
-		int pid = fork1();
-		if (pid == 0) {
-			runcmd(parsecmd(buf));
+		struct cmd *cmd = parsecmd(buf);
+		int status = run(cmd, &pid);
+		if (cmd == NULL) {
+			continue;
 		}
-		pid = waitpid(pid, &status, 0);
 		if (WIFSIGNALED(status)) {
 			fprintf(stderr, "pid %d: %s (%d)\n", pid, strsignal(WTERMSIG(status)),
 			        WEXITSTATUS(status));
-		} else if (WEXITSTATUS(status) != 0 && buf[0] != '\n') {
+		} else if (WEXITSTATUS(status) != 0 && pid != 0) {
 			fprintf(stderr, "ERROR: pid %d returned with status %d\n", pid,
 			        WEXITSTATUS(status));
 		}
@@ -291,6 +798,7 @@ fork1(void)
 {
 	int pid;
 
+	fflush(stdout);
 	pid = fork();
 	if (pid == -1) {
 		panic("fork");
@@ -444,12 +952,15 @@ parsecmd(char *s)
 	char *es;
 	struct cmd *cmd;
 
+	if (setjmp(parse_error) != 0) {
+		return NULL;
+	}
 	es = s + strlen(s);
 	cmd = parseline(&s, es);
 	peek(&s, es, "");
 	if (s != es) {
 		fprintf(stderr, "leftovers: %s\n", s);
-		panic("syntax error");
+		syntax("syntax error");
 	}
 	nulterminate(cmd);
 	return cmd;
@@ -494,7 +1005,7 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 	while (peek(ps, es, "<>")) {
 		tok = gettoken(ps, es, NULL, NULL);
 		if (gettoken(ps, es, &q, &eq) != 'a') {
-			panic("missing file for redirection");
+			syntax("missing file for redirection");
 		}
 		switch (tok) {
 		case '<':
@@ -517,12 +1028,12 @@ parseblock(char **ps, char *es)
 	struct cmd *cmd;
 
 	if (!peek(ps, es, "(")) {
-		panic("parseblock");
+		syntax("parseblock");
 	}
 	gettoken(ps, es, NULL, NULL);
 	cmd = parseline(ps, es);
 	if (!peek(ps, es, ")")) {
-		panic("syntax - missing )");
+		syntax("syntax - missing )");
 	}
 	gettoken(ps, es, NULL, NULL);
 	cmd = parseredirs(cmd, ps, es);
@@ -551,13 +1062,13 @@ parseexec(char **ps, char *es)
 			break;
 		}
 		if (tok != 'a') {
-			panic("syntax error: expected `a'");
+			syntax("syntax error: expected `a'");
 		}
 		cmd->argv[argc] = q;
 		cmd->eargv[argc] = eq;
 		argc++;
 		if (argc >= MAXARG) {
-			panic("too many args");
+			syntax("too many args");
 		}
 		ret = parseredirs(ret, ps, es);
 	}
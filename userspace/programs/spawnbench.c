@@ -0,0 +1,177 @@
+// Time process creation with fork(), vfork() and posix_spawn(), and
+// the shell running a script with and without its builtins.
+// Usage: spawnbench [iterations] [megabytes of memory to drag along]
+#include <ext.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SCRIPT "/spawnbench.sh"
+
+extern char **environ;
+
+static char *echo_argv[] = { "echo", "hi", NULL };
+static int null_fd;
+
+static void
+check(pid_t pid, const char *what)
+{
+	int status;
+
+	if (pid < 0) {
+		perror(what);
+		exit(EXIT_FAILURE);
+	}
+	if (waitpid(pid, &status, 0) < 0 || WIFSIGNALED(status) ||
+	    WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "%s: child failed\n", what);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+with_fork(void)
+{
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(null_fd, STDOUT_FILENO);
+		execvp(echo_argv[0], echo_argv);
+		_exit(127);
+	}
+	check(pid, "fork");
+}
+
+static void
+with_vfork(void)
+{
+	pid_t pid = vfork();
+	if (pid == 0) {
+		dup2(null_fd, STDOUT_FILENO);
+		execvp(echo_argv[0], echo_argv);
+		_exit(127);
+	}
+	check(pid, "vfork");
+}
+
+static void
+with_spawn(void)
+{
+	posix_spawn_file_actions_t fa;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, null_fd, STDOUT_FILENO);
+	int err = posix_spawnp(&pid, echo_argv[0], &fa, NULL, echo_argv, environ);
+	posix_spawn_file_actions_destroy(&fa);
+	if (err != 0) {
+		fprintf(stderr, "posix_spawnp: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	check(pid, "posix_spawnp");
+}
+
+static void
+write_script(long lines, int builtins)
+{
+	FILE *fp = fopen(SCRIPT, "w");
+
+	if (fp == NULL) {
+		perror(SCRIPT);
+		exit(EXIT_FAILURE);
+	}
+	for (long i = 0; i < lines; i++) {
+		switch (i % 4) {
+		case 0:
+			fprintf(fp, "%s line %ld\n", builtins ? "echo" : "/bin/echo", i);
+			break;
+		case 1:
+			fprintf(fp, "%s -n %ld ]\n", builtins ? "[" : "/bin/[", i);
+			break;
+		case 2:
+			fprintf(fp, "echo %ld | wc\n", i);
+			break;
+		case 3:
+			fprintf(fp, "ls / > /dev/null\n");
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+static time_t
+run_script(void)
+{
+	time_t before = uptime();
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		int fd = open(SCRIPT, O_RDONLY);
+		if (fd < 0) {
+			perror(SCRIPT);
+			_exit(127);
+		}
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+		dup2(null_fd, STDOUT_FILENO);
+		execlp("sh", "sh", (char *)NULL);
+		_exit(127);
+	}
+	check(pid, "sh");
+	return uptime() - before;
+}
+
+int
+main(int argc, char **argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 200;
+	long ballast = argc > 2 ? atol(argv[2]) : 4;
+
+	if (iterations <= 0 || ballast < 0) {
+		fprintf(stderr, "usage: %s [iterations] [megabytes]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if ((null_fd = open("/dev/null", O_WRONLY)) < 0) {
+		perror("/dev/null");
+		exit(EXIT_FAILURE);
+	}
+	// fork() copies all of this every time; the others do not.
+	char *mem = malloc(ballast << 20 | 1);
+	if (mem == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(mem, 1, ballast << 20);
+
+	static const struct {
+		const char *name;
+		void (*fn)(void);
+	} tests[] = {
+		{ "fork+exec", with_fork },
+		{ "vfork+exec", with_vfork },
+		{ "posix_spawn", with_spawn },
+	};
+	printf("%ld children, %ld MiB of memory, times in ms\n", iterations,
+	       ballast);
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		time_t before = uptime();
+		for (long j = 0; j < iterations; j++) {
+			tests[i].fn();
+		}
+		time_t ms = uptime() - before;
+		printf("%-12s %8ld %8ld us/child\n", tests[i].name, ms,
+		       ms * 1000 / iterations);
+	}
+	free(mem);
+
+	printf("sh < script, %ld lines\n", iterations);
+	write_script(iterations, 0);
+	printf("%-12s %8ld\n", "external", run_script());
+	write_script(iterations, 1);
+	printf("%-12s %8ld\n", "builtins", run_script());
+	unlink(SCRIPT);
+	return 0;
+}
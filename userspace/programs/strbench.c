@@ -0,0 +1,151 @@
+// Compare libc's memcpy(), memset(), memcmp(), strlen() and memchr()
+// with plain byte loops. Usage: strbench [megabytes per test]
+#include <ext.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keep the compiler from turning the loops back into library calls.
+#define BYTEWISE __attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+
+static BYTEWISE void *
+byte_memcpy(void *dst, const void *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		((char *)dst)[i] = ((const char *)src)[i];
+	}
+	return dst;
+}
+
+static BYTEWISE void *
+byte_memset(void *dst, int c, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		((char *)dst)[i] = c;
+	}
+	return dst;
+}
+
+static BYTEWISE int
+byte_memcmp(const void *a, const void *b, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (((const uint8_t *)a)[i] != ((const uint8_t *)b)[i]) {
+			return ((const uint8_t *)a)[i] - ((const uint8_t *)b)[i];
+		}
+	}
+	return 0;
+}
+
+static BYTEWISE size_t
+byte_strlen(const char *s)
+{
+	size_t n = 0;
+	while (s[n] != '\0') {
+		n++;
+	}
+	return n;
+}
+
+static BYTEWISE void *
+byte_memchr(const void *s, int c, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (((const char *)s)[i] == (char)c) {
+			return (void *)((const char *)s + i);
+		}
+	}
+	return NULL;
+}
+
+static const size_t sizes[] = { 16, 64, 256, 4096, 65536 };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+#define BUFSIZE 65536
+
+static char *src, *dst;
+// Results are added up here so the calls cannot be optimized away.
+static volatile size_t sink;
+
+enum op { MEMCPY, MEMSET, MEMCMP, STRLEN, MEMCHR, NOPS };
+static const char *op_names[NOPS] = { "memcpy", "memset", "memcmp", "strlen",
+	                                    "memchr" };
+
+static time_t
+run(enum op op, int libc, size_t size, size_t total)
+{
+	size_t reps = total / size;
+
+	// The memset() test leaves dst different from src.
+	if (op == MEMCMP) {
+		byte_memcpy(dst, src, BUFSIZE);
+	}
+	time_t before = uptime();
+
+	for (size_t r = 0; r < reps; r++) {
+		switch (op) {
+		case MEMCPY:
+			sink += libc ? (size_t)memcpy(dst, src, size)
+			             : (size_t)byte_memcpy(dst, src, size);
+			break;
+		case MEMSET:
+			sink += libc ? (size_t)memset(dst, (int)r, size)
+			             : (size_t)byte_memset(dst, (int)r, size);
+			break;
+		case MEMCMP:
+			sink += libc ? memcmp(dst, src, size) : byte_memcmp(dst, src, size);
+			break;
+		case STRLEN:
+			// src has a terminator at every size we test.
+			sink += libc ? strlen(src + BUFSIZE - size)
+			             : byte_strlen(src + BUFSIZE - size);
+			break;
+		case MEMCHR:
+			sink += libc ? (size_t)memchr(src, '\0', size)
+			             : (size_t)byte_memchr(src, '\0', size);
+			break;
+		case NOPS:
+			break;
+		}
+	}
+	return uptime() - before;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 64) << 20;
+
+	if (total == 0) {
+		fprintf(stderr, "usage: %s [megabytes per test]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	// One extra byte for strlen()'s terminator.
+	src = malloc(BUFSIZE + 1);
+	dst = malloc(BUFSIZE);
+	if (src == NULL || dst == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	byte_memset(src, 'a', BUFSIZE);
+	src[BUFSIZE - 1] = 'b';
+	src[BUFSIZE] = '\0';
+	byte_memcpy(dst, src, BUFSIZE);
+
+	printf("%dMiB per test, times in ms (bytewise / libc)\n", (int)(total >> 20));
+	printf("%-8s", "size");
+	for (enum op op = 0; op < NOPS; op++) {
+		printf("%16s", op_names[op]);
+	}
+	printf("\n");
+	for (size_t i = 0; i < NSIZES; i++) {
+		printf("%-8zu", sizes[i]);
+		for (enum op op = 0; op < NOPS; op++) {
+			time_t slow = run(op, 0, sizes[i], total);
+			time_t fast = run(op, 1, sizes[i], total);
+			printf("%9ld/%-6ld", slow, fast);
+		}
+		printf("\n");
+	}
+	return 0;
+}
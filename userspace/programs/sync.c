@@ -0,0 +1,9 @@
+// Put everything the file systems are holding back on disk.
+#include <unistd.h>
+
+int
+main(void)
+{
+	sync();
+	return 0;
+}
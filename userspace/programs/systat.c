@@ -0,0 +1,303 @@
+// Time system calls and collect kernel tracepoints with /dev/trace,
+// either while a command runs or for a while across the whole system.
+// Usage: systat [-de] [-s seconds] [command [args...]]
+//   -d  print every event as well (implies -e)
+//   -e  turn the tracepoints on too, and summarize them
+//   -s  with no command, watch for this many seconds (default 5)
+// The figures are for the whole system, systat's own calls included.
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/trace.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const event_names[TRACE_NTYPES] = {
+	[TRACE_SCHED_SWITCH] = "sched_switch",
+	[TRACE_BLOCK_SUBMIT] = "block_submit",
+	[TRACE_BLOCK_COMPLETE] = "block_complete",
+	[TRACE_PAGE_FAULT] = "page_fault",
+	[TRACE_LOG_COMMIT] = "log_commit",
+	[TRACE_INPUT] = "input",
+};
+
+static const char *const input_names[] = { "keyboard", "mouse" };
+
+struct row {
+	struct syscall_stat stat;
+	size_t num; // SYS_*
+};
+
+static struct trace_event *events;
+static size_t nevents, events_cap;
+static uint64_t tsc_khz;
+
+static void *
+xrealloc(void *p, size_t size)
+{
+	if ((p = realloc(p, size)) == NULL) {
+		perror("systat");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+// Read out whatever events are waiting.
+static void
+drain(int fd)
+{
+	ssize_t n;
+
+	do {
+		if (events_cap - nevents < 64) {
+			events_cap = events_cap * 2 + 64;
+			events = xrealloc(events, events_cap * sizeof(*events));
+		}
+		n = read(fd, events + nevents, (events_cap - nevents) * sizeof(*events));
+		if (n > 0) {
+			nevents += n / sizeof(*events);
+		}
+	} while (n > 0);
+}
+
+// Cycles in the unit the report is in: nanoseconds if the kernel
+// could measure the TSC, cycles if not.
+static uint64_t
+scale(uint64_t cycles)
+{
+	if (tsc_khz == 0) {
+		return cycles;
+	}
+	return cycles * 1000000 / tsc_khz;
+}
+
+// The histogram only says which power of two a call fell in, so
+// assume the calls are spread evenly within it.
+static uint64_t
+percentile(const struct syscall_stat *s, int pct)
+{
+	uint64_t want = (s->count * pct + 99) / 100;
+	uint64_t seen = 0;
+
+	for (int i = 0; i < SYSSTAT_BUCKETS; i++) {
+		if (s->hist[i] == 0 || seen + s->hist[i] < want) {
+			seen += s->hist[i];
+			continue;
+		}
+		uint64_t lo = i == 0 ? 0 : 1UL << i;
+		uint64_t hi = 1UL << (i + 1);
+		uint64_t v = lo + (hi - lo) * (want - seen) / s->hist[i];
+		return v < s->max ? v : s->max;
+	}
+	return s->max;
+}
+
+// Most total time first.
+static int
+compare_total(const void *a, const void *b)
+{
+	uint64_t x = ((const struct row *)a)->stat.cycles;
+	uint64_t y = ((const struct row *)b)->stat.cycles;
+	return (x < y) - (x > y);
+}
+
+static int
+compare_tsc(const void *a, const void *b)
+{
+	uint64_t x = ((const struct trace_event *)a)->tsc;
+	uint64_t y = ((const struct trace_event *)b)->tsc;
+	return (x > y) - (x < y);
+}
+
+static void
+report_syscalls(void)
+{
+	int fd = open("/dev/sysstat", O_RDONLY);
+	static struct syscall_stat stats[SYSCALL_AMT + 1];
+
+	if (fd < 0) {
+		perror("/dev/sysstat");
+		exit(EXIT_FAILURE);
+	}
+	ssize_t n = read(fd, stats, sizeof(stats));
+	close(fd);
+	if (n < 0) {
+		perror("/dev/sysstat");
+		exit(EXIT_FAILURE);
+	}
+	size_t nstats = n / sizeof(*stats);
+	static struct row rows[SYSCALL_AMT + 1];
+	size_t nrows = 0;
+	for (size_t i = 0; i < nstats; i++) {
+		if (stats[i].count != 0) {
+			rows[nrows++] = (struct row){ stats[i], i };
+		}
+	}
+	qsort(rows, nrows, sizeof(*rows), compare_total);
+
+	const char *unit = tsc_khz != 0 ? "ns" : "cycles";
+	printf("%-14s %8s %10s %10s %10s %10s  (%s)\n", "syscall", "count", "avg",
+	       "p50", "p99", "max", unit);
+	for (size_t i = 0; i < nrows; i++) {
+		const struct syscall_stat *s = &rows[i].stat;
+		const char *name = syscall_names[rows[i].num] != NULL ?
+		                     syscall_names[rows[i].num] :
+		                     "?";
+		printf("%-14s %8lu %10lu %10lu %10lu %10lu\n", name, s->count,
+		       scale(s->cycles / s->count), scale(percentile(s, 50)),
+		       scale(percentile(s, 99)), scale(s->max));
+	}
+}
+
+static void
+report_events(bool dump, uint64_t dropped)
+{
+	size_t counts[TRACE_NTYPES] = { 0 };
+	uint64_t commit_cycles = 0;
+	uint64_t io_cycles = 0, io_done = 0;
+	uint64_t input_cycles[2] = { 0 }, input_count[2] = { 0 };
+
+	qsort(events, nevents, sizeof(*events), compare_tsc);
+	for (size_t i = 0; i < nevents; i++) {
+		struct trace_event *e = &events[i];
+		if (e->type >= TRACE_NTYPES) {
+			continue;
+		}
+		counts[e->type]++;
+		if (dump) {
+			printf("%16lu cpu%-3u pid %-5d %-14s %#lx %#lx\n", e->tsc, e->cpu,
+			       e->pid, event_names[e->type], e->arg0, e->arg1);
+		}
+		if (e->type == TRACE_LOG_COMMIT) {
+			commit_cycles += e->arg1;
+		}
+		if (e->type == TRACE_INPUT && e->arg0 < 2) {
+			input_cycles[e->arg0] += e->arg1;
+			input_count[e->arg0]++;
+		}
+		// A request completes after the last submit of the same
+		// sector.
+		if (e->type == TRACE_BLOCK_COMPLETE) {
+			for (size_t j = i; j-- > 0;) {
+				if (events[j].type == TRACE_BLOCK_SUBMIT &&
+				    events[j].arg0 == e->arg0) {
+					io_cycles += e->tsc - events[j].tsc;
+					io_done++;
+					break;
+				}
+			}
+		}
+	}
+	printf("\n%-14s %8s\n", "event", "count");
+	for (int t = 1; t < TRACE_NTYPES; t++) {
+		printf("%-14s %8zu\n", event_names[t], counts[t]);
+	}
+	const char *unit = tsc_khz != 0 ? "ns" : "cycles";
+	if (io_done != 0) {
+		printf("block I/O: %lu %s on average\n", scale(io_cycles / io_done), unit);
+	}
+	if (counts[TRACE_LOG_COMMIT] != 0) {
+		printf("log commit: %lu %s on average\n",
+		       scale(commit_cycles / counts[TRACE_LOG_COMMIT]), unit);
+	}
+	for (int i = 0; i < 2; i++) {
+		if (input_count[i] != 0) {
+			printf("%s: %lu %s from interrupt to read on average\n",
+			       input_names[i], scale(input_cycles[i] / input_count[i]), unit);
+		}
+	}
+	if (dropped != 0) {
+		printf("%lu events lost to full buffers\n", dropped);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	bool dump = false, trace = false;
+	int seconds = 5;
+	int c;
+
+	while ((c = getopt(argc, argv, "des:")) != -1) {
+		switch (c) {
+		case 'd':
+			dump = true;
+			trace = true;
+			break;
+		case 'e':
+			trace = true;
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (seconds <= 0) {
+		goto usage;
+	}
+
+	int fd = open("/dev/trace", O_RDONLY);
+	if (fd < 0) {
+		perror("/dev/trace");
+		exit(EXIT_FAILURE);
+	}
+	if (ioctl(fd, TRACEIOCSTART, trace ? TRACE_ALL : TRACE_SYSCALLS) < 0) {
+		perror("TRACEIOCSTART");
+		exit(EXIT_FAILURE);
+	}
+
+	// Keep the buffers from filling up while it runs.
+	const struct timespec pause = { 0, 20 * 1000 * 1000 };
+	if (optind < argc) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			close(fd);
+			execvp(argv[optind], argv + optind);
+			perror(argv[optind]);
+			_exit(127);
+		}
+		int status;
+		while (waitpid(pid, &status, WNOHANG) == 0) {
+			drain(fd);
+			nanosleep(&pause, NULL);
+		}
+	} else {
+		for (int i = 0; i < seconds * 50; i++) {
+			drain(fd);
+			nanosleep(&pause, NULL);
+		}
+	}
+	ioctl(fd, TRACEIOCSTOP);
+	drain(fd);
+
+	struct trace_info info;
+	if (ioctl(fd, TRACEIOCINFO, &info) < 0) {
+		perror("TRACEIOCINFO");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	tsc_khz = info.tsc_khz;
+
+	report_syscalls();
+	if (trace) {
+		report_events(dump, info.dropped);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-de] [-s seconds] [command [args...]]\n",
+	        argv[0]);
+	exit(EXIT_FAILURE);
+}
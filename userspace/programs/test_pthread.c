@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define NTHREADS 4
+#define ITERS 10000
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static long counter;
+static int ready;
+
+static void *
+add(void *arg)
+{
+	for (int i = 0; i < ITERS; i++) {
+		pthread_mutex_lock(&lock);
+		counter++;
+		pthread_mutex_unlock(&lock);
+	}
+	// errno is per-thread.
+	errno = (int)(intptr_t)arg;
+	assert(getpid() != gettid());
+	return (void *)(intptr_t)errno;
+}
+
+static void *
+waiter(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	while (!ready) {
+		pthread_cond_wait(&cond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+	pthread_exit(arg);
+}
+
+int
+main(void)
+{
+	pthread_t t[NTHREADS];
+
+	errno = 0;
+	for (intptr_t i = 0; i < NTHREADS; i++) {
+		assert(pthread_create(&t[i], NULL, add, (void *)(i + 1)) == 0);
+	}
+	for (intptr_t i = 0; i < NTHREADS; i++) {
+		void *ret;
+		assert(pthread_join(t[i], &ret) == 0);
+		assert(ret == (void *)(i + 1));
+	}
+	assert(errno == 0);
+	assert(counter == NTHREADS * ITERS);
+	assert(getpid() == gettid());
+
+	pthread_t w;
+	assert(pthread_create(&w, NULL, waiter, (void *)42) == 0);
+	pthread_mutex_lock(&lock);
+	ready = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	void *ret;
+	assert(pthread_join(w, &ret) == 0);
+	assert(ret == (void *)42);
+
+	assert(pthread_join(pthread_self(), NULL) == EDEADLK);
+	printf("test_pthread: all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	const char *path = "/test_uio.tmp";
+	int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	assert(fd >= 0);
+
+	// writev() must walk the vectors, not repeat the first one.
+	struct iovec out[3] = {
+		{ "abc", 3 },
+		{ "", 0 },
+		{ "defgh", 5 },
+	};
+	assert(writev(fd, out, 3) == 8);
+	assert(lseek(fd, 0, SEEK_CUR) == 8);
+
+	// Positional I/O leaves the file offset alone.
+	char buf[16] = { 0 };
+	assert(pread(fd, buf, 4, 2) == 4);
+	assert(memcmp(buf, "cdef", 4) == 0);
+	assert(pwrite(fd, "XY", 2, 1) == 2);
+	assert(lseek(fd, 0, SEEK_CUR) == 8);
+
+	char a[2], b[4], c[8];
+	struct iovec in[3] = {
+		{ a, sizeof(a) },
+		{ b, sizeof(b) },
+		{ c, sizeof(c) },
+	};
+	assert(preadv(fd, in, 3, 0) == 8);
+	assert(memcmp(a, "aX", 2) == 0);
+	assert(memcmp(b, "Ydef", 4) == 0);
+	assert(memcmp(c, "gh", 2) == 0);
+
+	assert(lseek(fd, 6, SEEK_SET) == 6);
+	assert(readv(fd, in, 3) == 2);
+	assert(memcmp(a, "gh", 2) == 0);
+
+	struct iovec tail[2] = {
+		{ "12", 2 },
+		{ "34", 2 },
+	};
+	assert(pwritev(fd, tail, 2, 8) == 4);
+	assert(pread(fd, buf, sizeof(buf), 0) == 12);
+	assert(memcmp(buf, "aXYdefgh1234", 12) == 0);
+
+	// Pipes cannot seek.
+	int p[2];
+	assert(pipe(p) == 0);
+	assert(pwrite(p[1], "x", 1, 0) < 0);
+	close(p[0]);
+	close(p[1]);
+
+	close(fd);
+	unlink(path);
+	printf("test_uio: all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+// Time creating, writing and unlinking files on the disk and on the
+// tmpfs at /tmp. Usage: tmpbench [files] [kilobytes per file]
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct times {
+	time_t create;
+	time_t write;
+	time_t unlink;
+};
+
+static void
+path_of(char *path, size_t n, const char *dir, int i)
+{
+	snprintf(path, n, "%s/file%04d", dir, i);
+}
+
+static struct times
+run(const char *dir, int nfiles, const char *buf, size_t size)
+{
+	struct times t;
+	char path[64];
+
+	if (mkdir(dir, 0755) < 0) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+	time_t before = uptime();
+	for (int i = 0; i < nfiles; i++) {
+		path_of(path, sizeof(path), dir, i);
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	}
+	t.create = uptime() - before;
+
+	before = uptime();
+	for (int i = 0; i < nfiles; i++) {
+		path_of(path, sizeof(path), dir, i);
+		int fd = open(path, O_WRONLY);
+		if (fd < 0 || write(fd, buf, size) != (ssize_t)size) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	}
+	t.write = uptime() - before;
+
+	before = uptime();
+	for (int i = 0; i < nfiles; i++) {
+		path_of(path, sizeof(path), dir, i);
+		if (unlink(path) < 0) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	t.unlink = uptime() - before;
+	rmdir(dir);
+	return t;
+}
+
+static void
+report(const char *what, int nfiles, time_t disk, time_t tmp)
+{
+	printf("%-8s %8ldms %8ldms %8ld files/s on /tmp\n", what, disk, tmp,
+	       (long)nfiles * 1000 / (tmp != 0 ? tmp : 1));
+}
+
+int
+main(int argc, char **argv)
+{
+	int nfiles = argc > 1 ? atoi(argv[1]) : 200;
+	size_t size = (size_t)(argc > 2 ? atoi(argv[2]) : 4) << 10;
+
+	if (nfiles <= 0 || nfiles > 9999) {
+		fprintf(stderr, "usage: %s [files] [kilobytes per file]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	char *buf = malloc(size + 1);
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(buf, 'x', size);
+
+	struct times disk = run("/tmpbench.dir", nfiles, buf, size);
+	struct times tmp = run("/tmp/tmpbench.dir", nfiles, buf, size);
+	free(buf);
+
+	printf("%d files of %zu bytes\n", nfiles, size);
+	printf("%-8s %10s %10s\n", "", "disk", "/tmp");
+	report("create", nfiles, disk.create, tmp.create);
+	report("write", nfiles, disk.write, tmp.write);
+	report("unlink", nfiles, disk.unlink, tmp.unlink);
+	return 0;
+}
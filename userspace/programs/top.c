@@ -0,0 +1,205 @@
+// Show what the CPUs are busy with, from /dev/cpustat and
+// /dev/procstat, every few seconds until interrupted.
+// Usage: top [-b] [-d seconds] [-n updates]
+//   -b  print one update after another instead of redrawing
+//   -d  seconds between updates (default 2)
+//   -n  stop after this many updates
+// %CPU is of one CPU, so a process with several busy threads can
+// go past 100.
+#include <ext.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/procstat.h>
+#include <unistd.h>
+
+#define MAXPROCS 256
+#define MAXCPUS 128
+
+struct sample {
+	time_t when; // uptime(), in milliseconds
+	struct proc_stat procs[MAXPROCS];
+	size_t nprocs;
+	struct cpu_stat cpus[MAXCPUS];
+	size_t ncpus;
+};
+
+struct row {
+	const struct proc_stat *st;
+	uint64_t busy; // Nanoseconds on a CPU since the last sample.
+};
+
+static struct sample samples[2];
+static struct row rows[MAXPROCS];
+
+static size_t
+read_all(const char *path, void *buf, size_t size, size_t each)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	ssize_t n = read(fd, buf, size);
+	if (n < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	return n / each;
+}
+
+static void
+take(struct sample *s)
+{
+	s->when = uptime();
+	s->nprocs = read_all("/dev/procstat", s->procs, sizeof(s->procs),
+	                     sizeof(*s->procs));
+	s->ncpus =
+		read_all("/dev/cpustat", s->cpus, sizeof(s->cpus), sizeof(*s->cpus));
+}
+
+static uint64_t
+cputime(const struct proc_stat *st)
+{
+	return st->usage.utime + st->usage.stime;
+}
+
+// Tenths of a percent.
+static uint64_t
+permille(uint64_t part, uint64_t whole)
+{
+	return whole == 0 ? 0 : part * 1000 / whole;
+}
+
+// Busiest first, then by pid.
+static int
+compare_busy(const void *a, const void *b)
+{
+	const struct row *x = a, *y = b;
+
+	if (x->busy != y->busy) {
+		return (x->busy < y->busy) - (x->busy > y->busy);
+	}
+	return (x->st->pid > y->st->pid) - (x->st->pid < y->st->pid);
+}
+
+static void
+show_cpus(const struct sample *prev, const struct sample *cur)
+{
+	for (size_t i = 0; i < cur->ncpus && i < prev->ncpus; i++) {
+		const struct cpu_stat *a = &prev->cpus[i], *b = &cur->cpus[i];
+		uint64_t user = b->user - a->user;
+		uint64_t sys = b->sys - a->sys;
+		uint64_t idle = b->idle - a->idle;
+		uint64_t total = user + sys + idle;
+		uint64_t u = permille(user, total), s = permille(sys, total),
+		         d = permille(idle, total);
+		printf("cpu%-3zu %3lu.%lu%% user %3lu.%lu%% sys %3lu.%lu%% idle "
+		       "%8lu switches\n",
+		       i, u / 10, u % 10, s / 10, s % 10, d / 10, d % 10,
+		       b->nswitch - a->nswitch);
+	}
+}
+
+static void
+show_procs(const struct sample *prev, const struct sample *cur)
+{
+	uint64_t wall = (cur->when - prev->when) * 1000000;
+	size_t nrows = 0;
+
+	for (size_t i = 0; i < cur->nprocs; i++) {
+		const struct proc_stat *st = &cur->procs[i];
+		uint64_t before = 0;
+		// Anything new did all of its running since the last one.
+		for (size_t j = 0; j < prev->nprocs; j++) {
+			if (prev->procs[j].pid == st->pid) {
+				before = cputime(&prev->procs[j]);
+				break;
+			}
+		}
+		rows[nrows++] = (struct row){ st, cputime(st) - before };
+	}
+	qsort(rows, nrows, sizeof(*rows), compare_busy);
+
+	printf("\n%5s %5s %-8s S CPU THR %8s %6s %9s %7s %6s %6s %6s %s\n", "PID",
+	       "PPID", "USER", "SIZE", "%CPU", "TIME", "MINFLT", "MAJFLT", "IN",
+	       "OUT", "NAME");
+	for (size_t i = 0; i < nrows; i++) {
+		const struct proc_stat *st = rows[i].st;
+		const struct passwd *pw = getpwuid(st->uid);
+		char user[16], cpu[8];
+		if (pw != NULL) {
+			snprintf(user, sizeof(user), "%s", pw->pw_name);
+		} else {
+			snprintf(user, sizeof(user), "%d", st->uid);
+		}
+		if (st->cpu >= 0) {
+			snprintf(cpu, sizeof(cpu), "%d", st->cpu);
+		} else {
+			snprintf(cpu, sizeof(cpu), "-");
+		}
+		uint64_t pct = permille(rows[i].busy, wall);
+		uint64_t cs = cputime(st) / 10000000; // Hundredths of a second.
+		printf("%5d %5d %-8.8s %c %3s %3u %7luK %4lu.%lu %3lu:%02lu.%02lu %7lu "
+		       "%6lu %6lu %6lu %.16s\n",
+		       st->pid, st->ppid, user, st->state, cpu, st->nthreads,
+		       st->size / 1024, pct / 10, pct % 10, cs / 6000, cs / 100 % 60,
+		       cs % 100, st->usage.minflt, st->usage.majflt, st->usage.inblock,
+		       st->usage.oublock, st->name);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	bool batch = false;
+	int delay = 2, count = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "bd:n:")) != -1) {
+		switch (c) {
+		case 'b':
+			batch = true;
+			break;
+		case 'd':
+			delay = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (delay <= 0 || count < 0 || optind != argc) {
+		goto usage;
+	}
+
+	take(&samples[0]);
+	for (int i = 0; count == 0 || i < count; i++) {
+		const struct sample *prev = &samples[i % 2];
+		struct sample *cur = &samples[(i + 1) % 2];
+		sleep(delay);
+		take(cur);
+		if (!batch) {
+			write(STDOUT_FILENO, "\033[H\033[J", 6);
+		} else if (i != 0) {
+			printf("\n");
+		}
+		printf("%zu processes, up %ld.%03lds\n", cur->nprocs, cur->when / 1000,
+		       cur->when % 1000);
+		show_cpus(prev, cur);
+		show_procs(prev, cur);
+		fflush(stdout);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-b] [-d seconds] [-n updates]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
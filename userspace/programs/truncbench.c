@@ -0,0 +1,166 @@
+// Exercise and time what big and sparse files need: writing far past
+// the end, reading holes, fallocate(), punching holes, ftruncate()
+// and unlinking.
+// Usage: truncbench [megabytes]
+// The file is that big (default 16), plus one byte past 1 GiB that
+// needs the triply indirect block.
+#include <ext.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+
+#define FILENAME "truncbench.dat"
+#define CHUNK (64 * 1024)
+#define FAR (1024L * 1024 * 1024)
+
+static char buf[CHUNK];
+static time_t before;
+
+static void
+fail(const char *what)
+{
+	perror(what);
+	unlink(FILENAME);
+	exit(EXIT_FAILURE);
+}
+
+static void
+start(void)
+{
+	before = uptime();
+}
+
+static void
+report(const char *what, off_t bytes)
+{
+	time_t ms = uptime() - before;
+
+	if (bytes > 0) {
+		bench_report(what, bytes, ms);
+	} else {
+		printf("%-24s %6ldms\n", what, ms);
+	}
+}
+
+// Read [off, off + len) and check that it is all c.
+static void
+expect(int fd, off_t off, off_t len, char c)
+{
+	for (off_t done = 0; done < len; done += CHUNK) {
+		size_t n = len - done < CHUNK ? len - done : CHUNK;
+		if (pread(fd, buf, n, off + done) != (ssize_t)n) {
+			fail("pread");
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (buf[i] != c) {
+				fprintf(stderr, "truncbench: byte %ld is %d, not %d\n",
+				        off + done + i, buf[i], c);
+				unlink(FILENAME);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+static void
+fill(int fd, off_t len, char c)
+{
+	memset(buf, c, CHUNK);
+	for (off_t done = 0; done < len; done += CHUNK) {
+		size_t n = len - done < CHUNK ? len - done : CHUNK;
+		if (pwrite(fd, buf, n, done) != (ssize_t)n) {
+			fail("pwrite");
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	long mb = argc > 1 ? atol(argv[1]) : 16;
+	struct stat st;
+
+	if (mb <= 0) {
+		fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	off_t size = mb * 1024 * 1024;
+
+	int fd = open(FILENAME, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fail(FILENAME);
+	}
+
+	start();
+	if (pwrite(fd, "x", 1, FAR) != 1) {
+		fail("pwrite past 1 GiB");
+	}
+	report("write past 1 GiB", 0);
+	if (fstat(fd, &st) < 0 || st.st_size != FAR + 1) {
+		fail("fstat");
+	}
+	start();
+	expect(fd, FAR - size, size, 0);
+	report("read hole", size);
+
+	start();
+	if (ftruncate(fd, 0) < 0) {
+		fail("ftruncate");
+	}
+	report("truncate sparse", 0);
+
+	start();
+	fill(fd, size, 'a');
+	report("write", size);
+	start();
+	if (ftruncate(fd, size / 2 + 1) < 0) {
+		fail("ftruncate");
+	}
+	report("truncate to half", 0);
+	if (ftruncate(fd, size) < 0) {
+		fail("ftruncate");
+	}
+	expect(fd, 0, size / 2 + 1, 'a');
+	expect(fd, size / 2 + 1, size - (size / 2 + 1), 0);
+
+	start();
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 4096,
+	              size / 2) < 0) {
+		fail("punch hole");
+	}
+	report("punch hole", 0);
+	expect(fd, 0, 4096, 'a');
+	expect(fd, 4096, size / 2, 0);
+
+	start();
+	if (ftruncate(fd, 0) < 0) {
+		fail("ftruncate");
+	}
+	report("truncate to 0", 0);
+
+	start();
+	if (fallocate(fd, 0, 0, size) < 0) {
+		fail("fallocate");
+	}
+	report("fallocate", size);
+	if (fstat(fd, &st) < 0 || st.st_size != size) {
+		fail("fstat");
+	}
+	expect(fd, 0, size, 0);
+	start();
+	fill(fd, size, 'b');
+	report("write preallocated", size);
+
+	close(fd);
+	start();
+	if (unlink(FILENAME) < 0) {
+		fail("unlink");
+	}
+	report("unlink", 0);
+	return 0;
+}
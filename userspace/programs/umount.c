@@ -0,0 +1,22 @@
+// Unmount the file system mounted on each directory given.
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mount.h>
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s directory...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 1; i < argc; i++) {
+		if (umount(argv[i]) < 0) {
+			perror(argv[i]);
+			ret = EXIT_FAILURE;
+		}
+	}
+	return ret;
+}
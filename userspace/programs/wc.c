@@ -1,38 +1,52 @@
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-char buf[512];
+static char buf[64 * 1024];
+
+enum {
+	WC_SPACE = 1 << 0,
+	WC_NEWLINE = 1 << 1,
+};
+
+// The characters that separate words, looked up rather than searched
+// for with strchr() on every byte.
+static const uint8_t byte_class[256] = {
+	[' '] = WC_SPACE,
+	['\r'] = WC_SPACE,
+	['\t'] = WC_SPACE,
+	['\v'] = WC_SPACE,
+	['\n'] = WC_SPACE | WC_NEWLINE,
+};
 
 static void
 wc(int fd, const char *name)
 {
-	int i, n;
-	int l, w, c, inword;
+	ssize_t n;
+	size_t l, w, c;
+	// A word starts wherever a non-space follows a space, and the start
+	// of the input counts as one.
+	unsigned prev_space = 1;
 
 	l = w = c = 0;
-	inword = 0;
 	while ((n = read(fd, buf, sizeof(buf))) > 0) {
-		for (i = 0; i < n; i++) {
-			c++;
-			if (buf[i] == '\n') {
-				l++;
-			}
-			if (strchr(" \r\t\n\v", buf[i])) {
-				inword = 0;
-			} else if (!inword) {
-				w++;
-				inword = 1;
-			}
+		c += n;
+		for (ssize_t i = 0; i < n; i++) {
+			unsigned cls = byte_class[(unsigned char)buf[i]];
+			unsigned space = cls & WC_SPACE;
+			w += prev_space & (space ^ 1);
+			l += cls >> 1;
+			prev_space = space;
 		}
 	}
 	if (n < 0) {
 		fprintf(stderr, "wc: read error\n");
 		exit(1);
 	}
-	fprintf(stdout, "%d %d %d %s\n", l, w, c, name);
+	fprintf(stdout, "%zu %zu %zu %s\n", l, w, c, name);
 }
 
 int